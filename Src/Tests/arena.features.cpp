@@ -0,0 +1,102 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <arena.h>
+
+SCENARIO("An arena hands out aligned memory and reuses it after a reset", "[arena]")
+{
+	GIVEN("arena = Arena()")
+	{
+		Arena arena;
+
+		WHEN("a = 3 bytes, b = 8 bytes aligned to 8 and c = 16 bytes aligned to 16 are allocated"
+			"And the arena is reset"
+			"And d = 3 bytes is allocated")
+		{
+			auto* a = static_cast<std::byte*>(arena.allocate(3, 1));
+			auto* b = static_cast<std::byte*>(arena.allocate(8, 8));
+			auto* c = static_cast<std::byte*>(arena.allocate(16, 16));
+			arena.reset();
+			auto* d = static_cast<std::byte*>(arena.allocate(3, 1));
+			THEN("b and c are aligned and come after a in the same block"
+				"And d reuses the memory of a")
+			{
+				REQUIRE(reinterpret_cast<uintptr_t>(b) % 8 == 0);
+				REQUIRE(reinterpret_cast<uintptr_t>(c) % 16 == 0);
+				REQUIRE(b >= a + 3);
+				REQUIRE(c >= b + 8);
+				REQUIRE(arena.blockCount() == 1);
+				REQUIRE(d == a);
+			}
+		}
+	}
+}
+
+SCENARIO("An arena scope gives back what was allocated while it was alive", "[arena]")
+{
+	GIVEN("arena = Arena()"
+		"And a = 3 bytes allocated from arena")
+	{
+		Arena arena;
+		auto* a = static_cast<std::byte*>(arena.allocate(3, 1));
+		auto marker = arena.mark();
+
+		WHEN("a scope is opened and closed around 100000 ints allocated from arena"
+			"And b = 3 bytes is allocated")
+		{
+			{
+				ArenaScope scope(arena);
+				arena.allocate(100000 * sizeof(int32_t), alignof(int32_t));
+				arena.allocate(16, 16);
+			}
+
+			auto releasedMarker = arena.mark();
+			auto* b = static_cast<std::byte*>(arena.allocate(3, 1));
+			THEN("the arena is back where the scope was opened"
+				"And b comes right after a")
+			{
+				REQUIRE(releasedMarker == marker);
+				REQUIRE(b == a + 3);
+			}
+		}
+	}
+}
+
+SCENARIO("An arena keeps its blocks across resets", "[arena]")
+{
+	GIVEN("arena = Arena()"
+		"And v = an ArenaVector<int32_t> on arena grown past one block")
+	{
+		Arena arena;
+
+		{
+			ArenaVector<int32_t> v{ ArenaAllocator<int32_t>(arena) };
+
+			for (int32_t i = 0; i < 100000; i++)
+			{
+				v.push_back(i);
+			}
+
+			REQUIRE(v[99999] == 99999);
+		}
+
+		auto blockCount = arena.blockCount();
+
+		WHEN("the arena is reset and the vector is grown again")
+		{
+			arena.reset();
+
+			ArenaVector<int32_t> v{ ArenaAllocator<int32_t>(arena) };
+
+			for (int32_t i = 0; i < 100000; i++)
+			{
+				v.push_back(i);
+			}
+
+			THEN("no new block was needed")
+			{
+				REQUIRE(blockCount > 1);
+				REQUIRE(arena.blockCount() == blockCount);
+			}
+		}
+	}
+}
\ No newline at end of file
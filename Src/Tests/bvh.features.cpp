@@ -0,0 +1,885 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <bvh.h>
+#include <widebvh.h>
+#include <compressedbvh.h>
+#include <sphere.h>
+#include <cube.h>
+#include <plane.h>
+#include <world.h>
+#include <group.h>
+#include <triangle.h>
+#include <movingsphere.h>
+#include <intersection.h>
+#include <bvhcache.h>
+#include <instance.h>
+
+SCENARIO("A sphere's bounding box is transformed to its parent space", "[bvh]")
+{
+	GIVEN("s = Sphere()"
+		"And setTransform(s, translation(1.0f, 2.0f, 3.0f) * scaling(2.0f, 2.0f, 2.0f))")
+	{
+		auto s = createSphere(translate(1.0f, 2.0f, 3.0f) * scale(2.0f, 2.0f, 2.0f));
+		WHEN("s.boundingBox(box)")
+		{
+			BoundingBox box;
+			auto result = s->boundingBox(box);
+			THEN("box.min == point(-1.0f, 0.0f, 1.0f)"
+				"And box.max == point(3.0f, 4.0f, 5.0f)")
+			{
+				REQUIRE(result);
+				REQUIRE(box.min == point(-1.0f, 0.0f, 1.0f));
+				REQUIRE(box.max == point(3.0f, 4.0f, 5.0f));
+			}
+		}
+	}
+}
+
+SCENARIO("A transformed triangle is found through its group and its world", "[bvh]")
+{
+	GIVEN("t = Triangle(point(0.0f, 1.0f, 0.0f), point(-1.0f, 0.0f, 0.0f), point(1.0f, 0.0f, 0.0f))"
+		"And setTransform(t, translation(10.0f, 0.0f, 0.0f))"
+		"And g = Group() with t added"
+		"And w = World() with t added"
+		"And r = Ray(point(10.0f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		auto t = createTriangle(point(0.0f, 1.0f, 0.0f), point(-1.0f, 0.0f, 0.0f), point(1.0f, 0.0f, 0.0f));
+		t->setTransform(translate(10.0f, 0.0f, 0.0f));
+		auto g = createGroup();
+		g->addChild(t);
+		auto w = World();
+		w.addObject(t);
+		auto r = Ray(point(10.0f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("t.boundingBox(box)")
+		{
+			BoundingBox box;
+			auto result = t->boundingBox(box);
+			THEN("box.min == point(9.0f, 0.0f, 0.0f)"
+				"And box.max == point(11.0f, 1.0f, 0.0f)")
+			{
+				REQUIRE(result);
+				REQUIRE(box.min == point(9.0f, 0.0f, 0.0f));
+				REQUIRE(box.max == point(11.0f, 1.0f, 0.0f));
+			}
+		}
+		WHEN("xs1 = intersect(g, r)"
+			"And xs2 = intersectWorld(w, r)"
+			"And w.commit()"
+			"And xs3 = intersectWorld(w, r)")
+		{
+			auto xs1 = g->intersect(r);
+			auto xs2 = intersectWorld(w, r);
+			w.commit();
+			auto xs3 = intersectWorld(w, r);
+			THEN("every query hits t at t == 5.0f")
+			{
+				REQUIRE(xs1.size() == 1);
+				REQUIRE(xs2.size() == 1);
+				REQUIRE(xs3.size() == 1);
+				REQUIRE(xs1[0].t == 5.0f);
+				REQUIRE(xs2[0].t == 5.0f);
+				REQUIRE(xs3[0].t == 5.0f);
+				REQUIRE(xs3[0].shape == t.get());
+			}
+		}
+	}
+}
+
+SCENARIO("The slab test takes the near plane of each axis from the ray's sign", "[bvh]")
+{
+	GIVEN("box = BoundingBox(point(0.0f, 0.0f, 0.0f), point(1.0f, 1.0f, 1.0f))"
+		"And r = Ray(point(1.5f, 0.5f, 2.5f), vector(-1.0f, 0.0f, -2.0f))")
+	{
+		auto box = BoundingBox(point(0.0f, 0.0f, 0.0f), point(1.0f, 1.0f, 1.0f));
+		auto r = Ray(point(1.5f, 0.5f, 2.5f), vector(-1.0f, 0.0f, -2.0f));
+		WHEN("tMin = -infinity, tMax = infinity"
+			"And hit = intersectSlabs(box.min, box.max, r, tMin, tMax)")
+		{
+			auto tMin = -std::numeric_limits<float>::infinity();
+			auto tMax = std::numeric_limits<float>::infinity();
+			auto hit = intersectSlabs(box.min, box.max, r, tMin, tMax);
+			THEN("r.sign == { 1, 0, 1 }"
+				"And the ray enters through the max z plane and leaves through the min z plane")
+			{
+				REQUIRE(r.sign[0] == 1);
+				REQUIRE(r.sign[1] == 0);
+				REQUIRE(r.sign[2] == 1);
+				REQUIRE(hit);
+				REQUIRE(tMin == 0.75f);
+				REQUIRE(tMax == 1.25f);
+			}
+		}
+	}
+}
+
+SCENARIO("A ray parallel to a slab with its origin on the slab's plane", "[bvh]")
+{
+	GIVEN("box = BoundingBox(point(0.0f, 0.0f, 0.0f), point(1.0f, 1.0f, 1.0f))"
+		"And r1 = Ray(point(0.0f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f))"
+		"And r2 = Ray(point(1.0f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		auto box = BoundingBox(point(0.0f, 0.0f, 0.0f), point(1.0f, 1.0f, 1.0f));
+		auto r1 = Ray(point(0.0f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		auto r2 = Ray(point(1.0f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("hit1 = box.hit(r1, 0.0f, 10.0f, entry1)"
+			"And hit2 = box.hit(r2, 0.0f, 10.0f, entry2)")
+		{
+			float entry1 = 0.0f;
+			float entry2 = 0.0f;
+			auto hit1 = box.hit(r1, 0.0f, 10.0f, entry1);
+			auto hit2 = box.hit(r2, 0.0f, 10.0f, entry2);
+			THEN("the NaN of the x slab leaves the interval alone"
+				"And both rays enter the box at t == 5.0f")
+			{
+				REQUIRE(hit1);
+				REQUIRE(hit2);
+				REQUIRE(entry1 == 5.0f);
+				REQUIRE(entry2 == 5.0f);
+			}
+		}
+	}
+}
+
+SCENARIO("A ray hits a box of zero width", "[bvh]")
+{
+	GIVEN("box = BoundingBox(point(0.0f, 0.0f, 0.0f), point(1.0f, 1.0f, 0.0f))"
+		"And r = Ray(point(0.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		auto box = BoundingBox(point(0.0f, 0.0f, 0.0f), point(1.0f, 1.0f, 0.0f));
+		auto r = Ray(point(0.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("hit = box.hit(r, 0.0f, 10.0f, entry)")
+		{
+			float entry = 0.0f;
+			auto hit = box.hit(r, 0.0f, 10.0f, entry);
+			THEN("the ray enters and leaves the box at t == 5.0f")
+			{
+				REQUIRE(hit);
+				REQUIRE(entry == 5.0f);
+				REQUIRE(!box.hit(r, 0.0f, 4.0f));
+			}
+		}
+	}
+}
+
+SCENARIO("Transforming a ray works out its inverse direction again", "[bvh]")
+{
+	GIVEN("r = Ray(point(1.0f, 2.0f, 3.0f), vector(0.0f, 1.0f, 4.0f))"
+		"And m = scaling(2.0f, -2.0f, 0.5f)")
+	{
+		auto r = Ray(point(1.0f, 2.0f, 3.0f), vector(0.0f, 1.0f, 4.0f));
+		auto m = scale(2.0f, -2.0f, 0.5f);
+		WHEN("r2 = transformRay(r, m)")
+		{
+			auto r2 = transformRay(r, m);
+			THEN("r2.invDirection == { infinity, -0.5f, 0.5f }"
+				"And r2.sign == { 0, 1, 0 }")
+			{
+				REQUIRE(r2.invDirection[0] == std::numeric_limits<float>::infinity());
+				REQUIRE(r2.invDirection[1] == -0.5f);
+				REQUIRE(r2.invDirection[2] == 0.5f);
+				REQUIRE(r2.sign[0] == 0);
+				REQUIRE(r2.sign[1] == 1);
+				REQUIRE(r2.sign[2] == 0);
+			}
+		}
+	}
+}
+
+SCENARIO("Building a BVH over separated primitives", "[bvh]")
+{
+	GIVEN("bounds = 8 unit boxes along the x axis")
+	{
+		std::vector<BoundingBox> bounds;
+
+		for (int32_t i = 0; i < 8; i++)
+		{
+			auto x = static_cast<float>(i * 3);
+			bounds.emplace_back(point(x, 0.0f, 0.0f), point(x + 1.0f, 1.0f, 1.0f));
+		}
+
+		WHEN("bvh.build(bounds)")
+		{
+			BVH bvh;
+			bvh.build(bounds);
+			THEN("the root encloses every box"
+				"And the root was split"
+				"And every primitive is referenced once")
+			{
+				REQUIRE(bvh.bounds().min == point(0.0f, 0.0f, 0.0f));
+				REQUIRE(bvh.bounds().max == point(22.0f, 1.0f, 1.0f));
+				REQUIRE(!bvh.nodes[0].isLeaf());
+				REQUIRE(bvh.primitiveIndices.size() == 8);
+			}
+		}
+	}
+}
+
+SCENARIO("Traversing a BVH only visits primitives whose bounds are hit", "[bvh]")
+{
+	GIVEN("bvh = BVH over 8 unit boxes along the x axis"
+		"And r = Ray(point(6.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		std::vector<BoundingBox> bounds;
+
+		for (int32_t i = 0; i < 8; i++)
+		{
+			auto x = static_cast<float>(i * 3);
+			bounds.emplace_back(point(x, 0.0f, 0.0f), point(x + 1.0f, 1.0f, 1.0f));
+		}
+
+		BVH bvh;
+		bvh.build(bounds);
+
+		auto r = Ray(point(6.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("bvh.traverse(r)")
+		{
+			std::vector<uint32_t> visited;
+			bvh.traverse(r, EPSILON, INFINITY, [&](uint32_t primitive) { visited.emplace_back(primitive); });
+			THEN("only the third box is visited")
+			{
+				REQUIRE(visited.size() == 1);
+				REQUIRE(visited[0] == 2);
+			}
+		}
+	}
+}
+
+SCENARIO("Traversal visits the nearest leaves first and honors a shrinking tMax", "[bvh]")
+{
+	GIVEN("bounds = 8 unit boxes along the z axis"
+		"And r = Ray(point(0.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		std::vector<BoundingBox> bounds;
+
+		for (int32_t i = 0; i < 8; i++)
+		{
+			auto z = static_cast<float>(i * 3);
+			bounds.emplace_back(point(0.0f, 0.0f, z), point(1.0f, 1.0f, z + 1.0f));
+		}
+
+		BVH bvh;
+		bvh.build(bounds);
+
+		WideBVH wideBVH;
+		wideBVH.collapse(bvh);
+
+		auto r = Ray(point(0.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("each traversal sets tMax to the far side of the first box it visits")
+		{
+			std::vector<uint32_t> visited;
+			auto tMax = std::numeric_limits<float>::infinity();
+			bvh.traverse(r, 0.0f, tMax, [&](uint32_t primitive) 
+			{ 
+				visited.emplace_back(primitive);
+				tMax = std::min(tMax, bounds[primitive].max.z + 5.0f);
+			});
+
+			std::vector<uint32_t> wideVisited;
+			auto wideTMax = std::numeric_limits<float>::infinity();
+			wideBVH.traverse(r, 0.0f, wideTMax, [&](uint32_t primitive)
+			{
+				wideVisited.emplace_back(primitive);
+				wideTMax = std::min(wideTMax, bounds[primitive].max.z + 5.0f);
+			});
+			THEN("the nearest box comes first"
+				"And the boxes behind it are skipped")
+			{
+				REQUIRE(visited[0] == 0);
+				REQUIRE(visited.size() < 8);
+				REQUIRE(wideVisited[0] == 0);
+				REQUIRE(wideVisited.size() < 8);
+			}
+		}
+	}
+}
+
+SCENARIO("Hits outside a ray's interval are dropped", "[bvh]")
+{
+	GIVEN("g = a group of a sphere and a cube at z = 10"
+		"And r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f)) with tMax = 5.0f")
+	{
+		auto g = createGroup();
+		auto s = createSphere();
+		g->addChild(s);
+		auto c = createCube();
+		c->setTransform(translate(0.0f, 0.0f, 10.0f));
+		g->addChild(c);
+		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f), 0.0f, 0.0f, 5.0f);
+		WHEN("xs = intersect(g, r)")
+		{
+			auto xs = g->intersect(r);
+			THEN("xs.count == 1"
+				"And xs[0].t == 4.0f"
+				"And xs[0].object == s")
+			{
+				REQUIRE(xs.size() == 1);
+				REQUIRE(xs[0].t == 4.0f);
+				REQUIRE(xs[0].shape == s.get());
+			}
+		}
+	}
+}
+
+SCENARIO("Building a linear BVH over separated primitives", "[bvh]")
+{
+	GIVEN("bounds = 8 unit boxes along the x axis")
+	{
+		std::vector<BoundingBox> bounds;
+
+		for (int32_t i = 0; i < 8; i++)
+		{
+			auto x = static_cast<float>(i * 3);
+			bounds.emplace_back(point(x, 0.0f, 0.0f), point(x + 1.0f, 1.0f, 1.0f));
+		}
+		BVH bvh;
+		bvh.build(bounds, BVHBuildQuality::Linear);
+
+		auto r = Ray(point(6.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("bvh.traverse(r)")
+		{
+			std::vector<uint32_t> visited;
+			bvh.traverse(r, EPSILON, INFINITY, [&](uint32_t primitive) { visited.emplace_back(primitive); });
+			THEN("there is one leaf per box"
+				"And only the third box is visited")
+			{
+				REQUIRE(bvh.nodes.size() == 15);
+				REQUIRE(bvh.bounds().min == point(0.0f, 0.0f, 0.0f));
+				REQUIRE(bvh.bounds().max == point(22.0f, 1.0f, 1.0f));
+				REQUIRE(visited.size() == 1);
+				REQUIRE(visited[0] == 2);
+			}
+		}
+	}
+}
+
+SCENARIO("Collapsing a BVH into a 4-wide BVH", "[bvh]")
+{
+	GIVEN("bounds = 8 unit boxes along the x axis"
+		"And bvh = a BVH built over bounds")
+	{
+		std::vector<BoundingBox> bounds;
+
+		for (int32_t i = 0; i < 8; i++)
+		{
+			auto x = static_cast<float>(i * 3);
+			bounds.emplace_back(point(x, 0.0f, 0.0f), point(x + 1.0f, 1.0f, 1.0f));
+		}
+		BVH bvh;
+		bvh.build(bounds, BVHBuildQuality::Linear);
+
+		WideBVH wideBVH;
+		wideBVH.collapse(bvh);
+
+		auto r1 = Ray(point(6.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		auto r2 = Ray(point(-5.0f, 0.5f, 0.5f), vector(1.0f, 0.0f, 0.0f));
+		WHEN("wideBVH.traverse(r1) and wideBVH.traverse(r2)")
+		{
+			std::vector<uint32_t> visited1;
+			wideBVH.traverse(r1, EPSILON, INFINITY, [&](uint32_t primitive) { visited1.emplace_back(primitive); });
+
+			std::vector<uint32_t> visited2;
+			wideBVH.traverse(r2, EPSILON, INFINITY, [&](uint32_t primitive) { visited2.emplace_back(primitive); });
+			THEN("wideBVH has fewer nodes than bvh"
+				"And r1 only visits the third box"
+				"And r2 visits every box")
+			{
+				REQUIRE(wideBVH.nodes.size() < bvh.nodes.size());
+				REQUIRE(visited1.size() == 1);
+				REQUIRE(visited1[0] == 2);
+				REQUIRE(visited2.size() == 8);
+			}
+		}
+	}
+}
+
+SCENARIO("Compressed BVH nodes contain the original child bounds", "[bvh]")
+{
+	GIVEN("bounds = 8 boxes of different sizes"
+		"And wideBVH = a 4-wide BVH built over bounds")
+	{
+		std::vector<BoundingBox> bounds;
+
+		for (int32_t i = 0; i < 8; i++)
+		{
+			auto x = static_cast<float>(i * 3) + 0.1f;
+			bounds.emplace_back(point(x, -0.3f, 0.7f), point(x + 0.37f * (i + 1), 1.9f, 2.3f));
+		}
+		BVH bvh;
+		bvh.build(bounds);
+
+		WideBVH wideBVH;
+		wideBVH.collapse(bvh);
+
+		WHEN("compressedBVH.compress(wideBVH)")
+		{
+			CompressedBVH compressedBVH;
+			compressedBVH.compress(wideBVH);
+
+			auto r = Ray(point(6.2f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+
+			std::vector<uint32_t> visited;
+			compressedBVH.traverse(r, EPSILON, INFINITY, [&](uint32_t primitive) { visited.emplace_back(primitive); });
+			THEN("every node is one cache line"
+				"And every dequantized child box contains the original one"
+				"And r still visits the third box")
+			{
+				REQUIRE(sizeof(CompressedBVHNode) == 64);
+				REQUIRE(compressedBVH.nodes.size() == wideBVH.nodes.size());
+
+				for (size_t i = 0; i < wideBVH.nodes.size(); i++)
+				{
+					const auto& node = wideBVH.nodes[i];
+
+					for (int32_t slot = 0; slot < WideBVHNode::Width; slot++)
+					{
+						if (node.minX[slot] > node.maxX[slot])
+						{
+							continue;
+						}
+
+						auto box = compressedBVH.childBounds(compressedBVH.nodes[i], slot);
+
+						REQUIRE(box.min.x <= node.minX[slot]);
+						REQUIRE(box.min.y <= node.minY[slot]);
+						REQUIRE(box.min.z <= node.minZ[slot]);
+						REQUIRE(box.max.x >= node.maxX[slot]);
+						REQUIRE(box.max.y >= node.maxY[slot]);
+						REQUIRE(box.max.z >= node.maxZ[slot]);
+					}
+				}
+
+				REQUIRE(std::find(visited.begin(), visited.end(), 2) != visited.end());
+			}
+		}
+	}
+}
+
+SCENARIO("Coincident primitives are split into small leaves that survive compression", "[bvh]")
+{
+	GIVEN("bounds = 70000 copies of the same unit box"
+		"And r = Ray(point(0.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		std::vector<BoundingBox> bounds(70000, BoundingBox(point(0.0f, 0.0f, 0.0f), point(1.0f, 1.0f, 1.0f)));
+
+		auto r = Ray(point(0.5f, 0.5f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("bvh.build(bounds) and compressedBVH = the compressed 4-wide BVH of bvh")
+		{
+			BVH bvh;
+			bvh.build(bounds);
+
+			WideBVH wideBVH;
+			wideBVH.collapse(bvh);
+
+			CompressedBVH compressedBVH;
+			compressedBVH.compress(wideBVH);
+
+			size_t visited = 0;
+			compressedBVH.traverse(r, EPSILON, INFINITY, [&](uint32_t) { visited++; });
+			THEN("no leaf holds more than BVH::MaxLeafSize primitives"
+				"And r visits every primitive through the compressed BVH")
+			{
+				for (const auto& node : bvh.nodes)
+				{
+					REQUIRE(node.primitiveCount <= BVH::MaxLeafSize);
+				}
+
+				REQUIRE(visited == bounds.size());
+			}
+		}
+	}
+}
+
+SCENARIO("Spatial splits over long thin triangles report each triangle once", "[bvh]")
+{
+	GIVEN("g = Group() of 16 parallel diagonal slivers built with spatial splits"
+		"And r = Ray(point(7.0f, 5.05f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		auto g = std::make_shared<Group>();
+
+		for (int32_t i = 0; i < 16; i++)
+		{
+			auto x = static_cast<float>(i * 2);
+			g->addChild(createTriangle(point(x, 0.0f, 0.0f), point(x + 10.0f, 10.0f, 0.0f), point(x + 10.0f, 10.2f, 0.0f)));
+		}
+
+		g->setBVHBuildQuality(BVHBuildQuality::Spatial);
+
+		auto r = Ray(point(7.0f, 5.05f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("xs = intersect(g, r)")
+		{
+			auto xs = g->intersect(r);
+			THEN("some sliver is referenced from more than one leaf"
+				"And xs.count == 1"
+				"And xs[0].t == 5.0f")
+			{
+				REQUIRE(g->getBVH().hasSplitReferences());
+				REQUIRE(xs.size() == 1);
+				REQUIRE(xs[0].t == 5.0f);
+				REQUIRE(xs[0].shape == g->getChild(1).get());
+			}
+		}
+	}
+}
+
+SCENARIO("A traversal remembers the primitives and lanes it visited", "[bvh]")
+{
+	GIVEN("visited = VisitedPrimitives(true)"
+		"And primitives 0 to 199 visited by lane 0")
+	{
+		VisitedPrimitives visited(true);
+
+		for (uint32_t primitive = 0; primitive < 200; primitive++)
+		{
+			REQUIRE(visited.visit(primitive, 0b0001) == 0b0001);
+		}
+
+		WHEN("a nested traversal visits primitive 7 with lanes 0 and 1"
+			"And the outer one visits every primitive again with lanes 0 and 1")
+		{
+			uint32_t nestedLanes = 0;
+
+			{
+				VisitedPrimitives nested(true);
+				nestedLanes = nested.visit(7, 0b0011);
+			}
+
+			std::vector<uint32_t> newLanes;
+
+			for (uint32_t primitive = 0; primitive < 200; primitive++)
+			{
+				newLanes.emplace_back(visited.visit(primitive, 0b0011));
+			}
+
+			THEN("the nested traversal sees primitive 7 for the first time"
+				"And the outer one only lets lane 1 through, once"
+				"And a disabled set lets everything through")
+			{
+				REQUIRE(nestedLanes == 0b0011);
+
+				for (auto lanes : newLanes)
+				{
+					REQUIRE(lanes == 0b0010);
+				}
+
+				REQUIRE(visited.visit(123, 0b0011) == 0);
+
+				VisitedPrimitives disabled(false);
+				REQUIRE(disabled.visit(7) == 1);
+				REQUIRE(disabled.visit(7) == 1);
+			}
+		}
+	}
+}
+
+SCENARIO("Intersecting a world with many objects through its BVH", "[bvh]")
+{
+	GIVEN("w = World() with a plane and a 10x10 grid of spheres"
+		"And r = Ray(point(6.0f, 10.0f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		auto w = World();
+		w.addObject(createPlane());
+
+		for (int32_t y = 0; y < 10; y++)
+		{
+			for (int32_t x = 0; x < 10; x++)
+			{
+				auto s = createSphere(translate(x * 3.0f, y * 3.0f + 1.0f, 0.0f));
+				w.addObject(s);
+			}
+		}
+
+		auto r = Ray(point(6.0f, 10.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("xs = intersectWorld(w, r)")
+		{
+			auto xs = intersectWorld(w, r);
+			THEN("xs.count == 2"
+				"And xs[0].t == 4.0f"
+				"And xs[1].t == 6.0f")
+			{
+				REQUIRE(xs.size() == 2);
+				REQUIRE(xs[0].t == 4.0f);
+				REQUIRE(xs[1].t == 6.0f);
+				REQUIRE(xs[0].shape == w.getObject(33).get());
+			}
+		}
+	}
+}
+
+SCENARIO("A group filled after its world's BVH was built is found once the BVH is marked dirty", "[bvh]")
+{
+	GIVEN("w = World() with 8 spheres along x and a group g of one sphere"
+		"And the BVH of w was built"
+		"And r = Ray(point(0.0f, 10.0f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		auto w = World();
+
+		for (int32_t i = 0; i < 8; i++)
+		{
+			w.addObject(createSphere(translate(i * 3.0f, 0.0f, 0.0f)));
+		}
+
+		auto g = createGroup();
+		g->addChild(createSphere());
+		w.addObject(g);
+		w.updateBVH();
+
+		auto r = Ray(point(0.0f, 10.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("s = a sphere at y = 10 is added to g"
+			"And markBVHDirty(w)"
+			"And xs = intersectClosest(w, r)")
+		{
+			auto s = createSphere(translate(0.0f, 10.0f, 0.0f));
+			g->addChild(s);
+			w.markBVHDirty();
+
+			auto xs = intersectClosest(w, r);
+			THEN("xs hits s at t = 4")
+			{
+				REQUIRE(xs.shape == s.get());
+				REQUIRE(xs.t == 4.0f);
+			}
+		}
+	}
+}
+
+SCENARIO("A world with a moving sphere culls it by its bounds at the ray time", "[bvh]")
+{
+	GIVEN("w = World() with 8 static spheres along y = 5"
+		"And s = a sphere moving from x = 0 to x = 10 between time 0 and 1")
+	{
+		auto w = World();
+
+		for (int32_t i = 0; i < 8; i++)
+		{
+			w.addObject(createSphere(translate(i * 3.0f, 5.0f, 0.0f)));
+		}
+
+		auto s = std::make_shared<MovingSphere>(point(0.0f, 0.0f, 0.0f), point(10.0f, 0.0f, 0.0f), 0.0f, 1.0f);
+		w.addObject(s);
+
+		WHEN("rays at x = 10 are cast at time 0, 0.5 and 1")
+		{
+			auto xs0 = intersectWorld(w, Ray(point(10.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f), 0.0f));
+			auto xs1 = intersectWorld(w, Ray(point(5.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f), 0.5f));
+			auto xs2 = intersectWorld(w, Ray(point(10.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f), 1.0f));
+			THEN("the world BVH keeps bounds at both ends of the motion"
+				"And only the rays that meet the sphere at their time hit it")
+			{
+				REQUIRE(w.getBVH().nodes.size() > 1);
+				REQUIRE(xs0.empty());
+				REQUIRE(xs1.size() == 2);
+				REQUIRE(xs1[0].t == 4.0f);
+				REQUIRE(xs2.size() == 2);
+				REQUIRE(xs2[0].t == 4.0f);
+				REQUIRE(xs2[0].shape == s.get());
+			}
+		}
+
+		WHEN("n = the normal where the time 1 ray hits s")
+		{
+			auto r = Ray(point(10.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f), 1.0f);
+			auto xs = intersectWorld(w, r);
+			auto comps = prepareComputations(xs[0], r, xs);
+			THEN("n points straight back along the ray")
+			{
+				REQUIRE(comps.normal == vector(0.0f, 0.0f, -1.0f));
+			}
+		}
+	}
+}
+
+SCENARIO("A group's BVH is saved to a cache file and mapped back without a rebuild", "[bvh]")
+{
+	GIVEN("g1 and g2 = groups of the same 64 spheres"
+		"And path = a cache file for g1 under hash 42")
+	{
+		auto g1 = createGroup();
+		auto g2 = createGroup();
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			auto s = createSphere(translate((i % 8) * 3.0f, (i / 8) * 3.0f, 0.0f));
+			g1->addChild(s);
+			g2->addChild(s);
+		}
+
+		g1->updateBVH();
+
+		auto path = (std::filesystem::temp_directory_path() / "bvhcache.features.bvh").string();
+		auto saved = saveBVHCache(path, 42, { g1 });
+
+		WHEN("loadBVHCache(path, 42, g2)")
+		{
+			auto loaded = loadBVHCache(path, 42, { g2 });
+			auto r = Ray(point(6.0f, 9.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+			auto xs1 = g1->intersect(r);
+			auto xs2 = g2->intersect(r);
+			THEN("g2 uses the mapped BVH instead of building its own"
+				"And both groups return the same hits")
+			{
+				REQUIRE(saved);
+				REQUIRE(loaded);
+				REQUIRE(g2->getBVH().empty());
+				REQUIRE(g2->getChildBVH().getCompressedBVH().nodes.empty());
+				REQUIRE(g2->getChildBVH().getCompressedBVH().getNodes().size() == g1->getChildBVH().getCompressedBVH().nodes.size());
+				REQUIRE(xs2.size() == 2);
+				REQUIRE(xs1.size() == xs2.size());
+				REQUIRE(xs1[0].t == xs2[0].t);
+				REQUIRE(xs1[0].shape == xs2[0].shape);
+			}
+		}
+
+		WHEN("g3 = a group of the same spheres"
+			"And loadBVHCache(path, 7, g3)")
+		{
+			auto g3 = createGroup();
+			g3->addChildren(g1->shapes);
+			auto loaded = loadBVHCache(path, 7, { g3 });
+			THEN("the hash doesn't match and g3 builds its own BVH")
+			{
+				REQUIRE_FALSE(loaded);
+				REQUIRE_FALSE(g3->getBVH().empty());
+			}
+		}
+	}
+}
+
+SCENARIO("The closest hit matches the first hit of the sorted list", "[bvh]")
+{
+	GIVEN("w = World() with a plane, a group of 64 spheres and an instance of it"
+		"And rays from above the grid in several directions")
+	{
+		auto w = World();
+		w.addObject(createPlane());
+
+		auto g = createGroup();
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			g->addChild(createSphere(translate((i % 8) * 3.0f, 1.0f, (i / 8) * 3.0f)));
+		}
+
+		w.addObject(g);
+		w.addObject(createInstance(g, translate(0.0f, 0.0f, 30.0f)));
+
+		WHEN("closest = intersectClosest(w, r) for every r")
+		{
+			THEN("closest has the t and shape of hit(intersectWorld(w, r))")
+			{
+				for (int32_t i = 0; i < 16; i++)
+				{
+					auto r = Ray(point(i * 1.5f, 10.0f, -5.0f), normalize(vector(0.3f, -1.0f, 0.2f + i * 0.25f)));
+					auto expected = hit(intersectWorld(w, r));
+					auto closest = intersectClosest(w, r);
+					REQUIRE(closest.t == expected.t);
+					REQUIRE(closest.shape == expected.shape);
+					REQUIRE(closest.instancedShape == expected.instancedShape);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("Shadow rays only look for shapes that cast shadows within their interval", "[bvh]")
+{
+	GIVEN("w = World() with a group of 64 spheres"
+		"And s = a sphere in front of the group that doesn't cast shadows")
+	{
+		auto w = World();
+		auto g = createGroup();
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			g->addChild(createSphere(translate((i % 8) * 3.0f, (i / 8) * 3.0f, 0.0f)));
+		}
+
+		auto s = createSphere(translate(30.0f, 0.0f, -5.0f));
+		s->material.castShadow = false;
+
+		w.addObject(g);
+		w.addObject(s);
+
+		WHEN("rays are cast toward the group, short of it and only through s")
+		{
+			auto blocked = intersectAny(w, Ray(point(6.0f, 9.0f, -5.0f), vector(0.0f, 0.0f, 1.0f), 0.0f, 0.0f, 10.0f));
+			auto tooShort = intersectAny(w, Ray(point(6.0f, 9.0f, -5.0f), vector(0.0f, 0.0f, 1.0f), 0.0f, 0.0f, 3.0f));
+			auto nonCaster = intersectAny(w, Ray(point(30.0f, 0.0f, -10.0f), vector(0.0f, 0.0f, 1.0f), 0.0f, 0.0f, 10.0f));
+			THEN("only the ray reaching the group is occluded")
+			{
+				REQUIRE(blocked);
+				REQUIRE_FALSE(tooShort);
+				REQUIRE_FALSE(nonCaster);
+			}
+		}
+	}
+}
+
+SCENARIO("Leaves of triangles are tested four at a time with the same hits as one by one", "[bvh]")
+{
+	GIVEN("g = a group of 128 triangles forming a wavy grid"
+		"And rays from above the grid in several directions")
+	{
+		auto g = createGroup();
+
+		auto height = [](int32_t x, int32_t z) { return ((x * 7 + z * 3) % 5) * 0.25f; };
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			auto x = i % 8;
+			auto z = i / 8;
+			auto p00 = point(x, height(x, z), z);
+			auto p10 = point(x + 1.0f, height(x + 1, z), z);
+			auto p01 = point(x, height(x, z + 1), z + 1.0f);
+			auto p11 = point(x + 1.0f, height(x + 1, z + 1), z + 1.0f);
+			g->addChild(createTriangle(p00, p10, p11));
+			g->addChild(createTriangle(p00, p11, p01));
+		}
+
+		g->updateBVH();
+
+		WHEN("xs = intersect(g, r) and closest = g's closest hit for every r")
+		{
+			THEN("the BVH packed its leaves into triangle blocks"
+				"And xs has the t, shape and u, v of every triangle hit one by one"
+				"And closest is the first of them")
+			{
+				REQUIRE(g->getChildBVH().triangleBlockCount() > 0);
+
+				for (int32_t i = 0; i < 16; i++)
+				{
+					auto r = Ray(point(i * 0.5f, 5.0f, -1.0f), normalize(vector(0.1f, -1.0f, 0.3f + i * 0.05f)));
+
+					Intersections expected;
+
+					for (const auto& shape : g->shapes)
+					{
+						shape->intersect(r, expected);
+					}
+
+					sortIntersections(expected);
+
+					auto xs = g->intersect(r);
+					REQUIRE(xs.size() == expected.size());
+
+					for (size_t j = 0; j < xs.size(); j++)
+					{
+						REQUIRE(xs[j].t == expected[j].t);
+						REQUIRE(xs[j].shape == expected[j].shape);
+						REQUIRE(xs[j].a == expected[j].a);
+						REQUIRE(xs[j].b == expected[j].b);
+					}
+
+					Intersection closest;
+					REQUIRE(g->intersectClosest(r, closest) == !expected.empty());
+
+					if (!expected.empty())
+					{
+						REQUIRE(closest.t == expected[0].t);
+						REQUIRE(closest.shape == expected[0].shape);
+						REQUIRE(g->intersectAny(r));
+					}
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
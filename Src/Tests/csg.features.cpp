@@ -3,6 +3,7 @@
 #include <csg.h>
 #include <sphere.h>
 #include <cube.h>
+#include <group.h>
 
 // Chapter 16 Constructive Solid Geometry (CSG)
 
@@ -101,7 +102,7 @@ SCENARIO("Filtering a list of intersections", "[csg]")
 		auto s1 = createSphere();
 		auto s2 = createCube();
 		auto xs = sortIntersections(
-			{ { 1.0f, s1 }, { 2.0f, s2 }, { 3.0f, s1 }, { 4.0f, s2 } });
+			{ { 1.0f, s1.get() }, { 2.0f, s2.get() }, { 3.0f, s1.get() }, { 4.0f, s2.get() } });
 		WHEN("result = filterIntersections(c, xs)"
 			"Examples:"
 			"| operation	| x0 | x1 |"
@@ -174,10 +175,85 @@ SCENARIO("A ray hits a CSG object", "[csg]")
 			{
 				REQUIRE(xs.size() == 2);
 				REQUIRE(xs[0].t == 4.0f);
-				REQUIRE(xs[0].shape == s1);
+				REQUIRE(xs[0].shape == s1.get());
 				REQUIRE(xs[1].t == 6.5f);
-				REQUIRE(xs[1].shape == s2);
+				REQUIRE(xs[1].shape == s2.get());
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+SCENARIO("A CSG shape's bounding box follows its operation", "[csg]")
+{
+	GIVEN("s1 = Sphere()"
+		"And s2 = Sphere()"
+		"And setTransform(s2, translation(1.0f, 0.0f, 0.0f))")
+	{
+		auto s1 = createSphere();
+		auto s2 = createSphere();
+		s2->setTransform(translate(1.0f, 0.0f, 0.0f));
+		WHEN("u = CSG(union, s1, s2)"
+			"And i = CSG(intersection, s1, s2)")
+		{
+			auto u = createCSG(Operation::Union, s1, s2);
+			auto i = createCSG(Operation::Intersection, s1, s2);
+			BoundingBox unionBox;
+			BoundingBox intersectionBox;
+			u->boundingBox(unionBox);
+			i->boundingBox(intersectionBox);
+			THEN("the union box covers both spheres"
+				"And the intersection box only their overlap")
+			{
+				REQUIRE(unionBox.min == point(-1.0f, -1.0f, -1.0f));
+				REQUIRE(unionBox.max == point(2.0f, 1.0f, 1.0f));
+				REQUIRE(intersectionBox.min == point(0.0f, -1.0f, -1.0f));
+				REQUIRE(intersectionBox.max == point(1.0f, 1.0f, 1.0f));
+			}
+		}
+	}
+}
+
+SCENARIO("An intersection of shapes that don't overlap is bounded and empty", "[csg]")
+{
+	GIVEN("s1 = Sphere()"
+		"And s2 = Sphere() with translation(5.0f, 0.0f, 0.0f)"
+		"And c = CSG(intersection, s1, s2)")
+	{
+		auto s1 = createSphere();
+		auto s2 = createSphere(translate(5.0f, 0.0f, 0.0f));
+		auto c = createCSG(Operation::Intersection, s1, s2);
+		WHEN("c.boundingBox(box)")
+		{
+			BoundingBox box;
+			auto result = c->boundingBox(box);
+			THEN("c is bounded"
+				"And box is empty")
+			{
+				REQUIRE(result);
+				REQUIRE(box.isEmpty());
+			}
+		}
+		WHEN("g = Group() with 16 spheres and c"
+			"And xs = intersect(g, Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f)))")
+		{
+			auto g = createGroup();
+
+			for (int32_t i = 0; i < 16; i++)
+			{
+				g->addChild(createSphere(translate(i * 3.0f, 0.0f, 0.0f)));
+			}
+
+			g->addChild(c);
+			auto xs = g->intersect(Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f)));
+			THEN("the group stays bounded"
+				"And its BVH leaves c out instead of testing it on every ray")
+			{
+				BoundingBox box;
+				REQUIRE(g->boundingBox(box));
+				REQUIRE(xs.size() == 2);
+				REQUIRE(g->getChildBVH().view().boundedShapes.size() == 16);
+				REQUIRE(g->getChildBVH().view().unboundedShapes.empty());
+			}
+		}
+	}
+}
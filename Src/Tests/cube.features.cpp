@@ -164,3 +164,24 @@ SCENARIO("The normal on the surface of a cube", "[cube]")
 	}
 }
 
+SCENARIO("A cube has a bounding box", "[cube]")
+{
+	GIVEN("c = Cube()"
+		"And setTransform(c, translation(1.0f, 0.0f, 0.0f) * scaling(2.0f, 3.0f, 4.0f))")
+	{
+		auto c = createCube();
+		c->setTransform(translate(1.0f, 0.0f, 0.0f) * scale(2.0f, 3.0f, 4.0f));
+		WHEN("c.boundingBox(box)")
+		{
+			BoundingBox box;
+			auto result = c->boundingBox(box);
+			THEN("box.min == point(-1.0f, -3.0f, -4.0f)"
+				"And box.max == point(3.0f, 3.0f, 4.0f)")
+			{
+				REQUIRE(result);
+				REQUIRE(box.min == point(-1.0f, -3.0f, -4.0f));
+				REQUIRE(box.max == point(3.0f, 3.0f, 4.0f));
+			}
+		}
+	}
+}
@@ -304,4 +304,40 @@ SCENARIO("The normal vector on a cylinder's end cap", "[cylinder]")
 			}
 		}
 	}
+}
+
+SCENARIO("A cylinder's bounding box", "[cylinder]")
+{
+	GIVEN("cylinder = Cylinder()"
+		"And cylinder.minimum = -5.0f"
+		"And cylinder.maximum = 3.0f")
+	{
+		auto cylinder = createCylinder(-5.0f, 3.0f);
+		WHEN("cylinder.boundingBox(box)")
+		{
+			BoundingBox box;
+			auto result = cylinder->boundingBox(box);
+			THEN("box.min == point(-1.0f, -5.0f, -1.0f)"
+				"And box.max == point(1.0f, 3.0f, 1.0f)")
+			{
+				REQUIRE(result);
+				REQUIRE(box.min == point(-1.0f, -5.0f, -1.0f));
+				REQUIRE(box.max == point(1.0f, 3.0f, 1.0f));
+			}
+		}
+	}
+
+	GIVEN("cylinder = Cylinder() with no limits")
+	{
+		auto cylinder = createCylinder();
+		WHEN("cylinder.boundingBox(box)")
+		{
+			BoundingBox box;
+			auto result = cylinder->boundingBox(box);
+			THEN("the cylinder is unbounded")
+			{
+				REQUIRE_FALSE(result);
+			}
+		}
+	}
 }
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <world.h>
+#include <csg.h>
+#include <cube.h>
+#include <triangle.h>
+
+#include <intersection.h>
+
+// A world with every shape type, some of them in nested groups
+static World flatSceneWorld()
+{
+	World w;
+
+	w.addObject(createSphere(translate(-3.0f, 1.0f, 0.0f)));
+	w.addObject(createPlane());
+
+	auto outer = createGroup();
+	outer->setTransform(translate(0.0f, 1.0f, 0.0f) * rotateY(0.5f));
+
+	auto cube = createCube();
+	cube->setTransform(translate(2.0f, 0.0f, 1.0f) * scale(0.5f));
+	outer->addChild(cube);
+
+	auto inner = createGroup();
+	inner->setTransform(scale(0.75f));
+
+	auto cylinder = createCylinder(-1.0f, 1.0f, true);
+	cylinder->setTransform(translate(-1.0f, 0.0f, 2.0f));
+	inner->addChild(cylinder);
+
+	auto cone = createCone(-1.0f, 0.0f, true);
+	cone->setTransform(translate(1.0f, 1.0f, -2.0f));
+	inner->addChild(cone);
+
+	inner->addChild(createTriangle(point(-1.0f, 0.0f, -1.0f), point(1.0f, 0.0f, -1.0f), point(0.0f, 2.0f, -1.0f)));
+
+	outer->addChild(inner);
+	w.addObject(outer);
+
+	auto csg = createCSG(Operation::Difference, createCube(), createSphere(scale(1.25f)));
+	csg->setTransform(translate(4.0f, 1.0f, 3.0f));
+	w.addObject(csg);
+
+	return w;
+}
+
+SCENARIO("Committing a world sorts its shapes by type", "[flatscene]")
+{
+	GIVEN("w = a world with a sphere, a plane, a CSG and a group of a cube and another group"
+		"of a cylinder, a cone and a triangle")
+	{
+		auto w = flatSceneWorld();
+
+		WHEN("commit(w)")
+		{
+			w.commit();
+
+			THEN("the groups are gone and each primitive is in the array of its type")
+			{
+				const auto* scene = w.getCommittedScene();
+
+				REQUIRE(scene != nullptr);
+				REQUIRE(scene->primitiveCount(ShapeType::Sphere) == 1);
+				REQUIRE(scene->primitiveCount(ShapeType::Plane) == 1);
+				REQUIRE(scene->primitiveCount(ShapeType::Cube) == 1);
+				REQUIRE(scene->primitiveCount(ShapeType::Cylinder) == 1);
+				REQUIRE(scene->primitiveCount(ShapeType::Cone) == 1);
+				REQUIRE(scene->primitiveCount(ShapeType::Triangle) == 1);
+				REQUIRE(scene->primitiveCount(ShapeType::Other) == 1);
+			}
+		}
+	}
+}
+
+SCENARIO("A committed world finds the same hits as the world it was built from", "[flatscene]")
+{
+	GIVEN("w = the same world"
+		"And a fan of rays from point(0, 3, -8)")
+	{
+		auto w = flatSceneWorld();
+
+		std::vector<Ray> rays;
+
+		for (int32_t y = 0; y < 16; y++)
+		{
+			for (int32_t x = 0; x < 16; x++)
+			{
+				rays.emplace_back(point(0.0f, 3.0f, -8.0f), normalize(vector(x / 3.0f - 2.5f, y / 6.0f - 1.5f, 4.0f)));
+			}
+		}
+
+		std::vector<Intersection> closest;
+		std::vector<bool> occluded;
+		std::vector<size_t> hitCount;
+
+		for (const auto& ray : rays)
+		{
+			closest.emplace_back(intersectClosest(w, ray));
+			occluded.emplace_back(intersectAny(w, ray));
+			hitCount.emplace_back(intersectWorld(w, ray).size());
+		}
+
+		WHEN("commit(w)")
+		{
+			w.commit();
+
+			THEN("every ray hits the same shape at the same t")
+			{
+				for (size_t i = 0; i < rays.size(); i++)
+				{
+					auto xs = intersectClosest(w, rays[i]);
+
+					REQUIRE(xs.shape == closest[i].shape);
+					REQUIRE(Math::equal(xs.t, closest[i].t));
+					REQUIRE(intersectAny(w, rays[i]) == occluded[i]);
+					REQUIRE(intersectWorld(w, rays[i]).size() == hitCount[i]);
+				}
+			}
+
+			AND_THEN("the packets agree with the single rays")
+			{
+				for (size_t i = 0; i < rays.size(); i += RayPacket::Width)
+				{
+					RayPacket packet;
+
+					for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+					{
+						packet.rays[lane] = rays[i + lane];
+					}
+
+					Intersection hits[RayPacket::Width];
+					intersectClosest(w, packet, 0xf, hits);
+
+					for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+					{
+						REQUIRE(hits[lane].shape == closest[i + lane].shape);
+						REQUIRE(Math::equal(hits[lane].t, closest[i + lane].t));
+					}
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("Adding an object drops the committed scene", "[flatscene]")
+{
+	GIVEN("w = the same world"
+		"And commit(w)")
+	{
+		auto w = flatSceneWorld();
+		w.commit();
+
+		WHEN("s = sphere()"
+			"And add s to w")
+		{
+			auto s = createSphere(translate(0.0f, 3.0f, -4.0f));
+			w.addObject(s);
+
+			THEN("w has no committed scene"
+				"And a ray at s still hits it")
+			{
+				REQUIRE(w.getCommittedScene() == nullptr);
+
+				auto xs = intersectClosest(w, Ray(point(0.0f, 3.0f, -8.0f), vector(0.0f, 0.0f, 1.0f)));
+
+				REQUIRE(xs.shape == s.get());
+				REQUIRE(xs.t == 3.0f);
+			}
+		}
+	}
+}
+SCENARIO("Changing the BVH build quality drops the committed scene", "[flatscene]")
+{
+	GIVEN("w = the same world"
+		"And commit(w)")
+	{
+		auto w = flatSceneWorld();
+		w.commit();
+
+		WHEN("setBVHBuildQuality(w, Spatial)")
+		{
+			w.setBVHBuildQuality(BVHBuildQuality::Spatial);
+
+			THEN("w has no committed scene until commit(w)")
+			{
+				REQUIRE(w.getCommittedScene() == nullptr);
+
+				w.commit();
+
+				REQUIRE(w.getCommittedScene() != nullptr);
+			}
+		}
+	}
+}
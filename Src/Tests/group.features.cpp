@@ -78,10 +78,10 @@ SCENARIO("Intersecting a ray with a nonempty group", "[group]")
 				"And xs[3].object == s1")
 			{
 				REQUIRE(xs.size() == 4);
-				REQUIRE(xs[0].shape == s2);
-				REQUIRE(xs[1].shape == s2);
-				REQUIRE(xs[2].shape == s1);
-				REQUIRE(xs[3].shape == s1);
+				REQUIRE(xs[0].shape == s2.get());
+				REQUIRE(xs[1].shape == s2.get());
+				REQUIRE(xs[2].shape == s1.get());
+				REQUIRE(xs[3].shape == s1.get());
 			}
 		}
 	}
@@ -111,4 +111,64 @@ SCENARIO("Intersecting a transformed group", "[group]")
 			}
 		}
 	}
+}
+
+SCENARIO("Intersecting a ray with a group large enough for a BVH", "[group]")
+{
+	GIVEN("g = Group()"
+		"And 16 spheres along the x axis, 3 units apart, added to g")
+	{
+		auto g = createGroup();
+
+		for (int32_t i = 0; i < 16; i++)
+		{
+			g->addChild(createSphere(translate(i * 3.0f, 0.0f, 0.0f)));
+		}
+
+		WHEN("r = Ray(point(9.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f))"
+			"And xs = localIntersect(g, r)")
+		{
+			auto r = Ray(point(9.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+			auto xs = g->localIntersect(r);
+			THEN("g has a BVH over its children"
+				"And xs.count == 2"
+				"And xs[0].object == the fourth child")
+			{
+				REQUIRE(!g->getBVH().empty());
+				REQUIRE(xs.size() == 2);
+				REQUIRE(xs[0].shape == g->getChild(3).get());
+				REQUIRE(xs[1].shape == g->getChild(3).get());
+			}
+		}
+	}
+}
+
+SCENARIO("A group's bounding box grows with children added after it was placed in its parent", "[group]")
+{
+	GIVEN("g1 = Group()"
+		"And g2 = Group()"
+		"And setTransform(g2, scaling(2.0f, 2.0f, 2.0f))"
+		"And addChild(g1, g2)")
+	{
+		auto g1 = createGroup();
+		auto g2 = createGroup();
+		g2->setTransform(scale(2.0f, 2.0f, 2.0f));
+		g1->addChild(g2);
+		WHEN("s = Sphere()"
+			"And setTransform(s, translation(5.0f, 0.0f, 0.0f))"
+			"And addChild(g2, s)")
+		{
+			auto s = createSphere(translate(5.0f, 0.0f, 0.0f));
+			g2->addChild(s);
+			BoundingBox box;
+			auto result = g1->boundingBox(box);
+			THEN("box.min == point(8.0f, -2.0f, -2.0f)"
+				"And box.max == point(12.0f, 2.0f, 2.0f)")
+			{
+				REQUIRE(result);
+				REQUIRE(box.min == point(8.0f, -2.0f, -2.0f));
+				REQUIRE(box.max == point(12.0f, 2.0f, 2.0f));
+			}
+		}
+	}
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <instance.h>
+#include <group.h>
+#include <triangle.h>
+#include <world.h>
+#include <intersection.h>
+
+SCENARIO("Intersecting a ray with an instance of a group", "[instance]")
+{
+	GIVEN("mesh = Group() of 16 triangles in the z = 0 plane"
+		"And instance = createInstance(mesh, translation(0.0f, 0.0f, 5.0f))"
+		"And r = Ray(point(0.25f, 0.25f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		auto mesh = createGroup();
+
+		for (int32_t i = 0; i < 16; i++)
+		{
+			auto x = static_cast<float>(i);
+			mesh->addChild(createTriangle(point(x, 0.0f, 0.0f), point(x, 1.0f, 0.0f), point(x + 1.0f, 0.0f, 0.0f)));
+		}
+
+		auto instance = createInstance(mesh, translate(0.0f, 0.0f, 5.0f));
+		auto r = Ray(point(0.25f, 0.25f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("xs = intersect(instance, r)")
+		{
+			auto xs = instance->intersect(r);
+			THEN("xs.count == 1"
+				"And xs[0].t == 10.0f"
+				"And xs[0].shape == instance"
+				"And xs[0].instancedShape == the first triangle")
+			{
+				REQUIRE(xs.size() == 1);
+				REQUIRE(xs[0].t == 10.0f);
+				REQUIRE(xs[0].shape == instance.get());
+				REQUIRE(xs[0].instancedShape == mesh->getChild(0).get());
+			}
+		}
+	}
+}
+
+SCENARIO("Instances share their mesh and override its material", "[instance]")
+{
+	GIVEN("mesh = Group() of 16 triangles in the z = 0 plane"
+		"And w = World() with 100 instances of mesh, rotated to face -x and spread along z")
+	{
+		auto mesh = createGroup();
+		mesh->material.color = color(1.0f, 0.0f, 0.0f);
+
+		for (int32_t i = 0; i < 16; i++)
+		{
+			auto x = static_cast<float>(i);
+			mesh->addChild(createTriangle(point(x, 0.0f, 0.0f), point(x, 1.0f, 0.0f), point(x + 1.0f, 0.0f, 0.0f)));
+		}
+
+		auto w = World();
+
+		for (int32_t i = 0; i < 100; i++)
+		{
+			auto instance = createInstance(mesh, translate(0.0f, 0.0f, i * 20.0f) * rotateY(RTC_PIDIV2));
+
+			if (i == 42)
+			{
+				instance->material.color = color(0.0f, 1.0f, 0.0f);
+			}
+
+			w.addObject(instance);
+		}
+
+		auto r = Ray(point(5.0f, 0.5f, 839.75f), vector(-1.0f, 0.0f, 0.0f));
+		WHEN("xs = intersectWorld(w, r)"
+			"And comps = prepareComputations(xs[0], r, xs)")
+		{
+			auto xs = intersectWorld(w, r);
+			auto comps = prepareComputations(xs[0], r, xs);
+			THEN("the ray only hits instance 42"
+				"And the mesh is not copied"
+				"And the normal is in world space"
+				"And the instance material is used")
+			{
+				REQUIRE(xs.size() == 1);
+				REQUIRE(xs[0].shape == w.getObjects()[42].get());
+				REQUIRE(std::dynamic_pointer_cast<Instance>(w.getObjects()[0])->getInstancedShape() == mesh);
+				REQUIRE(std::dynamic_pointer_cast<Instance>(w.getObjects()[99])->getInstancedShape() == mesh);
+				REQUIRE(comps.normal == vector(1.0f, 0.0f, 0.0f));
+				REQUIRE(comps.shape->getMaterial().color == color(0.0f, 1.0f, 0.0f));
+				REQUIRE(w.getObjects()[41]->getMaterial().color == color(1.0f, 0.0f, 0.0f));
+			}
+		}
+	}
+}
@@ -19,11 +19,11 @@ SCENARIO("An intersection encapsulates t and object", "[intersection]")
 
 		WHEN("i = Intersection(3.5f, s.id)")
 		{
-			auto i = Intersection{ 3.5f, s, s };
+			auto i = Intersection{ 3.5f, s.get() };
 			THEN("i.t == 3.5f")
 			{
 				REQUIRE(i.t == 3.5f);
-				REQUIRE(i.object == s);
+				REQUIRE(i.shape == s.get());
 			}
 		}
 	}
@@ -37,8 +37,8 @@ SCENARIO("Aggregating intersections", "[intersection]")
 	{
 		auto s = std::make_shared<Sphere>();
 
-		auto i1 = Intersection{ 1.0f, s };
-		auto i2 = Intersection{ 2.0f, s };
+		auto i1 = Intersection{ 1.0f, s.get() };
+		auto i2 = Intersection{ 2.0f, s.get() };
 
 		WHEN("xs = intersections(i1, i2)")
 		{
@@ -64,8 +64,8 @@ SCENARIO("The hit, when all intersections have positive t", "[intersection]")
 		"And xs = intersections(i2, i1)")
 	{
 		auto s = std::make_shared<Sphere>();
-		auto i1 = Intersection{ 1.0f, s };
-		auto i2 = Intersection{ 2.0f, s };
+		auto i1 = Intersection{ 1.0f, s.get() };
+		auto i2 = Intersection{ 2.0f, s.get() };
 		auto xs = sortIntersections({ i2, i1 });
 
 		WHEN("i = hit(xs)")
@@ -88,8 +88,8 @@ SCENARIO("The hit, when some intersections have negative t", "[intersection]")
 		"And xs = intersections(i2, i1)")
 	{
 		auto s = std::make_shared<Sphere>();
-		auto i1 = Intersection{ -1.0f, s };
-		auto i2 = Intersection{ 1.0f, s };
+		auto i1 = Intersection{ -1.0f, s.get() };
+		auto i2 = Intersection{ 1.0f, s.get() };
 		auto xs = sortIntersections({ i2, i1 });
 
 		WHEN("i = hit(xs)")
@@ -112,8 +112,8 @@ SCENARIO("The hit, when all intersections have negative t", "[intersection]")
 		"And xs = intersections(i2, i1)")
 	{
 		auto s = std::make_shared<Sphere>();
-		auto i1 = Intersection{ -2.0f, s };
-		auto i2 = Intersection{ -1.0f, s };
+		auto i1 = Intersection{ -2.0f, s.get() };
+		auto i2 = Intersection{ -1.0f, s.get() };
 		auto xs = sortIntersections({ i2, i1 });
 
 		WHEN("i = hit(xs)")
@@ -138,10 +138,10 @@ SCENARIO("The hit is always the lowest nonnegative intersection", "[intersection
 		"And xs = intersections(i1, i2, i3, i4)")
 	{
 		auto s = std::make_shared<Sphere>();
-		auto i1 = Intersection{ 5.0f, s };
-		auto i2 = Intersection{ 7.0f, s };
-		auto i3 = Intersection{ -3.0f, s };
-		auto i4 = Intersection{ 2.0f, s };
+		auto i1 = Intersection{ 5.0f, s.get() };
+		auto i2 = Intersection{ 7.0f, s.get() };
+		auto i3 = Intersection{ -3.0f, s.get() };
+		auto i4 = Intersection{ 2.0f, s.get() };
 		auto xs = sortIntersections({ i1, i2, i3, i4 });
 
 		WHEN("i = hit(xs)")
@@ -166,7 +166,7 @@ SCENARIO("Precomputing the state of an intersection", "[intersections]")
 	{
 		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
 		auto shape = createSphere();
-		auto i = Intersection{ 4.0f, shape };
+		auto i = Intersection{ 4.0f, shape.get() };
 		WHEN("comps = prepareComputations(i, r)")
 		{
 			auto comps = prepareComputations(i, r);
@@ -193,7 +193,7 @@ SCENARIO("The hit, when an intersection occurs on the outside", "[intersections]
 	{
 		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
 		auto shape = createSphere();
-		auto i = Intersection{ 4.0f, shape };
+		auto i = Intersection{ 4.0f, shape.get() };
 		WHEN("comps = prepareComputations(i, r)")
 		{
 			auto comps = prepareComputations(i, r);
@@ -213,7 +213,7 @@ SCENARIO("The hit, when an intersection occurs on the inside", "[intersections]"
 	{
 		auto r = Ray(point(0.0f, 0.0f, 0.0f), vector(0.0f, 0.0f, 1.0f));
 		auto shape = createSphere();
-		auto i = Intersection{ 1.0f, shape };
+		auto i = Intersection{ 1.0f, shape.get() };
 		WHEN("comps = prepareComputations(i, r)")
 		{
 			auto comps = prepareComputations(i, r);
@@ -241,7 +241,7 @@ SCENARIO("The hit should offset the point", "[intersections]")
 		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
 		auto shape = createSphere();
 		shape->setTransform(translate(0.0f, 0.0f, 1.0f));
-		auto i = Intersection{ 5.0f, shape };
+		auto i = Intersection{ 5.0f, shape.get() };
 		WHEN("comps = prepareComputations(i, r)")
 		{
 			auto comps = prepareComputations(i, r);
@@ -264,7 +264,7 @@ SCENARIO("Precomputing the reflection vector", "[intersections]")
 	{
 		auto shape = createPlane();
 		auto r = Ray(point(0.0f, 1.0f, -1.0f), vector(0.0f, -SQRT2 / 2.0f, SQRT2 / 2.0f));
-		auto i = Intersection{ SQRT2, shape };
+		auto i = Intersection{ SQRT2, shape.get() };
 		WHEN("comps = prepareComputations(i, r)")
 		{
 			auto comps = prepareComputations(i, r);
@@ -300,7 +300,7 @@ SCENARIO("Finding n1 and n2 at various intersections", "[intersections]")
 		C->setTransform(translate(0.0f, 0.0f, 0.25f));
 		C->material.refractiveIndex = 2.5f;
 		auto r = Ray(point(0.0f, 0.0f, -4.0f), vector(0.0f, 0.0f, 1.0f));
-		auto xs = sortIntersections({ { 2.0f, A }, { 2.75f, B }, { 3.25f, C }, { 4.75f, B }, { 5.25f, C }, { 6.0f, A } });
+		auto xs = sortIntersections({ { 2.0f, A.get() }, { 2.75f, B.get() }, { 3.25f, C.get() }, { 4.75f, B.get() }, { 5.25f, C.get() }, { 6.0f, A.get() } });
 		WHEN("comps = preparecomputations(xs[<index>], r, xs)"
 			"Examples:"
 			"| index | n1  | n2  |"
@@ -345,8 +345,8 @@ SCENARIO("The under point is offset below the surface", "[intersections]")
 		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
 		auto shape = createGlassSphere();
 		shape->setTransform(translate(0.0f, 0.0f, 1.0f));
-		auto i = Intersection{ 5.0f, shape };
-		auto xs = sortIntersections({ {5.0f, shape } });
+		auto i = Intersection{ 5.0f, shape.get() };
+		auto xs = sortIntersections({ {5.0f, shape.get() } });
 		WHEN("comps = prepareComputations(i, r, xs)")
 		{
 			auto comps = prepareComputations(i, r, xs);
@@ -370,7 +370,7 @@ SCENARIO("The refracted color with an opaque surface", "[intersections]")
 		auto w = defaultWorld();
 		auto shape = w.getObject(0);
 		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
-		auto xs = sortIntersections({ { 4.0f, shape }, { 6.0f, shape } });
+		auto xs = sortIntersections({ { 4.0f, shape.get() }, { 6.0f, shape.get() } });
 		WHEN("comps = prepareComputations(xs[0], r, xs)"
 			"And c = refractedColor(w, comps, 5.0f)")
 		{
@@ -399,7 +399,7 @@ SCENARIO("The refracted color at the maximum recursive depth", "[intersections]"
 		shape->material.transparency = 1.0f;
 		shape->material.refractiveIndex = 1.5f;
 		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
-		auto xs = sortIntersections({ { 4.0f, shape }, { 6.0f, shape } });
+		auto xs = sortIntersections({ { 4.0f, shape.get() }, { 6.0f, shape.get() } });
 		WHEN("comps = prepareComputations(xs[0], r, xs)"
 			"And c = refractedColor(w, comps, 0)")
 		{
@@ -428,7 +428,7 @@ SCENARIO("The refracted color under total internal reflection", "[intersections]
 		shape->material.transparency = 1.0f;
 		shape->material.refractiveIndex = 1.5f;
 		auto r = Ray(point(0.0f, 0.0f, SQRT2 / 2.0f), vector(0.0f, 1.0f, 0.0f));
-		auto xs = sortIntersections({ { -SQRT2 / 2.0f, shape}, {SQRT2 / 2.0f, shape } });
+		auto xs = sortIntersections({ { -SQRT2 / 2.0f, shape.get()}, {SQRT2 / 2.0f, shape.get() } });
 		// NOTE: this time you're inside the sphere, so you need
 		// to look at the second intersection, xs[1], not xs[0]
 		WHEN("comps = preparecomputations(xs[1], r, xs)"
@@ -453,7 +453,7 @@ SCENARIO("The Schlick approximation under total internal reflection", "[intersec
 	{
 		auto shape = createGlassSphere();
 		auto r = Ray(point(0.0f, 0.0f, SQRT2 / 2.0f), vector(0.0f, 1.0f, 0.0f));
-		auto xs = sortIntersections({ { -SQRT2 / 2.0f, shape }, { SQRT2 / 2.0f, shape } });
+		auto xs = sortIntersections({ { -SQRT2 / 2.0f, shape.get() }, { SQRT2 / 2.0f, shape.get() } });
 		WHEN("comps = prepareComputations(xs[1], r, xs)"
 			"And reflectance = schlick(comps)")
 		{
@@ -475,7 +475,7 @@ SCENARIO("The Schlick approximation with a perpendicular viewing angle", "[inter
 	{
 		auto shape = createGlassSphere();
 		auto r = Ray(point(0.0f, 0.0f, 0.0f), vector(0.0f, 1.0f, 0.0f));
-		auto xs = sortIntersections({ { -1.0f, shape }, { 1.0f, shape } });
+		auto xs = sortIntersections({ { -1.0f, shape.get() }, { 1.0f, shape.get() } });
 		WHEN("comps = prepareComputations(xs[1], r, xs)"
 			"And reflectance = schlick(comps)")
 		{
@@ -497,7 +497,7 @@ SCENARIO("The Schlick approximation with small angle and n2 > n1", "[intersectio
 	{
 		auto shape = createGlassSphere();
 		auto r = Ray(point(0.0f, 0.99f, -2.0f), vector(0.0f, 0.0f, 1.0f));
-		auto xs = sortIntersections({ { 1.8589f, shape } });
+		auto xs = sortIntersections({ { 1.8589f, shape.get() } });
 		WHEN("comps = prepareComputations(xs[1], r, xs)"
 			"And reflectance = schlick(comps)")
 		{
@@ -520,12 +520,247 @@ SCENARIO("An intersection can encapsulate `u` and `v`", "[intersections]")
 		auto s = createTriangle(point(0.0f, 1.0f, 0.0f), point(-1.0f, 0.0f, 0.0f), point(1.0f, 0.0f, 0.0f));
 		WHEN("i = intersectionWithUV(3.5f, s, 0.2f, 0.4f)")
 		{
-			auto i = intersectionWithUV(3.5f, s, 0.2f, 0.4f);
-			THEN("i.u == 0.2f"
-				"And i.v == 0.4f")
+			auto i = intersectionWithUV(3.5f, s.get(), 0.2f, 0.4f);
+			THEN("i.a == 0.2f"
+				"And i.b == 0.4f")
 			{
-				REQUIRE(i.u == 0.2f);
-				REQUIRE(i.v == 0.4f);
+				REQUIRE(i.a == 0.2f);
+				REQUIRE(i.b == 0.4f);
+			}
+		}
+	}
+}
+
+SCENARIO("A hit list keeps four hits inline and grows past them", "[intersections]")
+{
+	GIVEN("s = Sphere()"
+		"And xs = Intersections() with the hits 1, 2, 3 and 4")
+	{
+		auto s = createSphere();
+		auto xs = Intersections();
+
+		for (int32_t i = 1; i <= 4; i++)
+		{
+			xs.push_back({ static_cast<float>(i), s.get() });
+		}
+
+		auto inlineCapacity = xs.capacity();
+
+		WHEN("the hit 5 is added"
+			"And moved = the list moved out of xs")
+		{
+			xs.push_back({ 5.0f, s.get() });
+			auto grownCapacity = xs.capacity();
+			auto moved = std::move(xs);
+			THEN("the four hits fit in the inline storage"
+				"And the fifth one moves the list to a larger storage that keeps every hit"
+				"And moved has all the hits in order")
+			{
+				REQUIRE(inlineCapacity == Intersections::InlineCapacity);
+				REQUIRE(grownCapacity > Intersections::InlineCapacity);
+				REQUIRE(moved.size() == 5);
+
+				for (size_t i = 0; i < moved.size(); i++)
+				{
+					REQUIRE(moved[i].t == static_cast<float>(i + 1));
+					REQUIRE(moved[i].shape == s.get());
+				}
+			}
+		}
+
+		WHEN("hits 5 to 8 are added"
+			"And xs[0] and then all of xs are added to xs again")
+		{
+			for (int32_t i = 5; i <= 8; i++)
+			{
+				xs.push_back({ static_cast<float>(i), s.get() });
+			}
+
+			xs.push_back(xs[0]);
+			xs.append(xs);
+			THEN("xs has the hits 1 to 8 and 1, twice")
+			{
+				REQUIRE(xs.size() == 18);
+
+				for (size_t i = 0; i < xs.size(); i++)
+				{
+					REQUIRE(xs[i].t == static_cast<float>(i % 9 == 8 ? 1 : i % 9 + 1));
+					REQUIRE(xs[i].shape == s.get());
+				}
+			}
+		}
+
+		WHEN("xs is cleared after the hit 5 is added")
+		{
+			xs.push_back({ 5.0f, s.get() });
+			auto grownCapacity = xs.capacity();
+			xs.clear();
+			THEN("xs is empty and keeps its storage for the next ray")
+			{
+				REQUIRE(xs.empty());
+				REQUIRE(xs.capacity() == grownCapacity);
+			}
+		}
+	}
+}
+
+SCENARIO("n1 and n2 are left at 1 for an opaque hit", "[intersections]")
+{
+	GIVEN("shape = Sphere() with refractiveIndex 1.5 and no transparency"
+		"And r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f))"
+		"And xs = intersections(4:shape, 6:shape)")
+	{
+		auto shape = createSphere();
+		shape->material.refractiveIndex = 1.5f;
+		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		auto xs = sortIntersections({ { 4.0f, shape.get() }, { 6.0f, shape.get() } });
+		WHEN("comps = prepareComputations(xs[0], r, xs)")
+		{
+			auto comps = prepareComputations(xs[0], r, xs);
+			THEN("comps.n1 == 1.0f"
+				"And comps.n2 == 1.0f")
+			{
+				REQUIRE(comps.n1 == 1.0f);
+				REQUIRE(comps.n2 == 1.0f);
+			}
+		}
+	}
+}
+
+SCENARIO("Finding n1 and n2 for triangles that use their group's material", "[intersections]")
+{
+	GIVEN("g = Group() with transparency 1.0 and refractiveIndex 1.5"
+		"And A, B = triangles in g at z = 0 and z = 1"
+		"And r = Ray(point(0.25f, 0.25f, -1.0f), vector(0.0f, 0.0f, 1.0f))"
+		"And xs = intersections(1:A, 2:B)")
+	{
+		auto g = createGroup();
+		g->material.transparency = 1.0f;
+		g->material.refractiveIndex = 1.5f;
+		auto A = createTriangle(point(0.0f, 0.0f, 0.0f), point(0.0f, 1.0f, 0.0f), point(1.0f, 0.0f, 0.0f));
+		auto B = createTriangle(point(0.0f, 0.0f, 1.0f), point(0.0f, 1.0f, 1.0f), point(1.0f, 0.0f, 1.0f));
+		g->addChild(A);
+		g->addChild(B);
+		auto r = Ray(point(0.25f, 0.25f, -1.0f), vector(0.0f, 0.0f, 1.0f));
+		auto xs = sortIntersections({ { 1.0f, A.get() }, { 2.0f, B.get() } });
+		WHEN("comps = prepareComputations(xs[0], r, xs)")
+		{
+			auto comps = prepareComputations(xs[0], r, xs);
+			THEN("comps.n1 == 1.0f"
+				"And comps.n2 == 1.5f")
+			{
+				REQUIRE(comps.n1 == 1.0f);
+				REQUIRE(comps.n2 == 1.5f);
+			}
+		}
+	}
+}
+
+SCENARIO("Finding n1 and n2 inside more overlapping shapes than MaxContainers", "[intersections]")
+{
+	GIVEN("shapes = MaxContainers + 4 glass spheres, shapes[k] with refractiveIndex 1 + k / 10"
+		"And r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f))"
+		"And xs = r enters every shape in order, then leaves them in the same order")
+	{
+		constexpr int32_t shapeCount = MaxContainers + 4;
+
+		std::vector<std::shared_ptr<Shape>> shapes;
+
+		for (int32_t k = 0; k < shapeCount; k++)
+		{
+			auto shape = createGlassSphere();
+			shape->material.refractiveIndex = 1.0f + k * 0.1f;
+			shapes.emplace_back(shape);
+		}
+
+		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+
+		Intersections xs;
+
+		for (int32_t k = 0; k < shapeCount; k++)
+		{
+			xs.push_back({ static_cast<float>(k + 1), shapes[k].get() });
+		}
+
+		for (int32_t k = 0; k < shapeCount; k++)
+		{
+			xs.push_back({ static_cast<float>(shapeCount + k + 1), shapes[k].get() });
+		}
+
+		WHEN("comps = prepareComputations(xs[<index>], r, xs)")
+		{
+			THEN("entering shapes[k] goes from shapes[k - 1] to shapes[k]"
+				"And leaving any but the last shape stays inside the last one"
+				"And leaving the last shape goes back to 1")
+			{
+				auto last = shapes.back()->material.refractiveIndex;
+
+				for (int32_t k = 0; k < shapeCount; k++)
+				{
+					auto entry = prepareComputations(xs[k], r, xs);
+
+					REQUIRE(entry.n1 == (k > 0 ? shapes[k - 1]->material.refractiveIndex : 1.0f));
+					REQUIRE(entry.n2 == shapes[k]->material.refractiveIndex);
+
+					auto exit = prepareComputations(xs[shapeCount + k], r, xs);
+
+					REQUIRE(exit.n1 == last);
+					REQUIRE(exit.n2 == (k < shapeCount - 1 ? last : 1.0f));
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("A batch of rays finds the same hits as one ray at a time", "[intersections]")
+{
+	GIVEN("w = defaultWorld()"
+		"And rays = 1001 rays from point(0.0f, 3.0f, -5.0f) to a grid of targets on the floor,"
+		"every eighth one turned away from the others")
+	{
+		auto w = defaultWorld();
+		std::vector<Ray> rays;
+
+		for (int32_t i = 0; i < 1001; i++)
+		{
+			auto origin = point(0.0f, 3.0f, -5.0f);
+			auto target = point(static_cast<float>(i % 33) * 0.25f - 4.0f, -1.5f, static_cast<float>(i / 33) * 0.25f - 4.0f);
+			auto direction = normalize(target - origin);
+
+			if (i % 8 == 5)
+			{
+				direction = -direction;
+			}
+
+			rays.push_back(Ray(origin, direction));
+		}
+
+		WHEN("stats = intersectClosest(w, rays, hits)"
+			"And anyStats = intersectAny(w, rays, occluded)")
+		{
+			std::vector<Intersection> hits(rays.size());
+			auto occluded = std::make_unique<bool[]>(rays.size());
+			auto stats = intersectClosest(w, rays, hits);
+			auto anyStats = intersectAny(w, rays, std::span<bool>(occluded.get(), rays.size()));
+			THEN("hits[i] == intersectClosest(w, rays[i])"
+				"And occluded[i] is whether rays[i] hits anything"
+				"And both queries counted every ray")
+			{
+				auto hitCount = 0;
+
+				for (size_t i = 0; i < rays.size(); i++)
+				{
+					auto expected = intersectClosest(w, rays[i]);
+					REQUIRE(hits[i].shape == expected.shape);
+					REQUIRE(Math::equal(hits[i].t, expected.t));
+					REQUIRE(occluded[i] == (expected.shape != nullptr));
+					hitCount += expected.shape != nullptr;
+				}
+
+				REQUIRE(hitCount > 0);
+				REQUIRE(hitCount < static_cast<int32_t>(rays.size()));
+				REQUIRE(stats.rayCount == rays.size());
+				REQUIRE(anyStats.rayCount == rays.size());
 			}
 		}
 	}
@@ -1,7 +1,7 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include <objLoader.h>
-#include <triangle.h>
+#include <trianglemesh.h>
 
 // Chapter 15 Triangles
 
@@ -64,13 +64,13 @@ SCENARIO("Parsing triangle faces", "[objfile]")
 	{
 		WHEN("parser = parseObjFile(file)"
 			"And g = parser.defaultGroup"
-			"And t1 = first child of g"
-			"And t2 = second child of g")
+			"And mesh = the TriangleMesh in g"
+			"And t1 = first triangle of mesh"
+			"And t2 = second triangle of mesh")
 		{
 			auto parser = parseObjFile("Assets/Models/test3.obj");
 			auto g = parser.defaultGroup;
-			auto t1 = std::dynamic_pointer_cast<Triangle>(g->getChild(0));
-			auto t2 = std::dynamic_pointer_cast<Triangle>(g->getChild(1));
+			auto mesh = std::dynamic_pointer_cast<TriangleMesh>(g->getChild(0));
 
 			THEN("t1.p1 == parser.vertices[1]"
 				"And t1.p1 == parser.vertices[2]"
@@ -79,12 +79,12 @@ SCENARIO("Parsing triangle faces", "[objfile]")
 				"And t2.p1 == parser.vertices[3]"
 				"And t2.p2 == parser.vertices[4]")
 			{
-				REQUIRE(t1->p0 == parser.vertices[1]);
-				REQUIRE(t1->p1 == parser.vertices[2]);
-				REQUIRE(t1->p2 == parser.vertices[3]);
-				REQUIRE(t2->p0 == parser.vertices[1]);
-				REQUIRE(t2->p1 == parser.vertices[3]);
-				REQUIRE(t2->p2 == parser.vertices[4]);
+				REQUIRE(mesh->position(0, 0) == parser.vertices[1]);
+				REQUIRE(mesh->position(0, 1) == parser.vertices[2]);
+				REQUIRE(mesh->position(0, 2) == parser.vertices[3]);
+				REQUIRE(mesh->position(1, 0) == parser.vertices[1]);
+				REQUIRE(mesh->position(1, 1) == parser.vertices[3]);
+				REQUIRE(mesh->position(1, 2) == parser.vertices[4]);
 			}
 		}
 	}
@@ -103,15 +103,14 @@ SCENARIO("Triangulating polygons", "[objfile]")
 	{
 		WHEN("parser = parseObjFile(file)"
 			"And g = parser.defaultGroup"
-			"And t1 = first child of g"
-			"And t2 = second child of g"
-			"And t3 = third child of g")
+			"And mesh = the TriangleMesh in g"
+			"And t1 = first triangle of mesh"
+			"And t2 = second triangle of mesh"
+			"And t3 = third triangle of mesh")
 		{
 			auto parser = parseObjFile("Assets/Models/test4.obj");
 			auto g = parser.defaultGroup;
-			auto t1 = std::dynamic_pointer_cast<Triangle>(g->getChild(0));
-			auto t2 = std::dynamic_pointer_cast<Triangle>(g->getChild(1));
-			auto t3 = std::dynamic_pointer_cast<Triangle>(g->getChild(2));
+			auto mesh = std::dynamic_pointer_cast<TriangleMesh>(g->getChild(0));
 
 			THEN("t1.p1 == parser.vertices[1]"
 				"And t1.p1 == parser.vertices[2]"
@@ -120,15 +119,15 @@ SCENARIO("Triangulating polygons", "[objfile]")
 				"And t2.p1 == parser.vertices[3]"
 				"And t2.p2 == parser.vertices[4]")
 			{
-				REQUIRE(t1->p0 == parser.vertices[1]);
-				REQUIRE(t1->p1 == parser.vertices[2]);
-				REQUIRE(t1->p2 == parser.vertices[3]);
-				REQUIRE(t2->p0 == parser.vertices[1]);
-				REQUIRE(t2->p1 == parser.vertices[3]);
-				REQUIRE(t2->p2 == parser.vertices[4]);
-				REQUIRE(t3->p0 == parser.vertices[1]);
-				REQUIRE(t3->p1 == parser.vertices[4]);
-				REQUIRE(t3->p2 == parser.vertices[5]);
+				REQUIRE(mesh->position(0, 0) == parser.vertices[1]);
+				REQUIRE(mesh->position(0, 1) == parser.vertices[2]);
+				REQUIRE(mesh->position(0, 2) == parser.vertices[3]);
+				REQUIRE(mesh->position(1, 0) == parser.vertices[1]);
+				REQUIRE(mesh->position(1, 1) == parser.vertices[3]);
+				REQUIRE(mesh->position(1, 2) == parser.vertices[4]);
+				REQUIRE(mesh->position(2, 0) == parser.vertices[1]);
+				REQUIRE(mesh->position(2, 1) == parser.vertices[4]);
+				REQUIRE(mesh->position(2, 2) == parser.vertices[5]);
 			}
 		}
 	}
@@ -141,14 +140,14 @@ SCENARIO("Triangles in groups", "[objfile]")
 		WHEN("parser = parseObjFile(file)"
 			"And g1 = FirstGroup from parser"
 			"And g2 = SecondGroup from parser"
-			"And t1 = first child of g1"
-			"And t2 = first child of g2")
+			"And t1 = first triangle of the TriangleMesh in g1"
+			"And t2 = first triangle of the TriangleMesh in g2")
 		{
 			auto parser = parseObjFile("Assets/Models/triangles.obj");
 			auto g1 = parser.groups[0];
 			auto g2 = parser.groups[1];
-			auto t1 = std::dynamic_pointer_cast<Triangle>(g1->getChild(0));
-			auto t2 = std::dynamic_pointer_cast<Triangle>(g2->getChild(0));
+			auto mesh1 = std::dynamic_pointer_cast<TriangleMesh>(g1->getChild(0));
+			auto mesh2 = std::dynamic_pointer_cast<TriangleMesh>(g2->getChild(0));
 			THEN("t1.p0 == parser.vertices[1]"
 				"And t1.p1 == parser.vertices[2]"
 				"And t1.p2 == parser.vertices[3]"
@@ -156,12 +155,12 @@ SCENARIO("Triangles in groups", "[objfile]")
 				"And t2.p1 == parser.vertices[3]"
 				"And t2.p2 == parser.vertices[4]")
 			{
-				REQUIRE(t1->p0 == parser.vertices[1]);
-				REQUIRE(t1->p1 == parser.vertices[2]);
-				REQUIRE(t1->p2 == parser.vertices[3]);
-				REQUIRE(t2->p0 == parser.vertices[1]);
-				REQUIRE(t2->p1 == parser.vertices[3]);
-				REQUIRE(t2->p2 == parser.vertices[4]);
+				REQUIRE(mesh1->position(0, 0) == parser.vertices[1]);
+				REQUIRE(mesh1->position(0, 1) == parser.vertices[2]);
+				REQUIRE(mesh1->position(0, 2) == parser.vertices[3]);
+				REQUIRE(mesh2->position(0, 0) == parser.vertices[1]);
+				REQUIRE(mesh2->position(0, 1) == parser.vertices[3]);
+				REQUIRE(mesh2->position(0, 2) == parser.vertices[4]);
 			}
 		}
 	}
@@ -179,8 +178,8 @@ SCENARIO("Converting an OBJ file to a group", "[objfile]")
 			THEN("g includes FirstGroup from parser"
 				"And g includes SecondGroup from parser")
 			{
-				REQUIRE(g->contains(parser.getGroup(0)));
-				REQUIRE(g->contains(parser.getGroup(1)));
+				REQUIRE(g->contains(parser.getGroup(0).get()));
+				REQUIRE(g->contains(parser.getGroup(1).get()));
 			}
 		}
 	}
@@ -222,13 +221,13 @@ SCENARIO("Faces with normals", "[objfile]")
 	{
 		WHEN("parser = parseObjFile(file)"
 			"And g = parser.defaultGroup"
-			"And t1 = first child of g"
-			"And t2 = second child of g")
+			"And mesh = the TriangleMesh in g"
+			"And t1 = first triangle of mesh"
+			"And t2 = second triangle of mesh")
 		{
 			auto parser = parseObjFile("Assets/Models/test6.obj");
 			auto g = parser.defaultGroup;
-			auto t1 = std::dynamic_pointer_cast<Triangle>(g->getChild(0));
-			auto t2 = std::dynamic_pointer_cast<Triangle>(g->getChild(1));
+			auto mesh = std::dynamic_pointer_cast<TriangleMesh>(g->getChild(0));
 			THEN("t1.p0 = parser.vertices[1]"
 				"And t1.p1 = parser.vertices[2]"
 				"And t1.p2 = parser.vertices[3]"
@@ -237,13 +236,15 @@ SCENARIO("Faces with normals", "[objfile]")
 				"And t1.n2 = parser.normals[2]"
 				"And t2 == t1)")
 			{
-				REQUIRE(t1->p0 == parser.vertices[1]);
-				REQUIRE(t1->p1 == parser.vertices[2]);
-				REQUIRE(t1->p2 == parser.vertices[3]);
-				REQUIRE(t1->n0 == parser.normals[3]);
-				REQUIRE(t1->n1 == parser.normals[1]);
-				REQUIRE(t1->n2 == parser.normals[2]);
-				REQUIRE(t2 == t1);
+				REQUIRE(mesh->position(0, 0) == parser.vertices[1]);
+				REQUIRE(mesh->position(0, 1) == parser.vertices[2]);
+				REQUIRE(mesh->position(0, 2) == parser.vertices[3]);
+				REQUIRE(mesh->normal(0, 0) == parser.normals[3]);
+				REQUIRE(mesh->normal(0, 1) == parser.normals[1]);
+				REQUIRE(mesh->normal(0, 2) == parser.normals[2]);
+				REQUIRE(mesh->position(1, 0) == mesh->position(0, 0));
+				REQUIRE(mesh->position(1, 1) == mesh->position(0, 1));
+				REQUIRE(mesh->position(1, 2) == mesh->position(0, 2));
 			}
 		}
 	}
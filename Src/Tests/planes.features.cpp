@@ -78,7 +78,7 @@ SCENARIO("A ray intersecting a plane from above", "[planes]")
 			{
 				REQUIRE(xs.size() == 1);
 				REQUIRE(xs[0].t == 1.0f);
-				REQUIRE(xs[0].shape == p);
+				REQUIRE(xs[0].shape == p.get());
 			}
 		}
 	}
@@ -100,7 +100,41 @@ SCENARIO("A ray intersecting a plane from below", "[planes]")
 			{
 				REQUIRE(xs.size() == 1);
 				REQUIRE(xs[0].t == 1.0f);
-				REQUIRE(xs[0].shape == p);
+				REQUIRE(xs[0].shape == p.get());
+			}
+		}
+	}
+}
+
+SCENARIO("A plane's bounding box", "[planes]")
+{
+	GIVEN("p = Plane()")
+	{
+		auto p = createPlane();
+		WHEN("p.boundingBox(box)")
+		{
+			BoundingBox box;
+			auto result = p->boundingBox(box);
+			THEN("the plane is unbounded")
+			{
+				REQUIRE_FALSE(result);
+			}
+		}
+	}
+
+	GIVEN("p = Plane(2.0f, 3.0f)")
+	{
+		auto p = createPlane(2.0f, 3.0f);
+		WHEN("p.boundingBox(box)")
+		{
+			BoundingBox box;
+			auto result = p->boundingBox(box);
+			THEN("box.min == point(-2.0f, 0.0f, -3.0f)"
+				"And box.max == point(2.0f, 0.0f, 3.0f)")
+			{
+				REQUIRE(result);
+				REQUIRE(box.min == point(-2.0f, 0.0f, -3.0f));
+				REQUIRE(box.max == point(2.0f, 0.0f, 3.0f));
 			}
 		}
 	}
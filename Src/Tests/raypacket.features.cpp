@@ -0,0 +1,170 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <raypacket.h>
+#include <sphere.h>
+#include <cube.h>
+#include <plane.h>
+#include <world.h>
+#include <group.h>
+#include <triangle.h>
+#include <trianglemesh.h>
+#include <instance.h>
+#include <intersection.h>
+
+SCENARIO("A packet of neighbouring rays finds the closest hits of the rays one by one", "[raypacket]")
+{
+	GIVEN("w = World() with a plane, a cube, a group of 64 spheres, an instance of it, "
+		"a group of 128 triangles and a mesh of the same triangles"
+		"And packets of 4 rays from one point toward a 2x2 quad of targets")
+	{
+		auto w = World();
+		w.addObject(createPlane());
+
+		auto cube = createCube();
+		cube->setTransform(translate(-6.0f, 1.0f, 10.0f));
+		w.addObject(cube);
+
+		auto spheres = createGroup();
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			spheres->addChild(createSphere(translate((i % 8) * 3.0f, 1.0f, (i / 8) * 3.0f)));
+		}
+
+		w.addObject(spheres);
+		w.addObject(createInstance(spheres, translate(0.0f, 0.0f, 30.0f)));
+
+		auto triangles = createGroup();
+		auto buffers = std::make_shared<MeshBuffers>();
+		buffers->positions.emplace_back(point(0.0f, 0.0f, 0.0f));
+		buffers->normals.emplace_back(vector(0.0f, 0.0f, 0.0f));
+		buffers->texcoords.emplace_back(vector(0.0f, 0.0f, 0.0f));
+
+		auto height = [](int32_t x, int32_t z) { return 3.0f + ((x * 7 + z * 3) % 5) * 0.25f; };
+
+		for (int32_t z = 0; z <= 8; z++)
+		{
+			for (int32_t x = 0; x <= 8; x++)
+			{
+				buffers->positions.emplace_back(point(x - 12.0f, height(x, z), z + 20.0f));
+			}
+		}
+
+		auto mesh = createTriangleMesh(buffers);
+		auto corner = [](int32_t x, int32_t z) { return static_cast<uint32_t>(1 + z * 9 + x); };
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			auto x = i % 8;
+			auto z = i / 8;
+			auto p00 = point(x - 12.0f, height(x, z), z + 20.0f);
+			auto p10 = point(x - 11.0f, height(x + 1, z), z + 20.0f);
+			auto p01 = point(x - 12.0f, height(x, z + 1), z + 21.0f);
+			auto p11 = point(x - 11.0f, height(x + 1, z + 1), z + 21.0f);
+			triangles->addChild(createTriangle(p00, p10, p11));
+			triangles->addChild(createTriangle(p00, p11, p01));
+
+			mesh->addTriangle({ { corner(x, z), corner(x + 1, z), corner(x + 1, z + 1) } });
+			mesh->addTriangle({ { corner(x, z), corner(x + 1, z + 1), corner(x, z + 1) } });
+		}
+
+		w.addObject(triangles);
+
+		auto meshGroup = createGroup();
+		meshGroup->addChild(mesh);
+		meshGroup->setTransform(translate(0.0f, 0.0f, -8.0f));
+		w.addObject(meshGroup);
+
+		auto origin = point(0.0f, 12.0f, -20.0f);
+
+		WHEN("hits = intersectClosest(w, packet, 0b1111, hits) for every packet")
+		{
+			THEN("every lane's hit has the t, shape, barycentrics and triangle of intersectClosest(w, packet.rays[lane])")
+			{
+				uint32_t hitCount = 0;
+
+				for (int32_t y = 0; y < 24; y += 2)
+				{
+					for (int32_t x = 0; x < 40; x += 2)
+					{
+						RayPacket packet;
+
+						for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+						{
+							auto target = point(-14.63f + (x + lane % 2) * 1.0f, 0.0f, 0.29f + (y + lane / 2) * 2.0f);
+							packet.rays[lane] = Ray(origin, normalize(target - origin));
+						}
+
+						Intersection hits[RayPacket::Width];
+						intersectClosest(w, packet, 0b1111, hits);
+
+						for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+						{
+							auto expected = intersectClosest(w, packet.rays[lane]);
+
+							REQUIRE(std::fabsf(hits[lane].t - expected.t) < EPSILON);
+							REQUIRE(hits[lane].shape == expected.shape);
+							REQUIRE(hits[lane].instancedShape == expected.instancedShape);
+							REQUIRE(hits[lane].primitive == expected.primitive);
+							REQUIRE(std::fabsf(hits[lane].a - expected.a) < EPSILON);
+							REQUIRE(std::fabsf(hits[lane].b - expected.b) < EPSILON);
+
+							hitCount += expected.t > 0.0f ? 1 : 0;
+						}
+					}
+				}
+
+				REQUIRE(hitCount > 0);
+			}
+		}
+	}
+}
+
+SCENARIO("Lanes of a packet go their own way and lanes outside the mask are left out", "[raypacket]")
+{
+	GIVEN("w = defaultWorld() with a group of 64 spheres around the origin"
+		"And packet = 4 rays from far away toward the origin from four sides")
+	{
+		auto w = defaultWorld();
+		auto g = createGroup();
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			g->addChild(createSphere(translate((i % 8) * 3.0f - 10.5f, 3.0f, (i / 8) * 3.0f - 10.5f)));
+		}
+
+		w.addObject(g);
+
+		RayPacket packet;
+		packet.rays[0] = Ray(point(0.0f, 0.5f, -20.0f), vector(0.0f, 0.0f, 1.0f));
+		packet.rays[1] = Ray(point(20.0f, 3.0f, 1.5f), vector(-1.0f, 0.0f, 0.0f));
+		packet.rays[2] = Ray(point(0.0f, 20.0f, 0.0f), vector(0.0f, -1.0f, 0.0f));
+		packet.rays[3] = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 1.0f, 0.0f));
+
+		WHEN("intersectClosest(w, packet, 0b1011, hits)")
+		{
+			Intersection hits[RayPacket::Width];
+			hits[2].t = 42.0f;
+
+			intersectClosest(w, packet, 0b1011, hits);
+
+			THEN("lanes 0, 1 and 3 have the hits of their rays one by one"
+				"And lane 2 has no hit")
+			{
+				for (int32_t lane : { 0, 1, 3 })
+				{
+					auto expected = intersectClosest(w, packet.rays[lane]);
+
+					REQUIRE(std::fabsf(hits[lane].t - expected.t) < EPSILON);
+					REQUIRE(hits[lane].shape == expected.shape);
+				}
+
+				REQUIRE(hits[0].shape == w.getObject(0).get());
+				REQUIRE(hits[1].t > 0.0f);
+				REQUIRE(hits[3].t == 0.0f);
+				REQUIRE(hits[2].t == 0.0f);
+				REQUIRE(hits[2].shape == nullptr);
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -129,8 +129,8 @@ SCENARIO("Intersect sets the object on the intersection", "[sphere]")
 		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
 		auto s = std::make_shared<Sphere>();
 
-		auto i1 = Intersection{ 1.0f, s };
-		auto i2 = Intersection{ 2.0f, s };
+		auto i1 = Intersection{ 1.0f, s.get() };
+		auto i2 = Intersection{ 2.0f, s.get() };
 
 		WHEN("xs = intersect(s, r)")
 		{
@@ -141,8 +141,8 @@ SCENARIO("Intersect sets the object on the intersection", "[sphere]")
 				"And xs[1].t == 2.0f")
 			{
 				REQUIRE(xs.size() == 2);
-				REQUIRE(xs[0].object == s);
-				REQUIRE(xs[1].object == s);
+				REQUIRE(xs[0].shape == s.get());
+				REQUIRE(xs[1].shape == s.get());
 			}
 		}
 	}
@@ -418,4 +418,36 @@ SCENARIO("A helper for producing a sphere with a glassy material", "[sphere]")
 			REQUIRE(s->material.refractiveIndex == 1.5f);
 		}
 	}
+}
+
+SCENARIO("The texture coordinates of a sphere are found for the shaded hit only", "[sphere]")
+{
+	GIVEN("s = Sphere()"
+		"And s.setTransform(translate(5.0f, 0.0f, 0.0f))"
+		"And r = Ray(point(5.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		auto s = std::make_shared<Sphere>();
+
+		s->setTransform(translate(5.0f, 0.0f, 0.0f));
+
+		auto r = Ray(point(5.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+
+		WHEN("xs = intersect(s, r)"
+			"And comps = prepareComputations(xs[0], r)")
+		{
+			auto xs = s->intersect(r);
+			auto comps = prepareComputations(xs[0], r);
+
+			THEN("xs[0] has no barycentrics"
+				"And comps.u == 0.75f"
+				"And comps.v == 0.5f")
+			{
+				REQUIRE(xs.size() == 2);
+				REQUIRE(xs[0].a == 0.0f);
+				REQUIRE(xs[0].b == 0.0f);
+				REQUIRE(Math::equal(comps.u, 0.75f));
+				REQUIRE(Math::equal(comps.v, 0.5f));
+			}
+		}
+	}
 }
\ No newline at end of file
@@ -0,0 +1,376 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <bvhcache.h>
+#include <group.h>
+#include <trianglemesh.h>
+
+SCENARIO("A triangle mesh is hit like the same triangles as separate shapes", "[trianglemesh]")
+{
+	GIVEN("buffers = the corners of a wavy 8x8 grid"
+		"And mesh = a TriangleMesh of the 128 grid triangles"
+		"And g = a group of the same triangles as Triangle shapes")
+	{
+		auto buffers = std::make_shared<MeshBuffers>();
+		buffers->positions.emplace_back(point(0.0f, 0.0f, 0.0f));
+		buffers->normals.emplace_back(vector(0.0f, 0.0f, 0.0f));
+		buffers->texcoords.emplace_back(vector(0.0f, 0.0f, 0.0f));
+
+		for (int32_t z = 0; z <= 8; z++)
+		{
+			for (int32_t x = 0; x <= 8; x++)
+			{
+				buffers->positions.emplace_back(point(x, ((x * 7 + z * 3) % 5) * 0.25f, z));
+			}
+		}
+
+		auto mesh = createTriangleMesh(buffers);
+		auto g = createGroup();
+
+		auto corner = [](int32_t x, int32_t z) { return static_cast<uint32_t>(1 + z * 9 + x); };
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			auto x = i % 8;
+			auto z = i / 8;
+
+			MeshTriangle t1;
+			t1.positions[0] = corner(x, z);
+			t1.positions[1] = corner(x + 1, z);
+			t1.positions[2] = corner(x + 1, z + 1);
+
+			MeshTriangle t2;
+			t2.positions[0] = corner(x, z);
+			t2.positions[1] = corner(x + 1, z + 1);
+			t2.positions[2] = corner(x, z + 1);
+
+			for (const auto& triangle : { t1, t2 })
+			{
+				mesh->addTriangle(triangle);
+				g->addChild(createTriangle(buffers->positions[triangle.positions[0]],
+										   buffers->positions[triangle.positions[1]],
+										   buffers->positions[triangle.positions[2]]));
+			}
+		}
+
+		WHEN("xs = intersect(mesh, r) and expected = intersect(g, r) for every r")
+		{
+			THEN("xs has the t, triangle and barycentrics of expected"
+				"And the closest hit of mesh is xs[0]"
+				"And the normals match")
+			{
+				for (int32_t i = 0; i < 16; i++)
+				{
+					auto r = Ray(point(0.3f + i * 0.45f, 5.0f, -1.0f), normalize(vector(0.1f, -1.0f, 0.3f + i * 0.05f)));
+					auto xs = mesh->intersect(r);
+					auto expected = g->intersect(r);
+
+					REQUIRE(xs.size() == expected.size());
+
+					for (size_t j = 0; j < xs.size(); j++)
+					{
+						REQUIRE(xs[j].t == expected[j].t);
+						REQUIRE(xs[j].shape == mesh.get());
+						REQUIRE(g->shapes[xs[j].primitive].get() == expected[j].shape);
+						REQUIRE(xs[j].a == expected[j].a);
+						REQUIRE(xs[j].b == expected[j].b);
+
+						auto position = r.at(xs[j].t);
+						REQUIRE(mesh->normalAt(position, xs[j]) == expected[j].shape->normalAt(position, expected[j]));
+					}
+
+					Intersection closest;
+					REQUIRE(mesh->intersectClosest(r, closest) == !xs.empty());
+					REQUIRE(mesh->intersectAny(r) == !xs.empty());
+
+					if (!xs.empty())
+					{
+						REQUIRE(closest.t == xs[0].t);
+						REQUIRE(closest.primitive == xs[0].primitive);
+					}
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("Spatial splits over a mesh of long thin triangles report each triangle once", "[trianglemesh]")
+{
+	GIVEN("mesh = a TriangleMesh of 16 parallel diagonal slivers built with spatial splits"
+		"And r = Ray(point(7.0f, 5.05f, -5.0f), vector(0.0f, 0.0f, 1.0f))")
+	{
+		auto buffers = std::make_shared<MeshBuffers>();
+		buffers->positions.emplace_back(point(0.0f, 0.0f, 0.0f));
+		buffers->normals.emplace_back(vector(0.0f, 0.0f, 0.0f));
+		buffers->texcoords.emplace_back(vector(0.0f, 0.0f, 0.0f));
+
+		auto mesh = createTriangleMesh(buffers);
+
+		for (int32_t i = 0; i < 16; i++)
+		{
+			auto first = static_cast<uint32_t>(buffers->positions.size());
+			auto x = static_cast<float>(i * 2);
+			buffers->positions.emplace_back(point(x, 0.0f, 0.0f));
+			buffers->positions.emplace_back(point(x + 10.0f, 10.0f, 0.0f));
+			buffers->positions.emplace_back(point(x + 10.0f, 10.2f, 0.0f));
+
+			MeshTriangle triangle;
+			triangle.positions[0] = first;
+			triangle.positions[1] = first + 1;
+			triangle.positions[2] = first + 2;
+			mesh->addTriangle(triangle);
+		}
+
+		mesh->setBVHBuildQuality(BVHBuildQuality::Spatial);
+
+		auto r = Ray(point(7.0f, 5.05f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		WHEN("xs = intersect(mesh, r)")
+		{
+			auto xs = mesh->intersect(r);
+			THEN("some sliver is referenced from more than one leaf"
+				"And xs.count == 1"
+				"And xs[0] is the second sliver at t = 5")
+			{
+				REQUIRE(mesh->view().splitReferences);
+				REQUIRE(xs.size() == 1);
+				REQUIRE(xs[0].t == 5.0f);
+				REQUIRE(xs[0].primitive == 1);
+			}
+		}
+	}
+}
+
+SCENARIO("A triangle mesh interpolates the normals and texture coordinates of the hit triangle", "[trianglemesh]")
+{
+	GIVEN("buffers with the corners, normals and texture coordinates of a smooth triangle"
+		"And mesh = a TriangleMesh of that triangle")
+	{
+		auto buffers = std::make_shared<MeshBuffers>();
+		buffers->positions = { point(0, 0, 0), point(0, 1, 0), point(-1, 0, 0), point(1, 0, 0) };
+		buffers->normals = { vector(0, 0, 0), vector(0, 1, 0), vector(-1, 0, 0), vector(1, 0, 0) };
+		buffers->texcoords = { vector(0, 0, 0), vector(0, 0, 0), vector(1, 0, 0), vector(0, 1, 0) };
+
+		auto mesh = createTriangleMesh(buffers);
+		mesh->addTriangle({ { 1, 2, 3 }, { 1, 2, 3 }, { 1, 2, 3 } });
+
+		WHEN("r = Ray(point(-0.2f, 0.3f, -2.0f), vector(0.0f, 0.0f, 1.0f))"
+			"And xs = intersect(mesh, r)"
+			"And n = normalAt(mesh, point(0.0f, 0.0f, 0.0f), xs[0])"
+			"And comps = prepareComputations(xs[0], r)")
+		{
+			auto r = Ray(point(-0.2f, 0.3f, -2.0f), vector(0.0f, 0.0f, 1.0f));
+			auto xs = mesh->intersect(r);
+			auto n = mesh->normalAt(point(0.0f, 0.0f, 0.0f), xs[0]);
+			auto comps = prepareComputations(xs[0], r);
+			THEN("xs[0].a == 0.45f"
+				"And xs[0].b == 0.25f"
+				"And n == vector(-0.5547f, 0.83205f, 0.0f)"
+				"And comps.u == 0.45f"
+				"And comps.v == 0.25f")
+			{
+				REQUIRE(xs.size() == 1);
+				REQUIRE(xs[0].a == 0.45f);
+				REQUIRE(xs[0].b == 0.25f);
+				REQUIRE(n == vector(-0.5547f, 0.83205f, 0.0f));
+				REQUIRE(comps.u == 0.45f);
+				REQUIRE(comps.v == 0.25f);
+			}
+		}
+	}
+}
+
+SCENARIO("A triangle mesh's BVH is saved to a cache file and mapped back", "[trianglemesh]")
+{
+	GIVEN("mesh1 and mesh2 = meshes of the same 64 triangles in groups g1 and g2"
+		"And path = a cache file for g1 under hash 42")
+	{
+		auto buffers = std::make_shared<MeshBuffers>();
+		buffers->positions.emplace_back(point(0.0f, 0.0f, 0.0f));
+		buffers->normals.emplace_back(vector(0.0f, 0.0f, 0.0f));
+		buffers->texcoords.emplace_back(vector(0.0f, 0.0f, 0.0f));
+
+		auto mesh1 = createTriangleMesh(buffers);
+		auto mesh2 = createTriangleMesh(buffers);
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			auto first = static_cast<uint32_t>(buffers->positions.size());
+			auto x = (i % 8) * 3.0f;
+			auto y = (i / 8) * 3.0f;
+			buffers->positions.emplace_back(point(x, y, 0.0f));
+			buffers->positions.emplace_back(point(x + 1.0f, y, 0.0f));
+			buffers->positions.emplace_back(point(x, y + 1.0f, 0.0f));
+
+			MeshTriangle triangle;
+			triangle.positions[0] = first;
+			triangle.positions[1] = first + 1;
+			triangle.positions[2] = first + 2;
+			mesh1->addTriangle(triangle);
+			mesh2->addTriangle(triangle);
+		}
+
+		auto g1 = createGroup();
+		auto g2 = createGroup();
+		g1->addChild(mesh1);
+		g2->addChild(mesh2);
+
+		g1->updateBVH();
+
+		auto path = (std::filesystem::temp_directory_path() / "trianglemesh.features.bvh").string();
+		auto saved = saveBVHCache(path, 42, { g1 });
+
+		WHEN("loadBVHCache(path, 42, g2)")
+		{
+			auto loaded = loadBVHCache(path, 42, { g2 });
+			auto r = Ray(point(6.2f, 9.2f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+			auto xs1 = g1->intersect(r);
+			auto xs2 = g2->intersect(r);
+			THEN("mesh2 uses the mapped BVH instead of building its own"
+				"And both meshes return the same hit")
+			{
+				REQUIRE(saved);
+				REQUIRE(loaded);
+				REQUIRE(mesh2->isBuilt());
+				REQUIRE(mesh2->getCompressedBVH().nodes.empty());
+				REQUIRE(mesh2->getCompressedBVH().getNodes().size() == mesh1->getCompressedBVH().nodes.size());
+				REQUIRE(xs1.size() == 1);
+				REQUIRE(xs2.size() == 1);
+				REQUIRE(xs1[0].t == xs2[0].t);
+				REQUIRE(xs1[0].primitive == xs2[0].primitive);
+			}
+		}
+	}
+}
+
+SCENARIO("Compressed mesh buffers decode close to the original vertices", "[trianglemesh]")
+{
+	GIVEN("buffers with a few positions, normals and texture coordinates"
+		"And compressed = compressMeshBuffers(buffers)")
+	{
+		MeshBuffers buffers;
+		buffers.positions = { point(0, 0, 0), point(-3.5f, 10.0f, 2.0f), point(12.25f, -4.0f, 2.0f), point(0.1f, 0.2f, 0.3f) };
+		buffers.normals = { vector(0, 0, 0), vector(0, 0, 1), vector(0.707f, 0, -0.707f), vector(1, 2, 3), vector(-1, -1, -1) };
+		buffers.texcoords = { vector(0, 0, 0), vector(0, 0, 0), vector(1, 0.5f, 0), vector(2, 1, 0) };
+
+		auto compressed = compressMeshBuffers(buffers);
+
+		THEN("positions are within a 21 bit step of the bounds"
+			"And normals point the same way"
+			"And texture coordinates are within a 16 bit step"
+			"And index 0 still reads as zero"
+			"And the vertices take 16 bytes instead of 48")
+		{
+			for (uint32_t i = 1; i < 4; i++)
+			{
+				auto position = compressed->position(i);
+				REQUIRE(std::fabsf(position.x - buffers.positions[i].x) <= 15.75f / 2097151.0f);
+				REQUIRE(std::fabsf(position.y - buffers.positions[i].y) <= 14.0f / 2097151.0f);
+				REQUIRE(std::fabsf(position.z - buffers.positions[i].z) <= 1.7f / 2097151.0f);
+				REQUIRE(position.w == 1.0f);
+			}
+
+			for (uint32_t i = 1; i < 5; i++)
+			{
+				REQUIRE(dot(compressed->normal(i), normalize(buffers.normals[i])) > 0.9999f);
+			}
+
+			for (uint32_t i = 1; i < 4; i++)
+			{
+				auto texcoord = compressed->texcoord(i);
+				REQUIRE(std::fabsf(texcoord.x - buffers.texcoords[i].x) <= 2.0f / 65535.0f);
+				REQUIRE(std::fabsf(texcoord.y - buffers.texcoords[i].y) <= 1.0f / 65535.0f);
+			}
+
+			REQUIRE(compressed->position(0) == point(0, 0, 0));
+			REQUIRE(compressed->normal(0) == vector(0, 0, 0));
+			REQUIRE(compressed->texcoord(0) == vector(0, 0, 0));
+			REQUIRE(sizeof(compressed->positions[0]) + sizeof(compressed->normals[0]) + sizeof(compressed->texcoords[0]) == 16);
+		}
+	}
+}
+
+SCENARIO("A mesh over compressed buffers is hit where the original mesh is", "[trianglemesh]")
+{
+	GIVEN("buffers = the corners of a wavy 8x8 grid"
+		"And mesh = a TriangleMesh of the 128 grid triangles over buffers"
+		"And compressedMesh = the same triangles over compressMeshBuffers(buffers)")
+	{
+		auto buffers = std::make_shared<MeshBuffers>();
+		buffers->positions.emplace_back(point(0.0f, 0.0f, 0.0f));
+		buffers->normals.emplace_back(vector(0.0f, 0.0f, 0.0f));
+		buffers->texcoords.emplace_back(vector(0.0f, 0.0f, 0.0f));
+
+		for (int32_t z = 0; z <= 8; z++)
+		{
+			for (int32_t x = 0; x <= 8; x++)
+			{
+				buffers->positions.emplace_back(point(x, ((x * 7 + z * 3) % 5) * 0.25f, z));
+				buffers->normals.emplace_back(normalize(vector(x - 4.0f, 8.0f, z - 4.0f)));
+				buffers->texcoords.emplace_back(vector(x / 8.0f, z / 8.0f, 0.0f));
+			}
+		}
+
+		auto mesh = createTriangleMesh(buffers);
+		auto compressedMesh = createTriangleMesh(compressMeshBuffers(*buffers));
+
+		auto corner = [](int32_t x, int32_t z) { return static_cast<uint32_t>(1 + z * 9 + x); };
+
+		for (int32_t i = 0; i < 64; i++)
+		{
+			auto x = i % 8;
+			auto z = i / 8;
+			uint32_t corners[2][3] = { { corner(x, z), corner(x + 1, z), corner(x + 1, z + 1) },
+									   { corner(x, z), corner(x + 1, z + 1), corner(x, z + 1) } };
+
+			for (const auto& triangleCorners : corners)
+			{
+				MeshTriangle triangle;
+
+				for (int32_t j = 0; j < 3; j++)
+				{
+					triangle.positions[j] = triangleCorners[j];
+					triangle.normals[j] = triangleCorners[j];
+					triangle.texcoords[j] = triangleCorners[j];
+				}
+
+				mesh->addTriangle(triangle);
+				compressedMesh->addTriangle(triangle);
+			}
+		}
+
+		WHEN("xs = intersect(mesh, r) and compressedXs = intersect(compressedMesh, r) for every r")
+		{
+			THEN("compressedXs hits the same triangles at nearly the same t"
+				"And with nearly the same normals and texture coordinates"
+				"And compressedMesh keeps no triangle blocks")
+			{
+				for (int32_t i = 0; i < 16; i++)
+				{
+					auto r = Ray(point(0.3f + i * 0.45f, 5.0f, -1.0f), normalize(vector(0.1f, -1.0f, 0.3f + i * 0.05f)));
+					auto xs = mesh->intersect(r);
+					auto compressedXs = compressedMesh->intersect(r);
+
+					REQUIRE(xs.size() == compressedXs.size());
+
+					for (size_t j = 0; j < xs.size(); j++)
+					{
+						REQUIRE(compressedXs[j].primitive == xs[j].primitive);
+						REQUIRE(std::fabsf(compressedXs[j].t - xs[j].t) < 0.0001f);
+						REQUIRE(std::fabsf(compressedXs[j].a - xs[j].a) < 0.001f);
+						REQUIRE(std::fabsf(compressedXs[j].b - xs[j].b) < 0.001f);
+
+						auto position = r.at(xs[j].t);
+						REQUIRE(dot(compressedMesh->normalAt(position, compressedXs[j]), mesh->normalAt(position, xs[j])) > 0.9999f);
+
+						auto uv = mesh->uvAt(position, xs[j]);
+						auto compressedUV = compressedMesh->uvAt(position, compressedXs[j]);
+						REQUIRE(std::fabsf(compressedUV.x - uv.x) < 0.001f);
+						REQUIRE(std::fabsf(compressedUV.y - uv.y) < 0.001f);
+					}
+				}
+
+				REQUIRE(mesh->triangleBlockCount() > 0);
+				REQUIRE(compressedMesh->triangleBlockCount() == 0);
+			}
+		}
+	}
+}
\ No newline at end of file
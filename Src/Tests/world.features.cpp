@@ -152,7 +152,7 @@ SCENARIO("Shading an intersection", "[world]")
 		auto w = defaultWorld();
 		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
 		auto shape = w.getObject(0);
-		auto i = Intersection{ 4.0f, shape };
+		auto i = Intersection{ 4.0f, shape.get() };
 		WHEN("comps = prepareComputations(i, r)"
 			"And c = shadeHit(w, comps)")
 		{
@@ -178,7 +178,7 @@ SCENARIO("Shading an intersection from the inside", "[world]")
 		w.getLight(0) = pointLight(point(0.0f, 0.25f, 0.0f), color(1.0f, 1.0f, 1.0f));
 		auto r = Ray(point(0.0f, 0.0f, 0.0f), vector(0.0f, 0.0f, 1.0f));
 		auto shape = w.getObject(1);
-		auto i = Intersection{ 0.5f, shape };
+		auto i = Intersection{ 0.5f, shape.get() };
 		WHEN("comps = prepareComputations(i, r)"
 			"And c = shadeHit(w, comps)")
 		{
@@ -208,6 +208,26 @@ SCENARIO("There is no shadow when nothing is collinear with point and light", "[
 	}
 }
 
+SCENARIO("colorAt() gives back the arena memory of its shadow tests", "[world]")
+{
+	GIVEN("w = defaultWorld()"
+		"And r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f))"
+		"And marker = the position of the thread's arena")
+	{
+		auto w = defaultWorld();
+		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		auto marker = Arena::local().mark();
+		WHEN("c = colorAt(w, r) without render()")
+		{
+			auto c = colorAt(w, r);
+			THEN("the thread's arena is back at marker")
+			{
+				REQUIRE(Arena::local().mark() == marker);
+			}
+		}
+	}
+}
+
 SCENARIO("The shadow when an object is between the point and the light", "[world]")
 {
 	GIVEN("w = defaultWorld()"
@@ -271,7 +291,7 @@ SCENARIO("shadeHit() is given an intersection in shad", "[world]")
 		s2->setTransform(translate(0.0f, 0.0f, 10.0f));
 		w.addObject(s2);
 		auto r = Ray(point(0.0f, 0.0f, 5.0f), vector(0.0f, 0.0f, 1.0f));
-		auto i = Intersection{ 4.0f, s2 };
+		auto i = Intersection{ 4.0f, s2.get() };
 		WHEN("comps = prepareComputations(i, r)"
 			"And c = shadeHit(w, comps)")
 		{
@@ -299,7 +319,7 @@ SCENARIO("The reflected color for a nonreflective material", "[world]")
 		auto r = Ray(point(0, 0, 0), vector(0, 0, 1));
 		auto shape = w.getObject(1);
 		shape->material.ambient = 1.0f;
-		auto i = Intersection{ 1.0f, shape };
+		auto i = Intersection{ 1.0f, shape.get() };
 		WHEN("comps = prepareComputations(i, r)"
 			 "And color = reflectedColor(w, comps)")
 		{
@@ -325,7 +345,7 @@ SCENARIO("The reflected color for a reflective material", "[world]")
 	{
 		auto w = defaultWorld();
 		auto r = Ray(point(0.0f, 0.0f, -3.0f), vector(0.0f, -SQRT2 / 2.0f, SQRT2 / 2.0f));
-		auto i = Intersection{ SQRT2, w.getObject(2) };
+		auto i = Intersection{ SQRT2, w.getObject(2).get() };
 		WHEN("comps = prepareComputations(i, r)"
 			"And color = reflectedColor(w, comps)")
 		{
@@ -351,7 +371,7 @@ SCENARIO("shadeHit() with a reflective material", "[world]")
 	{
 		auto w = defaultWorld();
 		auto r = Ray(point(0.0f, 0.0f, -3.0f), vector(0.0f, -SQRT2 / 2.0f, SQRT2 / 2.0f));
-		auto i = Intersection{ SQRT2, w.getObject(2) };
+		auto i = Intersection{ SQRT2, w.getObject(2).get() };
 		WHEN("comps = prepareComputations(i, r)"
 			"And color = shadeHit(w, comps)")
 		{
@@ -409,7 +429,7 @@ SCENARIO("The reflected color at the maximum recursive depth", "[world]")
 	{
 		auto w = defaultWorld();
 		auto r = Ray(point(0.0f, 0.0f, -3.0f), vector(0.0f, -SQRT2 / 2.0f, SQRT2 / 2.0f));
-		auto i = Intersection{ SQRT2, w.getObject(2) };
+		auto i = Intersection{ SQRT2, w.getObject(2).get() };
 		WHEN("comps = prepareComputations(i, r)"
 			"And color = reflectedColor(w, comps)")
 		{
@@ -445,7 +465,7 @@ SCENARIO("The refracted color with a refracted ray", "[world]")
 		B->material.transparency = 1.0f;
 		B->material.refractiveIndex = 1.5f;
 		auto r = Ray(point(0.0f, 0.0f, 0.1f), vector(0.0f, 1.0f, 0.0f));
-		auto xs = intersections({ { -0.9899f, A }, { -0.4899f, B }, { 0.4899f, B }, { 0.9899f, A } });
+		auto xs = intersections({ { -0.9899f, A.get() }, { -0.4899f, B.get() }, { 0.4899f, B.get() }, { 0.9899f, A.get() } });
 		WHEN("comps = prepareComputations(xs[2], r, xs)"
 			"And c = refractedColor(w, comps, 5)")
 		{
@@ -487,7 +507,7 @@ SCENARIO("shadeHit() with a transparent material", "[world]")
 		ball->setTransform(translate(0.0f, -3.5f, -0.5f));
 		w.addObject(ball);
 		auto r = Ray(point(0.0f, 0.0f, -3.0f), vector(0.0f, -SQRT2 / 2.0f, SQRT2 / 2.0f));
-		auto xs = sortIntersections({ { SQRT2, floor } });
+		auto xs = sortIntersections({ { SQRT2, floor.get() } });
 		WHEN("comps = prepareComputations(xs[0], r, xs)"
 			"And c = shadeHit(w, comps, 5)")
 		{
@@ -531,7 +551,7 @@ SCENARIO("shadeHit() with a reflective, transparent material", "[world]")
 		ball->material.ambient = 0.5f;
 		ball->setTransform(translate(0.0f, -3.5f, -0.5f));
 		w.addObject(ball);
-		auto xs = sortIntersections({ { SQRT2, floor } });
+		auto xs = sortIntersections({ { SQRT2, floor.get() } });
 		WHEN("comps = prepareComputations(xs[0], r, xs)"
 			"And color = shadeHit(w, comps, 5)")
 		{
@@ -543,4 +563,35 @@ SCENARIO("shadeHit() with a reflective, transparent material", "[world]")
 			}
 		}
 	}
+}
+
+SCENARIO("The refracted color when the world has refraction turned off", "[world]")
+{
+	GIVEN("w = defaultWorld()"
+		"And shape = the first object in w"
+		"And shape has:"
+		"| material.transparency | 1.0f |"
+		"| material.refractiveIndex | 1.5f |"
+		"And refraction is turned off in w"
+		"And r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f))"
+		"And xs = intersections(4:shape, 6:shape)")
+	{
+		auto w = defaultWorld();
+		auto shape = w.getObject(0);
+		shape->material.transparency = 1.0f;
+		shape->material.refractiveIndex = 1.5f;
+		w.setRefractionEnabled(false);
+		auto r = Ray(point(0.0f, 0.0f, -5.0f), vector(0.0f, 0.0f, 1.0f));
+		auto xs = sortIntersections({ { 4.0f, shape.get() }, { 6.0f, shape.get() } });
+		WHEN("comps = prepareComputations(xs[0], r, xs)"
+			"And c = refractedColor(w, comps, 5)")
+		{
+			auto comps = prepareComputations(xs[0], r, xs);
+			auto c = refractedColor(w, comps, 5);
+			THEN("c == color(0.0f, 0.0f, 0.0f)")
+			{
+				REQUIRE(c == color(0.0f, 0.0f, 0.0f));
+			}
+		}
+	}
 }
\ No newline at end of file
@@ -222,11 +222,11 @@ namespace YAML
 			rhs.rotation = node["transform"]["rotation"].as<tuple>();
 			rhs.scale = node["transform"]["scale"].as<tuple>();
 
-			rhs.transform = translate(rhs.translation) * 
+			rhs.setTransform(translate(rhs.translation) * 
 							 rotateZ(rhs.rotation.z) * 
 							 rotateY(rhs.rotation.y) * 
 				             rotateX(rhs.rotation.x) * 
-						     scale(rhs.scale);
+						     scale(rhs.scale));
 
 			return true;
 		}
@@ -256,11 +256,11 @@ namespace YAML
 			rhs.rotation = node["transform"]["rotation"].as<tuple>();
 			rhs.scale = node["transform"]["scale"].as<tuple>();
 
-			rhs.transform = translate(rhs.translation) * 
+			rhs.setTransform(translate(rhs.translation) * 
 							 rotateZ(rhs.rotation.z) * 
 				             rotateY(rhs.rotation.y) * 
 							 rotateX(rhs.rotation.x) * 
-							 scale(rhs.scale);
+							 scale(rhs.scale));
 
 			return true;
 		}
@@ -286,11 +286,11 @@ namespace YAML
 			rhs.rotation = node["transform"]["rotation"].as<tuple>();
 			rhs.scale = node["transform"]["scale"].as<tuple>();
 
-			rhs.transform = translate(rhs.translation) * 
+			rhs.setTransform(translate(rhs.translation) * 
 							 rotateZ(rhs.rotation.z) * 
 							 rotateY(rhs.rotation.y) * 
 							 rotateX(rhs.rotation.x) * 
-							 scale(rhs.scale);
+							 scale(rhs.scale));
 
 			return true;
 		}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump allocator for the temporaries of one sample. An allocation moves a pointer
+// forward in the current block, nothing is freed on its own and reset() makes every
+// block reusable at once. Each thread has its own (Arena::local()), the renderer resets
+// it before every sample and ArenaScope gives back what a call used, so the per ray work
+// never goes to the global allocator and its lock once the blocks are there.
+class Arena
+{
+public:
+	static constexpr size_t BlockSize = 64 * 1024;
+
+	Arena() = default;
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t size, size_t alignment)
+	{
+		if (current < blocks.size())
+		{
+			if (auto* memory = allocateFrom(blocks[current], size, alignment))
+			{
+				return memory;
+			}
+		}
+
+		// The blocks after the current one are free, take the next one that is large enough
+		for (current++; current < blocks.size(); current++)
+		{
+			blocks[current].used = 0;
+
+			if (auto* memory = allocateFrom(blocks[current], size, alignment))
+			{
+				return memory;
+			}
+		}
+
+		blocks.emplace_back(std::max(BlockSize, size + alignment));
+		current = blocks.size() - 1;
+
+		return allocateFrom(blocks[current], size, alignment);
+	}
+
+	// Everything allocated so far must be done with, the blocks are kept
+	void reset()
+	{
+		current = 0;
+
+		if (!blocks.empty())
+		{
+			blocks[0].used = 0;
+		}
+	}
+
+	// Where the next allocation goes, release() gives back everything allocated after it
+	struct Marker
+	{
+		size_t block = 0;
+		size_t used = 0;
+
+		bool operator==(const Marker& other) const = default;
+	};
+
+	Marker mark() const
+	{
+		return { current, current < blocks.size() ? blocks[current].used : 0 };
+	}
+
+	// Everything allocated since "marker" must be done with, like reset() for a part
+	void release(const Marker& marker)
+	{
+		current = marker.block;
+
+		if (current < blocks.size())
+		{
+			blocks[current].used = marker.used;
+		}
+	}
+
+	size_t blockCount() const { return blocks.size(); }
+
+	static Arena& local()
+	{
+		thread_local Arena arena;
+		return arena;
+	}
+
+private:
+	struct Block
+	{
+		Block(size_t inSize)
+		: memory(std::make_unique<std::byte[]>(inSize)), size(inSize)
+		{}
+
+		std::unique_ptr<std::byte[]> memory;
+		size_t size = 0;
+		size_t used = 0;
+	};
+
+	static void* allocateFrom(Block& block, size_t size, size_t alignment)
+	{
+		auto base = reinterpret_cast<uintptr_t>(block.memory.get());
+		auto aligned = (base + block.used + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+
+		if (aligned + size > base + block.size)
+		{
+			return nullptr;
+		}
+
+		block.used = aligned + size - base;
+
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	std::vector<Block> blocks;
+	size_t current = 0;
+};
+
+// Standard allocator on top of an arena, the thread's own by default. deallocate()
+// does nothing, the memory comes back with the next Arena::reset().
+template<typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	ArenaAllocator()
+	: arena(&Arena::local())
+	{}
+
+	ArenaAllocator(Arena& inArena)
+	: arena(&inArena)
+	{}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other)
+	: arena(other.arena)
+	{}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T*, size_t) {}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+
+	Arena* arena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Gives back what was allocated from an arena while it is alive. Calls that keep their
+// temporaries in the thread's arena (shadeHit()) open one, so the arena doesn't grow
+// whoever calls them, render() or not.
+class ArenaScope
+{
+public:
+	ArenaScope(Arena& inArena = Arena::local())
+	: arena(inArena), marker(inArena.mark())
+	{}
+
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope& operator=(const ArenaScope&) = delete;
+
+	~ArenaScope()
+	{
+		arena.release(marker);
+	}
+
+private:
+	Arena& arena;
+	Arena::Marker marker;
+};
\ No newline at end of file
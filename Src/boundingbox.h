@@ -1,6 +1,29 @@
 #pragma once
 
 #include "tuple.h"
+#include "ray.h"
+
+// Slab test shared by the bounding boxes (BVH nodes, group culling) and Cube. Narrows
+// [tMin, tMax] to the part of the ray inside the box and tells if anything is left.
+// ray.sign picks the near and far plane of each axis, so there is no swap and no branch,
+// and the comparisons keep the running interval when a slab gives NaN (origin on a
+// plane the ray is parallel to). A zero width interval still counts as a hit, flat
+// boxes (a single triangle) have one.
+inline bool intersectSlabs(const tuple& boxMin, const tuple& boxMax, const Ray& ray, float& tMin, float& tMax)
+{
+	const tuple* planes[2] = { &boxMin, &boxMax };
+
+	for (int32_t axis = 0; axis < 3; axis++)
+	{
+		auto t0 = ((*planes[ray.sign[axis]])[axis] - ray.origin[axis]) * ray.invDirection[axis];
+		auto t1 = ((*planes[1 - ray.sign[axis]])[axis] - ray.origin[axis]) * ray.invDirection[axis];
+
+		tMin = t0 > tMin ? t0 : tMin;
+		tMax = t1 < tMax ? t1 : tMax;
+	}
+
+	return tMin <= tMax;
+}
 
 class BoundingBox
 {
@@ -22,27 +45,52 @@ public:
 		if (point.z > max.z) max.z = point.z;
 	}
 
+	bool isValid() const
+	{
+		return min.x <= max.x && min.y <= max.y && min.z <= max.z &&
+			   std::isfinite(min.x) && std::isfinite(min.y) && std::isfinite(min.z) &&
+			   std::isfinite(max.x) && std::isfinite(max.y) && std::isfinite(max.z);
+	}
+
+	// Nothing inside (min > max on some axis), like a default box. Shapes that report
+	// such a box are bounded but can't be hit, BVHs leave them out.
+	bool isEmpty() const
+	{
+		return min.x > max.x || min.y > max.y || min.z > max.z;
+	}
+
+	tuple extent() const
+	{
+		return vector(max.x - min.x, max.y - min.y, max.z - min.z);
+	}
+
+	tuple centroid() const
+	{
+		return point((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f);
+	}
+
+	float surfaceArea() const
+	{
+		auto e = extent();
+		return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
 	inline bool hit(const Ray& ray, float inTMin = EPSILON, float inTMax = INFINITY) const
 	{
-		for (int a = 0; a < 3; a++)
+		float entry;
+		return hit(ray, inTMin, inTMax, entry);
+	}
+
+	// Same test, also gives the t where the ray enters the box (at least inTMin)
+	inline bool hit(const Ray& ray, float inTMin, float inTMax, float& outEntry) const
+	{
+		if (!intersectSlabs(min, max, ray, inTMin, inTMax))
 		{
-			auto invD = 1.0f / ray.direction[a];
-			auto t0 = (min[a] - ray.origin[a]) * invD;
-			auto t1 = (max[a] - ray.origin[a]) * invD;
-
-			if (invD < 0.0f)
-			{
-				std::swap(t0, t1);
-			}
-
-			auto tMin = t0 > inTMin ? t0 : inTMin;
-			auto tMax = t1 < inTMax ? t1 : inTMax;
-
-			if (tMax <= tMin)
-			{
-				return false;
-			}
+			return false;
 		}
+
+		outEntry = inTMin;
+
 		return true;
 	}
 
@@ -65,4 +113,31 @@ inline static BoundingBox surroundingBox(const BoundingBox& box0, const Bounding
 	tuple max = point(maxX, maxY, maxZ);
 
 	return BoundingBox(min, max);
+}
+
+// Common part of two boxes, invalid (min > max) when they don't overlap
+inline static BoundingBox overlappingBox(const BoundingBox& box0, const BoundingBox& box1)
+{
+	tuple min = point(std::max(box0.min.x, box1.min.x), std::max(box0.min.y, box1.min.y), std::max(box0.min.z, box1.min.z));
+	tuple max = point(std::min(box0.max.x, box1.max.x), std::min(box0.max.y, box1.max.y), std::min(box0.max.z, box1.max.z));
+
+	return BoundingBox(min, max);
+}
+
+// Bounding box of the 8 transformed corners of "box", used to bring an
+// object space box into the space of its parent
+inline static BoundingBox transformBoundingBox(const BoundingBox& box, const matrix4& transform)
+{
+	BoundingBox result;
+
+	for (int32_t corner = 0; corner < 8; corner++)
+	{
+		auto x = (corner & 1) ? box.max.x : box.min.x;
+		auto y = (corner & 2) ? box.max.y : box.min.y;
+		auto z = (corner & 4) ? box.max.z : box.min.z;
+
+		result.addPoint(transform * point(x, y, z));
+	}
+
+	return result;
 }
\ No newline at end of file
@@ -1,123 +1,1216 @@
 #pragma once
 
+#include "boundingbox.h"
 #include "shape.h"
-#include "aabb.h"
-
-//inline bool boxCompare(const std::shared_ptr<Shape>& a, const std::shared_ptr<Shape>& b, int32_t axis)
-//{
-//	AABB boxA;
-//	AABB boxB;
-//
-//	if (!a->boundingBox(0, 0, boxA) || !b->boundingBox(0, 0, boxB))
-//	{
-//		std::cerr << "No bounding box in BVHNode constructor.\n";
-//	}
-//
-//	return boxA.min()[axis] < boxB.min()[axis];
-//}
-//
-//inline bool boxXCompare(const std::shared_ptr<Shape>& a, const std::shared_ptr<Shape>& b)
-//{
-//	return boxCompare(a, b, 0);
-//}
-//
-//inline bool boxYCompare(const std::shared_ptr<Shape>& a, const std::shared_ptr<Shape>& b)
-//{
-//	return boxCompare(a, b, 1);
-//}
-//
-//inline bool boxZCompare(const std::shared_ptr<Shape>& a, const std::shared_ptr<Shape>& b)
-//{
-//	return boxCompare(a, b, 2);
-//}
-//
-//class BVHNode : public Shape
-//{
-//public:
-//	BVHNode() = default;
-//	BVHNode(const std::vector<std::shared_ptr<Shape>>& objects, float time0, float time1)
-//		: BVHNode(objects, 0, objects.size(), time0, time1)
-//	{
-//
-//	}
-//
-//	BVHNode(const std::vector<std::shared_ptr<Shape>>& objects, size_t start, size_t end, float time0, float time1)
-//	{
-//		auto localObjects = objects;
-//
-//		int32_t axis = randomInt(0, 2);
-//
-//		auto comparator = (axis == 0) ? boxXCompare
-//											   : (axis == 1) ? boxYCompare
-//															 : boxZCompare;
-//
-//		size_t objectSpan = end - start;
-//
-//		if (objectSpan == 1)
-//		{
-//			left = right = localObjects[start];
-//		}
-//		else if (objectSpan == 2)
-//		{
-//			if (comparator(localObjects[start], localObjects[start + 1]))
-//			{
-//				left = localObjects[start];
-//				right = localObjects[start + 1];
-//			}
-//			else
-//			{
-//				left = localObjects[start + 1];
-//				right = localObjects[start];
-//			}
-//		}
-//		else
-//		{
-//			std::sort(localObjects.begin() + start, localObjects.begin() + end, comparator);
-//
-//			auto mid = start + objectSpan / 2;
-//			left = std::make_shared<BVHNode>(localObjects, start, mid, time0, time1);
-//			right = std::make_shared<BVHNode>(localObjects, mid, end, time0, time1);
-//		}
-//
-//		AABB boxLeft;
-//		AABB boxRight;
-//
-//		if (!left->boundingBox(time0, time1, boxLeft) ||
-//			!right->boundingBox(time0, time1, boxRight))
-//		{
-//			std::cerr << "No bounding box in BVHNode constructor.\n";
-//		}
-//
-//		box = surroundingBox(boxLeft, boxRight);
-//	}
-//
-//	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override
-//	{
-//		if (!box.hit(transformedRay, EPSILON, INFINITY))
-//		{
-//			return { { 0.0f,  shared_from_this() } };
-//		}
-//
-//		auto hitLeft = left->localIntersect(transformedRay);
-//		auto hitRight = right->localIntersect(transformedRay);
-//
-//		auto result = hitLeft.empty() ? hitRight : hitLeft;
-//
-//		return result;
-//	}
-//
-//	virtual tuple localNormalAt(const tuple& localPosition) const override
-//	{
-//		return {};
-//	}
-//
-//	virtual bool boundingBox(float time0, float time1, AABB& outputBox) override
-//	{
-//		outputBox = box;
-//		return true;
-//	}
-//
-//	std::shared_ptr<Shape> left;
-//	std::shared_ptr<Shape> right;
-//	AABB box;
-//};
\ No newline at end of file
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include <atomic>
+#include <bit>
+#include <thread>
+#include <execution>
+#include <functional>
+
+enum class BVHBuildQuality : uint8_t
+{
+	// Binned SAH, slower to build but cheapest to trace, the default for static scenes
+	SAH,
+	// Morton code (LBVH) build, a parallel sort plus a parallel emission of the hierarchy.
+	// Meant for scenes that are rebuilt all the time, like the hot reload loop
+	Linear,
+	// SAH plus spatial splits (SBVH). Primitives straddling a split plane are clipped and
+	// referenced from both sides, which tightens the boxes around long thin triangles
+	Spatial
+};
+
+// Bounds of the part of a primitive inside "clip", used by spatial splits.
+// Without one, the primitive's box is simply cut by the clip box
+using PrimitiveClipper = std::function<BoundingBox(uint32_t primitive, const BoundingBox& clip)>;
+
+struct BVHNode
+{
+	BoundingBox bounds;
+
+	// Interior node: index of the left child, the right child is stored right after it.
+	// Leaf node: index of the first primitive in BVH::primitiveIndices.
+	uint32_t leftFirst = 0;
+	uint32_t primitiveCount = 0;
+
+	bool isLeaf() const { return primitiveCount > 0; }
+};
+
+// Bounding volume hierarchy over an array of primitive bounds, built either with the
+// binned surface area heuristic (SAH) or from Morton codes (LBVH). The BVH only stores
+// indices, the owner (World, Group) maps them back to its own primitives in the
+// traversal visitor.
+class BVH
+{
+public:
+	static constexpr int32_t BinCount = 16;
+	static constexpr uint32_t MaxLeafSize = 4;
+	static constexpr int32_t MaxDepth = 48;
+
+	// LBVH depth is bounded by the Morton code bits plus the index bits used to break ties
+	static constexpr int32_t TraversalStackSize = 128;
+
+	// Cost of visiting a node relative to intersecting one primitive
+	static constexpr float TraversalCost = 0.125f;
+
+	// Above this many primitives 10 bits per axis can't tell neighbours apart, switch to 21
+	static constexpr size_t Morton63Threshold = 1 << 16;
+
+	// Spatial splits are only tried when the children of the best object split overlap by
+	// more than this fraction of the root area (Stich et al. 2009)
+	static constexpr float SpatialSplitAlpha = 1e-5f;
+
+	// Extra primitive references spatial splits may add, as a fraction of the primitive count
+	static constexpr float SpatialSplitBudget = 0.3f;
+
+	void build(const std::vector<BoundingBox>& primitiveBounds, BVHBuildQuality quality = BVHBuildQuality::SAH,
+			   const PrimitiveClipper& clipper = {})
+	{
+		nodes.clear();
+		primitiveIndices.clear();
+		splitReferences = false;
+
+		if (primitiveBounds.empty())
+		{
+			return;
+		}
+
+		if (quality == BVHBuildQuality::Linear)
+		{
+			buildLinear(primitiveBounds);
+			return;
+		}
+
+		if (quality == BVHBuildQuality::Spatial)
+		{
+			buildSpatial(primitiveBounds, clipper);
+			return;
+		}
+
+		auto primitiveCount = static_cast<uint32_t>(primitiveBounds.size());
+
+		std::vector<tuple> centroids(primitiveCount);
+
+		for (uint32_t i = 0; i < primitiveCount; i++)
+		{
+			centroids[i] = primitiveBounds[i].centroid();
+		}
+
+		primitiveIndices.resize(primitiveCount);
+		std::iota(primitiveIndices.begin(), primitiveIndices.end(), 0);
+
+		// A binary tree with N leaves never has more than 2N - 1 nodes,
+		// reserving up front keeps node references valid during the build
+		nodes.reserve(primitiveCount * 2 - 1);
+
+		BVHNode root;
+		root.leftFirst = 0;
+		root.primitiveCount = primitiveCount;
+		nodes.emplace_back(root);
+
+		updateNodeBounds(0, primitiveBounds);
+		subdivide(0, 0, primitiveBounds, centroids);
+	}
+
+	// Calls visitor(primitiveIndex) for every primitive in a leaf whose bounds
+	// are hit by the ray within [tMin, tMax], nearest leaves first. tMax is read
+	// again before every step, a visitor that shrinks it skips what lies behind.
+	template<typename Visitor>
+	void traverse(const Ray& ray, float tMin, const float& tMax, Visitor&& visitor) const
+	{
+		traverseOrdered(nodes.size(), tMax, 
+						[&](uint32_t index) -> const BVHNode& { return nodes[index]; },
+						[&](const BVHNode& node, float& distance) { return node.bounds.hit(ray, tMin, tMax, distance); },
+						[&](uint32_t index) { visitor(primitiveIndices[index]); });
+	}
+
+	// Front to back traversal shared with MotionBVH, whose nodes only differ in how their
+	// bounds are tested. hitNode(node, distance) tests a node against the caller's ray and
+	// interval. Children are tested before they are pushed, the nearer one goes on top,
+	// and entries that start beyond the current tMax are dropped when popped.
+	template<typename NodeAt, typename HitNode, typename Visitor>
+	static void traverseOrdered(size_t nodeCount, const float& tMax, 
+								NodeAt&& nodeAt, HitNode&& hitNode, Visitor&& visitor)
+	{
+		float distance = 0.0f;
+
+		if (nodeCount == 0 || !hitNode(nodeAt(0), distance))
+		{
+			return;
+		}
+
+		struct StackEntry
+		{
+			uint32_t node;
+			float distance;
+		};
+
+		StackEntry stack[TraversalStackSize];
+		int32_t stackSize = 0;
+
+		stack[stackSize++] = { 0, distance };
+
+		while (stackSize > 0)
+		{
+			auto entry = stack[--stackSize];
+
+			if (entry.distance > tMax)
+			{
+				continue;
+			}
+
+			const auto& node = nodeAt(entry.node);
+
+			if (node.isLeaf())
+			{
+				for (uint32_t i = 0; i < node.primitiveCount; i++)
+				{
+					visitor(node.leftFirst + i);
+				}
+				continue;
+			}
+
+			float leftDistance = 0.0f;
+			float rightDistance = 0.0f;
+
+			auto leftHit = hitNode(nodeAt(node.leftFirst), leftDistance);
+			auto rightHit = hitNode(nodeAt(node.leftFirst + 1), rightDistance);
+
+			if (leftHit && rightHit)
+			{
+				auto nearFirst = leftDistance <= rightDistance;
+
+				stack[stackSize++] = nearFirst ? StackEntry{ node.leftFirst + 1, rightDistance } : StackEntry{ node.leftFirst, leftDistance };
+				stack[stackSize++] = nearFirst ? StackEntry{ node.leftFirst, leftDistance } : StackEntry{ node.leftFirst + 1, rightDistance };
+			}
+			else if (leftHit)
+			{
+				stack[stackSize++] = { node.leftFirst, leftDistance };
+			}
+			else if (rightHit)
+			{
+				stack[stackSize++] = { node.leftFirst + 1, rightDistance };
+			}
+		}
+	}
+
+	bool empty() const { return nodes.empty(); }
+
+	BoundingBox bounds() const { return nodes.empty() ? BoundingBox() : nodes[0].bounds; }
+
+	// True when a spatial split put some primitive in more than one leaf,
+	// a traversal may then report that primitive more than once
+	bool hasSplitReferences() const { return splitReferences; }
+
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> primitiveIndices;
+
+private:
+	struct Bin
+	{
+		BoundingBox bounds;
+		uint32_t count = 0;
+	};
+
+	// A primitive, or the part of it on one side of a spatial split
+	struct Reference
+	{
+		BoundingBox bounds;
+		uint32_t primitive = 0;
+	};
+
+	struct SpatialBin
+	{
+		BoundingBox bounds;
+		uint32_t entries = 0;
+		uint32_t exits = 0;
+	};
+
+	struct SpatialBuild
+	{
+		PrimitiveClipper clipper;
+		float rootArea = 0.0f;
+		size_t referenceCount = 0;
+		size_t referenceBudget = 0;
+	};
+
+	bool splitReferences = false;
+
+	void buildSpatial(const std::vector<BoundingBox>& primitiveBounds, const PrimitiveClipper& clipper)
+	{
+		std::vector<Reference> references(primitiveBounds.size());
+
+		BoundingBox rootBounds;
+
+		for (uint32_t i = 0; i < static_cast<uint32_t>(primitiveBounds.size()); i++)
+		{
+			references[i].bounds = primitiveBounds[i];
+			references[i].primitive = i;
+			rootBounds = surroundingBox(rootBounds, primitiveBounds[i]);
+		}
+
+		SpatialBuild build;
+
+		if (clipper)
+		{
+			// The clipper only sees the primitive, keep the result inside the clip box
+			build.clipper = [&clipper](uint32_t primitive, const BoundingBox& clip)
+			{
+				return overlappingBox(clipper(primitive, clip), clip);
+			};
+		}
+		else
+		{
+			build.clipper = [&primitiveBounds](uint32_t primitive, const BoundingBox& clip)
+			{
+				return overlappingBox(primitiveBounds[primitive], clip);
+			};
+		}
+
+		build.rootArea = rootBounds.surfaceArea();
+		build.referenceCount = references.size();
+		build.referenceBudget = references.size() + static_cast<size_t>(references.size() * SpatialSplitBudget);
+
+		nodes.emplace_back();
+
+		subdivideSpatial(0, references, 0, build);
+	}
+
+	void makeSpatialLeaf(uint32_t nodeIndex, const std::vector<Reference>& references)
+	{
+		auto& node = nodes[nodeIndex];
+
+		node.leftFirst = static_cast<uint32_t>(primitiveIndices.size());
+		node.primitiveCount = static_cast<uint32_t>(references.size());
+
+		for (const auto& reference : references)
+		{
+			primitiveIndices.emplace_back(reference.primitive);
+		}
+	}
+
+	// Same binned SAH as subdivide() over references, plus a binned spatial split
+	// search whenever the best object split leaves overlapping children
+	void subdivideSpatial(uint32_t nodeIndex, std::vector<Reference>& references, int32_t depth, SpatialBuild& build)
+	{
+		BoundingBox nodeBounds;
+		BoundingBox centroidBounds;
+
+		for (const auto& reference : references)
+		{
+			nodeBounds = surroundingBox(nodeBounds, reference.bounds);
+			centroidBounds.addPoint(reference.bounds.centroid());
+		}
+
+		nodes[nodeIndex].bounds = nodeBounds;
+
+		auto count = static_cast<uint32_t>(references.size());
+
+		if (count <= 1)
+		{
+			makeSpatialLeaf(nodeIndex, references);
+			return;
+		}
+
+		if (depth >= MaxDepth)
+		{
+			splitSpatialAtMedian(nodeIndex, references, depth, build);
+			return;
+		}
+
+		// Object split
+		int32_t objectAxis = -1;
+		int32_t objectSplit = 0;
+		float objectCost = std::numeric_limits<float>::max();
+		BoundingBox objectOverlap;
+
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			auto axisMin = centroidBounds.min[axis];
+			auto axisExtent = centroidBounds.max[axis] - axisMin;
+
+			if (axisExtent <= 0.0f)
+			{
+				continue;
+			}
+
+			Bin bins[BinCount];
+			auto binScale = BinCount / axisExtent;
+
+			for (const auto& reference : references)
+			{
+				auto binIndex = std::min(BinCount - 1, static_cast<int32_t>((reference.bounds.centroid()[axis] - axisMin) * binScale));
+
+				bins[binIndex].count++;
+				bins[binIndex].bounds = surroundingBox(bins[binIndex].bounds, reference.bounds);
+			}
+
+			BoundingBox leftBoxes[BinCount - 1];
+			BoundingBox rightBoxes[BinCount - 1];
+			uint32_t leftCount[BinCount - 1];
+			uint32_t rightCount[BinCount - 1];
+
+			BoundingBox leftBox;
+			BoundingBox rightBox;
+			uint32_t leftSum = 0;
+			uint32_t rightSum = 0;
+
+			for (int32_t i = 0; i < BinCount - 1; i++)
+			{
+				leftSum += bins[i].count;
+				leftCount[i] = leftSum;
+				leftBox = surroundingBox(leftBox, bins[i].bounds);
+				leftBoxes[i] = leftBox;
+
+				rightSum += bins[BinCount - 1 - i].count;
+				rightCount[BinCount - 2 - i] = rightSum;
+				rightBox = surroundingBox(rightBox, bins[BinCount - 1 - i].bounds);
+				rightBoxes[BinCount - 2 - i] = rightBox;
+			}
+
+			for (int32_t i = 0; i < BinCount - 1; i++)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+				{
+					continue;
+				}
+
+				auto cost = leftCount[i] * leftBoxes[i].surfaceArea() + rightCount[i] * rightBoxes[i].surfaceArea();
+
+				if (cost < objectCost)
+				{
+					objectCost = cost;
+					objectAxis = axis;
+					objectSplit = i + 1;
+					objectOverlap = overlappingBox(leftBoxes[i], rightBoxes[i]);
+				}
+			}
+		}
+
+		// Spatial split
+		int32_t spatialAxis = -1;
+		float spatialPlane = 0.0f;
+		float spatialCost = std::numeric_limits<float>::max();
+
+		auto overlapArea = objectOverlap.isValid() ? objectOverlap.surfaceArea() : 0.0f;
+
+		if ((objectAxis < 0 || overlapArea > SpatialSplitAlpha * build.rootArea) && build.referenceCount < build.referenceBudget)
+		{
+			for (int32_t axis = 0; axis < 3; axis++)
+			{
+				auto axisMin = nodeBounds.min[axis];
+				auto axisExtent = nodeBounds.max[axis] - axisMin;
+
+				if (axisExtent <= 0.0f)
+				{
+					continue;
+				}
+
+				SpatialBin bins[BinCount];
+				auto binWidth = axisExtent / BinCount;
+
+				auto binOf = [&](float value)
+				{
+					return Math::clamp(static_cast<int32_t>((value - axisMin) / binWidth), 0, BinCount - 1);
+				};
+
+				for (const auto& reference : references)
+				{
+					auto firstBin = binOf(reference.bounds.min[axis]);
+					auto lastBin = binOf(reference.bounds.max[axis]);
+
+					bins[firstBin].entries++;
+					bins[lastBin].exits++;
+
+					if (firstBin == lastBin)
+					{
+						bins[firstBin].bounds = surroundingBox(bins[firstBin].bounds, reference.bounds);
+						continue;
+					}
+
+					// Clip the reference to every bin it crosses
+					for (auto bin = firstBin; bin <= lastBin; bin++)
+					{
+						auto clip = reference.bounds;
+						clip.min[axis] = bin == firstBin ? clip.min[axis] : axisMin + binWidth * bin;
+						clip.max[axis] = bin == lastBin ? clip.max[axis] : axisMin + binWidth * (bin + 1);
+
+						auto clipped = build.clipper(reference.primitive, clip);
+
+						if (clipped.isValid())
+						{
+							bins[bin].bounds = surroundingBox(bins[bin].bounds, clipped);
+						}
+					}
+				}
+
+				float rightArea[BinCount - 1];
+				uint32_t rightCount[BinCount - 1];
+
+				BoundingBox rightBox;
+				uint32_t rightSum = 0;
+
+				for (int32_t i = BinCount - 1; i > 0; i--)
+				{
+					rightSum += bins[i].exits;
+					rightBox = surroundingBox(rightBox, bins[i].bounds);
+					rightCount[i - 1] = rightSum;
+					rightArea[i - 1] = rightBox.isValid() ? rightBox.surfaceArea() : 0.0f;
+				}
+
+				BoundingBox leftBox;
+				uint32_t leftSum = 0;
+
+				for (int32_t i = 0; i < BinCount - 1; i++)
+				{
+					leftSum += bins[i].entries;
+					leftBox = surroundingBox(leftBox, bins[i].bounds);
+
+					if (leftSum == 0 || rightCount[i] == 0)
+					{
+						continue;
+					}
+
+					auto leftArea = leftBox.isValid() ? leftBox.surfaceArea() : 0.0f;
+					auto cost = leftSum * leftArea + rightCount[i] * rightArea[i];
+
+					if (cost < spatialCost)
+					{
+						spatialCost = cost;
+						spatialAxis = axis;
+						spatialPlane = axisMin + binWidth * (i + 1);
+					}
+				}
+			}
+		}
+
+		if (objectAxis < 0 && spatialAxis < 0)
+		{
+			splitSpatialAtMedian(nodeIndex, references, depth, build);
+			return;
+		}
+
+		auto bestCost = std::min(objectCost, spatialCost);
+		auto nodeArea = nodeBounds.surfaceArea();
+		auto splitCost = nodeArea > 0.0f ? TraversalCost + bestCost / nodeArea : TraversalCost;
+
+		if (splitCost >= static_cast<float>(count) && count <= MaxLeafSize)
+		{
+			makeSpatialLeaf(nodeIndex, references);
+			return;
+		}
+
+		std::vector<Reference> left;
+		std::vector<Reference> right;
+
+		if (spatialCost < objectCost)
+		{
+			for (const auto& reference : references)
+			{
+				if (reference.bounds.max[spatialAxis] <= spatialPlane)
+				{
+					left.emplace_back(reference);
+				}
+				else if (reference.bounds.min[spatialAxis] >= spatialPlane)
+				{
+					right.emplace_back(reference);
+				}
+				else
+				{
+					auto leftClip = reference.bounds;
+					leftClip.max[spatialAxis] = spatialPlane;
+
+					auto rightClip = reference.bounds;
+					rightClip.min[spatialAxis] = spatialPlane;
+
+					auto leftPart = Reference{ build.clipper(reference.primitive, leftClip), reference.primitive };
+					auto rightPart = Reference{ build.clipper(reference.primitive, rightClip), reference.primitive };
+
+					// A primitive that only touches the plane may clip to nothing on one side
+					if (leftPart.bounds.isValid() && rightPart.bounds.isValid())
+					{
+						left.emplace_back(leftPart);
+						right.emplace_back(rightPart);
+						build.referenceCount++;
+						splitReferences = true;
+					}
+					else if (rightPart.bounds.isValid())
+					{
+						right.emplace_back(rightPart);
+					}
+					else
+					{
+						left.emplace_back(leftPart.bounds.isValid() ? leftPart : reference);
+					}
+				}
+			}
+		}
+		else
+		{
+			auto axisMin = centroidBounds.min[objectAxis];
+			auto binScale = BinCount / (centroidBounds.max[objectAxis] - axisMin);
+
+			for (const auto& reference : references)
+			{
+				auto binIndex = std::min(BinCount - 1, static_cast<int32_t>((reference.bounds.centroid()[objectAxis] - axisMin) * binScale));
+				(binIndex < objectSplit ? left : right).emplace_back(reference);
+			}
+		}
+
+		if (left.empty() || right.empty())
+		{
+			splitSpatialAtMedian(nodeIndex, references, depth, build);
+			return;
+		}
+
+		// The children own their references from here on
+		std::vector<Reference>().swap(references);
+
+		splitSpatialNode(nodeIndex, left, right, depth, build);
+	}
+
+	// splitAtMedian() for the spatial build
+	void splitSpatialAtMedian(uint32_t nodeIndex, std::vector<Reference>& references, int32_t depth, SpatialBuild& build)
+	{
+		if (references.size() <= MaxLeafSize)
+		{
+			makeSpatialLeaf(nodeIndex, references);
+			return;
+		}
+
+		auto middle = references.begin() + references.size() / 2;
+
+		std::vector<Reference> left(references.begin(), middle);
+		std::vector<Reference> right(middle, references.end());
+
+		std::vector<Reference>().swap(references);
+
+		splitSpatialNode(nodeIndex, left, right, depth, build);
+	}
+
+	void splitSpatialNode(uint32_t nodeIndex, std::vector<Reference>& left, std::vector<Reference>& right, int32_t depth, SpatialBuild& build)
+	{
+		auto leftIndex = static_cast<uint32_t>(nodes.size());
+
+		nodes.emplace_back();
+		nodes.emplace_back();
+
+		nodes[nodeIndex].leftFirst = leftIndex;
+		nodes[nodeIndex].primitiveCount = 0;
+
+		subdivideSpatial(leftIndex, left, depth + 1, build);
+		subdivideSpatial(leftIndex + 1, right, depth + 1, build);
+	}
+
+	// Spread the lower 10 (21) bits of value so there are two zero bits between each of them
+	static uint64_t expandBits10(uint64_t value)
+	{
+		value &= 0x3ff;
+		value = (value | (value << 16)) & 0x030000ff;
+		value = (value | (value << 8)) & 0x0300f00f;
+		value = (value | (value << 4)) & 0x030c30c3;
+		value = (value | (value << 2)) & 0x09249249;
+		return value;
+	}
+
+	static uint64_t expandBits21(uint64_t value)
+	{
+		value &= 0x1fffff;
+		value = (value | (value << 32)) & 0x001f00000000ffff;
+		value = (value | (value << 16)) & 0x001f0000ff0000ff;
+		value = (value | (value << 8)) & 0x100f00f00f00f00f;
+		value = (value | (value << 4)) & 0x10c30c30c30c30c3;
+		value = (value | (value << 2)) & 0x1249249249249249;
+		return value;
+	}
+
+	// 30 bit (10 bits per axis) or 63 bit (21 bits per axis) Morton code of a point in [0, 1]^3
+	static uint64_t mortonCode(const tuple& normalized, bool use63Bits)
+	{
+		auto bits = use63Bits ? 21 : 10;
+		auto scale = static_cast<float>((1 << bits) - 1);
+
+		auto x = static_cast<uint64_t>(Math::clamp(normalized.x * scale, 0.0f, scale));
+		auto y = static_cast<uint64_t>(Math::clamp(normalized.y * scale, 0.0f, scale));
+		auto z = static_cast<uint64_t>(Math::clamp(normalized.z * scale, 0.0f, scale));
+
+		if (use63Bits)
+		{
+			return (expandBits21(x) << 2) | (expandBits21(y) << 1) | expandBits21(z);
+		}
+
+		return (expandBits10(x) << 2) | (expandBits10(y) << 1) | expandBits10(z);
+	}
+
+	// Parallel LSD radix sort of (key, value) pairs, 8 bits per pass. Each worker builds a
+	// histogram of its own chunk, the prefix sums over (digit, chunk) give every chunk its
+	// own output ranges so the scatter needs no synchronization and stays stable.
+	static void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int32_t keyBits)
+	{
+		constexpr int32_t RadixBits = 8;
+		constexpr int32_t BucketCount = 1 << RadixBits;
+
+		auto count = keys.size();
+		auto chunkCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), count / 4096));
+		auto chunkSize = (count + chunkCount - 1) / chunkCount;
+
+		std::vector<uint64_t> keysOut(count);
+		std::vector<uint32_t> valuesOut(count);
+		std::vector<size_t> histograms(chunkCount * BucketCount);
+
+		std::vector<size_t> chunks(chunkCount);
+		std::iota(chunks.begin(), chunks.end(), 0);
+
+		for (int32_t shift = 0; shift < keyBits; shift += RadixBits)
+		{
+			std::fill(histograms.begin(), histograms.end(), 0);
+
+			std::for_each(std::execution::par, chunks.begin(), chunks.end(), 
+			[&](size_t chunk)
+			{
+				auto* histogram = &histograms[chunk * BucketCount];
+				auto end = std::min(count, (chunk + 1) * chunkSize);
+
+				for (auto i = chunk * chunkSize; i < end; i++)
+				{
+					histogram[(keys[i] >> shift) & (BucketCount - 1)]++;
+				}
+			});
+
+			size_t offset = 0;
+
+			for (int32_t digit = 0; digit < BucketCount; digit++)
+			{
+				for (size_t chunk = 0; chunk < chunkCount; chunk++)
+				{
+					auto digitCount = histograms[chunk * BucketCount + digit];
+					histograms[chunk * BucketCount + digit] = offset;
+					offset += digitCount;
+				}
+			}
+
+			std::for_each(std::execution::par, chunks.begin(), chunks.end(), 
+			[&](size_t chunk)
+			{
+				auto* histogram = &histograms[chunk * BucketCount];
+				auto end = std::min(count, (chunk + 1) * chunkSize);
+
+				for (auto i = chunk * chunkSize; i < end; i++)
+				{
+					auto destination = histogram[(keys[i] >> shift) & (BucketCount - 1)]++;
+					keysOut[destination] = keys[i];
+					valuesOut[destination] = values[i];
+				}
+			});
+
+			std::swap(keys, keysOut);
+			std::swap(values, valuesOut);
+		}
+	}
+
+	// Karras 2012, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees".
+	// Every internal node finds its key range and split on its own, so they are all emitted in
+	// parallel, and bounds are then propagated from the leaves up in parallel as well.
+	void buildLinear(const std::vector<BoundingBox>& primitiveBounds)
+	{
+		auto count = static_cast<uint32_t>(primitiveBounds.size());
+
+		BoundingBox centroidBounds;
+
+		for (const auto& box : primitiveBounds)
+		{
+			centroidBounds.addPoint(box.centroid());
+		}
+
+		auto extent = centroidBounds.extent();
+
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			extent[axis] = extent[axis] > 0.0f ? 1.0f / extent[axis] : 0.0f;
+		}
+
+		auto use63Bits = count > Morton63Threshold;
+
+		std::vector<uint64_t> keys(count);
+		std::vector<uint32_t> values(count);
+
+		std::for_each(std::execution::par, keys.begin(), keys.end(), 
+		[&](uint64_t& key)
+		{
+			auto i = static_cast<uint32_t>(&key - keys.data());
+			auto normalized = (primitiveBounds[i].centroid() - centroidBounds.min) * extent;
+
+			key = mortonCode(normalized, use63Bits);
+			values[i] = i;
+		});
+
+		radixSort(keys, values, use63Bits ? 63 : 30);
+
+		primitiveIndices = std::move(values);
+
+		if (count == 1)
+		{
+			BVHNode root;
+			root.bounds = primitiveBounds[primitiveIndices[0]];
+			root.leftFirst = 0;
+			root.primitiveCount = 1;
+			nodes.emplace_back(root);
+			return;
+		}
+
+		// Length of the common prefix of keys i and j, equal keys are told apart by their index
+		auto delta = [&](int64_t i, int64_t j) -> int32_t
+		{
+			if (j < 0 || j >= count)
+			{
+				return -1;
+			}
+
+			if (keys[i] == keys[j])
+			{
+				return 64 + std::countl_zero(static_cast<uint64_t>(i ^ j));
+			}
+
+			return std::countl_zero(keys[i] ^ keys[j]);
+		};
+
+		// Internal nodes are 0..count - 2, children with the LeafFlag bit set are leaves
+		constexpr uint32_t LeafFlag = 0x80000000;
+
+		struct LinearNode
+		{
+			uint32_t left = 0;
+			uint32_t right = 0;
+			BoundingBox bounds;
+		};
+
+		std::vector<LinearNode> internalNodes(count - 1);
+		std::vector<uint32_t> internalParents(count - 1, 0);
+		std::vector<uint32_t> leafParents(count, 0);
+
+		std::for_each(std::execution::par, internalNodes.begin(), internalNodes.end(), 
+		[&](LinearNode& node)
+		{
+			auto i = static_cast<int64_t>(&node - internalNodes.data());
+
+			// Direction of the range covered by this node
+			auto direction = (delta(i, i + 1) - delta(i, i - 1)) >= 0 ? 1 : -1;
+
+			// Upper bound for the length of the range, then binary search for the other end
+			auto deltaMin = delta(i, i - direction);
+			int64_t lengthMax = 2;
+
+			while (delta(i, i + lengthMax * direction) > deltaMin)
+			{
+				lengthMax *= 2;
+			}
+
+			int64_t length = 0;
+
+			for (auto step = lengthMax / 2; step >= 1; step /= 2)
+			{
+				if (delta(i, i + (length + step) * direction) > deltaMin)
+				{
+					length += step;
+				}
+			}
+
+			auto j = i + length * direction;
+
+			// Binary search for the split position, where the common prefix gets longer
+			auto deltaNode = delta(i, j);
+			int64_t split = 0;
+			int64_t step = length;
+
+			do
+			{
+				step = (step + 1) >> 1;
+
+				if (delta(i, i + (split + step) * direction) > deltaNode)
+				{
+					split += step;
+				}
+			} while (step > 1);
+
+			auto gamma = static_cast<uint32_t>(i + split * direction + std::min(direction, 0));
+
+			node.left = (std::min(i, j) == gamma) ? (gamma | LeafFlag) : gamma;
+			node.right = (std::max(i, j) == gamma + 1) ? ((gamma + 1) | LeafFlag) : gamma + 1;
+
+			auto self = static_cast<uint32_t>(i);
+
+			((node.left & LeafFlag) ? leafParents[node.left & ~LeafFlag] : internalParents[node.left]) = self;
+			((node.right & LeafFlag) ? leafParents[node.right & ~LeafFlag] : internalParents[node.right]) = self;
+		});
+
+		auto childBounds = [&](uint32_t child) -> const BoundingBox&
+		{
+			return (child & LeafFlag) ? primitiveBounds[primitiveIndices[child & ~LeafFlag]] : internalNodes[child].bounds;
+		};
+
+		// Each leaf walks up, the second thread to reach a node has both children ready
+		std::vector<std::atomic<uint32_t>> visits(count - 1);
+
+		std::for_each(std::execution::par, leafParents.begin(), leafParents.end(), 
+		[&](uint32_t& leafParent)
+		{
+			auto parent = leafParent;
+
+			while (true)
+			{
+				if (visits[parent].fetch_add(1, std::memory_order_acq_rel) == 0)
+				{
+					break;
+				}
+
+				auto& node = internalNodes[parent];
+				node.bounds = surroundingBox(childBounds(node.left), childBounds(node.right));
+
+				if (parent == 0)
+				{
+					break;
+				}
+
+				parent = internalParents[parent];
+			}
+		});
+
+		// Children of internal node i go to slots 2i + 1 and 2i + 2, which keeps siblings next
+		// to each other like the SAH build and lets every node be written independently
+		nodes.resize(2 * static_cast<size_t>(count) - 1);
+
+		auto toNode = [&](uint32_t child)
+		{
+			BVHNode node;
+
+			if (child & LeafFlag)
+			{
+				node.bounds = primitiveBounds[primitiveIndices[child & ~LeafFlag]];
+				node.leftFirst = child & ~LeafFlag;
+				node.primitiveCount = 1;
+			}
+			else
+			{
+				node.bounds = internalNodes[child].bounds;
+				node.leftFirst = 2 * child + 1;
+				node.primitiveCount = 0;
+			}
+
+			return node;
+		};
+
+		nodes[0] = toNode(0);
+
+		std::for_each(std::execution::par, internalNodes.begin(), internalNodes.end(), 
+		[&](const LinearNode& node)
+		{
+			auto i = static_cast<uint32_t>(&node - internalNodes.data());
+
+			nodes[2 * i + 1] = toNode(node.left);
+			nodes[2 * i + 2] = toNode(node.right);
+		});
+	}
+
+	void updateNodeBounds(uint32_t nodeIndex, const std::vector<BoundingBox>& primitiveBounds)
+	{
+		auto& node = nodes[nodeIndex];
+
+		node.bounds = BoundingBox();
+
+		for (uint32_t i = 0; i < node.primitiveCount; i++)
+		{
+			node.bounds = surroundingBox(node.bounds, primitiveBounds[primitiveIndices[node.leftFirst + i]]);
+		}
+	}
+
+	void subdivide(uint32_t nodeIndex, int32_t depth, const std::vector<BoundingBox>& primitiveBounds, const std::vector<tuple>& centroids)
+	{
+		auto& node = nodes[nodeIndex];
+
+		if (node.primitiveCount <= 1)
+		{
+			return;
+		}
+
+		if (depth >= MaxDepth)
+		{
+			splitAtMedian(nodeIndex, depth, primitiveBounds, centroids);
+			return;
+		}
+
+		auto first = node.leftFirst;
+		auto count = node.primitiveCount;
+
+		BoundingBox centroidBounds;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			centroidBounds.addPoint(centroids[primitiveIndices[first + i]]);
+		}
+
+		int32_t bestAxis = -1;
+		int32_t bestSplit = 0;
+		float bestCost = std::numeric_limits<float>::max();
+
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			auto axisMin = centroidBounds.min[axis];
+			auto axisExtent = centroidBounds.max[axis] - axisMin;
+
+			if (axisExtent <= 0.0f)
+			{
+				continue;
+			}
+
+			Bin bins[BinCount];
+			auto binScale = BinCount / axisExtent;
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				auto primitive = primitiveIndices[first + i];
+				auto binIndex = std::min(BinCount - 1, static_cast<int32_t>((centroids[primitive][axis] - axisMin) * binScale));
+
+				bins[binIndex].count++;
+				bins[binIndex].bounds = surroundingBox(bins[binIndex].bounds, primitiveBounds[primitive]);
+			}
+
+			// Sweep from both ends to get the area and primitive count on each side of every split plane
+			float leftArea[BinCount - 1];
+			float rightArea[BinCount - 1];
+			uint32_t leftCount[BinCount - 1];
+			uint32_t rightCount[BinCount - 1];
+
+			BoundingBox leftBox;
+			BoundingBox rightBox;
+			uint32_t leftSum = 0;
+			uint32_t rightSum = 0;
+
+			for (int32_t i = 0; i < BinCount - 1; i++)
+			{
+				leftSum += bins[i].count;
+				leftCount[i] = leftSum;
+				leftBox = surroundingBox(leftBox, bins[i].bounds);
+				leftArea[i] = leftSum > 0 ? leftBox.surfaceArea() : 0.0f;
+
+				rightSum += bins[BinCount - 1 - i].count;
+				rightCount[BinCount - 2 - i] = rightSum;
+				rightBox = surroundingBox(rightBox, bins[BinCount - 1 - i].bounds);
+				rightArea[BinCount - 2 - i] = rightSum > 0 ? rightBox.surfaceArea() : 0.0f;
+			}
+
+			for (int32_t i = 0; i < BinCount - 1; i++)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+				{
+					continue;
+				}
+
+				auto cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = i + 1;
+				}
+			}
+		}
+
+		// All centroids coincide, the SAH can't tell the primitives apart
+		if (bestAxis < 0)
+		{
+			splitAtMedian(nodeIndex, depth, primitiveBounds, centroids);
+			return;
+		}
+
+		auto nodeArea = node.bounds.surfaceArea();
+		auto splitCost = nodeArea > 0.0f ? TraversalCost + bestCost / nodeArea : TraversalCost;
+
+		if (splitCost >= static_cast<float>(count) && count <= MaxLeafSize)
+		{
+			return;
+		}
+
+		auto axisMin = centroidBounds.min[bestAxis];
+		auto binScale = BinCount / (centroidBounds.max[bestAxis] - axisMin);
+
+		auto middle = std::partition(primitiveIndices.begin() + first, primitiveIndices.begin() + first + count,
+		[&](uint32_t primitive)
+		{
+			auto binIndex = std::min(BinCount - 1, static_cast<int32_t>((centroids[primitive][bestAxis] - axisMin) * binScale));
+			return binIndex < bestSplit;
+		});
+
+		auto leftPrimitiveCount = static_cast<uint32_t>(middle - (primitiveIndices.begin() + first));
+
+		if (leftPrimitiveCount == 0 || leftPrimitiveCount == count)
+		{
+			splitAtMedian(nodeIndex, depth, primitiveBounds, centroids);
+			return;
+		}
+
+		splitNode(nodeIndex, leftPrimitiveCount, depth, primitiveBounds, centroids);
+	}
+
+	// Where the SAH gives up (coincident centroids, the MaxDepth cutoff) a node bigger than
+	// MaxLeafSize is halved at the index median instead. Leaves of duplicate primitives stay
+	// small that way, and the node formats that store leaf sizes in 16 bits never overflow.
+	void splitAtMedian(uint32_t nodeIndex, int32_t depth, const std::vector<BoundingBox>& primitiveBounds, const std::vector<tuple>& centroids)
+	{
+		auto count = nodes[nodeIndex].primitiveCount;
+
+		if (count <= MaxLeafSize)
+		{
+			return;
+		}
+
+		splitNode(nodeIndex, count / 2, depth, primitiveBounds, centroids);
+	}
+
+	// Turns a leaf into an interior node over its first leftPrimitiveCount primitives and the rest
+	void splitNode(uint32_t nodeIndex, uint32_t leftPrimitiveCount, int32_t depth, const std::vector<BoundingBox>& primitiveBounds, const std::vector<tuple>& centroids)
+	{
+		auto& node = nodes[nodeIndex];
+
+		auto first = node.leftFirst;
+		auto count = node.primitiveCount;
+
+		auto leftIndex = static_cast<uint32_t>(nodes.size());
+
+		BVHNode left;
+		left.leftFirst = first;
+		left.primitiveCount = leftPrimitiveCount;
+
+		BVHNode right;
+		right.leftFirst = first + leftPrimitiveCount;
+		right.primitiveCount = count - leftPrimitiveCount;
+
+		nodes.emplace_back(left);
+		nodes.emplace_back(right);
+
+		node.leftFirst = leftIndex;
+		node.primitiveCount = 0;
+
+		updateNodeBounds(leftIndex, primitiveBounds);
+		updateNodeBounds(leftIndex + 1, primitiveBounds);
+
+		subdivide(leftIndex, depth + 1, primitiveBounds, centroids);
+		subdivide(leftIndex + 1, depth + 1, primitiveBounds, centroids);
+	}
+};
+// The primitives one traversal of a BVH with split references has visited, and the lanes
+// of a packet that visited each of them. An open addressing hash set, so a ray through n
+// leaves pays O(n) and not a list search per visit. The sets of nested traversals (a
+// group's visitor traversing the group's children) are stacked on one buffer per thread,
+// each owns the end of it while it is alive. Disabled sets keep nothing.
+class VisitedPrimitives
+{
+public:
+	VisitedPrimitives(bool inEnabled)
+	: enabled(inEnabled), first(inEnabled ? buffer().size() : 0)
+	{
+		if (enabled)
+		{
+			buffer().resize(first + capacity);
+		}
+	}
+
+	VisitedPrimitives(const VisitedPrimitives&) = delete;
+	VisitedPrimitives& operator=(const VisitedPrimitives&) = delete;
+
+	~VisitedPrimitives()
+	{
+		if (enabled)
+		{
+			buffer().resize(first);
+		}
+	}
+
+	// The lanes that visit "primitive" for the first time, all of them when disabled
+	uint32_t visit(uint32_t primitive, uint32_t lanes = 1)
+	{
+		if (!enabled)
+		{
+			return lanes;
+		}
+
+		// Kept at most half full, probe sequences stay short
+		if ((count + 1) * 2 > capacity)
+		{
+			grow();
+		}
+
+		auto& entry = buffer()[first + find(primitive)];
+
+		if (entry.primitive == EmptySlot)
+		{
+			entry = { primitive, lanes };
+			count++;
+			return lanes;
+		}
+
+		auto newLanes = lanes & ~entry.lanes;
+		entry.lanes |= lanes;
+
+		return newLanes;
+	}
+
+private:
+	struct Entry
+	{
+		uint32_t primitive = EmptySlot;
+		uint32_t lanes = 0;
+	};
+
+	static constexpr uint32_t EmptySlot = std::numeric_limits<uint32_t>::max();
+
+	static std::vector<Entry>& buffer()
+	{
+		thread_local std::vector<Entry> entries;
+		return entries;
+	}
+
+	// Slot of "primitive", or the empty slot where it goes
+	size_t find(uint32_t primitive) const
+	{
+		const auto& entries = buffer();
+		auto mask = capacity - 1;
+
+		// Fibonacci hashing, the top bits of the product are the best mixed
+		auto slot = static_cast<size_t>((primitive * 2654435769u) >> (32 - std::countr_zero(capacity)));
+
+		while (entries[first + slot].primitive != EmptySlot && entries[first + slot].primitive != primitive)
+		{
+			slot = (slot + 1) & mask;
+		}
+
+		return slot;
+	}
+
+	void grow()
+	{
+		auto& entries = buffer();
+		std::vector<Entry> old(entries.begin() + first, entries.end());
+
+		capacity *= 2;
+		entries.resize(first);
+		entries.resize(first + capacity);
+
+		for (const auto& entry : old)
+		{
+			if (entry.primitive != EmptySlot)
+			{
+				entries[first + find(entry.primitive)] = entry;
+			}
+		}
+	}
+
+	bool enabled = false;
+	size_t first = 0;
+	size_t capacity = 64;
+	size_t count = 0;
+};
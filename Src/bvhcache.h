@@ -0,0 +1,499 @@
+#pragma once
+
+#include "group.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read only view of a whole file. The pages are mapped, not read, so only the
+// parts that are actually touched get loaded from disk.
+class MappedFile
+{
+public:
+	MappedFile(const std::string& path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+
+		LARGE_INTEGER fileSize;
+
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			return;
+		}
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+		if (mapping == nullptr)
+		{
+			return;
+		}
+
+		auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+		if (view == nullptr)
+		{
+			return;
+		}
+
+		bytes = static_cast<const uint8_t*>(view);
+		byteCount = static_cast<size_t>(fileSize.QuadPart);
+#else
+		auto file = open(path.c_str(), O_RDONLY);
+
+		if (file < 0)
+		{
+			return;
+		}
+
+		struct stat status;
+
+		if (fstat(file, &status) == 0 && status.st_size > 0)
+		{
+			auto view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+
+			if (view != MAP_FAILED)
+			{
+				bytes = static_cast<const uint8_t*>(view);
+				byteCount = static_cast<size_t>(status.st_size);
+			}
+		}
+
+		// The mapping stays valid after the descriptor is closed
+		close(file);
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (bytes != nullptr)
+		{
+			UnmapViewOfFile(bytes);
+		}
+
+		if (mapping != nullptr)
+		{
+			CloseHandle(mapping);
+		}
+
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+#else
+		if (bytes != nullptr)
+		{
+			munmap(const_cast<uint8_t*>(bytes), byteCount);
+		}
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool isOpen() const { return bytes != nullptr; }
+
+	const uint8_t* data() const { return bytes; }
+
+	size_t size() const { return byteCount; }
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+	const uint8_t* bytes = nullptr;
+	size_t byteCount = 0;
+};
+
+// 64 bit FNV-1a, pass the previous result as "hash" to continue over more data
+inline static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	auto bytes = static_cast<const uint8_t*>(data);
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+// A cache file holds the child BVHs of a list of groups (the groups of one OBJ file)
+// and the BVHs of the meshes in them, keyed by a hash of the source file. The header
+// and one entry per BVH are followed by the flat arrays of every BVH, which are used
+// in place once the file is mapped.
+// The data is written in the layout of the machine that built it, a cache file is not
+// meant to be moved to another platform.
+struct BVHCacheHeader
+{
+	static constexpr uint32_t Magic = 0x43485642; // "BVHC"
+
+	// Bump when the layout of the file or of CompressedBVHNode changes, or when files written
+	// by older builds can't be trusted (version 2 could hold leaf sizes wrapped at 16 bits)
+	static constexpr uint32_t Version = 3;
+
+	uint32_t magic = Magic;
+	uint32_t version = Version;
+	uint64_t contentHash = 0;
+	uint32_t nodeSize = sizeof(CompressedBVHNode);
+	uint32_t entryCount = 0;
+};
+
+struct BVHCacheEntry
+{
+	// Byte offsets from the start of the file and element counts
+	uint64_t nodeOffset = 0;
+	uint64_t nodeCount = 0;
+	uint64_t primitiveIndexOffset = 0;
+	uint64_t primitiveIndexCount = 0;
+	uint64_t boundedShapeOffset = 0;
+	uint64_t boundedShapeCount = 0;
+	uint64_t unboundedShapeOffset = 0;
+	uint64_t unboundedShapeCount = 0;
+
+	// Children of a group or triangles of a mesh. Groups below Group::BVHThreshold
+	// never build a BVH and are stored with built = 0.
+	uint64_t shapeCount = 0;
+	uint32_t built = 0;
+	uint8_t quality = 0;
+	uint8_t splitReferences = 0;
+
+	// Primitive indices of a mesh are triangle indices, there are no shape lists
+	uint8_t mesh = 0;
+	uint8_t padding = 0;
+};
+
+// One BVH of a cache file, the child BVH of a group or the BVH of a mesh in it
+struct BVHCacheSlot
+{
+	uint64_t shapeCount = 0;
+	BVHBuildQuality quality = BVHBuildQuality::SAH;
+	bool mesh = false;
+
+	// Whether there is a BVH to save, and then its arrays
+	bool built = false;
+	ShapeBVHView view;
+
+	std::function<void(const ShapeBVHView& view, std::shared_ptr<const void> storage)> attach;
+};
+
+// Every group of the list, each followed by the meshes among its children
+inline static std::vector<BVHCacheSlot> bvhCacheSlots(const std::vector<std::shared_ptr<Group>>& groups)
+{
+	std::vector<BVHCacheSlot> slots;
+
+	for (const auto& group : groups)
+	{
+		auto& childBVH = group->getChildBVH();
+
+		auto& slot = slots.emplace_back();
+		slot.shapeCount = group->shapes.size();
+		slot.quality = childBVH.getBuildQuality();
+
+		// Moving shapes need the motion BVH, which isn't cached
+		slot.built = childBVH.isBuilt(group->shapes.size()) && !childBVH.isMoving();
+		slot.view = slot.built ? childBVH.view() : ShapeBVHView();
+		slot.attach = [group](const ShapeBVHView& view, std::shared_ptr<const void> storage)
+		{
+			group->getChildBVH().attach(group->shapes, view, std::move(storage));
+		};
+
+		for (const auto& shape : group->shapes)
+		{
+			auto mesh = std::dynamic_pointer_cast<TriangleMesh>(shape);
+
+			if (mesh == nullptr)
+			{
+				continue;
+			}
+
+			auto& meshSlot = slots.emplace_back();
+			meshSlot.shapeCount = mesh->triangleCount();
+			meshSlot.quality = mesh->getBuildQuality();
+			meshSlot.mesh = true;
+			meshSlot.built = mesh->isBuilt();
+			meshSlot.view = meshSlot.built ? mesh->view() : ShapeBVHView();
+			meshSlot.attach = [mesh](const ShapeBVHView& view, std::shared_ptr<const void> storage)
+			{
+				mesh->attach(view, std::move(storage));
+			};
+		}
+	}
+
+	return slots;
+}
+
+template<typename T>
+inline static std::span<const T> mappedSpan(const MappedFile& file, uint64_t offset, uint64_t count)
+{
+	return std::span<const T>(reinterpret_cast<const T*>(file.data() + offset), static_cast<size_t>(count));
+}
+
+inline static std::string bvhCachePath(uint64_t contentHash)
+{
+	std::stringstream path;
+	path << "Cache/BVH/" << std::hex << std::setw(16) << std::setfill('0') << contentHash << ".bvh";
+	return path.str();
+}
+
+// Writes the built BVHs of "groups" and their meshes, returns false when nothing was written
+inline static bool saveBVHCache(const std::string& path, uint64_t contentHash, const std::vector<std::shared_ptr<Group>>& groups)
+{
+	auto slots = bvhCacheSlots(groups);
+
+	BVHCacheHeader header;
+	header.contentHash = contentHash;
+	header.entryCount = static_cast<uint32_t>(slots.size());
+
+	std::vector<BVHCacheEntry> entries(slots.size());
+
+	uint64_t offset = sizeof(BVHCacheHeader) + sizeof(BVHCacheEntry) * entries.size();
+
+	// Nodes are 64 byte aligned in the file, so they are aligned in the mapping too
+	auto place = [&](uint64_t byteCount, uint64_t alignment)
+	{
+		offset = (offset + alignment - 1) / alignment * alignment;
+		auto placed = offset;
+		offset += byteCount;
+		return placed;
+	};
+
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		const auto& slot = slots[i];
+		auto& entry = entries[i];
+
+		entry.shapeCount = slot.shapeCount;
+		entry.quality = static_cast<uint8_t>(slot.quality);
+		entry.mesh = slot.mesh ? 1 : 0;
+
+		if (!slot.built)
+		{
+			continue;
+		}
+
+		const auto& view = slot.view;
+
+		entry.built = 1;
+		entry.splitReferences = view.splitReferences ? 1 : 0;
+		entry.nodeCount = view.nodes.size();
+		entry.nodeOffset = place(view.nodes.size_bytes(), alignof(CompressedBVHNode));
+		entry.primitiveIndexCount = view.primitiveIndices.size();
+		entry.primitiveIndexOffset = place(view.primitiveIndices.size_bytes(), sizeof(uint32_t));
+		entry.boundedShapeCount = view.boundedShapes.size();
+		entry.boundedShapeOffset = place(view.boundedShapes.size_bytes(), sizeof(uint32_t));
+		entry.unboundedShapeCount = view.unboundedShapes.size();
+		entry.unboundedShapeOffset = place(view.unboundedShapes.size_bytes(), sizeof(uint32_t));
+	}
+
+	std::vector<uint8_t> bytes(offset);
+
+	std::memcpy(bytes.data(), &header, sizeof(header));
+	std::memcpy(bytes.data() + sizeof(header), entries.data(), sizeof(BVHCacheEntry) * entries.size());
+
+	auto copy = [&](uint64_t offset, auto span)
+	{
+		if (!span.empty())
+		{
+			std::memcpy(bytes.data() + offset, span.data(), span.size_bytes());
+		}
+	};
+
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		const auto& entry = entries[i];
+		const auto& view = slots[i].view;
+
+		if (entry.built == 0)
+		{
+			continue;
+		}
+
+		copy(entry.nodeOffset, view.nodes);
+		copy(entry.primitiveIndexOffset, view.primitiveIndices);
+		copy(entry.boundedShapeOffset, view.boundedShapes);
+		copy(entry.unboundedShapeOffset, view.unboundedShapes);
+	}
+
+	std::error_code error;
+	auto directory = std::filesystem::path(path).parent_path();
+
+	if (!directory.empty())
+	{
+		std::filesystem::create_directories(directory, error);
+	}
+
+	// Written next to the target and renamed, so a reader never maps a half written file
+	auto temporaryPath = path + ".tmp";
+
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+		if (!file.good())
+		{
+			file.close();
+			std::filesystem::remove(temporaryPath, error);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temporaryPath, path, error);
+
+	if (error)
+	{
+		std::filesystem::remove(temporaryPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+// Maps the cache file and attaches its BVHs to "groups" and their meshes, which have to
+// hold the same shapes as the ones it was saved from. Nothing is attached unless the
+// whole file matches, the groups and meshes then build their BVHs as usual.
+inline static bool loadBVHCache(const std::string& path, uint64_t contentHash, const std::vector<std::shared_ptr<Group>>& groups)
+{
+	auto slots = bvhCacheSlots(groups);
+
+	auto file = std::make_shared<MappedFile>(path);
+
+	if (!file->isOpen() || file->size() < sizeof(BVHCacheHeader))
+	{
+		return false;
+	}
+
+	BVHCacheHeader header;
+	std::memcpy(&header, file->data(), sizeof(header));
+
+	if (header.magic != BVHCacheHeader::Magic ||
+		header.version != BVHCacheHeader::Version ||
+		header.contentHash != contentHash ||
+		header.nodeSize != sizeof(CompressedBVHNode) ||
+		header.entryCount != slots.size() ||
+		file->size() < sizeof(BVHCacheHeader) + sizeof(BVHCacheEntry) * slots.size())
+	{
+		return false;
+	}
+
+	std::vector<BVHCacheEntry> entries(slots.size());
+	std::memcpy(entries.data(), file->data() + sizeof(header), sizeof(BVHCacheEntry) * entries.size());
+
+	auto fits = [&](uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t alignment)
+	{
+		return offset % alignment == 0 && offset <= file->size() && count <= (file->size() - offset) / elementSize;
+	};
+
+	// Indices are checked too, so a damaged file can't send a traversal out of bounds
+	auto indicesBelow = [](std::span<const uint32_t> indices, uint64_t limit)
+	{
+		return std::all_of(indices.begin(), indices.end(), [&](uint32_t index) { return index < limit; });
+	};
+
+	auto childrenValid = [](std::span<const CompressedBVHNode> nodes, uint64_t primitiveIndexCount)
+	{
+		return std::all_of(nodes.begin(), nodes.end(), [&](const CompressedBVHNode& node)
+		{
+			for (int32_t slot = 0; slot < CompressedBVHNode::Width; slot++)
+			{
+				if (!(node.validMask & (1 << slot)))
+				{
+					continue;
+				}
+
+				auto valid = node.primitiveCount[slot] > 0 ? 
+							 uint64_t(node.child[slot]) + node.primitiveCount[slot] <= primitiveIndexCount :
+							 node.child[slot] < nodes.size();
+
+				if (!valid)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		});
+	};
+
+	std::vector<ShapeBVHView> views(slots.size());
+
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		const auto& entry = entries[i];
+
+		if (entry.shapeCount != slots[i].shapeCount ||
+			entry.quality != static_cast<uint8_t>(slots[i].quality) ||
+			entry.mesh != (slots[i].mesh ? 1 : 0))
+		{
+			return false;
+		}
+
+		if (entry.built == 0)
+		{
+			continue;
+		}
+
+		if (!fits(entry.nodeOffset, entry.nodeCount, sizeof(CompressedBVHNode), alignof(CompressedBVHNode)) ||
+			!fits(entry.primitiveIndexOffset, entry.primitiveIndexCount, sizeof(uint32_t), sizeof(uint32_t)) ||
+			!fits(entry.boundedShapeOffset, entry.boundedShapeCount, sizeof(uint32_t), sizeof(uint32_t)) ||
+			!fits(entry.unboundedShapeOffset, entry.unboundedShapeCount, sizeof(uint32_t), sizeof(uint32_t)))
+		{
+			return false;
+		}
+
+		auto& view = views[i];
+		view.nodes = mappedSpan<CompressedBVHNode>(*file, entry.nodeOffset, entry.nodeCount);
+		view.primitiveIndices = mappedSpan<uint32_t>(*file, entry.primitiveIndexOffset, entry.primitiveIndexCount);
+		view.boundedShapes = mappedSpan<uint32_t>(*file, entry.boundedShapeOffset, entry.boundedShapeCount);
+		view.unboundedShapes = mappedSpan<uint32_t>(*file, entry.unboundedShapeOffset, entry.unboundedShapeCount);
+		view.splitReferences = entry.splitReferences != 0;
+
+		if (!childrenValid(view.nodes, entry.primitiveIndexCount) ||
+			!indicesBelow(view.primitiveIndices, entry.mesh != 0 ? entry.shapeCount : entry.boundedShapeCount) ||
+			!indicesBelow(view.boundedShapes, entry.shapeCount) ||
+			!indicesBelow(view.unboundedShapes, entry.shapeCount))
+		{
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		if (entries[i].built != 0)
+		{
+			slots[i].attach(views[i], file);
+		}
+	}
+
+	return true;
+}
\ No newline at end of file
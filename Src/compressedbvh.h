@@ -0,0 +1,528 @@
+#pragma once
+
+#include "raypacket.h"
+#include "widebvh.h"
+
+#include <cstring>
+#include <span>
+
+#ifdef ARIA_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+// 4-wide node squeezed into one cache line. Child bounds are stored as 8 bit offsets
+// from the node origin in steps of 2^exponent (per axis), rounded outwards so the
+// dequantized boxes always contain the real ones.
+struct alignas(64) CompressedBVHNode
+{
+	static constexpr int32_t Width = WideBVHNode::Width;
+
+	float origin[3];
+	int8_t exponent[3];
+
+	// Bit i is set when slot i is in use
+	uint8_t validMask = 0;
+
+	uint8_t minX[Width];
+	uint8_t minY[Width];
+	uint8_t minZ[Width];
+	uint8_t maxX[Width];
+	uint8_t maxY[Width];
+	uint8_t maxZ[Width];
+
+	// Same meaning as in WideBVHNode
+	uint32_t child[Width];
+	uint16_t primitiveCount[Width];
+};
+
+static_assert(sizeof(CompressedBVHNode) == 64, "CompressedBVHNode should fill exactly one cache line");
+
+// Compressed copy of a WideBVH, half the size per node. The wide BVH already emits its
+// nodes in depth first order, so a node's first child subtree follows it in memory.
+class CompressedBVH
+{
+public:
+	static constexpr int32_t Width = CompressedBVHNode::Width;
+
+	CompressedBVH() = default;
+
+	// Copies of an attached BVH keep pointing at the same external memory
+	CompressedBVH(const CompressedBVH& other)
+	: nodes(other.nodes), primitiveIndices(other.primitiveIndices),
+	  nodeView(other.nodeView), primitiveIndexView(other.primitiveIndexView)
+	{
+		if (other.ownsStorage())
+		{
+			bindStorage();
+		}
+	}
+
+	CompressedBVH& operator=(const CompressedBVH& other)
+	{
+		nodes = other.nodes;
+		primitiveIndices = other.primitiveIndices;
+		nodeView = other.nodeView;
+		primitiveIndexView = other.primitiveIndexView;
+
+		if (other.ownsStorage())
+		{
+			bindStorage();
+		}
+
+		return *this;
+	}
+
+	// Moving a vector keeps its buffer, the views stay valid
+	CompressedBVH(CompressedBVH&& other) = default;
+	CompressedBVH& operator=(CompressedBVH&& other) = default;
+
+	void compress(const WideBVH& wideBVH)
+	{
+		nodes.resize(wideBVH.nodes.size());
+		primitiveIndices = wideBVH.primitiveIndices;
+
+		for (size_t i = 0; i < wideBVH.nodes.size(); i++)
+		{
+			nodes[i] = compressNode(wideBVH.nodes[i]);
+		}
+
+		bindStorage();
+	}
+
+	// Traverses nodes and indices owned by someone else (a memory mapped BVH cache file)
+	// instead of its own copies. The caller keeps that memory alive while this BVH is used.
+	void attach(std::span<const CompressedBVHNode> inNodes, std::span<const uint32_t> inPrimitiveIndices)
+	{
+		nodes.clear();
+		primitiveIndices.clear();
+		nodeView = inNodes;
+		primitiveIndexView = inPrimitiveIndices;
+	}
+
+	// Calls visitor(primitiveIndex) for every primitive in a leaf whose (slightly
+	// enlarged) bounds are hit by the ray within [tMin, tMax], nearest leaves first.
+	// Like WideBVH::traverse, a visitor may shrink tMax while it runs.
+	template<typename Visitor>
+	void traverse(const Ray& ray, float tMin, const float& tMax, Visitor&& visitor) const
+	{
+		traverseLeaves(ray, tMin, tMax, [&](uint32_t first, uint32_t primitiveCount)
+		{
+			for (uint32_t i = 0; i < primitiveCount; i++)
+			{
+				visitor(primitiveIndexView[first + i]);
+			}
+		});
+	}
+
+	// Same order, but leafVisitor(first, primitiveCount) gets whole leaves, the range
+	// [first, first + primitiveCount) of getPrimitiveIndices()
+	template<typename LeafVisitor>
+	void traverseLeaves(const Ray& ray, float tMin, const float& tMax, LeafVisitor&& leafVisitor) const
+	{
+		if (nodeView.empty())
+		{
+			return;
+		}
+
+		traverseLeavesFrom({ 0, 0, tMin }, ray, tMin, tMax, leafVisitor);
+	}
+
+	// traverseLeaves() for the lanes of a packet in laneMask, each node is read once for
+	// all of them. leafVisitor(first, primitiveCount, leafLaneMask) gets the lanes whose
+	// ray hits the leaf's bounds. Every lane has its own [tMin, tMax] from its ray, the
+	// visitor may shrink packet.rays[lane].tMax while it runs. Once only one lane is left
+	// in a subtree (the packet diverged) the subtree is traversed with that ray alone.
+	template<typename LeafVisitor>
+	void traversePacketLeaves(const RayPacket& packet, uint32_t laneMask, LeafVisitor&& leafVisitor) const
+	{
+		if (nodeView.empty() || laneMask == 0)
+		{
+			return;
+		}
+
+		struct PacketStackEntry
+		{
+			uint32_t child;
+			uint32_t primitiveCount;
+			uint32_t laneMask;
+
+			// Nearest entry distance over the lanes
+			float distance;
+		};
+
+		auto entryDistance = std::numeric_limits<float>::infinity();
+
+		for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+		{
+			if (laneMask & (1 << lane))
+			{
+				entryDistance = std::min(entryDistance, packet.rays[lane].tMin);
+			}
+		}
+
+		PacketStackEntry stack[WideBVH::TraversalStackSize];
+		int32_t stackSize = 0;
+
+		stack[stackSize++] = { 0, 0, laneMask, entryDistance };
+
+		while (stackSize > 0)
+		{
+			auto entry = stack[--stackSize];
+
+			// Lanes with a hit before the entry are done with it
+			auto entryLanes = 0u;
+
+			for (auto lanes = entry.laneMask; lanes != 0; lanes &= lanes - 1)
+			{
+				auto lane = std::countr_zero(lanes);
+
+				if (entry.distance <= packet.rays[lane].tMax)
+				{
+					entryLanes |= 1 << lane;
+				}
+			}
+
+			if (entryLanes == 0)
+			{
+				continue;
+			}
+
+			if (entry.primitiveCount > 0)
+			{
+				leafVisitor(entry.child, entry.primitiveCount, entryLanes);
+				continue;
+			}
+
+			if (std::has_single_bit(entryLanes))
+			{
+				const auto& ray = packet.rays[std::countr_zero(entryLanes)];
+
+				traverseLeavesFrom({ entry.child, 0, entry.distance }, ray, ray.tMin, ray.tMax, [&](uint32_t first, uint32_t primitiveCount)
+				{
+					leafVisitor(first, primitiveCount, entryLanes);
+				});
+
+				continue;
+			}
+
+			const auto& node = nodeView[entry.child];
+
+			uint32_t slotLanes[Width] = {};
+			float distances[Width];
+			std::fill(distances, distances + Width, std::numeric_limits<float>::infinity());
+
+			for (auto lanes = entryLanes; lanes != 0; lanes &= lanes - 1)
+			{
+				auto lane = std::countr_zero(lanes);
+				const auto& ray = packet.rays[lane];
+
+				float laneDistances[Width];
+
+				for (auto hitMask = intersectChildren(node, RayData(ray, ray.tMin, ray.tMax), laneDistances); hitMask != 0; hitMask &= hitMask - 1)
+				{
+					auto slot = std::countr_zero(hitMask);
+
+					slotLanes[slot] |= 1 << lane;
+					distances[slot] = std::min(distances[slot], laneDistances[slot]);
+				}
+			}
+
+			uint32_t hitMask = 0;
+
+			for (int32_t slot = 0; slot < Width; slot++)
+			{
+				hitMask |= slotLanes[slot] != 0 ? 1 << slot : 0;
+			}
+
+			int32_t slots[Width];
+			auto count = sortHitSlots(hitMask, distances, slots);
+
+			for (int32_t i = 0; i < count; i++)
+			{
+				auto slot = slots[i];
+				stack[stackSize++] = { node.child[slot], node.primitiveCount[slot], slotLanes[slot], distances[slot] };
+			}
+		}
+	}
+
+	bool empty() const { return nodeView.empty(); }
+
+	// What the traversal reads, the owned vectors below or attached memory
+	std::span<const CompressedBVHNode> getNodes() const { return nodeView; }
+
+	std::span<const uint32_t> getPrimitiveIndices() const { return primitiveIndexView; }
+
+	// Conservative bounds of a child slot, as seen by the traversal
+	BoundingBox childBounds(const CompressedBVHNode& node, int32_t slot) const
+	{
+		const uint8_t* minPlanes[3] = { node.minX, node.minY, node.minZ };
+		const uint8_t* maxPlanes[3] = { node.maxX, node.maxY, node.maxZ };
+
+		BoundingBox box;
+
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			box.min[axis] = dequantize(node, axis, minPlanes[axis][slot]);
+			box.max[axis] = dequantize(node, axis, maxPlanes[axis][slot]);
+		}
+
+		return box;
+	}
+
+	// Filled by compress(), empty when attached
+	std::vector<CompressedBVHNode> nodes;
+	std::vector<uint32_t> primitiveIndices;
+
+private:
+	bool ownsStorage() const { return nodeView.data() == nodes.data(); }
+
+	void bindStorage()
+	{
+		nodeView = nodes;
+		primitiveIndexView = primitiveIndices;
+	}
+
+	std::span<const CompressedBVHNode> nodeView;
+	std::span<const uint32_t> primitiveIndexView;
+
+	// Single ray traversal of the subtree below "root"
+	template<typename LeafVisitor>
+	void traverseLeavesFrom(WideStackEntry root, const Ray& ray, float tMin, const float& tMax, LeafVisitor&& leafVisitor) const
+	{
+		RayData rayData(ray, tMin, tMax);
+
+		WideStackEntry stack[WideBVH::TraversalStackSize];
+		int32_t stackSize = 0;
+
+		stack[stackSize++] = root;
+
+		while (stackSize > 0)
+		{
+			auto entry = stack[--stackSize];
+
+			if (entry.distance > tMax)
+			{
+				continue;
+			}
+
+			if (entry.primitiveCount > 0)
+			{
+				leafVisitor(entry.child, entry.primitiveCount);
+				continue;
+			}
+
+			const auto& node = nodeView[entry.child];
+
+			rayData.tMax = tMax;
+
+			float distances[Width];
+			int32_t slots[Width];
+
+			auto count = sortHitSlots(intersectChildren(node, rayData, distances), distances, slots);
+
+			for (int32_t i = 0; i < count; i++)
+			{
+				auto slot = slots[i];
+				stack[stackSize++] = { node.child[slot], node.primitiveCount[slot], distances[slot] };
+			}
+		}
+	}
+
+	struct RayData
+	{
+		RayData(const Ray& ray, float inTMin, float inTMax)
+		: tMin(inTMin), tMax(inTMax)
+		{
+			for (int32_t axis = 0; axis < 3; axis++)
+			{
+				origin[axis] = ray.origin[axis];
+				invDirection[axis] = ray.invDirection[axis];
+				negative[axis] = ray.sign[axis] != 0;
+			}
+		}
+
+		float origin[3];
+		float invDirection[3];
+		bool negative[3];
+		float tMin;
+		float tMax;
+	};
+
+	// 2^exponent built straight from the float bits, exponents are kept in the normal range
+	static float scaleOf(int8_t exponent)
+	{
+		return std::bit_cast<float>(static_cast<uint32_t>(exponent + 127) << 23);
+	}
+
+	static float dequantize(const CompressedBVHNode& node, int32_t axis, uint8_t value)
+	{
+		return node.origin[axis] + static_cast<float>(value) * scaleOf(node.exponent[axis]);
+	}
+
+	// Dequantizes the child boxes and runs the same slab test as WideBVH
+	static uint32_t intersectChildren(const CompressedBVHNode& node, const RayData& ray, float* distances)
+	{
+		const uint8_t* nearPlanes[3] =
+		{
+			ray.negative[0] ? node.maxX : node.minX,
+			ray.negative[1] ? node.maxY : node.minY,
+			ray.negative[2] ? node.maxZ : node.minZ
+		};
+
+		const uint8_t* farPlanes[3] =
+		{
+			ray.negative[0] ? node.minX : node.maxX,
+			ray.negative[1] ? node.minY : node.maxY,
+			ray.negative[2] ? node.minZ : node.maxZ
+		};
+
+#ifdef ARIA_SIMD_SSE
+		auto zero = _mm_setzero_si128();
+
+		// Widens 4 bytes to 4 floats with plain SSE2
+		auto load = [&](const uint8_t* planes)
+		{
+			int32_t packed;
+			std::memcpy(&packed, planes, sizeof(packed));
+
+			auto bytes = _mm_cvtsi32_si128(packed);
+			auto words = _mm_unpacklo_epi8(bytes, zero);
+			return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+		};
+
+		auto tMin = _mm_set1_ps(ray.tMin);
+		auto tMax = _mm_set1_ps(ray.tMax);
+
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			auto nodeOrigin = _mm_set1_ps(node.origin[axis]);
+			auto scale = _mm_set1_ps(scaleOf(node.exponent[axis]));
+			auto origin = _mm_set1_ps(ray.origin[axis]);
+			auto invDirection = _mm_set1_ps(ray.invDirection[axis]);
+
+			auto nearPlane = _mm_add_ps(nodeOrigin, _mm_mul_ps(load(nearPlanes[axis]), scale));
+			auto farPlane = _mm_add_ps(nodeOrigin, _mm_mul_ps(load(farPlanes[axis]), scale));
+
+			auto t0 = _mm_mul_ps(_mm_sub_ps(nearPlane, origin), invDirection);
+			auto t1 = _mm_mul_ps(_mm_sub_ps(farPlane, origin), invDirection);
+
+			tMin = _mm_max_ps(t0, tMin);
+			tMax = _mm_min_ps(t1, tMax);
+		}
+
+		_mm_storeu_ps(distances, tMin);
+
+		auto hitMask = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tMin, tMax)));
+#else
+		uint32_t hitMask = 0;
+
+		for (int32_t slot = 0; slot < Width; slot++)
+		{
+			auto tMin = ray.tMin;
+			auto tMax = ray.tMax;
+
+			for (int32_t axis = 0; axis < 3; axis++)
+			{
+				auto t0 = (dequantize(node, axis, nearPlanes[axis][slot]) - ray.origin[axis]) * ray.invDirection[axis];
+				auto t1 = (dequantize(node, axis, farPlanes[axis][slot]) - ray.origin[axis]) * ray.invDirection[axis];
+
+				tMin = t0 > tMin ? t0 : tMin;
+				tMax = t1 < tMax ? t1 : tMax;
+			}
+
+			distances[slot] = tMin;
+
+			if (tMin <= tMax)
+			{
+				hitMask |= 1 << slot;
+			}
+		}
+#endif
+		return hitMask & node.validMask;
+	}
+
+	static CompressedBVHNode compressNode(const WideBVHNode& wideNode)
+	{
+		const float* wideMin[3] = { wideNode.minX, wideNode.minY, wideNode.minZ };
+		const float* wideMax[3] = { wideNode.maxX, wideNode.maxY, wideNode.maxZ };
+
+		CompressedBVHNode node;
+
+		uint8_t* minPlanes[3] = { node.minX, node.minY, node.minZ };
+		uint8_t* maxPlanes[3] = { node.maxX, node.maxY, node.maxZ };
+
+		for (int32_t slot = 0; slot < Width; slot++)
+		{
+			// Unused WideBVH slots carry an inverted box, min > max
+			if (wideNode.minX[slot] <= wideNode.maxX[slot])
+			{
+				node.validMask |= 1 << slot;
+			}
+
+			node.child[slot] = wideNode.child[slot];
+
+			// BVH builds halve any leaf bigger than BVH::MaxLeafSize, even one of coincident
+			// primitives, so leaf sizes fit in 16 bits
+			node.primitiveCount[slot] = static_cast<uint16_t>(wideNode.primitiveCount[slot]);
+		}
+
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			auto nodeMin = std::numeric_limits<float>::max();
+			auto nodeMax = -std::numeric_limits<float>::max();
+
+			for (int32_t slot = 0; slot < Width; slot++)
+			{
+				if (node.validMask & (1 << slot))
+				{
+					nodeMin = std::min(nodeMin, wideMin[axis][slot]);
+					nodeMax = std::max(nodeMax, wideMax[axis][slot]);
+				}
+			}
+
+			// Smallest power of two step that spans the node in 254 steps, the spare
+			// step absorbs rounding when the top of the node is dequantized
+			int32_t exponent = 0;
+			std::frexp((nodeMax - nodeMin) / 254.0f, &exponent);
+			exponent = Math::clamp(exponent, -126, 127);
+
+			node.origin[axis] = nodeMin;
+			node.exponent[axis] = static_cast<int8_t>(exponent);
+
+			auto scale = scaleOf(node.exponent[axis]);
+
+			for (int32_t slot = 0; slot < Width; slot++)
+			{
+				if (!(node.validMask & (1 << slot)))
+				{
+					minPlanes[axis][slot] = 255;
+					maxPlanes[axis][slot] = 0;
+					continue;
+				}
+
+				auto low = static_cast<int32_t>(std::floor((wideMin[axis][slot] - nodeMin) / scale));
+				auto high = static_cast<int32_t>(std::ceil((wideMax[axis][slot] - nodeMin) / scale));
+
+				low = Math::clamp(low, 0, 255);
+				high = Math::clamp(high, 0, 255);
+
+				// Step outwards until the dequantized box, computed exactly like the
+				// traversal does, contains the real one
+				while (low > 0 && nodeMin + static_cast<float>(low) * scale > wideMin[axis][slot])
+				{
+					low--;
+				}
+
+				while (high < 255 && nodeMin + static_cast<float>(high) * scale < wideMax[axis][slot])
+				{
+					high++;
+				}
+
+				minPlanes[axis][slot] = static_cast<uint8_t>(low);
+				maxPlanes[axis][slot] = static_cast<uint8_t>(high);
+			}
+		}
+
+		return node;
+	}
+};
\ No newline at end of file
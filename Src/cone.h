@@ -2,74 +2,119 @@
 
 #include "shape.h"
 
-class Cone : public Shape
+inline static bool checkConeCap(const Ray& ray, float t, float y)
 {
-public:
-	Cone(float inMinimum = -std::numeric_limits<float>::max(),
-		 float inMaximum = std::numeric_limits<float>::max(), bool inClosed = false)
-		: minimum(inMinimum), maximum(inMaximum), closed(inClosed)
-	{}
+	auto x = ray.origin.x + t * ray.direction.x;
+	auto z = ray.origin.z + t * ray.direction.z;
+	return (x * x + z * z) <= y * y;
+}
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override
+template<typename HitVisitor>
+inline static void intersectConeCaps(float minimum, float maximum, bool closed, const Ray& ray, HitVisitor&& hitVisitor)
+{
+	// caps only matter if the cone is closed, and might possibly be intersected by the ray.
+	if (!closed || std::fabsf(ray.direction.y) <= EPSILON)
 	{
-		// https://forum.raytracerchallenge.com/thread/166/chapter-cones-all-tests-pass
-		auto origin = transformedRay.origin;
-		auto direction = transformedRay.direction;
+		return;
+	}
 
-		auto a = direction.x * direction.x -
-					  direction.y * direction.y +
-					  direction.z * direction.z;
+	// check for an intersection with the lower end cap by intersecting
+	// the ray with the plane at y=cone.minimum
+	auto t = (minimum - ray.origin.y) / ray.direction.y;
+	if (ray.inRange(t) && checkConeCap(ray, t, minimum))
+	{
+		hitVisitor(t);
+	}
 
-		auto b = 2.0f * origin.x * direction.x - 
-				      2.0f * origin.y * direction.y +
-				      2.0f * origin.z * direction.z;
+	// check for an intersection with the upper end cap by intersecting
+	// the ray with the plane at y=cone.maximum
+	t = (maximum - ray.origin.y) / ray.direction.y;
+	if (ray.inRange(t) && checkConeCap(ray, t, maximum))
+	{
+		hitVisitor(t);
+	}
+}
 
-		auto c = origin.x * origin.x -
-					  origin.y * origin.y +
-					  origin.z * origin.z;
+// The hits of the ray and a double cone around the y axis within [ray.tMin, ray.tMax],
+// the sides first and then the caps, each goes to hitVisitor(t). Cone::localIntersect()
+// and FlatScene share it.
+template<typename HitVisitor>
+inline static void intersectCone(float minimum, float maximum, bool closed, const Ray& ray, HitVisitor&& hitVisitor)
+{
+	// https://forum.raytracerchallenge.com/thread/166/chapter-cones-all-tests-pass
+	auto origin = ray.origin;
+	auto direction = ray.direction;
 
-		std::vector<Intersection> result;
+	auto a = direction.x * direction.x -
+				  direction.y * direction.y +
+				  direction.z * direction.z;
 
-		if (Math::isZeroHighPrecision(a) && !Math::isZeroHighPrecision(b))
-		{
-			auto t = -c / (2.0f * b);
+	auto b = 2.0f * origin.x * direction.x - 
+			      2.0f * origin.y * direction.y +
+			      2.0f * origin.z * direction.z;
+
+	auto c = origin.x * origin.x -
+				  origin.y * origin.y +
+				  origin.z * origin.z;
 
-			result.push_back({ t, shared_from_this() });
+	if (Math::isZeroHighPrecision(a) && !Math::isZeroHighPrecision(b))
+	{
+		auto t = -c / (2.0f * b);
+
+		if (ray.inRange(t))
+		{
+			hitVisitor(t);
 		}
+	}
 
-		if (a > EPSILON_HIGH_PRECISION)
+	if (a > EPSILON_HIGH_PRECISION)
+	{
+		auto discriminant = b * b - 4 * a * c;
+
+		const auto realEpsilon = EPSILON_HIGH_PRECISION * Math::max(std::fabsf(a), std::fabsf(b), std::fabsf(c));
+
+		if (discriminant >= -realEpsilon)
 		{
-			auto discriminant = b * b - 4 * a * c;
+			const auto sqrtDiscriminant = std::sqrtf(std::max(discriminant, 0.0f)); //round to 0 if need be.
 
-			const auto realEpsilon = EPSILON_HIGH_PRECISION * Math::max(std::fabsf(a), std::fabsf(b), std::fabsf(c));
+			auto t0 = (-b - sqrtDiscriminant) / (2.0f * a);
+			auto t1 = (-b + sqrtDiscriminant) / (2.0f * a);
 
-			if (discriminant >= -realEpsilon)
+			if (t0 > t1)
 			{
-				const auto sqrtDiscriminant = std::sqrtf(std::max(discriminant, 0.0f)); //round to 0 if need be.
-
-				auto t0 = (-b - sqrtDiscriminant) / (2.0f * a);
-				auto t1 = (-b + sqrtDiscriminant) / (2.0f * a);
-
-				if (t0 > t1)
-				{
-					std::swap(t0, t1);
-				}
-
-				auto y0 = origin.y + t0 * direction.y;
-				if (Math::between(y0, minimum, maximum))
-				{
-					result.push_back({ t0, shared_from_this() });
-				}
-
-				auto y1 = origin.y + t1 * direction.y;
-				if (Math::between(y1, minimum, maximum))
-				{
-					result.push_back({ t1, shared_from_this() });
-				}
+				std::swap(t0, t1);
+			}
+
+			auto y0 = origin.y + t0 * direction.y;
+			if (Math::between(y0, minimum, maximum) && ray.inRange(t0))
+			{
+				hitVisitor(t0);
+			}
+
+			auto y1 = origin.y + t1 * direction.y;
+			if (Math::between(y1, minimum, maximum) && ray.inRange(t1))
+			{
+				hitVisitor(t1);
 			}
 		}
+	}
+
+	intersectConeCaps(minimum, maximum, closed, ray, hitVisitor);
+}
 
-		intersectCaps(transformedRay, result);
+class Cone : public Shape
+{
+public:
+	Cone(float inMinimum = -std::numeric_limits<float>::max(),
+		 float inMaximum = std::numeric_limits<float>::max(), bool inClosed = false)
+		: minimum(inMinimum), maximum(inMaximum), closed(inClosed)
+	{}
+
+	virtual Intersections localIntersect(const Ray& transformedRay) override
+	{
+		Intersections result;
+
+		intersectCone(minimum, maximum, closed, transformedRay, [&](float t) { result.push_back({ t, this }); });
 
 		return result;
 
@@ -84,7 +129,7 @@ public:
 		//		// If a is zero but b isnt, calc the single point of intersection:
 		//		const auto t = -c / (2.0f * b);
 
-		//		result.push_back({ t, shared_from_this() });
+		//		result.push_back({ t, this });
 		//	}
 		//}
 		//else 
@@ -110,14 +155,14 @@ public:
 
 		//		if (between(y0, minimum, maximum)) 
 		//		{
-		//			result.push_back({ t0, shared_from_this() });
+		//			result.push_back({ t0, this });
 		//		}
 
 		//		const auto y1 = origin.y + t1 * direction.y;
 
 		//		if (between(y1, minimum, maximum))
 		//		{
-		//			result.push_back({ t1, shared_from_this() });
+		//			result.push_back({ t1, this });
 		//		}
 		//	}
 		//}
@@ -152,6 +197,19 @@ public:
 
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
+		// Without both limits the cone is infinitely long
+		if (minimum <= -std::numeric_limits<float>::max() || maximum >= std::numeric_limits<float>::max())
+		{
+			return false;
+		}
+
+		// The radius at height y is |y|, the widest end decides the box
+		auto radius = std::max(std::abs(minimum), std::abs(maximum));
+
+		auto localBox = BoundingBox(point(-radius, minimum, -radius), point(radius, maximum, radius));
+
+		outputBox = transformBoundingBox(localBox, transform);
+
 		return true;
 	}
 
@@ -159,39 +217,6 @@ public:
 	float minimum = std::numeric_limits<float>::min();
 	float maximum = std::numeric_limits<float>::max();
 	bool closed = false;
-
-private:
-	bool checkCap(const Ray& ray, float t, float y)
-	{
-		auto x = ray.origin.x + t * ray.direction.x;
-		auto z = ray.origin.z + t * ray.direction.z;
-		return (x * x + z * z) <= y * y;
-	}
-
-	void intersectCaps(const Ray& ray, std::vector<Intersection>& result)
-	{
-		// caps only matter if the cone is closed, and might possibly be intersected by the ray.
-		if (!closed || std::fabsf(ray.direction.y) <= EPSILON)
-		{
-			return;
-		}
-
-		// check for an intersection with the lower end cap by intersecting
-		// the ray with the plane at y=cone.minimum
-		auto t = (minimum - ray.origin.y) / ray.direction.y;
-		if (checkCap(ray, t, minimum))
-		{
-			result.push_back({ t, shared_from_this() });
-		}
-
-		// check for an intersection with the upper end cap by intersecting
-		// the ray with the plane at y=cone.maximum
-		t = (maximum - ray.origin.y) / ray.direction.y;
-		if (checkCap(ray, t, maximum))
-		{
-			result.push_back({ t, shared_from_this() });
-		}
-	}
 };
 
 inline static std::shared_ptr<Shape> createCone(float minimum = -std::numeric_limits<float>::max(),
@@ -39,39 +39,115 @@ public:
 		Shape::setTransform(inTransform);
 	}
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override
+	virtual Intersections localIntersect(const Ray& transformedRay) override
 	{
-		auto leftIntersections = left->intersect(transformedRay);
-		auto rightIntersections = right->intersect(transformedRay);
+		// Being inside or outside a child depends on every hit along the ray, so the
+		// children see the whole ray and only the result is cut to the interval
+		auto childRay = transformedRay;
+		childRay.tMin = -std::numeric_limits<float>::infinity();
+		childRay.tMax = std::numeric_limits<float>::infinity();
 
-		std::vector<Intersection> combinedIntersections;
+		Intersections combinedIntersections;
 
-		combinedIntersections.insert(combinedIntersections.end(), leftIntersections.begin(), leftIntersections.end());
-		combinedIntersections.insert(combinedIntersections.end(), rightIntersections.begin(), rightIntersections.end());
+		left->intersect(childRay, combinedIntersections);
+		right->intersect(childRay, combinedIntersections);
 
 		sortIntersections(combinedIntersections);
 
-		return filterIntersections(combinedIntersections);
+		auto result = filterIntersections(combinedIntersections);
+
+		result.resize(std::remove_if(result.begin(), result.end(), [&](const Intersection& intersection)
+		{
+			return !transformedRay.inRange(intersection.t);
+		}) - result.begin());
+
+		return result;
 	}
 
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
+		// Children report their bounds in the space of the CSG. An empty child is bounded,
+		// its box becomes the default one so it adds nothing to a union.
+		auto childBounds = [](Shape& child, BoundingBox& outBox)
+		{
+			if (!child.boundingBox(outBox))
+			{
+				return false;
+			}
+
+			if (outBox.isEmpty())
+			{
+				outBox = BoundingBox();
+				return true;
+			}
+
+			return outBox.isValid();
+		};
+
+		BoundingBox leftBox;
+		BoundingBox rightBox;
+
+		auto leftBounded = childBounds(*left, leftBox);
+		auto rightBounded = childBounds(*right, rightBox);
+
+		BoundingBox localBox;
+
+		if (operation == Operation::Union)
+		{
+			if (!leftBounded || !rightBounded)
+			{
+				return false;
+			}
+
+			localBox = surroundingBox(leftBox, rightBox);
+		}
+		else if (operation == Operation::Intersection)
+		{
+			// Only what is inside both children is left, either box limits it
+			if (!leftBounded && !rightBounded)
+			{
+				return false;
+			}
+
+			localBox = !leftBounded ? rightBox : (!rightBounded ? leftBox : overlappingBox(leftBox, rightBox));
+		}
+		else
+		{
+			// A difference is never bigger than its left child
+			if (!leftBounded)
+			{
+				return false;
+			}
+
+			localBox = leftBox;
+		}
+
+		// Children of an intersection that don't overlap leave nothing to hit, the CSG
+		// is bounded and empty like a mesh without triangles
+		if (localBox.isEmpty())
+		{
+			outputBox = BoundingBox();
+			return true;
+		}
+
+		outputBox = transformBoundingBox(localBox, transform);
+
 		return true;
 	}
 
-	virtual bool contains(const std::shared_ptr<Shape>& shape) override
+	virtual bool contains(const Shape* shape) override
 	{
 		return left->contains(shape) || right->contains(shape);
 	}
 
-	std::vector<Intersection> filterIntersections(const std::vector<Intersection>& intersections)
+	Intersections filterIntersections(const Intersections& intersections)
 	{
 		// Begin outside of both children
 		auto inLeft = false;
 		auto inRight = false;
 
 		// Prepare a list to receive the filtered intersections
-		std::vector<Intersection> result;
+		Intersections result;
 
 		for (const auto& intersection : intersections)
 		{
@@ -80,7 +156,7 @@ public:
 
 			if (intersectionAllowed(operation, leftHit, inLeft, inRight))
 			{
-				result.emplace_back(intersection);
+				result.push_back(intersection);
 			}
 
 			// Depending on which object was hit, toggle either inLeft or inRight
@@ -1,9 +1,33 @@
 #pragma once
 
-#include <tuple>
-
 #include "shape.h"
 
+// The two faces of a cube of half size "extent" that the ray crosses, the ones within
+// [ray.tMin, ray.tMax] go to hitVisitor(t), the nearer one first. Cube::localIntersect()
+// and FlatScene share it.
+template<typename HitVisitor>
+inline static void intersectCube(float extent, const Ray& ray, HitVisitor&& hitVisitor)
+{
+	// Both faces the ray crosses are needed, not only the part inside the ray's interval
+	auto tMin = -std::numeric_limits<float>::infinity();
+	auto tMax = std::numeric_limits<float>::infinity();
+
+	if (!intersectSlabs(point(-extent), point(extent), ray, tMin, tMax))
+	{
+		return;
+	}
+
+	if (ray.inRange(tMin))
+	{
+		hitVisitor(tMin);
+	}
+
+	if (ray.inRange(tMax))
+	{
+		hitVisitor(tMax);
+	}
+}
+
 class Cube : public Shape
 {
 public:
@@ -12,21 +36,13 @@ public:
 	{
 	}
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override
+	virtual Intersections localIntersect(const Ray& transformedRay) override
 	{
-		auto [xTMin, xTMax] = checkAxis(transformedRay.origin.x, transformedRay.direction.x);
-		auto [yTMin, yTMax] = checkAxis(transformedRay.origin.y, transformedRay.direction.y);
-		auto [zTMin, zTMax] = checkAxis(transformedRay.origin.z, transformedRay.direction.z);
+		Intersections result;
 
-		auto tMin = Math::max(xTMin, yTMin, zTMin);
-		auto tMax = Math::min(xTMax, yTMax, zTMax);
-
-		if (tMin > tMax)
-		{
-			return {};
-		}
+		intersectCube(extent, transformedRay, [&](float t) { result.push_back({ t, this }); });
 
-		return { { tMin, shared_from_this() }, { tMax, shared_from_this() } };
+		return result;
 	}
 
 	virtual tuple localNormalAt(const tuple& localPosition, const Intersection intersection = {}) const override
@@ -50,41 +66,20 @@ public:
 
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
-		return true;
-	}
+		auto localBox = BoundingBox(point(-extent, -extent, -extent), point(extent, extent, extent));
 
-private:
-	std::tuple<float, float> checkAxis(float origin, float direction)
-	{
-		auto tMinNumerator = (-extent - origin);
-		auto tMaxNumerator = ( extent - origin);
-		auto tMin = INFINITY;
-		auto tMax = INFINITY;
+		outputBox = transformBoundingBox(localBox, transform);
 
-		if (std::fabsf(direction) >= EPSILON)
-		{
-			tMin = tMinNumerator / direction;
-			tMax = tMaxNumerator / direction;
-		}
-		else
-		{
-			// https://pragprog.com/cms/errata/jbtracer-errata/
-			tMin = tMinNumerator * INFINITY;
-			tMax = tMaxNumerator * INFINITY;
-		}
-
-		if (tMin > tMax)
-		{
-			std::swap(tMin, tMax);
-		}
-
-		return { tMin, tMax };
+		return true;
 	}
 
+	float getExtent() const { return extent; }
+
+private:
 	float extent = 1.0f;
 };
 
-std::shared_ptr<Shape> createCube(float extent = 1.0f)
+inline std::shared_ptr<Shape> createCube(float extent = 1.0f)
 {
 	return std::make_shared<Cube>(extent);
 }
\ No newline at end of file
@@ -2,72 +2,117 @@
 
 #include "shape.h"
 
-class Cylinder : public Shape
+// A helper function to reduce duplication.
+// checks to see if the intersection at `t` is within a radius
+// of 1 (the radius of your cylinders) from the y axis.
+inline static bool checkCylinderCap(const Ray& ray, float t)
 {
-public:
-	Cylinder(float inMinimum = -std::numeric_limits<float>::max(), 
-			 float inMaximum = std::numeric_limits<float>::max(), bool inClosed = false)
-	: minimum(inMinimum), maximum(inMaximum), closed(inClosed)
-	{}
+	auto x = ray.origin.x + t * ray.direction.x;
+	auto z = ray.origin.z + t * ray.direction.z;
+
+	// Test case Example 3Example 5ʱz = 1.00000024, ·false
+	return (x * x + z * z) <= (1.0f + EPSILON);
+}
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay)
+template<typename HitVisitor>
+inline static void intersectCylinderCaps(float minimum, float maximum, bool closed, const Ray& ray, HitVisitor&& hitVisitor)
+{
+	// Caps only matter if the cylinder is closed, and might possibly be
+	// intersected by the ray.
+	if (!closed || Math::equal(std::fabsf(ray.direction.y), 0.0f))
 	{
-		auto origin = transformedRay.origin;
-		auto direction = transformedRay.direction;
+		return;
+	}
 
-		auto a = std::powf(direction.x, 2.0f) + 
-					  std::powf(direction.z, 2.0f);
+	// Check for an intersection with the lower end cap by intersecting
+	// the ray with the plane at y = cylinder.minimum
+	auto t0 = (minimum - ray.origin.y) / ray.direction.y;
+	if (ray.inRange(t0) && checkCylinderCap(ray, t0))
+	{
+		hitVisitor(t0);
+	}
 
-		// Ray is parallel to the y axis
-		if (Math::equal(a, 0.0f))
-		{
-			std::vector<Intersection> result;
-			intersectCaps(transformedRay, result);
-			return result;
-		}
+	// Check for an intersection with the upper end cap by intersecting
+	// the ray with the plane at y = cylinder.maximum
+	auto t1 = (maximum - ray.origin.y) / ray.direction.y;
+	if (ray.inRange(t1) && checkCylinderCap(ray, t1))
+	{
+		hitVisitor(t1);
+	}
+}
 
-		auto b = 2.0f * origin.x * direction.x +
-					  2.0f * origin.z * direction.z;
+// The hits of the ray and a unit cylinder around the y axis within [ray.tMin, ray.tMax],
+// the sides first and then the caps, each goes to hitVisitor(t). Cylinder::localIntersect()
+// and FlatScene share it.
+template<typename HitVisitor>
+inline static void intersectCylinder(float minimum, float maximum, bool closed, const Ray& ray, HitVisitor&& hitVisitor)
+{
+	auto origin = ray.origin;
+	auto direction = ray.direction;
 
-		auto c = std::powf(origin.x, 2.0f) +
-					  std::powf(origin.z, 2.0f) - 1.0f;
+	auto a = std::powf(direction.x, 2.0f) + 
+				  std::powf(direction.z, 2.0f);
 
-		auto discriminant = b * b - 4 * a * c;
+	// Ray is parallel to the y axis
+	if (Math::equal(a, 0.0f))
+	{
+		intersectCylinderCaps(minimum, maximum, closed, ray, hitVisitor);
+		return;
+	}
 
-		// Ray does not intersect the cylinder
-		if (discriminant < 0.0f)
-		{
-			return {};
-		}
+	auto b = 2.0f * origin.x * direction.x +
+				  2.0f * origin.z * direction.z;
 
-		auto t0 = (-b - std::sqrtf(discriminant)) / (2.0f * a);
-		auto t1 = (-b + std::sqrtf(discriminant)) / (2.0f * a);
+	auto c = std::powf(origin.x, 2.0f) +
+				  std::powf(origin.z, 2.0f) - 1.0f;
 
-		if (t0 > t1)
-		{
-			std::swap(t0, t1);
-		}
+	auto discriminant = b * b - 4 * a * c;
 
-		std::vector<Intersection> result;
+	// Ray does not intersect the cylinder
+	if (discriminant < 0.0f)
+	{
+		return;
+	}
 
-		auto y0 = origin.y + t0 * direction.y;
+	auto t0 = (-b - std::sqrtf(discriminant)) / (2.0f * a);
+	auto t1 = (-b + std::sqrtf(discriminant)) / (2.0f * a);
 
-		if (y0 > minimum && y0 < maximum)
-		{
-			result.push_back({ t0, shared_from_this() });
-		}
+	if (t0 > t1)
+	{
+		std::swap(t0, t1);
+	}
 
-		auto y1 = origin.y + t1 * direction.y;
+	auto y0 = origin.y + t0 * direction.y;
 
-		if (y1 > minimum && y1 < maximum)
-		{
-			result.push_back({ t1, shared_from_this() });
-		}
+	if (y0 > minimum && y0 < maximum && ray.inRange(t0))
+	{
+		hitVisitor(t0);
+	}
+
+	auto y1 = origin.y + t1 * direction.y;
 
-		intersectCaps(transformedRay, result);
+	if (y1 > minimum && y1 < maximum && ray.inRange(t1))
+	{
+		hitVisitor(t1);
+	}
+
+	intersectCylinderCaps(minimum, maximum, closed, ray, hitVisitor);
+}
+
+class Cylinder : public Shape
+{
+public:
+	Cylinder(float inMinimum = -std::numeric_limits<float>::max(), 
+			 float inMaximum = std::numeric_limits<float>::max(), bool inClosed = false)
+	: minimum(inMinimum), maximum(inMaximum), closed(inClosed)
+	{}
+
+	virtual Intersections localIntersect(const Ray& transformedRay)
+	{
+		Intersections result;
+
+		intersectCylinder(minimum, maximum, closed, transformedRay, [&](float t) { result.push_back({ t, this }); });
 
-		// This is just a placeholder, to ensure the tests
-		// pass that expect the ray to miss
 		return result;
 	}
 
@@ -90,6 +135,16 @@ public:
 
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
+		// Without both limits the cylinder is infinitely long
+		if (minimum <= -std::numeric_limits<float>::max() || maximum >= std::numeric_limits<float>::max())
+		{
+			return false;
+		}
+
+		auto localBox = BoundingBox(point(-1.0f, minimum, -1.0f), point(1.0f, maximum, 1.0f));
+
+		outputBox = transformBoundingBox(localBox, transform);
+
 		return true;
 	}
 
@@ -97,44 +152,6 @@ public:
 	float minimum = std::numeric_limits<float>::min();
 	float maximum = std::numeric_limits<float>::max();
 	bool closed = false;
-private:
-	// A helper function to reduce duplication.
-	// checks to see if the intersection at `t` is within a radius
-	// of 1 (the radius of your cylinders) from the y axis.
-	bool checkCap(const Ray& ray, float t)
-	{
-		auto x = ray.origin.x + t * ray.direction.x;
-		auto z = ray.origin.z + t * ray.direction.z;
-
-		// Test case Example 3Example 5ʱz = 1.00000024, ·false
-		return (x * x + z * z) <= (1.0f + EPSILON);
-	}
-
-	void intersectCaps(const Ray& ray, std::vector<Intersection>& result)
-	{
-		// Caps only matter if the cylinder is closed, and might possibly be
-		// intersected by the ray.
-		if (!closed || Math::equal(std::fabsf(ray.direction.y), 0.0f))
-		{
-			return;
-		}
-
-		// Check for an intersection with the lower end cap by intersecting
-		// the ray with the plane at y = cylinder.minimum
-		auto t0 = (minimum - ray.origin.y) / ray.direction.y;
-		if (checkCap(ray, t0))
-		{
-			result.push_back({ t0, shared_from_this() });
-		}
-
-		// Check for an intersection with the upper end cap by intersecting
-		// the ray with the plane at y = cylinder.maximum
-		auto t1 = (maximum - ray.origin.y) / ray.direction.y;
-		if (checkCap(ray, t1))
-		{
-			result.push_back({ t1, shared_from_this() });
-		}
-	}
 };
 
 inline static std::shared_ptr<Shape> createCylinder(float minimum = -std::numeric_limits<float>::max(),
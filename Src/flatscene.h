@@ -0,0 +1,625 @@
+#pragma once
+
+#include "group.h"
+#include "cone.h"
+#include "cylinder.h"
+#include "plane.h"
+#include "sphere.h"
+
+#include <array>
+#include <typeinfo>
+
+// A primitive of a FlatScene: the array it is in and its position there
+struct FlatPrimitive
+{
+	ShapeType type = ShapeType::Other;
+	uint32_t index = 0;
+};
+
+// The primitives with an intersection test FlatScene can call directly. inversedTransform
+// goes from world space to the primitive's space, the transforms of the groups it was in
+// included. "shape" is what the hits report, the shading still goes through it.
+struct FlatSphere
+{
+	matrix4 inversedTransform;
+	tuple center;
+	float radius = 1.0f;
+	Shape* shape = nullptr;
+};
+
+struct FlatPlane
+{
+	matrix4 inversedTransform;
+	float extentX = 0.0f;
+	float extentZ = 0.0f;
+	Shape* shape = nullptr;
+};
+
+struct FlatCube
+{
+	matrix4 inversedTransform;
+	float extent = 1.0f;
+	Shape* shape = nullptr;
+};
+
+// Cylinders and cones have the same parameters
+struct FlatCylinder
+{
+	matrix4 inversedTransform;
+	float minimum = 0.0f;
+	float maximum = 0.0f;
+	bool closed = false;
+	Shape* shape = nullptr;
+};
+
+struct FlatTriangle
+{
+	matrix4 inversedTransform;
+	tuple p0;
+	tuple e0;
+	tuple e1;
+	Shape* shape = nullptr;
+};
+
+// Everything else (CSG, meshes, instances, moving shapes...) keeps its own virtual
+// intersection tests. The rays are only brought into the space of its parent group.
+struct FlatShape
+{
+	matrix4 parentInversedTransform;
+	Shape* shape = nullptr;
+
+	// Top level shapes take the rays as they are
+	bool inGroup = false;
+};
+
+// The objects of a World frozen for rendering (World::commit()). Groups are dissolved, their
+// primitives go into one array per type with their world transforms worked out, and one BVH
+// over all of them replaces the World's and the groups' BVHs. The queries switch on the
+// primitive type instead of calling through the Shape vtable and walking the group tree.
+//
+// The shapes are not owned, the World keeps them alive. Changes to them after the build
+// are not seen, World::commit() builds again.
+class FlatScene
+{
+public:
+	void build(const std::vector<std::shared_ptr<Shape>>& objects, BVHBuildQuality quality = BVHBuildQuality::SAH)
+	{
+		clear();
+
+		std::vector<BoundingBox> sphereBounds;
+		std::vector<BoundingBox> planeBounds;
+		std::vector<BoundingBox> cubeBounds;
+		std::vector<BoundingBox> cylinderBounds;
+		std::vector<BoundingBox> coneBounds;
+		std::vector<BoundingBox> triangleBounds;
+		std::vector<BoundingBox> otherBounds;
+
+		// World space corners of the triangles, for the spatial split clipper
+		std::vector<std::array<tuple, 3>> triangleCorners;
+
+		// Bounds of a shape whose parent has the given world transform. Shapes without
+		// finite bounds get an infinite box, empty ones the default (empty) box.
+		auto worldBounds = [](Shape& shape, const matrix4& parentTransform)
+		{
+			BoundingBox box;
+
+			if (!shape.boundingBox(box))
+			{
+				return BoundingBox(point(-std::numeric_limits<float>::infinity()), point(std::numeric_limits<float>::infinity()));
+			}
+
+			if (box.isEmpty())
+			{
+				return BoundingBox();
+			}
+
+			return box.isValid() ? transformBoundingBox(box, parentTransform) : box;
+		};
+
+		auto flatten = [&](auto&& self, const std::shared_ptr<Shape>& object, const matrix4& parentTransform, const matrix4& parentInversedTransform, bool inGroup) -> void
+		{
+			auto& shape = *object;
+			const auto& type = typeid(shape);
+			auto inversedTransform = shape.inversedTransform * parentInversedTransform;
+
+			if (type == typeid(Group))
+			{
+				for (const auto& child : static_cast<Group&>(shape).shapes)
+				{
+					self(self, child, parentTransform * shape.transform, inversedTransform, true);
+				}
+			}
+			else if (type == typeid(Sphere))
+			{
+				const auto& sphere = static_cast<Sphere&>(shape);
+				spheres.push_back({ inversedTransform, sphere.center, sphere.radius, &shape });
+				sphereBounds.emplace_back(worldBounds(shape, parentTransform));
+			}
+			else if (type == typeid(Plane))
+			{
+				const auto& plane = static_cast<Plane&>(shape);
+				planes.push_back({ inversedTransform, plane.extentX, plane.extentZ, &shape });
+				planeBounds.emplace_back(worldBounds(shape, parentTransform));
+			}
+			else if (type == typeid(Cube))
+			{
+				cubes.push_back({ inversedTransform, static_cast<Cube&>(shape).getExtent(), &shape });
+				cubeBounds.emplace_back(worldBounds(shape, parentTransform));
+			}
+			else if (type == typeid(Cylinder))
+			{
+				const auto& cylinder = static_cast<Cylinder&>(shape);
+				cylinders.push_back({ inversedTransform, cylinder.minimum, cylinder.maximum, cylinder.closed, &shape });
+				cylinderBounds.emplace_back(worldBounds(shape, parentTransform));
+			}
+			else if (type == typeid(Cone))
+			{
+				const auto& cone = static_cast<Cone&>(shape);
+				cones.push_back({ inversedTransform, cone.minimum, cone.maximum, cone.closed, &shape });
+				coneBounds.emplace_back(worldBounds(shape, parentTransform));
+			}
+			else if (type == typeid(Triangle))
+			{
+				const auto& triangle = static_cast<Triangle&>(shape);
+				triangles.push_back({ inversedTransform, triangle.p0, triangle.e0, triangle.e1, &shape });
+				triangleBounds.emplace_back(worldBounds(shape, parentTransform));
+
+				auto transform = parentTransform * shape.transform;
+				triangleCorners.push_back({ transform * triangle.p0, transform * triangle.p1, transform * triangle.p2 });
+			}
+			else
+			{
+				others.push_back({ parentInversedTransform, &shape, inGroup });
+				otherBounds.emplace_back(worldBounds(shape, parentTransform));
+			}
+		};
+
+		for (const auto& object : objects)
+		{
+			flatten(flatten, object, matrix4(1.0f), matrix4(1.0f), false);
+		}
+
+		// Primitives are listed type by type, shapes without finite bounds (planes,
+		// infinite cylinders...) are kept aside and tested on every ray
+		std::vector<BoundingBox> bounds;
+
+		auto addPrimitives = [&](ShapeType type, const std::vector<BoundingBox>& typeBounds)
+		{
+			for (uint32_t i = 0; i < static_cast<uint32_t>(typeBounds.size()); i++)
+			{
+				// Nothing to hit in an empty box
+				if (typeBounds[i].isEmpty())
+				{
+					continue;
+				}
+
+				if (!typeBounds[i].isValid())
+				{
+					unboundedPrimitives.push_back({ type, i });
+					continue;
+				}
+
+				boundedPrimitives.push_back({ type, i });
+				bounds.emplace_back(typeBounds[i]);
+			}
+		};
+
+		addPrimitives(ShapeType::Sphere, sphereBounds);
+		addPrimitives(ShapeType::Plane, planeBounds);
+		addPrimitives(ShapeType::Cube, cubeBounds);
+		addPrimitives(ShapeType::Cylinder, cylinderBounds);
+		addPrimitives(ShapeType::Cone, coneBounds);
+		addPrimitives(ShapeType::Triangle, triangleBounds);
+		addPrimitives(ShapeType::Other, otherBounds);
+
+		auto clipper = [&](uint32_t primitive, const BoundingBox& clip)
+		{
+			const auto& flatPrimitive = boundedPrimitives[primitive];
+
+			if (flatPrimitive.type == ShapeType::Triangle)
+			{
+				const auto& corners = triangleCorners[flatPrimitive.index];
+				return clippedTriangleBounds(corners[0], corners[1], corners[2], clip);
+			}
+
+			return overlappingBox(bounds[primitive], clip);
+		};
+
+		BVH bvh;
+		bvh.build(bounds, quality, clipper);
+
+		WideBVH wideBVH;
+		wideBVH.collapse(bvh);
+		compressedBVH.compress(wideBVH);
+
+		splitReferences = bvh.hasSplitReferences();
+		built = true;
+	}
+
+	void clear()
+	{
+		spheres.clear();
+		planes.clear();
+		cubes.clear();
+		cylinders.clear();
+		cones.clear();
+		triangles.clear();
+		others.clear();
+		boundedPrimitives.clear();
+		unboundedPrimitives.clear();
+		compressedBVH = {};
+		splitReferences = false;
+		built = false;
+	}
+
+	bool isBuilt() const { return built; }
+
+	// Nearest hit within [ray.tMin, ray.tMax], written to outHit only when there is one
+	bool intersectClosest(const Ray& ray, Intersection& outHit) const
+	{
+		auto closestRay = ray;
+		auto found = false;
+
+		traverse(closestRay, closestRay.tMax, [&](const FlatPrimitive& primitive)
+		{
+			if (intersectClosest(primitive, closestRay, outHit))
+			{
+				found = true;
+				closestRay.tMax = outHit.t;
+			}
+		});
+
+		return found;
+	}
+
+	// intersectClosest() for the lanes of a packet in laneMask, each BVH node is read once
+	// for all of them. Returns the mask of the lanes with a hit in outHits.
+	uint32_t intersectClosestPacket(const RayPacket& packet, uint32_t laneMask, Intersection* outHits) const
+	{
+		auto closestPacket = packet;
+		uint32_t hitMask = 0;
+
+		auto intersectLanes = [&](const FlatPrimitive& primitive, uint32_t lanes)
+		{
+			Intersection hits[RayPacket::Width];
+
+			for (auto hitLanes = intersectClosestPacket(primitive, closestPacket, lanes, hits); hitLanes != 0; hitLanes &= hitLanes - 1)
+			{
+				auto lane = std::countr_zero(hitLanes);
+
+				outHits[lane] = hits[lane];
+				closestPacket.rays[lane].tMax = hits[lane].t;
+				hitMask |= 1 << lane;
+			}
+		};
+
+		for (const auto& primitive : unboundedPrimitives)
+		{
+			intersectLanes(primitive, laneMask);
+		}
+
+		// Same as in traverse(), with the lanes that already visited a primitive
+		VisitedPrimitives visited(splitReferences);
+
+		auto primitiveIndices = compressedBVH.getPrimitiveIndices();
+
+		compressedBVH.traversePacketLeaves(closestPacket, laneMask, [&](uint32_t leafFirst, uint32_t primitiveCount, uint32_t leafLanes)
+		{
+			for (uint32_t i = 0; i < primitiveCount; i++)
+			{
+				auto primitive = primitiveIndices[leafFirst + i];
+
+				if (auto lanes = visited.visit(primitive, leafLanes); lanes != 0)
+				{
+					intersectLanes(boundedPrimitives[primitive], lanes);
+				}
+			}
+		});
+
+		return hitMask;
+	}
+
+	// Whether anything that casts a shadow is hit within [ray.tMin, ray.tMax]
+	bool intersectAny(const Ray& ray) const
+	{
+		auto occludedRay = ray;
+		auto occluded = false;
+
+		traverse(occludedRay, occludedRay.tMax, [&](const FlatPrimitive& primitive)
+		{
+			if (occluded)
+			{
+				return;
+			}
+
+			if (primitive.type == ShapeType::Other)
+			{
+				const auto& other = others[primitive.index];
+				Ray groupRay;
+
+				occluded = other.shape->intersectAny(parentSpace(other, occludedRay, groupRay));
+			}
+			else
+			{
+				intersectPrimitive(primitive, occludedRay, [&](const Intersection& hit)
+				{
+					occluded = occluded || hit.shape->getMaterial().castShadow;
+				});
+			}
+
+			if (occluded)
+			{
+				// Nothing fits in an empty interval, the traversal just drains its stack
+				occludedRay.tMax = -std::numeric_limits<float>::infinity();
+			}
+		});
+
+		return occluded;
+	}
+
+	// Appends every hit within [ray.tMin, ray.tMax] to outHits, unsorted
+	void intersect(const Ray& ray, Intersections& outHits) const
+	{
+		traverse(ray, ray.tMax, [&](const FlatPrimitive& primitive)
+		{
+			if (primitive.type == ShapeType::Other)
+			{
+				const auto& other = others[primitive.index];
+				Ray groupRay;
+
+				other.shape->intersect(parentSpace(other, ray, groupRay), outHits);
+			}
+			else
+			{
+				intersectPrimitive(primitive, ray, [&](const Intersection& hit) { outHits.push_back(hit); });
+			}
+		});
+	}
+
+	size_t primitiveCount(ShapeType type) const
+	{
+		switch (type)
+		{
+		case ShapeType::Sphere:
+			return spheres.size();
+		case ShapeType::Plane:
+			return planes.size();
+		case ShapeType::Cube:
+			return cubes.size();
+		case ShapeType::Cylinder:
+			return cylinders.size();
+		case ShapeType::Cone:
+			return cones.size();
+		case ShapeType::Triangle:
+			return triangles.size();
+		default:
+			return others.size();
+		}
+	}
+
+private:
+	// Calls visitor(primitive) for the unbounded primitives and then for the bounded ones
+	// whose bounds the ray hits within [ray.tMin, tMax], nearest first. tMax is read again
+	// after every visit. Spatial splits can put a primitive in several leaves, each one is
+	// visited only once.
+	template<typename Visitor>
+	void traverse(const Ray& ray, const float& tMax, Visitor&& visitor) const
+	{
+		for (const auto& primitive : unboundedPrimitives)
+		{
+			visitor(primitive);
+		}
+
+		VisitedPrimitives visited(splitReferences);
+
+		compressedBVH.traverse(ray, ray.tMin, tMax, [&](uint32_t primitive)
+		{
+			if (visited.visit(primitive) != 0)
+			{
+				visitor(boundedPrimitives[primitive]);
+			}
+		});
+	}
+
+	// The ray in the space of the parent group of a shape, transformed into outRay when
+	// the shape is in one
+	static const Ray& parentSpace(const FlatShape& other, const Ray& ray, Ray& outRay)
+	{
+		if (!other.inGroup)
+		{
+			return ray;
+		}
+
+		outRay = transformRay(ray, other.parentInversedTransform);
+
+		return outRay;
+	}
+
+	static const RayPacket& parentSpace(const FlatShape& other, const RayPacket& packet, uint32_t laneMask, RayPacket& outPacket)
+	{
+		if (!other.inGroup)
+		{
+			return packet;
+		}
+
+		outPacket = transformRayPacket(packet, laneMask, other.parentInversedTransform);
+
+		return outPacket;
+	}
+
+	// Nearest hit of one primitive within [ray.tMin, ray.tMax], written to outHit only
+	// when there is one
+	bool intersectClosest(const FlatPrimitive& primitive, const Ray& ray, Intersection& outHit) const
+	{
+		if (primitive.type == ShapeType::Other)
+		{
+			const auto& other = others[primitive.index];
+			Ray groupRay;
+
+			return other.shape->intersectClosest(parentSpace(other, ray, groupRay), outHit);
+		}
+
+		auto found = false;
+
+		intersectPrimitive(primitive, ray, [&](const Intersection& hit)
+		{
+			if (!found || hit.t < outHit.t)
+			{
+				outHit = hit;
+				found = true;
+			}
+		});
+
+		return found;
+	}
+
+	// intersectClosest() of one primitive for the lanes of a packet in laneMask. Spheres,
+	// planes and triangles test the four lanes together with their shapes' packet kernels,
+	// groups, meshes and instances with their own intersectClosestPacket().
+	uint32_t intersectClosestPacket(const FlatPrimitive& primitive, const RayPacket& packet, uint32_t laneMask, Intersection* outHits) const
+	{
+		uint32_t hitMask = 0;
+
+		switch (primitive.type)
+		{
+#ifdef ARIA_SIMD_SSE
+		case ShapeType::Sphere:
+		{
+			const auto& sphere = spheres[primitive.index];
+			float hitT[RayPacket::Width];
+
+			hitMask = intersectSpherePacket(sphere.center, sphere.radius, RayPacketLanes(transformRayPacket(packet, laneMask, sphere.inversedTransform), laneMask), hitT);
+
+			for (auto lanes = hitMask; lanes != 0; lanes &= lanes - 1)
+			{
+				auto lane = std::countr_zero(lanes);
+				outHits[lane] = { hitT[lane], sphere.shape };
+			}
+
+			break;
+		}
+		case ShapeType::Plane:
+		{
+			const auto& plane = planes[primitive.index];
+			float hitT[RayPacket::Width];
+
+			hitMask = intersectPlanePacket(plane.extentX, plane.extentZ, RayPacketLanes(transformRayPacket(packet, laneMask, plane.inversedTransform), laneMask), hitT);
+
+			for (auto lanes = hitMask; lanes != 0; lanes &= lanes - 1)
+			{
+				auto lane = std::countr_zero(lanes);
+				outHits[lane] = { hitT[lane], plane.shape };
+			}
+
+			break;
+		}
+		case ShapeType::Triangle:
+		{
+			const auto& triangle = triangles[primitive.index];
+			float hitT[RayPacket::Width];
+			float hitU[RayPacket::Width];
+			float hitV[RayPacket::Width];
+
+			hitMask = intersectTrianglePacket(triangle.p0, triangle.e0, triangle.e1, RayPacketLanes(transformRayPacket(packet, laneMask, triangle.inversedTransform), laneMask), hitT, hitU, hitV);
+
+			for (auto lanes = hitMask; lanes != 0; lanes &= lanes - 1)
+			{
+				auto lane = std::countr_zero(lanes);
+				outHits[lane] = intersectionWithUV(hitT[lane], triangle.shape, hitU[lane], hitV[lane]);
+			}
+
+			break;
+		}
+#endif
+		case ShapeType::Other:
+		{
+			const auto& other = others[primitive.index];
+			RayPacket groupPacket;
+
+			hitMask = other.shape->intersectClosestPacket(parentSpace(other, packet, laneMask, groupPacket), laneMask, outHits);
+			break;
+		}
+		default:
+			for (auto lanes = laneMask; lanes != 0; lanes &= lanes - 1)
+			{
+				auto lane = std::countr_zero(lanes);
+
+				if (intersectClosest(primitive, packet.rays[lane], outHits[lane]))
+				{
+					hitMask |= 1 << lane;
+				}
+			}
+
+			break;
+		}
+
+		return hitMask;
+	}
+
+	// Calls hitVisitor(intersection) for every hit of a primitive with a direct test
+	// within [ray.tMin, ray.tMax]
+	template<typename HitVisitor>
+	void intersectPrimitive(const FlatPrimitive& primitive, const Ray& ray, HitVisitor&& hitVisitor) const
+	{
+		switch (primitive.type)
+		{
+		case ShapeType::Sphere:
+		{
+			const auto& sphere = spheres[primitive.index];
+			intersectSphere(sphere.center, sphere.radius, transformRay(ray, sphere.inversedTransform), [&](float t) { hitVisitor(Intersection{ t, sphere.shape }); });
+			break;
+		}
+		case ShapeType::Plane:
+		{
+			const auto& plane = planes[primitive.index];
+			intersectPlane(plane.extentX, plane.extentZ, transformRay(ray, plane.inversedTransform), [&](float t) { hitVisitor(Intersection{ t, plane.shape }); });
+			break;
+		}
+		case ShapeType::Cube:
+		{
+			const auto& cube = cubes[primitive.index];
+			intersectCube(cube.extent, transformRay(ray, cube.inversedTransform), [&](float t) { hitVisitor(Intersection{ t, cube.shape }); });
+			break;
+		}
+		case ShapeType::Cylinder:
+		{
+			const auto& cylinder = cylinders[primitive.index];
+			intersectCylinder(cylinder.minimum, cylinder.maximum, cylinder.closed, transformRay(ray, cylinder.inversedTransform), [&](float t) { hitVisitor(Intersection{ t, cylinder.shape }); });
+			break;
+		}
+		case ShapeType::Cone:
+		{
+			const auto& cone = cones[primitive.index];
+			intersectCone(cone.minimum, cone.maximum, cone.closed, transformRay(ray, cone.inversedTransform), [&](float t) { hitVisitor(Intersection{ t, cone.shape }); });
+			break;
+		}
+		case ShapeType::Triangle:
+		{
+			const auto& triangle = triangles[primitive.index];
+			intersectTriangle(triangle.p0, triangle.e0, triangle.e1, transformRay(ray, triangle.inversedTransform), [&](float t, float u, float v)
+			{
+				hitVisitor(intersectionWithUV(t, triangle.shape, u, v));
+			});
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	std::vector<FlatSphere> spheres;
+	std::vector<FlatPlane> planes;
+	std::vector<FlatCube> cubes;
+	std::vector<FlatCylinder> cylinders;
+	std::vector<FlatCylinder> cones;
+	std::vector<FlatTriangle> triangles;
+	std::vector<FlatShape> others;
+
+	// boundedPrimitives is what the BVH's primitive indices point into
+	std::vector<FlatPrimitive> boundedPrimitives;
+	std::vector<FlatPrimitive> unboundedPrimitives;
+
+	CompressedBVH compressedBVH;
+	bool splitReferences = false;
+	bool built = false;
+};
\ No newline at end of file
@@ -1,110 +1,173 @@
 #pragma once
 
 #include "shape.h"
+#include "shapebvh.h"
 
 #include "cube.h"
+#include "triangle.h"
+#include "trianglemesh.h"
 
 class Group : public Shape
 {
 public:
 	Group() = default;
 
-	virtual void setTransform(const matrix4& inTransform) override
+	using Shape::intersect;
+
+	// The children append to the caller's list directly
+	virtual void intersect(const Ray& ray, Intersections& outHits) override
 	{
-		Shape::setTransform(inTransform);
-
-		auto minX = aabb.min.x;
-		auto minY = aabb.min.y;
-		auto minZ = aabb.min.z;
-
-		auto maxX = aabb.max.x;
-		auto maxY = aabb.max.y;
-		auto maxZ = aabb.max.z;
-
-		std::vector<tuple> cornerPoints =
-		{
-			{ minX, minY, minZ, 1.0 },
-			{ minX, minY, maxZ, 1.0 },
-			{ minX, maxY, minZ, 1.0 },
-			{ minX, maxY, maxZ, 1.0 },
-			{ maxX, minY, minZ, 1.0 },
-			{ maxX, minY, maxZ, 1.0 },
-			{ maxX, maxY, minZ, 1.0 },
-			{ maxX, maxY, maxZ, 1.0 }
-		};
+		intersectChildren(transformRay(ray, inversedTransform), outHits);
+	}
 
-		// Theoretically, the AABB of the Group only needs to be scaled and rotated, 
-		// and should not be translated, because based on the current implementation 
-		// the ray will be transformed to the space where the Group is located, in fact 
-		// the Group itself is always located at the origin of the Object space, scaling,
-		// rotation, and translation are all for the ray.
-		std::for_each(cornerPoints.begin(), cornerPoints.end(),
-		[&](tuple& point)
-		{
-			point = rotateZ(rotation.z) * 
-					rotateY(rotation.y) * 
-				    rotateX(rotation.x) * scale * point;
-		});
+	virtual Intersections localIntersect(const Ray& transformedRay) override 
+	{ 
+		Intersections result;
 
-		tuple min = point(std::numeric_limits<float>::max());
-		tuple max = point(-std::numeric_limits<float>::max());
+		intersectChildren(transformedRay, result);
 
-		for (const auto& point : cornerPoints)
-		{
-			min.x = std::min(min.x, point.x);
-			min.y = std::min(min.y, point.y);
-			min.z = std::min(min.z, point.z);
+		return result;
+	}
+
+	// Children are asked for their closest hit too, each hit shrinks the ray so the BVH
+	// skips the children behind it
+	virtual bool intersectClosest(const Ray& ray, Intersection& outHit) override
+	{
+		auto localRay = transformRay(ray, inversedTransform);
 
-			max.x = std::max(max.x, point.x);
-			max.y = std::max(max.y, point.y);
-			max.z = std::max(max.z, point.z);
+		if (shapes.empty() || (!unbounded && !aabb.hit(localRay, localRay.tMin, localRay.tMax)))
+		{
+			return false;
 		}
 
-		aabb = BoundingBox(min, max);
+		auto found = false;
 
-		auto scaleX = (aabb.max.x - aabb.min.x) / scale.x;
-		auto scaleY = (aabb.max.y - aabb.min.y) / scale.y;
-		auto scaleZ = (aabb.max.z - aabb.min.z) / scale.z;
+		auto intersectChild = [&](const std::shared_ptr<Shape>& shape)
+		{
+			if (shape->intersectClosest(localRay, outHit))
+			{
+				found = true;
+				localRay.tMax = outHit.t;
+			}
+		};
 
-		cube = createCube(scaleX * 0.5f);
-		cube->material = Materials::DarkRed;
-		cube->material.refractiveIndex = 1.0f;
-		cube->material.transparency = 1.0f;
+		if (shapes.size() >= BVHThreshold)
+		{
+			childBVH.traverse(shapes, localRay, localRay.tMax, intersectChild, [&](Triangle& triangle, float t, float u, float v)
+			{
+				outHit = triangle.hitAt(t, u, v);
+				found = true;
+				localRay.tMax = t;
+			});
+		}
+		else
+		{
+			std::for_each(shapes.begin(), shapes.end(), intersectChild);
+		}
 
-		//shapes.emplace_back(cube);
+		return found;
 	}
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override 
-	{ 
-		if (shapes.empty())
+	// Same as intersectClosest() for the lanes of a packet, the children BVH is traversed
+	// once for all of them and the children get the lanes that reach them
+	virtual uint32_t intersectClosestPacket(const RayPacket& packet, uint32_t laneMask, Intersection* outHits) override
+	{
+		auto localPacket = transformRayPacket(packet, laneMask, inversedTransform);
+
+		for (auto lanes = laneMask; lanes != 0; lanes &= lanes - 1)
 		{
-			return {};
+			auto lane = std::countr_zero(lanes);
+			const auto& localRay = localPacket.rays[lane];
+
+			if (!unbounded && !aabb.hit(localRay, localRay.tMin, localRay.tMax))
+			{
+				laneMask &= ~(1u << lane);
+			}
 		}
 
-		if (!aabb.hit(transformedRay))
+		if (shapes.empty() || laneMask == 0)
 		{
-			//std::cout << "Miss" << std::endl;
-			return {};
+			return 0;
 		}
 
-		//auto aabbResult = cube->localIntersect(transformedRay);
+		uint32_t hitMask = 0;
+
+		auto intersectChild = [&](const std::shared_ptr<Shape>& shape, uint32_t childLanes)
+		{
+			Intersection childHits[RayPacket::Width];
 
-		//if (aabbResult.empty())
-		//{
-			//return {};
-		//}
+			for (auto lanes = shape->intersectClosestPacket(localPacket, childLanes, childHits); lanes != 0; lanes &= lanes - 1)
+			{
+				auto lane = std::countr_zero(lanes);
 
-		std::vector<Intersection> result;
+				outHits[lane] = childHits[lane];
+				localPacket.rays[lane].tMax = childHits[lane].t;
+				hitMask |= 1 << lane;
+			}
+		};
 
-		for (const auto& shape : shapes)
+		if (shapes.size() >= BVHThreshold)
 		{
-			auto intersections = shape->intersect(transformedRay);
-			result.insert(result.end(), intersections.begin(), intersections.end());
+			childBVH.traversePacket(shapes, localPacket, laneMask, intersectChild, [&](Triangle& triangle, int32_t lane, float t, float u, float v)
+			{
+				outHits[lane] = triangle.hitAt(t, u, v);
+				localPacket.rays[lane].tMax = t;
+				hitMask |= 1 << lane;
+			});
+		}
+		else
+		{
+			for (const auto& shape : shapes)
+			{
+				intersectChild(shape, laneMask);
+			}
 		}
 
-		sortIntersections(result);
+		return hitMask;
+	}
 
-		return result;
+	virtual bool intersectAny(const Ray& ray) override
+	{
+		auto localRay = transformRay(ray, inversedTransform);
+
+		if (shapes.empty() || (!unbounded && !aabb.hit(localRay, localRay.tMin, localRay.tMax)))
+		{
+			return false;
+		}
+
+		auto intersectChild = [&localRay](const std::shared_ptr<Shape>& shape) { return shape->intersectAny(localRay); };
+
+		if (shapes.size() < BVHThreshold)
+		{
+			return std::any_of(shapes.begin(), shapes.end(), intersectChild);
+		}
+
+		auto occluded = false;
+
+		auto setOccluded = [&]()
+		{
+			occluded = true;
+
+			// Nothing fits in an empty interval, the traversal just drains its stack
+			localRay.tMax = -std::numeric_limits<float>::infinity();
+		};
+
+		childBVH.traverse(shapes, localRay, localRay.tMax, [&](const std::shared_ptr<Shape>& shape)
+		{
+			if (!occluded && intersectChild(shape))
+			{
+				setOccluded();
+			}
+		},
+		[&](Triangle& triangle, float, float, float)
+		{
+			if (!occluded && triangle.getMaterial().castShadow)
+			{
+				setOccluded();
+			}
+		});
+
+		return occluded;
 	}
 
 	virtual tuple localNormalAt(const tuple& localPosition, const Intersection intersection = {}) const override
@@ -114,9 +177,10 @@ public:
 
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
-		outputBox = aabb;
+		// aabb is in the group's object space, and stays empty (inverted) without bounded children
+		outputBox = aabb.isValid() ? transformBoundingBox(aabb, transform) : aabb;
 
-		return true;
+		return !unbounded;
 	}
 
 	void addChild(const std::shared_ptr<Shape>& shape)
@@ -124,11 +188,9 @@ public:
 		auto child = shape;
 		child->parent = shared_from_this();
 		shapes.emplace_back(child);
+		childBVH.markDirty();
 
-		BoundingBox box;
-		child->boundingBox(box);
-
-		aabb = surroundingBox(aabb, box);
+		includeChildBounds(*child);
 	}
 
 	void addChildren(const std::vector<std::shared_ptr<Shape>>& inShapes)
@@ -138,10 +200,6 @@ public:
 			addChild(shape);
 		}
 
-		BoundingBox box;
-		boundingBoxOfShapes(inShapes, box);
-
-		aabb = surroundingBox(aabb, box);
 	}
 
 	auto getChild(int32_t index)
@@ -153,21 +211,137 @@ public:
 		return shapes[index];
 	}
 
-	virtual bool contains(const std::shared_ptr<Shape>& shape) override
+	virtual bool contains(const Shape* shape) override
 	{
-		return std::find(shapes.begin(), 
-						  shapes.end(), 
-						   shape) != shapes.end();
+		return std::find_if(shapes.begin(), 
+							 shapes.end(), 
+							 [shape](const std::shared_ptr<Shape>& child) { return child.get() == shape; }) != shapes.end();
 	}
 
 	bool isEmpty() const { return shapes.empty(); }
 
+	// Applies to nested groups too, meshes from parseObjFile are usually one level down
+	void setBVHBuildQuality(BVHBuildQuality quality)
+	{
+		childBVH.setBuildQuality(quality);
+
+		for (const auto& shape : shapes)
+		{
+			if (auto group = std::dynamic_pointer_cast<Group>(shape))
+			{
+				group->setBVHBuildQuality(quality);
+			}
+			else if (auto mesh = std::dynamic_pointer_cast<TriangleMesh>(shape))
+			{
+				mesh->setBVHBuildQuality(quality);
+			}
+		}
+	}
+
+	// Build the child BVHs (this group, nested ones and meshes) now rather than in the first intersection
+	void updateBVH()
+	{
+		if (shapes.size() >= BVHThreshold)
+		{
+			childBVH.update(shapes);
+		}
+
+		for (const auto& shape : shapes)
+		{
+			if (auto group = std::dynamic_pointer_cast<Group>(shape))
+			{
+				group->updateBVH();
+			}
+			else if (auto mesh = std::dynamic_pointer_cast<TriangleMesh>(shape))
+			{
+				mesh->updateBVH();
+			}
+		}
+	}
+
+	const BVH& getBVH() 
+	{ 
+		updateBVH();
+		return childBVH.getBVH(); 
+	}
+
+	// For bvhcache.h, which saves built child BVHs and attaches cached ones
+	ShapeBVH& getChildBVH() { return childBVH; }
+
+	// Below this many children a linear loop is cheaper than the BVH
+	static constexpr size_t BVHThreshold = 8;
+
 	std::vector<std::shared_ptr<Shape>> shapes;
 
-	std::shared_ptr<Shape> cube;
+	// Set when a child has no bounding box, the group can't cull rays with aabb then
+	bool unbounded = false;
+
+private:
+	// Appends the hits of the children to outHits, sorted among themselves
+	void intersectChildren(const Ray& localRay, Intersections& outHits)
+	{
+		if (shapes.empty())
+		{
+			return;
+		}
+
+		if (!unbounded && !aabb.hit(localRay, localRay.tMin, localRay.tMax))
+		{
+			//std::cout << "Miss" << std::endl;
+			return;
+		}
+
+		auto first = outHits.size();
+
+		auto intersectChild = [&](const std::shared_ptr<Shape>& shape)
+		{
+			shape->intersect(localRay, outHits);
+		};
+
+		// Large groups (OBJ meshes) only intersect the children whose bounds are hit,
+		// leaves of plain triangles are tested by the BVH four at a time
+		if (shapes.size() >= BVHThreshold)
+		{
+			childBVH.traverse(shapes, localRay, localRay.tMax, intersectChild, [&](Triangle& triangle, float t, float u, float v)
+			{
+				outHits.push_back(triangle.hitAt(t, u, v));
+			});
+		}
+		else
+		{
+			std::for_each(shapes.begin(), shapes.end(), intersectChild);
+		}
+
+		std::sort(outHits.begin() + first, outHits.end(), compare);
+	}
+
+	void includeChildBounds(Shape& child)
+	{
+		BoundingBox box;
+
+		if (!child.boundingBox(box))
+		{
+			// A child without bounds makes the whole group unbounded
+			unbounded = true;
+		}
+		else if (box.isValid())
+		{
+			aabb = surroundingBox(aabb, box);
+		}
+
+		// Groups are often filled after they went into their parent, which has to grow too.
+		// A World can't be reached from here, see World::addObject()
+		if (auto group = std::dynamic_pointer_cast<Group>(parent))
+		{
+			group->childBVH.markDirty();
+			group->includeChildBounds(*this);
+		}
+	}
+
+	ShapeBVH childBVH;
 };
 
-std::shared_ptr<Group> createGroup()
+inline std::shared_ptr<Group> createGroup()
 {
 	return std::make_shared<Group>();
 }
\ No newline at end of file
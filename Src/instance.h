@@ -0,0 +1,124 @@
+#pragma once
+
+#include "shape.h"
+
+// Places a shared shape (usually an OBJ mesh group, the BLAS) somewhere else in the
+// scene without copying it. The instance only owns a transform and a material, the
+// instanced shape and its child BVH are shared by every instance and never changed.
+// World's BVH over the instances is the top level.
+//
+// Hits report the instance as their shape, so materials, shadows and refraction see
+// the instance, and keep the primitive that was hit in Intersection::instancedShape.
+// Only one level of instancing is supported, the instanced shape can't hold instances.
+class Instance : public Shape
+{
+public:
+	Instance(const std::shared_ptr<Shape>& inShape)
+	: instancedShape(inShape)
+	{
+		// Starts with the look of the instanced shape, assign material to override it
+		material = instancedShape->material;
+	}
+
+	using Shape::intersect;
+
+	virtual void intersect(const Ray& ray, Intersections& outHits) override
+	{
+		intersectInstanced(transformRay(ray, inversedTransform), outHits);
+	}
+
+	virtual Intersections localIntersect(const Ray& transformedRay) override
+	{
+		Intersections intersections;
+
+		intersectInstanced(transformedRay, intersections);
+
+		return intersections;
+	}
+
+	virtual bool intersectClosest(const Ray& ray, Intersection& outHit) override
+	{
+		Intersection primitiveHit;
+
+		if (!instancedShape->intersectClosest(transformRay(ray, inversedTransform), primitiveHit))
+		{
+			return false;
+		}
+
+		outHit = primitiveHit;
+		outHit.instancedShape = primitiveHit.shape;
+		outHit.shape = this;
+
+		return true;
+	}
+
+	// Hits report the instance, so its material decides about shadows
+	virtual bool intersectAny(const Ray& ray) override
+	{
+		return getMaterial().castShadow && instancedShape->intersectAny(transformRay(ray, inversedTransform));
+	}
+
+	// localPosition is in the space of the instanced shape's parent, which is exactly
+	// what the primitive's normalAt() expects as its world space
+	virtual tuple localNormalAt(const tuple& localPosition, const Intersection intersection = {}) const override
+	{
+		return intersection.instancedShape->normalAt(localPosition, intersection);
+	}
+
+	virtual tuple localUVAt(const tuple& localPosition, const Intersection& intersection) const override
+	{
+		return intersection.instancedShape->uvAt(localPosition, intersection);
+	}
+
+	virtual bool boundingBox(BoundingBox& outputBox) override
+	{
+		BoundingBox box;
+
+		if (!instancedShape->boundingBox(box))
+		{
+			return false;
+		}
+
+		if (box.isEmpty())
+		{
+			outputBox = BoundingBox();
+			return true;
+		}
+
+		if (!box.isValid())
+		{
+			return false;
+		}
+
+		outputBox = transformBoundingBox(box, transform);
+
+		return true;
+	}
+
+	const auto& getInstancedShape() const { return instancedShape; }
+
+private:
+	void intersectInstanced(const Ray& localRay, Intersections& outHits)
+	{
+		auto first = outHits.size();
+
+		instancedShape->intersect(localRay, outHits);
+
+		for (auto i = first; i < outHits.size(); i++)
+		{
+			outHits[i].instancedShape = outHits[i].shape;
+			outHits[i].shape = this;
+		}
+	}
+
+	std::shared_ptr<Shape> instancedShape;
+};
+
+inline static std::shared_ptr<Instance> createInstance(const std::shared_ptr<Shape>& shape, const matrix4& transform = matrix4(1.0f))
+{
+	auto instance = std::make_shared<Instance>(shape);
+
+	instance->setTransform(transform);
+
+	return instance;
+}
\ No newline at end of file
@@ -4,8 +4,11 @@
 #include "world.h"
 
 #include "intersection.h"
+#include "arena.h"
 
-std::vector<Intersection> intersect(const std::shared_ptr<Shape>& sphere, const Ray& ray)
+#include <execution>
+
+Intersections intersect(const std::shared_ptr<Shape>& sphere, const Ray& ray)
 {
 	return sphere->intersect(ray);
 }
@@ -26,26 +29,21 @@ tuple normalAt(const std::shared_ptr<Shape>& shape, const tuple& worldPoint)
 	return shape->normalAt(worldPoint);
 }
 
-std::vector<Intersection> sortIntersections(const std::initializer_list<Intersection>& intersectionList)
+Intersections sortIntersections(const std::initializer_list<Intersection>& intersectionList)
 {
-	std::vector<Intersection> result;
-
-	std::for_each(intersectionList.begin(), intersectionList.end(), [&](const Intersection& intersection)
-	{
-		result.emplace_back(intersection);
-	});
+	Intersections result(intersectionList);
 
 	std::sort(result.begin(), result.end(), compare);
 
 	return result;
 }
 
-void sortIntersections(std::vector<Intersection>& intersectionList)
+void sortIntersections(Intersections& intersectionList)
 {
 	std::sort(intersectionList.begin(), intersectionList.end(), compare);
 }
 
-Intersection hit(const std::vector<Intersection>& intersections)
+Intersection hit(const Intersections& intersections)
 {
 	for (size_t i = 0; i < intersections.size(); i++)
 	{
@@ -58,45 +56,245 @@ Intersection hit(const std::vector<Intersection>& intersections)
 	return {};
 }
 
-std::vector<Intersection> intersectWorld(const World& world, const Ray& ray)
+Intersections intersectWorld(const World& world, const Ray& ray)
 {
-	std::vector<Intersection> result;
+	Intersections result;
+
+	intersectWorld(world, ray, result);
 
-	for (const auto& shape : world.getObjects())
+	return result;
+}
+
+void intersectWorld(const World& world, const Ray& ray, Intersections& outHits)
+{
+	auto first = outHits.size();
+
+	// A committed world has its primitives in flat arrays, no virtual calls on the way
+	if (const auto* scene = world.getCommittedScene())
+	{
+		scene->intersect(ray, outHits);
+	}
+	else
 	{
-		// Old method
-		//auto intersection = intersect(object, ray);
-		auto intersections= shape->intersect(ray);
+		// Only objects whose bounds are hit by the ray are intersected
+		world.traverse(ray, [&](const std::shared_ptr<Shape>& shape)
+		{
+			shape->intersect(ray, outHits);
+		});
+	}
+
+	std::sort(outHits.begin() + first, outHits.end(), compare);
+}
 
-		result.insert(result.end(), intersections.begin(), intersections.end());
+Intersection intersectClosest(const World& world, const Ray& ray)
+{
+	Intersection closest;
+
+	// Like hit(), only hits in front of the origin count
+	auto closestRay = ray;
+	closestRay.tMin = std::max(ray.tMin, std::numeric_limits<float>::denorm_min());
+
+	if (const auto* scene = world.getCommittedScene())
+	{
+		scene->intersectClosest(closestRay, closest);
+		return closest;
 	}
 
-	sortIntersections(result);
+	// Every hit shrinks the interval, the traversal skips the objects behind it
+	world.traverse(closestRay, closestRay.tMax, [&](const std::shared_ptr<Shape>& shape)
+	{
+		if (shape->intersectClosest(closestRay, closest))
+		{
+			closestRay.tMax = closest.t;
+		}
+	});
 
-	return result;
+	return closest;
 }
 
-HitResult prepareComputations(const Intersection& intersection, const Ray& ray, const std::vector<Intersection>& intersections)
+void intersectClosest(const World& world, const RayPacket& packet, uint32_t laneMask, Intersection* outHits)
+{
+	auto closestPacket = packet;
+
+	for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+	{
+		outHits[lane] = {};
+
+		auto& ray = closestPacket.rays[lane];
+		ray.tMin = std::max(ray.tMin, std::numeric_limits<float>::denorm_min());
+	}
+
+	if (const auto* scene = world.getCommittedScene())
+	{
+		scene->intersectClosestPacket(closestPacket, laneMask, outHits);
+		return;
+	}
+
+	world.traversePacket(closestPacket, laneMask, [&](const std::shared_ptr<Shape>& shape, uint32_t shapeLanes)
+	{
+		Intersection hits[RayPacket::Width];
+
+		for (auto lanes = shape->intersectClosestPacket(closestPacket, shapeLanes, hits); lanes != 0; lanes &= lanes - 1)
+		{
+			auto lane = std::countr_zero(lanes);
+
+			outHits[lane] = hits[lane];
+			closestPacket.rays[lane].tMax = hits[lane].t;
+		}
+	});
+}
+
+bool intersectAny(const World& world, const Ray& ray)
+{
+	if (const auto* scene = world.getCommittedScene())
+	{
+		return scene->intersectAny(ray);
+	}
+
+	auto occludedRay = ray;
+	auto occluded = false;
+
+	world.traverse(occludedRay, occludedRay.tMax, [&](const std::shared_ptr<Shape>& shape)
+	{
+		if (!occluded && shape->intersectAny(occludedRay))
+		{
+			occluded = true;
+
+			// Nothing fits in an empty interval, the traversal just drains its stack
+			occludedRay.tMax = -std::numeric_limits<float>::infinity();
+		}
+	});
+
+	return occluded;
+}
+
+// Rays per task of a batch query, enough to keep the cost of handing out tasks small
+constexpr size_t RayQueryBatchSize = 256;
+
+// Rays of a packet pointing further apart than this (the cosine of about 8 degrees) soon
+// take different paths through the BVH, they are faster traced one at a time
+constexpr float CoherentPacketCosine = 0.99f;
+
+// Whether rays [first, first + count) leave from one point in about the same direction,
+// like a packet of camera rays
+static bool isCoherent(std::span<const Ray> rays, size_t first, int32_t count)
+{
+	for (auto i = first + 1; i < first + count; i++)
+	{
+		if (!(rays[i].origin == rays[first].origin) || dot(rays[i].direction, rays[first].direction) < CoherentPacketCosine)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Calls batchVisitor(first, last) for the batches of rays [0, rayCount) in parallel
+template<typename BatchVisitor>
+static RayQueryStats forEachRayBatch(const World& world, size_t rayCount, BatchVisitor&& batchVisitor)
+{
+	// The traversals would build it on first use, it isn't part of the trace time
+	if (world.getCommittedScene() == nullptr)
+	{
+		world.updateBVH();
+	}
+
+	std::vector<size_t> batches((rayCount + RayQueryBatchSize - 1) / RayQueryBatchSize);
+
+	for (size_t i = 0; i < batches.size(); i++)
+	{
+		batches[i] = i * RayQueryBatchSize;
+	}
+
+	AriaCore::Timer timer;
+
+	std::for_each(std::execution::par, batches.begin(), batches.end(),
+	[&](size_t first)
+	{
+		batchVisitor(first, std::min(first + RayQueryBatchSize, rayCount));
+	});
+
+	RayQueryStats stats;
+	stats.rayCount = rayCount;
+	stats.seconds = timer.Elapsed();
+
+	return stats;
+}
+
+RayQueryStats intersectClosest(const World& world, std::span<const Ray> rays, std::span<Intersection> outHits)
+{
+	auto rayCount = std::min(rays.size(), outHits.size());
+
+	return forEachRayBatch(world, rayCount, [&](size_t first, size_t last)
+	{
+		for (auto packetFirst = first; packetFirst < last; packetFirst += RayPacket::Width)
+		{
+			// The last packet of a batch may be short
+			auto laneCount = static_cast<int32_t>(std::min<size_t>(RayPacket::Width, last - packetFirst));
+
+			if (!isCoherent(rays, packetFirst, laneCount))
+			{
+				for (auto i = packetFirst; i < packetFirst + laneCount; i++)
+				{
+					outHits[i] = intersectClosest(world, rays[i]);
+				}
+
+				continue;
+			}
+
+			RayPacket packet;
+			std::copy(rays.begin() + packetFirst, rays.begin() + packetFirst + laneCount, packet.rays);
+
+			Intersection hits[RayPacket::Width];
+			intersectClosest(world, packet, (1u << laneCount) - 1, hits);
+
+			std::copy(hits, hits + laneCount, outHits.begin() + packetFirst);
+		}
+	});
+}
+
+RayQueryStats intersectAny(const World& world, std::span<const Ray> rays, std::span<bool> outOccluded)
+{
+	auto rayCount = std::min(rays.size(), outOccluded.size());
+
+	return forEachRayBatch(world, rayCount, [&](size_t first, size_t last)
+	{
+		for (auto i = first; i < last; i++)
+		{
+			// Like intersectClosest(), only hits in front of the origin count
+			auto ray = rays[i];
+			ray.tMin = std::max(ray.tMin, std::numeric_limits<float>::denorm_min());
+
+			outOccluded[i] = intersectAny(world, ray);
+		}
+	});
+}
+
+HitResult prepareComputations(const Intersection& intersection, const Ray& ray, const Intersections& intersections)
 {
 	// Instantiate a data structure for storing some precomputed values
 	HitResult hitResult;
 
 	// Copy the intersection's properties, for convenience
 	hitResult.t = intersection.t;
-	hitResult.shape = intersection.shape;
+	hitResult.shape = intersection.shape->shared_from_this();
 
-	hitResult.u = intersection.u;
-	hitResult.v = intersection.v;
 	hitResult.a = intersection.a;
 	hitResult.b = intersection.b;
 
 	// Precompute some useful values
 	hitResult.position = ray.at(hitResult.t);
+
+	// Only the shaded hit gets texture coordinates
+	auto uv = intersection.shape->uvAt(hitResult.position, intersection);
+	hitResult.u = uv.x;
+	hitResult.v = uv.y;
 	hitResult.viewDirection = -ray.direction;
 
 	// Old method
 	//hitResult.normal = normalAt(hitResult.object, hitResult.position);
-	hitResult.normal = hitResult.shape->normalAt(hitResult.position, intersection);
+	hitResult.normal = intersection.shape->normalAt(hitResult.position, intersection);
 
 	if (dot(hitResult.normal, hitResult.viewDirection) < 0.0f)
 	{
@@ -115,59 +313,83 @@ HitResult prepareComputations(const Intersection& intersection, const Ray& ray,
 	hitResult.underPosition = hitResult.position - hitResult.normal * EPSILON;
 	hitResult.reflectVector = reflect(ray.direction, hitResult.normal);
 
-	// For refractive material
-	auto containers = std::vector<std::shared_ptr<Shape>>();
+	// n1 and n2 only matter for refraction, they stay 1 otherwise
+	if (!intersections.empty() && intersection.shape->getMaterial().transparency > 0.0f)
+	{
+		computeRefractiveIndices(hitResult, intersection, intersections);
+	}
+
+	return hitResult;
+}
+
+void computeRefractiveIndices(HitResult& hitResult, const Intersection& intersection, const Intersections& intersections)
+{
+	// Shapes the ray is inside of, the innermost last. Past MaxContainers (deep nesting,
+	// or many shapes overlapping) the stack moves to the thread's arena.
+	ArenaScope arenaScope;
+
+	const Shape* fixedContainers[MaxContainers];
+	ArenaVector<const Shape*> spilledContainers;
+
+	auto* containers = fixedContainers;
+	int32_t containerCount = 0;
+	int32_t containerCapacity = MaxContainers;
+
+	auto innermostIndex = [&]()
+	{
+		return containerCount > 0 ? containers[containerCount - 1]->getMaterial().refractiveIndex : 1.0f;
+	};
 
 	for (const auto& i : intersections)
 	{
-		if (i == intersection)
+		auto isHit = (i == intersection);
+
+		if (isHit)
 		{
-			if (containers.empty())
-			{
-				hitResult.n1 = 1.0f;
-			}
-			else
-			{
-				auto shape = containers.back();
-				hitResult.n1 = shape->material.refractiveIndex;
-			}
+			hitResult.n1 = innermostIndex();
 		}
 
-		if (auto result = std::find(containers.begin(), containers.end(), i.shape); result != containers.end())
+		// The ray leaves the shape if it is already inside, the most recent entry is the likely one
+		auto container = containerCount - 1;
+
+		for (; container >= 0 && containers[container] != i.shape; container--) {}
+
+		if (container >= 0)
 		{
-			containers.erase(result);
+			std::copy(containers + container + 1, containers + containerCount, containers + container);
+			containerCount--;
 		}
 		else
 		{
-			containers.emplace_back(i.shape);
+			if (containerCount == containerCapacity)
+			{
+				if (spilledContainers.empty())
+				{
+					spilledContainers.assign(fixedContainers, fixedContainers + containerCount);
+				}
+
+				containerCapacity *= 2;
+				spilledContainers.resize(containerCapacity);
+				containers = spilledContainers.data();
+			}
+
+			containers[containerCount++] = i.shape;
 		}
 
-		if (i == intersection)
+		if (isHit)
 		{
-			if (containers.empty())
-			{
-				hitResult.n2 = 1.0f;
-			}
-			else
-			{
-				auto shape = containers.back();
-				hitResult.n2 = shape->material.refractiveIndex;
-			}
+			hitResult.n2 = innermostIndex();
 			break;
 		}
 	}
-
-	return hitResult;
 }
 
-Intersection intersectionWithUV(float t, const std::shared_ptr<Shape>& shape, float a, float b, float u, float v)
+Intersection intersectionWithUV(float t, Shape* shape, float a, float b)
 {
 	Intersection intersection;
 	intersection.t = t;
 	intersection.shape = shape;
 	intersection.a = a;
 	intersection.b = b;
-	intersection.u = u;
-	intersection.v = v;
 	return intersection;
 }
\ No newline at end of file
@@ -1,16 +1,164 @@
 #pragma once
 
 #include "ray.h"
+#include "raypacket.h"
 
+#include <span>
+
+// Plain hit record, copied around for every candidate hit. The shapes are raw pointers,
+// the scene owns them for as long as the hits are used, and the owning shared_ptr is
+// only looked up once a hit gets shaded (prepareComputations).
 struct Intersection
 {
 	float t = 0.0f;
-	std::shared_ptr<class Shape> shape;
-	std::shared_ptr<class Sphere> object;
+	class Shape* shape = nullptr;
+
+	// Barycentrics of triangle hits, the weights of the 2nd and 3rd corner. Texture
+	// coordinates are only worked out for the hit that gets shaded (Shape::uvAt()).
 	float a = 0.0f;
 	float b = 0.0f;
-	float u = 0.0f;
-	float v = 0.0f;
+
+	// Time of the ray that produced the hit, moving shapes need it for the normal
+	float time = 0.0f;
+
+	// Primitive hit inside an Instance, "shape" is then the instance itself
+	class Shape* instancedShape = nullptr;
+
+	// Triangle hit inside a TriangleMesh
+	uint32_t primitive = 0;
+};
+
+// Hit list with room for a few hits inline. Shapes return 0 to 4 hits almost always,
+// those lists never touch the heap. Longer lists (groups, the whole world) move to heap
+// storage that clear() keeps, a list that is reused stops allocating after its longest ray.
+class Intersections
+{
+public:
+	static constexpr uint32_t InlineCapacity = 4;
+
+	Intersections() = default;
+
+	Intersections(std::initializer_list<Intersection> intersections)
+	{
+		reserve(static_cast<uint32_t>(intersections.size()));
+
+		for (const auto& intersection : intersections)
+		{
+			push_back(intersection);
+		}
+	}
+
+	Intersections(const Intersections& other)
+	{
+		append(other);
+	}
+
+	Intersections(Intersections&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	Intersections& operator=(const Intersections& other)
+	{
+		if (this != &other)
+		{
+			clear();
+			append(other);
+		}
+
+		return *this;
+	}
+
+	Intersections& operator=(Intersections&& other) noexcept
+	{
+		if (this == &other)
+		{
+			return *this;
+		}
+
+		if (other.heapStorage != nullptr)
+		{
+			heapStorage = std::move(other.heapStorage);
+			allocated = other.allocated;
+			count = other.count;
+		}
+		else
+		{
+			heapStorage.reset();
+			allocated = InlineCapacity;
+			count = other.count;
+			std::copy(other.inlineStorage, other.inlineStorage + other.count, inlineStorage);
+		}
+
+		other.allocated = InlineCapacity;
+		other.count = 0;
+
+		return *this;
+	}
+
+	void push_back(const Intersection& intersection)
+	{
+		if (count == allocated)
+		{
+			// "intersection" may be one of the hits of this list, it is copied before
+			// the storage it lives in goes away
+			auto copy = intersection;
+			reserve(allocated * 2);
+			data()[count++] = copy;
+			return;
+		}
+
+		data()[count++] = intersection;
+	}
+
+	void append(const Intersections& other)
+	{
+		// Appending a list to itself copies the hits that were there before it grew
+		auto otherCount = other.count;
+		reserve(count + otherCount);
+		std::copy(other.begin(), other.begin() + otherCount, data() + count);
+		count += otherCount;
+	}
+
+	void reserve(uint32_t newCapacity)
+	{
+		if (newCapacity <= allocated)
+		{
+			return;
+		}
+
+		auto storage = std::make_unique<Intersection[]>(newCapacity);
+		std::copy(begin(), end(), storage.get());
+
+		heapStorage = std::move(storage);
+		allocated = newCapacity;
+	}
+
+	// Only shrinks, for dropping the hits appended after a given size
+	void resize(size_t newSize) { count = std::min(count, static_cast<uint32_t>(newSize)); }
+
+	void clear() { count = 0; }
+
+	size_t size() const { return count; }
+	size_t capacity() const { return allocated; }
+	bool empty() const { return count == 0; }
+
+	Intersection* data() { return heapStorage != nullptr ? heapStorage.get() : inlineStorage; }
+	const Intersection* data() const { return heapStorage != nullptr ? heapStorage.get() : inlineStorage; }
+
+	Intersection* begin() { return data(); }
+	Intersection* end() { return data() + count; }
+	const Intersection* begin() const { return data(); }
+	const Intersection* end() const { return data() + count; }
+
+	Intersection& operator[](size_t index) { return data()[index]; }
+	const Intersection& operator[](size_t index) const { return data()[index]; }
+
+private:
+	Intersection inlineStorage[InlineCapacity];
+	std::unique_ptr<Intersection[]> heapStorage;
+	uint32_t count = 0;
+	uint32_t allocated = InlineCapacity;
 };
 
 struct HitResult
@@ -40,7 +188,7 @@ inline static bool operator==(const Intersection& a, const Intersection& b)
 }
 
 // No long needed, just preserve for old test cases
-std::vector<Intersection> intersect(const std::shared_ptr<class Sphere>& sphere, const Ray& ray);
+Intersections intersect(const std::shared_ptr<class Sphere>& sphere, const Ray& ray);
 
 // No long needed, just preserve for old test cases
 tuple normalAt(const std::shared_ptr<class Sphere>& sphere, const tuple& worldPoint);
@@ -53,14 +201,57 @@ inline static bool compare(const Intersection& a, const Intersection& b)
 	return a.t < b.t;
 }
 
-std::vector<Intersection> sortIntersections(const std::initializer_list<Intersection>& intersectionList);
+Intersections sortIntersections(const std::initializer_list<Intersection>& intersectionList);
+
+void sortIntersections(Intersections& intersectionList);
+
+Intersection hit(const Intersections& intersections);
+
+Intersections intersectWorld(const class World& world, const Ray& ray);
+
+// Same hits, sorted, appended to a list the caller keeps around
+void intersectWorld(const class World& world, const Ray& ray, Intersections& outHits);
+
+// What hit(intersectWorld(world, ray)) returns, without collecting and sorting every
+// hit along the ray. t is 0 when nothing is hit.
+Intersection intersectClosest(const class World& world, const Ray& ray);
+
+// intersectClosest() for the lanes of a packet in laneMask (camera rays of neighbouring
+// pixels), traced together. outHits[lane] has t 0 for the lanes that hit nothing.
+void intersectClosest(const class World& world, const RayPacket& packet, uint32_t laneMask, Intersection* outHits);
+
+// Whether the ray hits anything that casts a shadow within [ray.tMin, ray.tMax].
+// Stops at the first such hit, for shadow rays.
+bool intersectAny(const class World& world, const Ray& ray);
+
+// Rays traced by a batch query and the time it took
+struct RayQueryStats
+{
+	size_t rayCount = 0;
+	float seconds = 0.0f;
+
+	float raysPerSecond() const { return seconds > 0.0f ? static_cast<float>(rayCount) / seconds : 0.0f; }
+};
+
+// intersectClosest() for a batch of rays (visibility between point sets and such), spread
+// over every core. outHits[i] is the hit of rays[i], t 0 for a miss. Every 4 rays in a row
+// that leave from one point in about the same direction are traced as one RayPacket, rays
+// from one observer to nearby targets are best kept next to each other.
+RayQueryStats intersectClosest(const class World& world, std::span<const Ray> rays, std::span<Intersection> outHits);
 
-void sortIntersections(std::vector<Intersection>& intersectionList);
+// intersectAny() for a batch of rays, spread over every core. outOccluded[i] is whether
+// anything that casts a shadow lies on rays[i] within [tMin, tMax], in front of the origin.
+RayQueryStats intersectAny(const class World& world, std::span<const Ray> rays, std::span<bool> outOccluded);
 
-Intersection hit(const std::vector<Intersection>& intersections);
+// intersections is the sorted list of every hit along the ray, it is only read to find
+// n1 and n2 when the hit shape is transparent. Pass none if refraction isn't needed.
+HitResult prepareComputations(const Intersection& intersection, const Ray& ray, const Intersections& intersections = {});
 
-std::vector<Intersection> intersectWorld(const class World& world, const Ray& ray);
+// Transparent shapes a ray can be inside of at once before finding n1 and n2 needs the arena
+constexpr int32_t MaxContainers = 16;
 
-HitResult prepareComputations(const Intersection& intersection, const Ray& ray, const std::vector<Intersection>& intersections = {});
+// n1 and n2 of hitResult from the shapes the ray is inside of when it reaches intersection
+void computeRefractiveIndices(HitResult& hitResult, const Intersection& intersection, const Intersections& intersections);
 
-Intersection intersectionWithUV(float t, const std::shared_ptr<Shape>& shape, float a, float b, float u, float v);
\ No newline at end of file
+// A triangle hit with barycentrics a and b
+Intersection intersectionWithUV(float t, class Shape* shape, float a, float b);
\ No newline at end of file
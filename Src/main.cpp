@@ -21,6 +21,7 @@
 #include "bvh.h"
 #include "torus.h"
 #include "movingsphere.h"
+#include "instance.h"
 
 #include "objLoader.h"
 #include "YAMLLoader.h"
@@ -905,9 +906,9 @@ Scene aabbTest()
 
 	scene.world.addObject(objModel);
 
-	auto scaleX = (objModel->aabb.max.x - objModel->aabb.min.x) / objModel->scale.x;
-	auto scaleY = (objModel->aabb.max.y - objModel->aabb.min.y) / objModel->scale.y;
-	auto scaleZ = (objModel->aabb.max.z - objModel->aabb.min.z) / objModel->scale.z;
+	auto scaleX = objModel->aabb.max.x - objModel->aabb.min.x;
+	auto scaleY = objModel->aabb.max.y - objModel->aabb.min.y;
+	auto scaleZ = objModel->aabb.max.z - objModel->aabb.min.z;
 
 	auto cube = createCube(scaleX * 0.5f);
 	cube->setTransform(T(objModel->translation) * S(objModel->scale));
@@ -1158,6 +1159,46 @@ Scene defaultSceneTest()
 	return scene;
 }
 
+Scene instancingTest()
+{
+	Scene scene = createDefaultScene();
+	scene.world.setName("InstancingTest");
+
+	// One copy of the mesh, placed 400 times
+	auto parser = parseObjFile("Assets/Models/ring_with_dolphin/ring.obj");
+
+	auto ring = objToGroup(parser);
+	ring->material.texture = createImageTexture("Assets/Models/ring_with_dolphin/textures/lambert2_baseColor.jpeg");
+	ring->material.metallic = 0.5f;
+
+	for (int32_t z = 0; z < 20; z++)
+	{
+		for (int32_t x = 0; x < 20; x++)
+		{
+			auto instance = createInstance(ring, T(x * 1.5f - 14.25f, 1.0f, -1.5f - z * 1.5f) * RY(r(x * 18.0f + z * 7.0f)) * S(0.5f));
+
+			if ((x + z) % 5 == 0)
+			{
+				instance->material.texture = nullptr;
+				instance->material.color = Colors::Purple;
+			}
+
+			scene.world.addObject(instance);
+		}
+	}
+
+	auto eye = point(0.0f, 16.0f, -42.0f);
+	auto center = point(0.0f, 0.0f, -14.0f);
+
+	scene.camera = Camera(640, 360, r(60.0f));
+	scene.camera.transform = viewTransform(eye,
+											  center,
+											  vector(0.0f, 1.0f, 0.0f));
+	scene.camera.inversedTransform = inverse(scene.camera.transform);
+
+	return scene;
+}
+
 Scene blenderScene(const std::string& path)
 {
 	Scene scene = loadScene(path);
@@ -1166,15 +1207,96 @@ Scene blenderScene(const std::string& path)
 	return scene;
 }
 
+// Meshes among shapes and in their nested groups
+void collectMeshes(const std::vector<std::shared_ptr<Shape>>& shapes, std::vector<std::shared_ptr<TriangleMesh>>& outMeshes)
+{
+	for (const auto& shape : shapes)
+	{
+		if (auto group = std::dynamic_pointer_cast<Group>(shape))
+		{
+			collectMeshes(group->shapes, outMeshes);
+		}
+		else if (auto mesh = std::dynamic_pointer_cast<TriangleMesh>(shape))
+		{
+			outMeshes.emplace_back(mesh);
+		}
+	}
+}
+
+// Renders the scene once per BVH build quality and reports build time against trace time
+void compareBVHBuildQuality(const Scene& scene)
+{
+	constexpr int32_t samplesPerPixel = 1;
+	constexpr int32_t maxDepth = 5;
+
+	const std::pair<BVHBuildQuality, std::string> qualities[] =
+	{
+		{ BVHBuildQuality::SAH, "SAH" },
+		{ BVHBuildQuality::Spatial, "SBVH" }
+	};
+
+	// commit() dissolves the groups into the flat scene, meshes are the only shapes whose
+	// own BVH is still traced. The world copies share them with the scene, so their
+	// quality is put back at the end.
+	std::vector<std::shared_ptr<TriangleMesh>> meshes;
+	collectMeshes(scene.world.getObjects(), meshes);
+
+	std::vector<BVHBuildQuality> meshQualities;
+
+	for (const auto& mesh : meshes)
+	{
+		meshQualities.emplace_back(mesh->getBuildQuality());
+	}
+
+	for (const auto& [quality, name] : qualities)
+	{
+		auto world = scene.world;
+		world.setBVHBuildQuality(quality);
+
+		for (const auto& mesh : meshes)
+		{
+			mesh->setBVHBuildQuality(quality);
+		}
+
+		AriaCore::Timer buildTimer(name + " build");
+
+		world.commit();
+
+		for (const auto& mesh : meshes)
+		{
+			mesh->updateBVH();
+		}
+
+		buildTimer.PrintElaspedMillis();
+
+		AriaCore::Timer traceTimer(name + " trace");
+
+		render(scene.camera, world, maxDepth, samplesPerPixel);
+
+		traceTimer.PrintElaspedMillis();
+	}
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		meshes[i]->setBVHBuildQuality(meshQualities[i]);
+	}
+}
+
 void renderScene(const std::string& path)
 {
 	auto scene = blenderScene(path);
 
-	//std::shared_ptr<Shape> bvhNode = std::make_shared<BVHNode>(scene.world.getObjects(), 0.0f, 0.0f);
-
 	auto camera = Camera(1280, 720, r(60.0f));
 	camera.transform = viewTransform(point(0.0f, 1.0f, -10.0f), point(0.0f, 1.0f, 0.0f), vector(0.0f, 1.0f, 0.0f));
 
+	// The scene is reloaded on every save, favour build speed over trace speed
+	{
+		AriaCore::Timer bvhTimer("Building BVH");
+		scene.world.setBVHBuildQuality(BVHBuildQuality::Linear);
+		scene.world.commit();
+		bvhTimer.PrintElaspedMillis();
+	}
+
 	AriaCore::Timer timer("Rendering");
 
 	constexpr int32_t samplesPerPixel = 8;
@@ -1199,8 +1321,11 @@ int main(int argc, char* argv[])
 	//auto scene = motionBlurTest();
 	//auto scene = textureTest();
 	//auto scene = depthOfFieldTest();
+	//auto scene = instancingTest();
 	auto scene = defaultSceneTest();
 
+	//compareBVHBuildQuality(objLoaderTest());
+
 	//auto [world, camera] = cornelBox();
 
 	//auto camera = Camera(1280, 720, r(60.0f));
@@ -1209,6 +1334,9 @@ int main(int argc, char* argv[])
 
 	//auto scene = cylinderTest();
 
+	// Nothing changes while rendering, the objects are traced from flat arrays
+	scene.world.commit();
+
 	AriaCore::Timer timer("Rendering");
 
 	constexpr int32_t samplesPerPixel = 1;
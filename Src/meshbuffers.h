@@ -0,0 +1,198 @@
+#pragma once
+
+#include "boundingbox.h"
+
+// Vertex attributes of a model, shared by every TriangleMesh made from it. Index 0 of
+// each array is a zero entry (OBJ indices start at 1), corners without a normal or a
+// texture coordinate point there.
+struct MeshBuffers
+{
+	std::vector<tuple> positions;
+	std::vector<tuple> normals;
+	std::vector<tuple> texcoords;
+};
+
+// MeshBuffers in 16 bytes per vertex instead of 48: positions as 21 bit fixed point per
+// axis within the bounds of the model, unit normals octahedral mapped to two 16 bit
+// values and texture coordinates as 16 bit fixed point within their own bounds.
+// Attributes are decoded when they are read. Index 0 still reads as zero.
+struct CompressedMeshBuffers
+{
+	static constexpr uint32_t PositionBits = 21;
+	static constexpr uint32_t PositionMax = (1u << PositionBits) - 1;
+	static constexpr uint32_t TexcoordMax = 0xffff;
+
+	tuple position(uint32_t index) const
+	{
+		if (index == 0)
+		{
+			return point(0.0f, 0.0f, 0.0f);
+		}
+
+		auto bits = positions[index];
+
+		return point(positionOrigin[0] + static_cast<float>(bits & PositionMax) * positionScale[0],
+					 positionOrigin[1] + static_cast<float>((bits >> PositionBits) & PositionMax) * positionScale[1],
+					 positionOrigin[2] + static_cast<float>((bits >> (2 * PositionBits)) & PositionMax) * positionScale[2]);
+	}
+
+	tuple normal(uint32_t index) const
+	{
+		if (index == 0)
+		{
+			return vector(0.0f, 0.0f, 0.0f);
+		}
+
+		auto bits = normals[index];
+		auto x = static_cast<float>(bits & 0xffff) / 65535.0f * 2.0f - 1.0f;
+		auto y = static_cast<float>(bits >> 16) / 65535.0f * 2.0f - 1.0f;
+		auto z = 1.0f - std::fabsf(x) - std::fabsf(y);
+
+		// The lower hemisphere is folded over the diagonals
+		auto fold = std::max(-z, 0.0f);
+		x += x >= 0.0f ? -fold : fold;
+		y += y >= 0.0f ? -fold : fold;
+
+		return normalize(vector(x, y, z));
+	}
+
+	tuple texcoord(uint32_t index) const
+	{
+		if (index == 0)
+		{
+			return vector(0.0f, 0.0f, 0.0f);
+		}
+
+		auto bits = texcoords[index];
+
+		return vector(texcoordOrigin[0] + static_cast<float>(bits & 0xffff) * texcoordScale[0],
+					  texcoordOrigin[1] + static_cast<float>(bits >> 16) * texcoordScale[1],
+					  0.0f);
+	}
+
+	size_t memorySize() const
+	{
+		return positions.size() * sizeof(uint64_t) + normals.size() * sizeof(uint32_t) + texcoords.size() * sizeof(uint32_t);
+	}
+
+	std::vector<uint64_t> positions;
+	std::vector<uint32_t> normals;
+	std::vector<uint32_t> texcoords;
+
+	float positionOrigin[3] = {};
+	float positionScale[3] = {};
+	float texcoordOrigin[2] = {};
+	float texcoordScale[2] = {};
+};
+
+// Steps of "scale" from "origin", rounded to the nearest one
+inline static uint32_t quantize(float value, float origin, float scale, uint32_t maxValue)
+{
+	if (scale <= 0.0f)
+	{
+		return 0;
+	}
+
+	return static_cast<uint32_t>(Math::clamp(std::round((value - origin) / scale), 0.0f, static_cast<float>(maxValue)));
+}
+
+// Octahedral mapping: the normal is projected onto the octahedron |x| + |y| + |z| = 1
+// and the lower half is unfolded onto the corners of the square
+inline static uint32_t encodeOctahedral(const tuple& normal)
+{
+	auto length = std::fabsf(normal.x) + std::fabsf(normal.y) + std::fabsf(normal.z);
+
+	if (length == 0.0f)
+	{
+		return 0;
+	}
+
+	auto x = normal.x / length;
+	auto y = normal.y / length;
+
+	if (normal.z < 0.0f)
+	{
+		auto foldedX = (1.0f - std::fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		auto foldedY = (1.0f - std::fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	auto encodedX = quantize(x, -1.0f, 2.0f / 65535.0f, 0xffff);
+	auto encodedY = quantize(y, -1.0f, 2.0f / 65535.0f, 0xffff);
+
+	return encodedX | (encodedY << 16);
+}
+
+inline static std::shared_ptr<CompressedMeshBuffers> compressMeshBuffers(const MeshBuffers& buffers)
+{
+	auto compressed = std::make_shared<CompressedMeshBuffers>();
+
+	// The zero entries are left out of the bounds, they decode as zero anyway
+	BoundingBox positionBounds;
+
+	for (size_t i = 1; i < buffers.positions.size(); i++)
+	{
+		positionBounds.addPoint(buffers.positions[i]);
+	}
+
+	float texcoordMin[2] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	float texcoordMax[2] = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+
+	for (size_t i = 1; i < buffers.texcoords.size(); i++)
+	{
+		texcoordMin[0] = std::min(texcoordMin[0], buffers.texcoords[i].x);
+		texcoordMin[1] = std::min(texcoordMin[1], buffers.texcoords[i].y);
+		texcoordMax[0] = std::max(texcoordMax[0], buffers.texcoords[i].x);
+		texcoordMax[1] = std::max(texcoordMax[1], buffers.texcoords[i].y);
+	}
+
+	if (positionBounds.isValid())
+	{
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			compressed->positionOrigin[axis] = positionBounds.min[axis];
+			compressed->positionScale[axis] = (positionBounds.max[axis] - positionBounds.min[axis]) / CompressedMeshBuffers::PositionMax;
+		}
+	}
+
+	if (buffers.texcoords.size() > 1)
+	{
+		for (int32_t axis = 0; axis < 2; axis++)
+		{
+			compressed->texcoordOrigin[axis] = texcoordMin[axis];
+			compressed->texcoordScale[axis] = (texcoordMax[axis] - texcoordMin[axis]) / CompressedMeshBuffers::TexcoordMax;
+		}
+	}
+
+	compressed->positions.resize(buffers.positions.size());
+	compressed->normals.resize(buffers.normals.size());
+	compressed->texcoords.resize(buffers.texcoords.size());
+
+	for (size_t i = 1; i < buffers.positions.size(); i++)
+	{
+		uint64_t bits = 0;
+
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			auto value = quantize(buffers.positions[i][axis], compressed->positionOrigin[axis], compressed->positionScale[axis], CompressedMeshBuffers::PositionMax);
+			bits |= static_cast<uint64_t>(value) << (axis * CompressedMeshBuffers::PositionBits);
+		}
+
+		compressed->positions[i] = bits;
+	}
+
+	for (size_t i = 1; i < buffers.normals.size(); i++)
+	{
+		compressed->normals[i] = encodeOctahedral(buffers.normals[i]);
+	}
+
+	for (size_t i = 1; i < buffers.texcoords.size(); i++)
+	{
+		auto u = quantize(buffers.texcoords[i].x, compressed->texcoordOrigin[0], compressed->texcoordScale[0], CompressedMeshBuffers::TexcoordMax);
+		auto v = quantize(buffers.texcoords[i].y, compressed->texcoordOrigin[1], compressed->texcoordScale[1], CompressedMeshBuffers::TexcoordMax);
+		compressed->texcoords[i] = u | (v << 16);
+	}
+
+	return compressed;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "bvh.h"
+
+struct MotionBVHNode
+{
+	// Bounds at MotionBVH::time0 and MotionBVH::time1, a ray at time t tests their blend
+	BoundingBox bounds0;
+	BoundingBox bounds1;
+
+	// Same meaning as in BVHNode
+	uint32_t leftFirst = 0;
+	uint32_t primitiveCount = 0;
+
+	bool isLeaf() const { return primitiveCount > 0; }
+};
+
+// BVH with bounds at two points in time. The topology is taken from a BVH built over
+// the swept bounds, the two sets of node bounds are then refit from the primitive
+// bounds at time0 and time1. A node box blended for the ray time contains every
+// primitive box at that time as long as primitives move linearly over [time0, time1].
+class MotionBVH
+{
+public:
+	void refit(const BVH& bvh, const std::vector<BoundingBox>& primitiveBounds0, const std::vector<BoundingBox>& primitiveBounds1,
+			   float inTime0, float inTime1)
+	{
+		time0 = inTime0;
+		time1 = inTime1;
+		primitiveIndices = bvh.primitiveIndices;
+
+		nodes.resize(bvh.nodes.size());
+
+		if (!nodes.empty())
+		{
+			refitNode(bvh, 0, primitiveBounds0, primitiveBounds1);
+		}
+	}
+
+	// Node bounds at "time", times outside [time0, time1] get the bounds at the nearest end
+	BoundingBox boundsAt(const MotionBVHNode& node, float time) const
+	{
+		auto s = time1 > time0 ? Math::clamp((time - time0) / (time1 - time0), 0.0f, 1.0f) : 0.0f;
+
+		return BoundingBox(node.bounds0.min + (node.bounds1.min - node.bounds0.min) * s,
+						   node.bounds0.max + (node.bounds1.max - node.bounds0.max) * s);
+	}
+
+	// Calls visitor(primitiveIndex) for every primitive in a leaf whose bounds
+	// at ray.time are hit by the ray within [tMin, tMax], nearest leaves first
+	template<typename Visitor>
+	void traverse(const Ray& ray, float tMin, const float& tMax, Visitor&& visitor) const
+	{
+		BVH::traverseOrdered(nodes.size(), tMax,
+							 [&](uint32_t index) -> const MotionBVHNode& { return nodes[index]; },
+							 [&](const MotionBVHNode& node, float& distance) { return boundsAt(node, ray.time).hit(ray, tMin, tMax, distance); },
+							 [&](uint32_t index) { visitor(primitiveIndices[index]); });
+	}
+
+	bool empty() const { return nodes.empty(); }
+
+	std::vector<MotionBVHNode> nodes;
+	std::vector<uint32_t> primitiveIndices;
+	float time0 = 0.0f;
+	float time1 = 0.0f;
+
+private:
+	// Children first, the LBVH layout doesn't keep them after their parent
+	void refitNode(const BVH& bvh, uint32_t nodeIndex, const std::vector<BoundingBox>& primitiveBounds0, const std::vector<BoundingBox>& primitiveBounds1)
+	{
+		const auto& source = bvh.nodes[nodeIndex];
+		auto& node = nodes[nodeIndex];
+
+		node.leftFirst = source.leftFirst;
+		node.primitiveCount = source.primitiveCount;
+		node.bounds0 = BoundingBox();
+		node.bounds1 = BoundingBox();
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = 0; i < node.primitiveCount; i++)
+			{
+				auto primitive = primitiveIndices[node.leftFirst + i];
+				node.bounds0 = surroundingBox(node.bounds0, primitiveBounds0[primitive]);
+				node.bounds1 = surroundingBox(node.bounds1, primitiveBounds1[primitive]);
+			}
+			return;
+		}
+
+		refitNode(bvh, node.leftFirst, primitiveBounds0, primitiveBounds1);
+		refitNode(bvh, node.leftFirst + 1, primitiveBounds0, primitiveBounds1);
+
+		node.bounds0 = surroundingBox(nodes[node.leftFirst].bounds0, nodes[node.leftFirst + 1].bounds0);
+		node.bounds1 = surroundingBox(nodes[node.leftFirst].bounds1, nodes[node.leftFirst + 1].bounds1);
+	}
+};
\ No newline at end of file
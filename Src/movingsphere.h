@@ -18,18 +18,26 @@ public:
 	: translation0(inTranslation0), translation1(inTranslation1), time0(inTime0), time1(inTime1)
 	{}
 
-	virtual std::vector<Intersection> intersect(const Ray& ray) override
+	// The transform is never touched here, rays are traced in parallel. Moving the ray
+	// by the opposite of the sphere's offset at ray.time gives the same hits
+	using Shape::intersect;
+
+	virtual void intersect(const Ray& ray, Intersections& outHits) override
 	{
-		auto newTranslation = computeTranslation(ray.time);
+		auto movedRay = ray;
+		movedRay.origin = ray.origin - offsetAt(ray.time);
+
+		auto first = outHits.size();
 
-		transform(0, 3) = newTranslation.x;
-		transform(1, 3) = newTranslation.y;
-		transform(2, 3) = newTranslation.z;
+		Shape::intersect(movedRay, outHits);
 
-		return Shape::intersect(ray);
+		for (auto i = first; i < outHits.size(); i++)
+		{
+			outHits[i].time = ray.time;
+		}
 	}
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override 
+	virtual Intersections localIntersect(const Ray& transformedRay) override 
 	{
 		// The vector from the sphere's center, to the ray origin
 		// Remember: the sphere is centered at the world origin
@@ -49,35 +57,81 @@ public:
 		auto t1 = (-b - std::sqrtf(discriminant)) / (2.0f * a);
 		auto t2 = (-b + std::sqrtf(discriminant)) / (2.0f * a);
 
-		auto shape = shared_from_this();
+		Intersections result;
+
+		if (transformedRay.inRange(t1))
+		{
+			result.push_back({ t1, this });
+		}
 
-		// https://blog.csdn.net/u013745174/article/details/52900870
-		auto object = std::dynamic_pointer_cast<Sphere>(shared_from_this());
+		if (transformedRay.inRange(t2))
+		{
+			result.push_back({ t2, this });
+		}
 
-		return { { t1, shape, object, 0.0f, 0.0f },
-				 { t2, shape, object, 0.0f, 0.0f } };
+		return result;
 	}
 
 	virtual tuple localNormalAt(const tuple& localPosition, const Intersection intersection = {}) const override
 	{ 
-		auto localNormal = localPosition - center;
+		// localPosition went through the transform at rest, undo the offset at the hit time
+		auto localOffset = inversedTransform * offsetAt(intersection.time);
+		auto localNormal = localPosition - localOffset - center;
 
 		return  localNormal;
 	}
 
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
-		auto a = translation - vector(scale.x, scale.y, scale.z);
-		auto b = translation + vector(scale.x, scale.y, scale.z);
+		// Cover the whole path between translation0 and translation1
+		BoundingBox box0;
+		BoundingBox box1;
 
-		outputBox = BoundingBox(a, b);
+		boundingBoxAt(time0, box0);
+		boundingBoxAt(time1, box1);
 
+		outputBox = surroundingBox(box0, box1);
+
+		return true;
+	}
+
+	virtual bool motionRange(float& outTime0, float& outTime1) const override
+	{
+		outTime0 = time0;
+		outTime1 = time1;
 		return true;
 	}
 
+	virtual bool boundingBoxAt(float time, BoundingBox& outputBox) override
+	{
+		auto localBox = BoundingBox(center - vector(radius), center + vector(radius));
+
+		auto movedTransform = transform;
+		auto translation = computeTranslation(time);
+
+		for (int32_t i = 0; i < 3; i++)
+		{
+			movedTransform(i, 3) = translation[i];
+		}
+
+		outputBox = transformBoundingBox(localBox, movedTransform);
+
+		return true;
+	}
+
+	// The sphere rests at translation0 before time0 and at translation1 after time1
 	tuple computeTranslation(float time) const
 	{
-		return translation0 + ((time - time0) / (time1 - time0)) * (translation1 - translation0);
+		auto s = time1 > time0 ? Math::clamp((time - time0) / (time1 - time0), 0.0f, 1.0f) : 0.0f;
+		return translation0 + s * (translation1 - translation0);
+	}
+
+	// How far computeTranslation(time) is from the translation baked into transform
+	tuple offsetAt(float time) const
+	{
+		auto offset = computeTranslation(time) - point(transform(0, 3), transform(1, 3), transform(2, 3));
+		offset.w = 0.0f;
+		return offset;
 	}
 
 	tuple center{ 0.0f, 0.0f, 0.0f, 1.0f };
@@ -5,7 +5,8 @@
 
 #include "tuple.h"
 #include "group.h"
-#include "triangle.h"
+#include "trianglemesh.h"
+#include "bvhcache.h"
 
 struct Parser
 {
@@ -121,39 +122,51 @@ inline static std::vector<uint32_t> parseIndices(const std::vector<std::string>&
 	return indices;
 }
 
-inline static auto fanTriangulation(const std::vector<tuple>& vertices, const std::vector<tuple>& normals = {}, const std::vector<tuple>& texcoords = {})
+// Splits a face into triangles around its first corner. Indices past the parsed
+// records point at the zero entries, like missing ones.
+inline static auto fanTriangulation(const Parser& parser, const std::vector<uint32_t>& positionIndices,
+									const std::vector<uint32_t>& normalIndices, const std::vector<uint32_t>& texcoordIndices)
 {
-	std::vector<std::shared_ptr<Shape>> triangls;
-	
-	for (size_t index = 2; index < vertices.size() - 1; index++)
+	auto checked = [](uint32_t index, const std::vector<tuple>& records) { return index < records.size() ? index : 0; };
+
+	std::vector<MeshTriangle> triangles;
+
+	for (size_t corner = 1; corner + 1 < positionIndices.size(); corner++)
 	{
-		std::shared_ptr<Shape> triangle;
-		if (normals.empty())
-		{
-			triangle = createTriangle(vertices[1], vertices[index], vertices[index + 1]);
+		MeshTriangle triangle;
+		size_t corners[3] = { 0, corner, corner + 1 };
 
-		}
-		else
+		for (int32_t i = 0; i < 3; i++)
 		{
-			triangle = createSmoothTriangle(vertices[1], vertices[index], vertices[index + 1],
-											 normals[1], normals[index], normals[index + 1],
-											 texcoords[1], texcoords[index], texcoords[index + 1]);
+			triangle.positions[i] = checked(positionIndices[corners[i]], parser.vertices);
+			triangle.normals[i] = checked(normalIndices[corners[i]], parser.normals);
+			triangle.texcoords[i] = checked(texcoordIndices[corners[i]], parser.texcoords);
 		}
-		triangls.emplace_back(triangle);
+
+		triangles.emplace_back(triangle);
 	}
 
-	return triangls;
+	return triangles;
 }
 
-static Parser parseObjFile(const std::string& path)
+// With compressMeshes the meshes share CompressedMeshBuffers, for models too large to
+// keep their vertices as floats
+static Parser parseObjFile(const std::string& path, bool compressMeshes = false)
 {
 	Parser parser;
 
-	std::ifstream file(path);
+	// Read in one go, the bytes also key the BVH cache
+	std::ifstream source(path, std::ios::binary);
+	std::string content((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+	std::istringstream file(content);
 
 	std::shared_ptr<Group> group;
+
+	// Faces of the default group and of every "g" group, each becomes one TriangleMesh
+	std::vector<MeshTriangle> defaultTriangles;
+	std::vector<std::vector<MeshTriangle>> groupTriangles;
 	
-	if (file.is_open())
+	if (source.is_open())
 	{
 		while (file.good())
 		{
@@ -196,6 +209,10 @@ static Parser parseObjFile(const std::string& path)
 			{
 				line = line.substr(2);
 
+				std::vector<uint32_t> positionIndices;
+				std::vector<uint32_t> normalIndices;
+				std::vector<uint32_t> texcoordIndices;
+
 				auto findDoubleSlash = line.find("//");
 				auto findSlash = line.find("/");
 
@@ -204,97 +221,31 @@ static Parser parseObjFile(const std::string& path)
 					// 1//3 2//1 3//2 ->
 					// {1//3, 2//1, 3//2}
 					auto faceIndices = splitString(line, " ");
-					// 1//3 ->
-					// {1, 3}
-					std::vector<std::vector<std::string>> indices;
-					for (size_t i = 0; i < faceIndices.size(); i++)
-					{
-						indices.emplace_back(splitString(faceIndices[i], "/"));
-					}
-
-					std::vector<uint32_t> vertexIndices;
-					std::vector<uint32_t> normalIndices;
-					std::vector<uint32_t> texcoordIndices;
-					std::vector<tuple> vertices(1);
-					std::vector<tuple> normals(1);
-					std::vector<tuple> texcoords(1);
-
-					for (size_t i = 0; i < indices.size(); i++)
-					{
-						auto index = parseIndices(indices[i]);
-						vertexIndices.emplace_back(index[0]);
-						texcoordIndices.emplace_back(index[1]);
-						normalIndices.emplace_back(index[2]);
-
-						auto position = parser.vertices[vertexIndices[i]];
-						vertices.emplace_back(position);
-
-						auto normal = parser.normals[normalIndices[i]];
-						normals.emplace_back(normal);
-
-						auto texcoord = parser.texcoords[texcoordIndices[i]];
-						texcoords.emplace_back(texcoord);
-					}
-
-					if (vertices.size() > 4)
-					{
-						auto triangles = fanTriangulation(vertices, normals, texcoords);
 
-						parser.defaultGroup->addChildren(triangles);
-
-						if (group != nullptr)
-						{
-							group->addChildren(triangles);
-						}
-
-						continue;
-					}
-
-					auto triangle = createSmoothTriangle(vertices[1], vertices[2], vertices[3], 
-																			normals[1], normals[2], normals[3],
-																			texcoords[1], texcoords[2], texcoords[3]);
-
-					parser.defaultGroup->addChild(triangle);
-
-					if (group != nullptr)
-					{
-						group->addChild(triangle);
-					}
-
-					continue;
-				}
-
-				auto indices = parseIndices(line);
-
-				if (indices.size() == 3)
-				{
-					auto p0 = parser.vertices[indices[0]];
-					auto p1 = parser.vertices[indices[1]];
-					auto p2 = parser.vertices[indices[2]];
-					auto triangle = createTriangle(p0, p1, p2);
-					parser.defaultGroup->addChild(triangle);
-
-					if (group != nullptr)
+					for (const auto& faceIndex : faceIndices)
 					{
-						group->addChild(triangle);
+						// 1//3 ->
+						// {1, 0, 3}
+						auto index = parseIndices(splitString(faceIndex, "/"));
+						positionIndices.emplace_back(index[0]);
+						texcoordIndices.emplace_back(index.size() > 1 ? index[1] : 0);
+						normalIndices.emplace_back(index.size() > 2 ? index[2] : 0);
 					}
 				}
 				else
 				{
-					std::vector<tuple> vertices;
-					vertices.emplace_back(point(0.0f, 0.0f, 0.0f));
-					for (size_t i = 0; i < indices.size(); i++)
-					{
-						vertices.emplace_back(parser.vertices[indices[i]]);
-					}
-					auto triangles = fanTriangulation(vertices);
+					positionIndices = parseIndices(line);
+					normalIndices.assign(positionIndices.size(), 0);
+					texcoordIndices.assign(positionIndices.size(), 0);
+				}
 
-					parser.defaultGroup->addChildren(triangles);
+				auto triangles = fanTriangulation(parser, positionIndices, normalIndices, texcoordIndices);
 
-					if (group != nullptr)
-					{
-						group->addChildren(triangles);
-					}
+				defaultTriangles.insert(defaultTriangles.end(), triangles.begin(), triangles.end());
+
+				if (group != nullptr)
+				{
+					groupTriangles.back().insert(groupTriangles.back().end(), triangles.begin(), triangles.end());
 				}
 
 				continue;
@@ -304,16 +255,91 @@ static Parser parseObjFile(const std::string& path)
 			{
 				group = createGroup();
 				parser.addGroup(group);
+				groupTriangles.emplace_back();
 				continue;
 			}
 		}
 	}
 
+	// All meshes of the file share one copy of the vertex data
+	auto buffers = std::make_shared<MeshBuffers>();
+	buffers->positions = parser.vertices;
+	buffers->normals = parser.normals;
+	buffers->texcoords = parser.texcoords;
+
+	std::shared_ptr<CompressedMeshBuffers> compressedBuffers;
+
+	if (compressMeshes)
+	{
+		compressedBuffers = compressMeshBuffers(*buffers);
+		buffers.reset();
+	}
+
+	auto addMesh = [&](const std::shared_ptr<Group>& meshGroup, const std::vector<MeshTriangle>& triangles)
+	{
+		if (triangles.empty())
+		{
+			return;
+		}
+
+		auto mesh = compressMeshes ? createTriangleMesh(compressedBuffers) : createTriangleMesh(buffers);
+
+		for (const auto& triangle : triangles)
+		{
+			mesh->addTriangle(triangle);
+		}
+
+		meshGroup->addChild(mesh);
+	};
+
+	addMesh(parser.defaultGroup, defaultTriangles);
+
+	for (size_t i = 0; i < groupTriangles.size(); i++)
+	{
+		addMesh(parser.groups[i], groupTriangles[i]);
+	}
+
 	if (parser.groups.empty())
 	{
 		parser.addDefaultGroup();
 	}
 
+	// Mesh groups are static from here on, their BVHs come from the cache when this
+	// file was loaded before, otherwise they are built now (and cached) instead of
+	// stalling the first rays of the render
+	std::vector<std::shared_ptr<Group>> meshGroups = { parser.defaultGroup };
+
+	for (const auto& g : parser.groups)
+	{
+		if (g != parser.defaultGroup)
+		{
+			meshGroups.emplace_back(g);
+		}
+	}
+
+	auto contentHash = hashBytes(content.data(), content.size());
+
+	// Compressed meshes are built over the decoded vertices, their BVHs are cached apart
+	if (compressMeshes)
+	{
+		contentHash = hashBytes(&compressMeshes, sizeof(compressMeshes), contentHash);
+	}
+
+	auto cachePath = bvhCachePath(contentHash);
+
+	if (!source.is_open() || !loadBVHCache(cachePath, contentHash, meshGroups))
+	{
+		for (const auto& g : meshGroups)
+		{
+			g->updateBVH();
+		}
+
+		if (source.is_open())
+		{
+			saveBVHCache(cachePath, contentHash, meshGroups);
+		}
+	}
+
 	return parser;
 }
 
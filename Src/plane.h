@@ -2,6 +2,60 @@
 
 #include "shape.h"
 
+// The hit of the ray and the xz plane within extentX and extentZ of the origin, if it lies
+// in [ray.tMin, ray.tMax], goes to hitVisitor(t). Plane::localIntersect() and FlatScene
+// share it.
+template<typename HitVisitor>
+inline static void intersectPlane(float extentX, float extentZ, const Ray& ray, HitVisitor&& hitVisitor)
+{
+	if (std::fabsf(ray.direction.y) < EPSILON)
+	{
+		return;
+	}
+
+	auto t = -ray.origin.y / ray.direction.y;
+
+	if (!ray.inRange(t))
+	{
+		return;
+	}
+
+	auto position = ray.at(t);
+
+	if ((position.x > extentX || position.x < -extentX) ||
+		(position.z > extentZ || position.z < -extentZ))
+	{
+		return;
+	}
+
+	hitVisitor(t);
+}
+
+#ifdef ARIA_SIMD_SSE
+// intersectPlane() for the four rays of a packet at once. Returns the mask of the lanes
+// with a hit, its t goes to outT[lane]. Plane and FlatScene share it.
+inline static uint32_t intersectPlanePacket(float extentX, float extentZ, const RayPacketLanes& rays, float* outT)
+{
+	auto signBit = _mm_set1_ps(-0.0f);
+	auto notParallel = _mm_cmpge_ps(_mm_andnot_ps(signBit, rays.directionY), _mm_set1_ps(EPSILON));
+
+	auto t = _mm_div_ps(_mm_xor_ps(rays.originY, signBit), rays.directionY);
+
+	auto positionX = _mm_add_ps(rays.originX, _mm_mul_ps(rays.directionX, t));
+	auto positionZ = _mm_add_ps(rays.originZ, _mm_mul_ps(rays.directionZ, t));
+
+	auto insideX = _mm_and_ps(_mm_cmple_ps(positionX, _mm_set1_ps(extentX)), _mm_cmpge_ps(positionX, _mm_set1_ps(-extentX)));
+	auto insideZ = _mm_and_ps(_mm_cmple_ps(positionZ, _mm_set1_ps(extentZ)), _mm_cmpge_ps(positionZ, _mm_set1_ps(-extentZ)));
+
+	auto hit = _mm_and_ps(_mm_and_ps(notParallel, rays.inRange(t)), _mm_and_ps(insideX, insideZ));
+	auto hitMask = static_cast<uint32_t>(_mm_movemask_ps(hit));
+
+	_mm_storeu_ps(outT, t);
+
+	return hitMask;
+}
+#endif
+
 class Plane : public Shape
 {
 
@@ -13,27 +67,33 @@ public:
 	
 	virtual ~Plane() = default;
 
-	std::vector<Intersection> localIntersect(const Ray& transformedRay) override
+	Intersections localIntersect(const Ray& transformedRay) override
 	{
-		if (std::fabsf(transformedRay.direction.y) < EPSILON)
-		{
-			return {};
-		}
+		Intersections result;
 
-		auto t = -transformedRay.origin.y / transformedRay.direction.y;
+		intersectPlane(extentX, extentZ, transformedRay, [&](float t) { result.push_back({ t, this }); });
 
-		auto position = transformedRay.at(t);
+		return result;
+	}
 
-		if ((position.x > extentX || position.x < -extentX) ||
-			(position.z > extentZ || position.z < -extentZ))
+#ifdef ARIA_SIMD_SSE
+	// The four lanes at once, the same arithmetic as localIntersect()
+	virtual uint32_t intersectClosestPacket(const RayPacket& packet, uint32_t laneMask, Intersection* outHits) override
+	{
+		float hitT[RayPacket::Width];
+		auto hitMask = intersectPlanePacket(extentX, extentZ, RayPacketLanes(transformRayPacket(packet, laneMask, inversedTransform), laneMask), hitT);
+
+		for (int32_t lane = 0; lane < RayPacket::Width; lane++)
 		{
-			return {};
+			if (hitMask & (1 << lane))
+			{
+				outHits[lane] = { hitT[lane], this };
+			}
 		}
 
-		auto shape = std::dynamic_pointer_cast<Plane>(shared_from_this());
-		
-		return { { t, shape }};
+		return hitMask;
 	}
+#endif
 
 	tuple localNormalAt(const tuple& localPosition, const Intersection intersection = {}) const override
 	{
@@ -42,6 +102,16 @@ public:
 
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
+		// The default plane is infinite, it goes on the unbounded list of the BVH
+		if (extentX >= std::numeric_limits<float>::max() || extentZ >= std::numeric_limits<float>::max())
+		{
+			return false;
+		}
+
+		auto localBox = BoundingBox(point(-extentX, 0.0f, -extentZ), point(extentX, 0.0f, extentZ));
+
+		outputBox = transformBoundingBox(localBox, transform);
+
 		return true;
 	}
 
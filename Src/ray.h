@@ -7,14 +7,39 @@ struct Ray
 {
 	Ray() {}
 
-	Ray(const tuple& inOrigin, const tuple& inDirection, float inTime = 0.0f)
-		: origin(inOrigin), direction(inDirection), time(inTime)
-	{}
+	Ray(const tuple& inOrigin, const tuple& inDirection, float inTime = 0.0f,
+		float inTMin = -std::numeric_limits<float>::infinity(), float inTMax = std::numeric_limits<float>::infinity())
+		: origin(inOrigin), direction(inDirection), time(inTime), tMin(inTMin), tMax(inTMax)
+	{
+		updateInverseDirection();
+	}
 
 	tuple at(float t) const { return origin + direction * t; }
+
+	// Slab tests read these instead of dividing for every box, call it after changing direction
+	void updateInverseDirection()
+	{
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			invDirection[axis] = 1.0f / direction[axis];
+			sign[axis] = invDirection[axis] < 0.0f ? 1 : 0;
+		}
+	}
+
+	// Hits outside [tMin, tMax] are dropped by every shape and skipped by traversal
+	bool inRange(float t) const { return t >= tMin && t <= tMax; }
+
 	tuple origin{ 0.0f, 0.0f, 0.0f, 1.0f };
 	tuple direction;
-	float time;
+	float time = 0.0f;
+
+	// Open by default, refraction needs the hits behind the origin too
+	float tMin = -std::numeric_limits<float>::infinity();
+	float tMax = std::numeric_limits<float>::infinity();
+
+	// 1 / direction, and 1 for the axes it is negative on (the far plane is the min one)
+	float invDirection[3] = { std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity() };
+	int32_t sign[3] = { 0, 0, 0 };
 };
 
 inline Ray transformRay(const Ray& ray, const matrix4& m)
@@ -23,6 +48,13 @@ inline Ray transformRay(const Ray& ray, const matrix4& m)
 
 	result.origin = m * ray.origin;
 	result.direction = m * ray.direction;
+	result.time = ray.time;
+
+	// The direction isn't normalized, so t means the same along the transformed ray
+	result.tMin = ray.tMin;
+	result.tMax = ray.tMax;
+
+	result.updateInverseDirection();
 
 	return result;
 }
\ No newline at end of file
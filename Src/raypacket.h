@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ray.h"
+#include "simd.h"
+
+// Camera rays of neighbouring pixels, traced together. They start at the same point and
+// point almost the same way, so they go through nearly the same BVH nodes and shapes.
+// Functions taking a packet also take a lane mask, lane i is rays[i] and only the lanes
+// with their bit set are traced (pixels past the edge of the image are not).
+struct RayPacket
+{
+	static constexpr int32_t Width = 4;
+
+	Ray rays[Width];
+};
+
+inline RayPacket transformRayPacket(const RayPacket& packet, uint32_t laneMask, const matrix4& m)
+{
+	RayPacket result;
+
+	for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+	{
+		if (laneMask & (1 << lane))
+		{
+			result.rays[lane] = transformRay(packet.rays[lane], m);
+		}
+	}
+
+	return result;
+}
+
+#ifdef ARIA_SIMD_SSE
+// The rays of a packet as structure of arrays, one register per axis, for the shape
+// kernels that test every lane at once
+struct RayPacketLanes
+{
+	explicit RayPacketLanes(const RayPacket& packet, uint32_t laneMask)
+	{
+		float values[8][RayPacket::Width] = {};
+
+		for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+		{
+			if (laneMask & (1 << lane))
+			{
+				const auto& ray = packet.rays[lane];
+
+				values[0][lane] = ray.origin.x;
+				values[1][lane] = ray.origin.y;
+				values[2][lane] = ray.origin.z;
+				values[3][lane] = ray.direction.x;
+				values[4][lane] = ray.direction.y;
+				values[5][lane] = ray.direction.z;
+				values[6][lane] = ray.tMin;
+				values[7][lane] = ray.tMax;
+			}
+		}
+
+		originX = _mm_loadu_ps(values[0]);
+		originY = _mm_loadu_ps(values[1]);
+		originZ = _mm_loadu_ps(values[2]);
+		directionX = _mm_loadu_ps(values[3]);
+		directionY = _mm_loadu_ps(values[4]);
+		directionZ = _mm_loadu_ps(values[5]);
+		tMin = _mm_loadu_ps(values[6]);
+		tMax = _mm_loadu_ps(values[7]);
+
+		// All bits set in the lanes of laneMask, the same form as a comparison result
+		auto laneBits = _mm_setr_epi32(1, 2, 4, 8);
+		active = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int32_t>(laneMask)), laneBits), laneBits));
+	}
+
+	// Lanes of laneMask where t is within [tMin, tMax], like Ray::inRange()
+	__m128 inRange(__m128 t) const
+	{
+		return _mm_and_ps(active, _mm_and_ps(_mm_cmpge_ps(t, tMin), _mm_cmple_ps(t, tMax)));
+	}
+
+	__m128 originX;
+	__m128 originY;
+	__m128 originZ;
+	__m128 directionX;
+	__m128 directionY;
+	__m128 directionZ;
+	__m128 tMin;
+	__m128 tMax;
+	__m128 active;
+};
+#endif
\ No newline at end of file
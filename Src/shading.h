@@ -8,6 +8,7 @@
 #include "camera.h"
 #include "canvas.h"
 #include "world.h"
+#include "arena.h"
 
 #include <thread>
 #include <atomic>
@@ -21,8 +22,9 @@ tuple lightingPBR(const Material& material, const std::shared_ptr<Shape>& shape,
 
 tuple shadeHit(const World& world, const HitResult& hitResult, int32_t depth = 1);
 tuple colorAt(const World& world, const Ray& ray, int32_t depth = 1);
+tuple colorAt(const World& world, const Ray& ray, const Intersection& intersection, int32_t depth);
 Canvas render(const Camera& camera, const World& world, int32_t maxDepth, int32_t samplesPerPixel = 1);
-std::vector<bool> isShadowed(const World& world, const tuple& position, float time = 0.0f);
+ArenaVector<bool> isShadowed(const World& world, const tuple& position, float time = 0.0f);
 tuple reflectedColor(const World& world, const HitResult& hitResult, int32_t depth);
 tuple refractedColor(const World& world, const HitResult& hitResult, int32_t depth);
 float schlick(const HitResult& hitResult);
@@ -291,6 +293,9 @@ tuple shadeHit(const World& world, const HitResult& hitResult, int32_t depth)
 {
 	tuple finalColor;
 
+	// The shadow results live in the thread's arena until this returns
+	ArenaScope arenaScope;
+
 	auto shadowResult = isShadowed(world, hitResult.overPosition, hitResult.time);
 
 	for (int32_t i = 0; i < world.lightCount(); i++)
@@ -326,14 +331,28 @@ inline static tuple computeBackgroundColor(const Ray& ray)
 
 tuple colorAt(const World& world, const Ray& ray, int32_t depth)
 {
-	auto intersections = intersectWorld(world, ray);
-
-	auto intersection = hit(intersections);
+	return colorAt(world, ray, intersectClosest(world, ray), depth);
+}
 
+// Same, for a closest hit found already (camera rays traced as a packet)
+tuple colorAt(const World& world, const Ray& ray, const Intersection& intersection, int32_t depth)
+{
 	auto backgroundColor = Colors::Black;// computeBackgroundColor(ray);
 
 	if (intersection.t > 0.0f)
 	{
+		// n1 and n2 come from the shapes the ray is inside of, which takes every hit
+		// along the ray. Only refraction (and schlick) reads them.
+		// The list is done with before colorAt() recurses, so one per thread does
+		thread_local Intersections intersections;
+
+		intersections.clear();
+
+		if (world.isRefractionEnabled() && intersection.shape->getMaterial().transparency > 0.0f)
+		{
+			intersectWorld(world, ray, intersections);
+		}
+
 		auto hitResult = prepareComputations(intersection, ray, intersections);
 		hitResult.backgroundColor = backgroundColor;
 		return shadeHit(world, hitResult, depth);
@@ -355,20 +374,25 @@ Canvas render(const Camera& camera, const World& world, int32_t maxDepth, int32_
 	// Mutex to ensure thread-safe access to completedIterations
 	std::mutex mtx;
 
+	// Pixels go in 2x2 quads, the camera rays of a quad are traced as one RayPacket.
+	// Lane 2 * dy + dx is the pixel (x + dx, y + dy).
+	constexpr int32_t QuadSize = 2;
+	static_assert(QuadSize * QuadSize == RayPacket::Width);
+
 	std::vector<int32_t> imageHorizontalIterator;
 	std::vector<int32_t> imageVerticalIterator;
 
-	imageHorizontalIterator.resize(camera.imageWidth);
-	imageVerticalIterator.resize(camera.imageHeight);
+	imageHorizontalIterator.resize((camera.imageWidth + QuadSize - 1) / QuadSize);
+	imageVerticalIterator.resize((camera.imageHeight + QuadSize - 1) / QuadSize);
 
-	for (int32_t i = 0; i < camera.imageWidth; i++)
+	for (int32_t i = 0; i < static_cast<int32_t>(imageHorizontalIterator.size()); i++)
 	{
-		imageHorizontalIterator[i] = i;
+		imageHorizontalIterator[i] = i * QuadSize;
 	}
 
-	for (int32_t i = 0; i < camera.imageHeight; i++)
+	for (int32_t i = 0; i < static_cast<int32_t>(imageVerticalIterator.size()); i++)
 	{
-		imageVerticalIterator[i] = i;
+		imageVerticalIterator[i] = i * QuadSize;
 	}
 
 	std::cout << "Start Rendering...\n";
@@ -379,25 +403,55 @@ Canvas render(const Camera& camera, const World& world, int32_t maxDepth, int32_
 	[&](int32_t y)
 	{
 		// Update completedIterations atomically
-		completedIterations.fetch_add(camera.imageWidth, std::memory_order_relaxed);
+		completedIterations.fetch_add(camera.imageWidth * std::min(QuadSize, camera.imageHeight - y), std::memory_order_relaxed);
 		printf("\rScanlines remaining: %.0f%%(%.0fs)",  completedIterations / static_cast<float>(pixelCount) * 100.0f, timer.Elapsed());
 
 		std::for_each(std::execution::par, imageHorizontalIterator.begin(), imageHorizontalIterator.end(),
 		[&, y](int32_t x)
 			{
-				auto finalColor = Colors::Black;
+				// Quads on the right and bottom edges may be cut off
+				uint32_t laneMask = 0;
+
+				for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+				{
+					if (x + lane % QuadSize < camera.imageWidth && y + lane / QuadSize < camera.imageHeight)
+					{
+						laneMask |= 1 << lane;
+					}
+				}
+
+				tuple finalColors[RayPacket::Width] = { Colors::Black, Colors::Black, Colors::Black, Colors::Black };
+
 				for (auto sample = 0; sample < samplesPerPixel; sample++)
 				{
-					auto rx = Math::randomFloat();
-					auto ry = Math::randomFloat();
-					auto ray = camera.rayForPixel(static_cast<float>(x + rx), static_cast<float>(y + ry));
-					finalColor += colorAt(world, ray, maxDepth);
-					if (x == 0 && y == 2)
+					// Nothing from the previous sample is still in use
+					Arena::local().reset();
+
+					RayPacket packet;
+
+					for (auto lanes = laneMask; lanes != 0; lanes &= lanes - 1)
+					{
+						auto lane = std::countr_zero(lanes);
+						auto rx = Math::randomFloat();
+						auto ry = Math::randomFloat();
+						packet.rays[lane] = camera.rayForPixel(static_cast<float>(x + lane % QuadSize + rx), static_cast<float>(y + lane / QuadSize + ry));
+					}
+
+					Intersection hits[RayPacket::Width];
+					intersectClosest(world, packet, laneMask, hits);
+
+					for (auto lanes = laneMask; lanes != 0; lanes &= lanes - 1)
 					{
-						//finalColor = Colors::Green;
+						auto lane = std::countr_zero(lanes);
+						finalColors[lane] += colorAt(world, packet.rays[lane], hits[lane], maxDepth);
 					}
 				}
-				image.writePixel(x, y, finalColor / static_cast<float>(samplesPerPixel));
+
+				for (auto lanes = laneMask; lanes != 0; lanes &= lanes - 1)
+				{
+					auto lane = std::countr_zero(lanes);
+					image.writePixel(x + lane % QuadSize, y + lane / QuadSize, finalColors[lane] / static_cast<float>(samplesPerPixel));
+				}
 			});
 	});
 
@@ -406,9 +460,9 @@ Canvas render(const Camera& camera, const World& world, int32_t maxDepth, int32_
 	return image;
 }
 
-inline std::vector<bool> isShadowed(const World & world, const tuple & position, float time)
+inline ArenaVector<bool> isShadowed(const World & world, const tuple & position, float time)
 {
-	std::vector<bool> shadowResult(world.lightCount(), false);
+	ArenaVector<bool> shadowResult(world.lightCount(), false);
 
 	for (int32_t i = 0; i < world.lightCount(); i++)
 	{
@@ -417,19 +471,11 @@ inline std::vector<bool> isShadowed(const World & world, const tuple & position,
 		auto distance = length(toLight);
 		auto direction = normalize(toLight);
 
-		auto ray = Ray(position, direction, time);
-		auto intersections = intersectWorld(world, ray);
-		auto intersection = hit(intersections);
+		// Only what lies between the point and the light matters, and shapes that
+		// don't cast shadows are ignored rather than hiding the ones behind them
+		auto ray = Ray(position, direction, time, std::numeric_limits<float>::denorm_min(), distance);
 
-		if (intersection.t > 0.0f && intersection.t < distance)
-		{
-			shadowResult[i] = true;
-
-			if (!intersection.shape->getMaterial().castShadow)
-			{
-				shadowResult[i] = false;
-			}
-		}
+		shadowResult[i] = intersectAny(world, ray);
 	}
 
 	return shadowResult;
@@ -450,7 +496,7 @@ tuple reflectedColor(const World& world, const HitResult& hitResult, int32_t dep
 
 tuple refractedColor(const World& world, const HitResult& hitResult, int32_t depth)
 {
-	if (Math::equal(hitResult.shape->getMaterial().transparency, 0.0f) || depth == 0)
+	if (!world.isRefractionEnabled() || Math::equal(hitResult.shape->getMaterial().transparency, 0.0f) || depth == 0)
 	{
 		return Colors::Black;
 	}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ray.h"
+#include "raypacket.h"
 #include "matrix.h"
 #include "material.h"
 #include "intersection.h"
@@ -12,7 +13,11 @@ enum class ShapeType : uint8_t
 	Plane,
 	Cube,
 	Cylinder,
-	Cone
+	Cone,
+	Triangle,
+
+	// Any other shape, FlatScene calls its virtual intersection tests
+	Other
 };
 
 class Shape : public std::enable_shared_from_this<Shape>
@@ -63,13 +68,71 @@ public:
 		inversedTransform = inverse(transform);
 	}
 
-	virtual std::vector<Intersection> intersect(const Ray& ray)
+	Intersections intersect(const Ray& ray)
+	{
+		Intersections intersections;
+		intersect(ray, intersections);
+		return intersections;
+	}
+
+	// Appends the hits to a list owned by the caller. Groups and instances override it
+	// to let their children append to the same list instead of returning their own.
+	virtual void intersect(const Ray& ray, Intersections& outHits)
 	{
 		auto localRay = transformRay(ray, inversedTransform);
-		return localIntersect(localRay);
+		outHits.append(localIntersect(localRay));
+	}
+
+	virtual Intersections localIntersect(const Ray& transformedRay) { return {}; }
+
+	// Nearest hit within [ray.tMin, ray.tMax], written to outHit only when there is one.
+	// Shapes with children override it to skip whatever lies behind the hits found so far.
+	virtual bool intersectClosest(const Ray& ray, Intersection& outHit)
+	{
+		auto intersections = intersect(ray);
+		auto closestT = std::numeric_limits<float>::infinity();
+
+		for (const auto& intersection : intersections)
+		{
+			if (ray.inRange(intersection.t) && intersection.t < closestT)
+			{
+				outHit = intersection;
+				closestT = intersection.t;
+			}
+		}
+
+		return closestT < std::numeric_limits<float>::infinity();
+	}
+
+	// intersectClosest() for the lanes of a packet in laneMask. outHits[lane] is written
+	// for every lane with a hit, the mask of those lanes is returned. By default the lanes
+	// go one by one, shapes with an SSE kernel override it to test them all at once.
+	virtual uint32_t intersectClosestPacket(const RayPacket& packet, uint32_t laneMask, Intersection* outHits)
+	{
+		uint32_t hitMask = 0;
+
+		for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+		{
+			if ((laneMask & (1 << lane)) && intersectClosest(packet.rays[lane], outHits[lane]))
+			{
+				hitMask |= 1 << lane;
+			}
+		}
+
+		return hitMask;
 	}
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) { return {}; }
+	// Whether anything that casts a shadow is hit within [ray.tMin, ray.tMax], for
+	// shadow rays. Shapes with children override it to stop at the first such hit.
+	virtual bool intersectAny(const Ray& ray)
+	{
+		auto intersections = intersect(ray);
+
+		return std::any_of(intersections.begin(), intersections.end(), [&ray](const Intersection& intersection)
+		{
+			return ray.inRange(intersection.t) && intersection.shape->getMaterial().castShadow;
+		});
+	}
 
 	tuple normalAt(const tuple& worldPosition, const Intersection intersection = {})
 	{ 
@@ -108,13 +171,40 @@ public:
 		return {}; 
 	}
 
+	// Texture coordinates of a hit in x and y. The intersection tests only return t (and
+	// barycentrics), this is called once for the hit that gets shaded.
+	tuple uvAt(const tuple& worldPosition, const Intersection& intersection)
+	{
+		return localUVAt(worldToObject(worldPosition), intersection);
+	}
+
+	virtual tuple localUVAt(const tuple& localPosition, const Intersection& intersection) const
+	{
+		return {};
+	}
+
 	virtual bool boundingBox(BoundingBox& outputBox) = 0;
 
-	virtual bool contains(const std::shared_ptr<Shape>& shape)
+	// Moving shapes return their motion range, the BVH then keeps bounds at both ends
+	virtual bool motionRange(float& outTime0, float& outTime1) const { return false; }
+
+	// Bounds at one point in time, only differs from boundingBox() for moving shapes
+	virtual bool boundingBoxAt(float time, BoundingBox& outputBox) { return boundingBox(outputBox); }
+
+	// Bounds of the part of the shape inside "clip", in the same space as boundingBox().
+	// Used by spatial BVH splits, shapes that can do better than cutting their box override it
+	virtual BoundingBox clippedBoundingBox(const BoundingBox& clip)
+	{
+		BoundingBox box;
+		boundingBox(box);
+		return overlappingBox(box, clip);
+	}
+
+	virtual bool contains(const Shape* shape)
 	{
 		// Chapter 16 Constructive Solid Geometry (CSG)
 		// If A is any other shape, the includes operator should return true if A is equal to B.
-		return (this == shape.get());
+		return (this == shape);
 	}
 
 	tuple worldToObject(const tuple& worldPosition)
@@ -146,7 +236,7 @@ public:
 		return worldNormal;
 	}
 
-	auto getMaterial() const
+	const Material& getMaterial() const
 	{
 		if (parent != nullptr && useParentMaterial)
 		{
@@ -172,7 +262,7 @@ protected:
 class TestShape : public Shape
 {
 public:
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override
+	virtual Intersections localIntersect(const Ray& transformedRay) override
 	{
 		savedRay = transformedRay;
 		return {}; 
@@ -185,6 +275,10 @@ public:
 
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
+		auto localBox = BoundingBox(point(-1.0f, -1.0f, -1.0f), point(1.0f, 1.0f, 1.0f));
+
+		outputBox = transformBoundingBox(localBox, transform);
+
 		return true;
 	}
 
@@ -0,0 +1,401 @@
+#pragma once
+
+#include "compressedbvh.h"
+#include "motionbvh.h"
+#include "triangle.h"
+#include "triangleblock.h"
+
+#include <mutex>
+
+// Flat arrays of a built ShapeBVH, everything a traversal needs. This is what
+// bvhcache.h writes to disk and hands back from a mapped cache file.
+struct ShapeBVHView
+{
+	std::span<const CompressedBVHNode> nodes;
+	std::span<const uint32_t> primitiveIndices;
+	std::span<const uint32_t> boundedShapes;
+	std::span<const uint32_t> unboundedShapes;
+	bool splitReferences = false;
+};
+
+// BVH over a list of shapes, shared by World (top level objects) and Group (children).
+// Shapes without finite bounds are kept aside and handed to every ray. The build is
+// lazy and thread safe, the first traversal after markDirty() pays for it.
+class ShapeBVH
+{
+public:
+	ShapeBVH() = default;
+
+	// Copies start out dirty and rebuild over the shape list of their new owner
+	ShapeBVH(const ShapeBVH& other) 
+	: quality(other.quality)
+	{}
+
+	ShapeBVH& operator=(const ShapeBVH& other)
+	{
+		quality = other.quality;
+		markDirty();
+		return *this;
+	}
+
+	void markDirty() { dirty = true; }
+
+	void setBuildQuality(BVHBuildQuality inQuality)
+	{
+		quality = inQuality;
+		markDirty();
+	}
+
+	BVHBuildQuality getBuildQuality() const { return quality; }
+
+	void update(const std::vector<std::shared_ptr<Shape>>& shapes)
+	{
+		// Shapes pushed into the list directly are caught by the size check
+		if (!dirty.load(std::memory_order_acquire) && builtShapeCount == shapes.size())
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(buildMutex);
+
+		if (!dirty.load(std::memory_order_relaxed) && builtShapeCount == shapes.size())
+		{
+			return;
+		}
+
+		boundedShapes.clear();
+		unboundedShapes.clear();
+
+		std::vector<BoundingBox> bounds;
+
+		for (uint32_t i = 0; i < static_cast<uint32_t>(shapes.size()); i++)
+		{
+			BoundingBox box;
+			auto bounded = shapes[i]->boundingBox(box);
+
+			// Bounded but empty shapes (an intersection CSG whose children don't overlap)
+			// can't be hit and are left out
+			if (bounded && box.isEmpty())
+			{
+				continue;
+			}
+
+			// Shapes without finite bounds (planes, infinite cylinders...) are tested on every ray
+			if (bounded && box.isValid())
+			{
+				boundedShapes.emplace_back(i);
+				bounds.emplace_back(box);
+			}
+			else
+			{
+				unboundedShapes.emplace_back(i);
+			}
+		}
+
+		auto clipper = [&](uint32_t primitive, const BoundingBox& clip)
+		{
+			return shapes[boundedShapes[primitive]]->clippedBoundingBox(clip);
+		};
+
+		bvh.build(bounds, quality, clipper);
+
+		WideBVH wideBVH;
+		wideBVH.collapse(bvh);
+		compressedBVH.compress(wideBVH);
+
+		refitMotion(shapes, bounds);
+		packTriangleBlocks(shapes);
+
+		splitReferences = bvh.hasSplitReferences();
+		storage.reset();
+
+		builtShapeCount = shapes.size();
+		dirty.store(false, std::memory_order_release);
+	}
+
+	// Calls visitor(shape) for every shape the ray might hit within [ray.tMin, ray.tMax]
+	template<typename Visitor>
+	void traverse(const std::vector<std::shared_ptr<Shape>>& shapes, const Ray& ray, Visitor&& visitor)
+	{
+		auto tMax = ray.tMax;
+		traverse(shapes, ray, tMax, visitor);
+	}
+
+	// Same, but tMax is read again after every visit. A visitor that shrinks it (closest
+	// hit) skips the subtrees behind what it found, bounded shapes come nearest first.
+	//
+	// With a triangleHitVisitor, leaves packed into a TriangleBlock are tested here four
+	// triangles at a time. Their triangles are not handed to visitor, instead every hit
+	// within [ray.tMin, tMax] goes to triangleHitVisitor(triangle, t, u, v).
+	template<typename Visitor, typename TriangleHitVisitor = std::nullptr_t>
+	void traverse(const std::vector<std::shared_ptr<Shape>>& shapes, const Ray& ray, const float& tMax, Visitor&& visitor,
+				  TriangleHitVisitor&& triangleHitVisitor = nullptr)
+	{
+		update(shapes);
+
+		for (auto index : unboundedShapes)
+		{
+			visitor(shapes[index]);
+		}
+
+		// Spatial splits can put a shape in several leaves, visit each one only once
+		VisitedPrimitives visited(splitReferences);
+
+		auto visitPrimitive = [&](uint32_t primitive)
+		{
+			if (visited.visit(primitive) != 0)
+			{
+				visitor(shapes[boundedShapes[primitive]]);
+			}
+		};
+
+		if (hasMotion)
+		{
+			motionBVH.traverse(ray, ray.tMin, tMax, visitPrimitive);
+		}
+		else if constexpr (std::is_null_pointer_v<std::decay_t<TriangleHitVisitor>>)
+		{
+			compressedBVH.traverse(ray, ray.tMin, tMax, visitPrimitive);
+		}
+		else
+		{
+			auto primitiveIndices = compressedBVH.getPrimitiveIndices();
+
+			auto intersectTriangle = [&](uint32_t primitive, float t, float u, float v)
+			{
+				// A miss can't turn into a hit in another leaf, only hits have to be remembered
+				if (visited.visit(primitive) != 0)
+				{
+					triangleHitVisitor(static_cast<Triangle&>(*shapes[boundedShapes[primitive]]), t, u, v);
+				}
+			};
+
+			compressedBVH.traverseLeaves(ray, ray.tMin, tMax, [&](uint32_t leafFirst, uint32_t primitiveCount)
+			{
+				if (triangleBlocks.intersectLeaf(leafFirst, primitiveCount, ray, ray.tMin, tMax, intersectTriangle))
+				{
+					return;
+				}
+
+				for (uint32_t i = 0; i < primitiveCount; i++)
+				{
+					visitPrimitive(primitiveIndices[leafFirst + i]);
+				}
+			});
+		}
+	}
+
+	// traverse() for the lanes of a packet in laneMask, every node is read once for all
+	// of them. visitor(shape, shapeLanes) gets the lanes that might hit the shape, and
+	// leaves packed into TriangleBlocks go to triangleHitVisitor(triangle, lane, t, u, v)
+	// lane by lane. A lane's tMax is packet.rays[lane].tMax, read again after every visit.
+	template<typename Visitor, typename TriangleHitVisitor = std::nullptr_t>
+	void traversePacket(const std::vector<std::shared_ptr<Shape>>& shapes, const RayPacket& packet, uint32_t laneMask, Visitor&& visitor,
+						TriangleHitVisitor&& triangleHitVisitor = nullptr)
+	{
+		update(shapes);
+
+		for (auto index : unboundedShapes)
+		{
+			visitor(shapes[index], laneMask);
+		}
+
+		// Same as in traverse(), with the lanes that already visited a shape
+		VisitedPrimitives visited(splitReferences);
+
+		auto visitPrimitive = [&](uint32_t primitive, uint32_t lanes)
+		{
+			if (auto newLanes = visited.visit(primitive, lanes); newLanes != 0)
+			{
+				visitor(shapes[boundedShapes[primitive]], newLanes);
+			}
+		};
+
+		auto primitiveIndices = compressedBVH.getPrimitiveIndices();
+
+		if (hasMotion)
+		{
+			// Every lane has its own time, the MotionBVH takes them one by one
+			for (auto lanes = laneMask; lanes != 0; lanes &= lanes - 1)
+			{
+				auto lane = std::countr_zero(lanes);
+				const auto& ray = packet.rays[lane];
+
+				motionBVH.traverse(ray, ray.tMin, ray.tMax, [&](uint32_t primitive) { visitPrimitive(primitive, 1u << lane); });
+			}
+		}
+		else
+		{
+			compressedBVH.traversePacketLeaves(packet, laneMask, [&](uint32_t leafFirst, uint32_t primitiveCount, uint32_t leafLanes)
+			{
+				if constexpr (!std::is_null_pointer_v<std::decay_t<TriangleHitVisitor>>)
+				{
+					auto blocked = true;
+
+					for (auto lanes = leafLanes; lanes != 0 && blocked; lanes &= lanes - 1)
+					{
+						auto lane = std::countr_zero(lanes);
+						const auto& ray = packet.rays[lane];
+
+						blocked = triangleBlocks.intersectLeaf(leafFirst, primitiveCount, ray, ray.tMin, ray.tMax, [&](uint32_t primitive, float t, float u, float v)
+						{
+							if (visited.visit(primitive, 1u << lane) != 0)
+							{
+								triangleHitVisitor(static_cast<Triangle&>(*shapes[boundedShapes[primitive]]), lane, t, u, v);
+							}
+						});
+					}
+
+					// Whether a leaf has a block doesn't depend on the lane
+					if (blocked)
+					{
+						return;
+					}
+				}
+
+				for (uint32_t i = 0; i < primitiveCount; i++)
+				{
+					visitPrimitive(primitiveIndices[leafFirst + i], leafLanes);
+				}
+			});
+		}
+	}
+
+	// Uses a BVH built earlier for the same shape list instead of building one. The
+	// arrays are not copied, "inStorage" keeps the memory they live in alive.
+	void attach(const std::vector<std::shared_ptr<Shape>>& shapes, const ShapeBVHView& view, std::shared_ptr<const void> inStorage)
+	{
+		std::lock_guard<std::mutex> lock(buildMutex);
+
+		bvh = BVH();
+		compressedBVH.attach(view.nodes, view.primitiveIndices);
+		motionBVH = MotionBVH();
+		hasMotion = false;
+		splitReferences = view.splitReferences;
+		boundedShapes.assign(view.boundedShapes.begin(), view.boundedShapes.end());
+		unboundedShapes.assign(view.unboundedShapes.begin(), view.unboundedShapes.end());
+		storage = std::move(inStorage);
+
+		packTriangleBlocks(shapes);
+
+		builtShapeCount = shapes.size();
+		dirty.store(false, std::memory_order_release);
+	}
+
+	// Valid until the next rebuild, check isBuilt() first
+	ShapeBVHView view() const
+	{
+		return { compressedBVH.getNodes(), compressedBVH.getPrimitiveIndices(), boundedShapes, unboundedShapes, splitReferences };
+	}
+
+	bool isBuilt(size_t shapeCount) const { return !dirty.load(std::memory_order_acquire) && builtShapeCount == shapeCount; }
+
+	// Empty when the BVH was attached from a cache
+	const BVH& getBVH() const { return bvh; }
+
+	const CompressedBVH& getCompressedBVH() const { return compressedBVH; }
+
+	const MotionBVH& getMotionBVH() const { return motionBVH; }
+
+	bool isMoving() const { return hasMotion; }
+
+	size_t triangleBlockCount() const { return triangleBlocks.size(); }
+
+private:
+	// Leaves that hold nothing but untransformed triangles are tested four at a time.
+	// Packed from the shapes, so attached BVHs get them too and cache files don't change.
+	void packTriangleBlocks(const std::vector<std::shared_ptr<Shape>>& shapes)
+	{
+		// Moving shapes go through the MotionBVH, which has no blocks
+		if (hasMotion)
+		{
+			triangleBlocks.clear();
+			return;
+		}
+
+		triangleBlocks.pack(compressedBVH, [&](uint32_t primitive, tuple& p0, tuple& e0, tuple& e1)
+		{
+			auto* triangle = dynamic_cast<const Triangle*>(shapes[boundedShapes[primitive]].get());
+
+			// The block works in the BVH's space, a transformed triangle has its own
+			if (triangle == nullptr || triangle->transform != matrix4(1.0f))
+			{
+				return false;
+			}
+
+			p0 = triangle->p0;
+			e0 = triangle->e0;
+			e1 = triangle->e1;
+
+			return true;
+		});
+	}
+
+	// With moving shapes around, rays go through node bounds blended for their time
+	// instead of the swept bounds. Shapes whose motion range differs from the overall
+	// one keep their swept box at both ends, a blend would not contain them.
+	void refitMotion(const std::vector<std::shared_ptr<Shape>>& shapes, const std::vector<BoundingBox>& bounds)
+	{
+		hasMotion = false;
+		motionBVH = MotionBVH();
+
+		auto time0 = std::numeric_limits<float>::max();
+		auto time1 = -std::numeric_limits<float>::max();
+
+		for (auto index : boundedShapes)
+		{
+			float shapeTime0 = 0.0f;
+			float shapeTime1 = 0.0f;
+
+			if (shapes[index]->motionRange(shapeTime0, shapeTime1))
+			{
+				hasMotion = true;
+				time0 = std::min(time0, shapeTime0);
+				time1 = std::max(time1, shapeTime1);
+			}
+		}
+
+		if (!hasMotion)
+		{
+			return;
+		}
+
+		auto bounds0 = bounds;
+		auto bounds1 = bounds;
+
+		for (uint32_t i = 0; i < static_cast<uint32_t>(boundedShapes.size()); i++)
+		{
+			const auto& shape = shapes[boundedShapes[i]];
+
+			float shapeTime0 = 0.0f;
+			float shapeTime1 = 0.0f;
+
+			if (shape->motionRange(shapeTime0, shapeTime1) && shapeTime0 == time0 && shapeTime1 == time1)
+			{
+				shape->boundingBoxAt(time0, bounds0[i]);
+				shape->boundingBoxAt(time1, bounds1[i]);
+			}
+		}
+
+		motionBVH.refit(bvh, bounds0, bounds1, time0, time1);
+	}
+
+	// The binary BVH is kept for its bounds and for inspection, rays go through the compressed one
+	BVH bvh;
+	CompressedBVH compressedBVH;
+	MotionBVH motionBVH;
+	bool hasMotion = false;
+	bool splitReferences = false;
+
+	// Owner of attached arrays (a mapped cache file), empty when built here
+	std::shared_ptr<const void> storage;
+
+	TriangleBlocks triangleBlocks;
+
+	std::vector<uint32_t> boundedShapes;
+	std::vector<uint32_t> unboundedShapes;
+	std::atomic<size_t> builtShapeCount = 0;
+	std::atomic<bool> dirty = true;
+	std::mutex buildMutex;
+	BVHBuildQuality quality = BVHBuildQuality::SAH;
+};
\ No newline at end of file
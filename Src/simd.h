@@ -0,0 +1,8 @@
+#pragma once
+
+// SSE2 comes with every x64 target, the SIMD paths are compiled whenever it is there
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ARIA_SIMD_SSE
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
\ No newline at end of file
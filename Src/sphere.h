@@ -7,48 +7,114 @@
 #include "material.h"
 #include "shape.h"
 
-class Sphere : public Shape
+// The roots of the ray and a sphere within [ray.tMin, ray.tMax], the nearer one first.
+// hitVisitor(t) gets each of them. Sphere::localIntersect() and FlatScene share it.
+template<typename HitVisitor>
+inline static void intersectSphere(const tuple& center, float radius, const Ray& ray, HitVisitor&& hitVisitor)
 {
-public:
-	Sphere() { }
+	// The vector from the sphere's center, to the ray origin
+	// Remember: the sphere is centered at the world origin
+	auto sphereToRay = ray.origin - center;
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override 
-	{ 
-		// The vector from the sphere's center, to the ray origin
-		// Remember: the sphere is centered at the world origin
-		auto sphereToRay = transformedRay.origin - center;
+	auto a = dot(ray.direction, ray.direction);
+	auto b = 2.0f * dot(ray.direction, sphereToRay);
+	auto c = dot(sphereToRay, sphereToRay) - radius;
 
-		auto a = dot(transformedRay.direction, transformedRay.direction);
-		auto b = 2.0f * dot(transformedRay.direction, sphereToRay);
-		auto c = dot(sphereToRay, sphereToRay) - radius;
+	auto discriminant = b * b - 4.0f * a * c;
 
-		auto discriminant = b * b - 4.0f * a * c;
+	if (discriminant < 0.0f)
+	{
+		return;
+	}
 
-		if (discriminant < 0.0f)
-		{
-			return {};
-		}
+	auto t0 = (-b - std::sqrtf(discriminant)) / (2.0f * a);
+	auto t1 = (-b + std::sqrtf(discriminant)) / (2.0f * a);
 
-		auto t0 = (-b - std::sqrtf(discriminant)) / (2.0f * a);
-		auto t1 = (-b + std::sqrtf(discriminant)) / (2.0f * a);
+	if (ray.inRange(t0))
+	{
+		hitVisitor(t0);
+	}
 
-		auto shape = shared_from_this();
+	if (ray.inRange(t1))
+	{
+		hitVisitor(t1);
+	}
+}
 
-		// https://blog.csdn.net/u013745174/article/details/52900870
-		auto object = std::dynamic_pointer_cast<Sphere>(shared_from_this());
+#ifdef ARIA_SIMD_SSE
+// intersectSphere() for the four rays of a packet at once. Returns the mask of the lanes
+// with a root within their interval, the nearer such root goes to outT[lane]. Sphere and
+// FlatScene share it.
+inline static uint32_t intersectSpherePacket(const tuple& center, float radius, const RayPacketLanes& rays, float* outT)
+{
+	auto sphereToRayX = _mm_sub_ps(rays.originX, _mm_set1_ps(center.x));
+	auto sphereToRayY = _mm_sub_ps(rays.originY, _mm_set1_ps(center.y));
+	auto sphereToRayZ = _mm_sub_ps(rays.originZ, _mm_set1_ps(center.z));
 
-		float u = 0.0f;
-		float v = 0.0f;
+	auto dot3 = [](__m128 aX, __m128 aY, __m128 aZ, __m128 bX, __m128 bY, __m128 bZ)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(aX, bX), _mm_mul_ps(aY, bY)), _mm_mul_ps(aZ, bZ));
+	};
+
+	auto a = dot3(rays.directionX, rays.directionY, rays.directionZ, rays.directionX, rays.directionY, rays.directionZ);
+	auto b = _mm_mul_ps(_mm_set1_ps(2.0f), dot3(rays.directionX, rays.directionY, rays.directionZ, sphereToRayX, sphereToRayY, sphereToRayZ));
+	auto c = _mm_sub_ps(dot3(sphereToRayX, sphereToRayY, sphereToRayZ, sphereToRayX, sphereToRayY, sphereToRayZ), _mm_set1_ps(radius));
 
-		auto t = std::min(t0, t1);
+	auto discriminant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_set1_ps(4.0f), _mm_mul_ps(a, c)));
+	auto hasRoots = _mm_cmpge_ps(discriminant, _mm_setzero_ps());
 
-		auto position = transformedRay.at(t);
+	auto root = _mm_sqrt_ps(_mm_max_ps(discriminant, _mm_setzero_ps()));
+	auto minusB = _mm_sub_ps(_mm_setzero_ps(), b);
+	auto twoA = _mm_mul_ps(_mm_set1_ps(2.0f), a);
 
-		getSphereUV(position, u, v);
+	auto t0 = _mm_div_ps(_mm_sub_ps(minusB, root), twoA);
+	auto t1 = _mm_div_ps(_mm_add_ps(minusB, root), twoA);
+
+	auto inRange0 = _mm_and_ps(hasRoots, rays.inRange(t0));
+	auto inRange1 = _mm_and_ps(hasRoots, rays.inRange(t1));
+
+	// t0 is the nearer root, t1 only counts when t0 is out of range
+	auto t = _mm_or_ps(_mm_and_ps(inRange0, t0), _mm_andnot_ps(inRange0, t1));
+	auto hitMask = static_cast<uint32_t>(_mm_movemask_ps(_mm_or_ps(inRange0, inRange1)));
+
+	_mm_storeu_ps(outT, t);
+
+	return hitMask;
+}
+#endif
 
-		return { { t0, shape, object, u, v },
-				 { t1, shape, object, u, v } };
+class Sphere : public Shape
+{
+public:
+	Sphere() { }
+
+	virtual Intersections localIntersect(const Ray& transformedRay) override 
+	{ 
+		Intersections result;
+
+		intersectSphere(center, radius, transformedRay, [&](float t) { result.push_back({ t, this }); });
+
+		return result;
+	}
+
+#ifdef ARIA_SIMD_SSE
+	// The four lanes at once, the same arithmetic as localIntersect()
+	virtual uint32_t intersectClosestPacket(const RayPacket& packet, uint32_t laneMask, Intersection* outHits) override
+	{
+		float hitT[RayPacket::Width];
+		auto hitMask = intersectSpherePacket(center, radius, RayPacketLanes(transformRayPacket(packet, laneMask, inversedTransform), laneMask), hitT);
+
+		for (int32_t lane = 0; lane < RayPacket::Width; lane++)
+		{
+			if (hitMask & (1 << lane))
+			{
+				outHits[lane] = { hitT[lane], this };
+			}
+		}
+
+		return hitMask;
 	}
+#endif
 
 	virtual tuple localNormalAt(const tuple& localPosition, const Intersection intersection = {}) const override
 	{ 
@@ -57,17 +123,27 @@ public:
 		return  localNormal;
 	}
 
+	virtual tuple localUVAt(const tuple& localPosition, const Intersection& intersection) const override
+	{
+		float u = 0.0f;
+		float v = 0.0f;
+
+		getSphereUV(localPosition - center, u, v);
+
+		return vector(u, v, 0.0f);
+	}
+
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
-		auto a = translation - vector(scale.x, scale.y, scale.z);
-		auto b = translation + vector(scale.x, scale.y, scale.z);
+		// Object space bounds transformed to the parent space
+		auto localBox = BoundingBox(center - vector(radius), center + vector(radius));
 
-		outputBox = BoundingBox(a, b);
+		outputBox = transformBoundingBox(localBox, transform);
 
 		return true;
 	}
 
-	void getSphereUV(const tuple& p, float& u, float& v)
+	static void getSphereUV(const tuple& p, float& u, float& v)
 	{
 		// p: a given point on the sphere of radius one, centered at the origin.
 		// u: returned value [0,1] of angle around the Y axis from X=-1.
@@ -11,7 +11,7 @@ public:
 	{
 	}
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override
+	virtual Intersections localIntersect(const Ray& transformedRay) override
 	{ 
 		double x1 = transformedRay.origin.x;
 		double y1 = transformedRay.origin.y;
@@ -53,7 +53,7 @@ public:
 		// the roots array is not sorted
 		for (int j = 0; j < num_real_roots; j++)
 		{
-			if (roots[j] > EPSILON_HIGH_PRECISION) {
+			if (roots[j] > EPSILON_HIGH_PRECISION && transformedRay.inRange(static_cast<float>(roots[j]))) {
 				intersected = true;
 				if (roots[j] < t)
 					t = roots[j];
@@ -65,7 +65,7 @@ public:
 			return {};
 		}
 
-		return { { static_cast<float>(t), shared_from_this() }};
+		return { { static_cast<float>(t), this }};
 	} 
 
 	virtual tuple localNormalAt(const tuple& localPosition, const Intersection intersection = {}) const override
@@ -87,6 +87,13 @@ public:
 
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
+		// The tube sweeps around the y axis
+		auto radius = sweptRadius + tubeRadius;
+
+		auto localBox = BoundingBox(point(-radius, -tubeRadius, -radius), point(radius, tubeRadius, radius));
+
+		outputBox = transformBoundingBox(localBox, transform);
+
 		return true;
 	}
 
@@ -2,6 +2,157 @@
 
 #include "shape.h"
 
+// Clips the triangle against the 6 planes of the box (Sutherland-Hodgman)
+// and bounds what is left
+inline static BoundingBox clippedTriangleBounds(const tuple& p0, const tuple& p1, const tuple& p2, const BoundingBox& clip)
+{
+	// A triangle clipped by 6 planes has at most 9 vertices
+	tuple polygon[9] = { p0, p1, p2 };
+	int32_t vertexCount = 3;
+
+	for (int32_t plane = 0; plane < 6 && vertexCount > 0; plane++)
+	{
+		auto axis = plane % 3;
+		auto isMax = plane >= 3;
+		auto planePosition = isMax ? clip.max[axis] : clip.min[axis];
+
+		auto inside = [&](const tuple& vertex)
+		{
+			return isMax ? vertex[axis] <= planePosition : vertex[axis] >= planePosition;
+		};
+
+		tuple clipped[9];
+		int32_t clippedCount = 0;
+
+		for (int32_t i = 0; i < vertexCount; i++)
+		{
+			const auto& current = polygon[i];
+			const auto& next = polygon[(i + 1) % vertexCount];
+
+			if (inside(current))
+			{
+				clipped[clippedCount++] = current;
+			}
+
+			if (inside(current) != inside(next) && clippedCount < 9)
+			{
+				auto t = (planePosition - current[axis]) / (next[axis] - current[axis]);
+				auto vertex = current + (next - current) * t;
+				vertex[axis] = planePosition;
+				clipped[clippedCount++] = vertex;
+			}
+		}
+
+		std::copy(clipped, clipped + clippedCount, polygon);
+		vertexCount = clippedCount;
+	}
+
+	BoundingBox box;
+
+	for (int32_t i = 0; i < vertexCount; i++)
+	{
+		box.addPoint(polygon[i]);
+	}
+
+	return overlappingBox(box, clip);
+}
+
+// Moller-Trumbore against the triangle with corner p0 and edges e0, e1 from it. A hit
+// within [ray.tMin, ray.tMax] goes to hitVisitor(t, u, v) with the barycentrics u, v (the
+// weights of the 2nd and 3rd corner). Triangle::localIntersect() and FlatScene share it.
+template<typename HitVisitor>
+inline static void intersectTriangle(const tuple& p0, const tuple& e0, const tuple& e1, const Ray& ray, HitVisitor&& hitVisitor)
+{
+	auto dirCrossE1 = cross(ray.direction, e1);
+	auto determinant = dot(e0, dirCrossE1);
+
+	if (std::fabsf(determinant) < EPSILON)
+	{
+		return;
+	}
+
+	auto f = 1.0f / determinant;
+
+	auto p0ToOrigin = ray.origin - p0;
+	auto u = f * dot(p0ToOrigin, dirCrossE1);
+
+	if (u < 0.0f || u > 1.0f)
+	{
+		return;
+	}
+
+	auto originCrossE0 = cross(p0ToOrigin, e0);
+	auto v = f * dot(ray.direction, originCrossE0);
+
+	if (v < 0.0f || (u + v) > 1.0f)
+	{
+		return;
+	}
+
+	auto t = f * dot(e1, originCrossE0);
+
+	if (!ray.inRange(t))
+	{
+		return;
+	}
+
+	hitVisitor(t, u, v);
+}
+
+#ifdef ARIA_SIMD_SSE
+// intersectTriangle() for the four rays of a packet at once (intersectTriangleBlock() has
+// four triangles and one ray instead). Returns the mask of the lanes with a hit, its t and
+// barycentrics go to outT, outU and outV. Triangle and FlatScene share it.
+inline static uint32_t intersectTrianglePacket(const tuple& p0, const tuple& e0, const tuple& e1, const RayPacketLanes& rays, float* outT, float* outU, float* outV)
+{
+	auto e0X = _mm_set1_ps(e0.x);
+	auto e0Y = _mm_set1_ps(e0.y);
+	auto e0Z = _mm_set1_ps(e0.z);
+	auto e1X = _mm_set1_ps(e1.x);
+	auto e1Y = _mm_set1_ps(e1.y);
+	auto e1Z = _mm_set1_ps(e1.z);
+
+	// dirCrossE1 = cross(direction, e1)
+	auto dirCrossE1X = _mm_sub_ps(_mm_mul_ps(rays.directionY, e1Z), _mm_mul_ps(rays.directionZ, e1Y));
+	auto dirCrossE1Y = _mm_sub_ps(_mm_mul_ps(rays.directionZ, e1X), _mm_mul_ps(rays.directionX, e1Z));
+	auto dirCrossE1Z = _mm_sub_ps(_mm_mul_ps(rays.directionX, e1Y), _mm_mul_ps(rays.directionY, e1X));
+
+	auto determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0X, dirCrossE1X), _mm_mul_ps(e0Y, dirCrossE1Y)), _mm_mul_ps(e0Z, dirCrossE1Z));
+
+	// |determinant| >= EPSILON, the sign bit is masked off
+	auto mask = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), determinant), _mm_set1_ps(EPSILON));
+
+	auto f = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+	auto p0ToOriginX = _mm_sub_ps(rays.originX, _mm_set1_ps(p0.x));
+	auto p0ToOriginY = _mm_sub_ps(rays.originY, _mm_set1_ps(p0.y));
+	auto p0ToOriginZ = _mm_sub_ps(rays.originZ, _mm_set1_ps(p0.z));
+
+	auto u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0ToOriginX, dirCrossE1X), _mm_mul_ps(p0ToOriginY, dirCrossE1Y)), _mm_mul_ps(p0ToOriginZ, dirCrossE1Z)));
+
+	mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmple_ps(u, _mm_set1_ps(1.0f))));
+
+	// originCrossE0 = cross(p0ToOrigin, e0)
+	auto originCrossE0X = _mm_sub_ps(_mm_mul_ps(p0ToOriginY, e0Z), _mm_mul_ps(p0ToOriginZ, e0Y));
+	auto originCrossE0Y = _mm_sub_ps(_mm_mul_ps(p0ToOriginZ, e0X), _mm_mul_ps(p0ToOriginX, e0Z));
+	auto originCrossE0Z = _mm_sub_ps(_mm_mul_ps(p0ToOriginX, e0Y), _mm_mul_ps(p0ToOriginY, e0X));
+
+	auto v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(rays.directionX, originCrossE0X), _mm_mul_ps(rays.directionY, originCrossE0Y)), _mm_mul_ps(rays.directionZ, originCrossE0Z)));
+
+	mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f))));
+
+	auto t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1X, originCrossE0X), _mm_mul_ps(e1Y, originCrossE0Y)), _mm_mul_ps(e1Z, originCrossE0Z)));
+
+	auto hitMask = static_cast<uint32_t>(_mm_movemask_ps(_mm_and_ps(mask, rays.inRange(t))));
+
+	_mm_storeu_ps(outT, t);
+	_mm_storeu_ps(outU, u);
+	_mm_storeu_ps(outV, v);
+
+	return hitMask;
+}
+#endif
+
 class Triangle : public Shape
 {
 public:
@@ -34,45 +185,42 @@ public:
 		t2 = inT2;
 	}
 
-	virtual std::vector<Intersection> localIntersect(const Ray& transformedRay) override
+	virtual Intersections localIntersect(const Ray& transformedRay) override
 	{
-		auto dirCrossE1 = cross(transformedRay.direction, e1);
-		auto determinant = dot(e0, dirCrossE1);
+		Intersections result;
 
-		if (std::fabsf(determinant) < EPSILON)
-		{
-			return {};
-		}
-
-		auto f = 1.0f / determinant;
+		intersectTriangle(p0, e0, e1, transformedRay, [&](float t, float u, float v) { result.push_back(hitAt(t, u, v)); });
 
-		auto p0ToOrigin = transformedRay.origin - p0;
-		auto u = f * dot(p0ToOrigin, dirCrossE1);
+		return result;
+	}
 
-		if (u < 0.0f || u > 1.0f)
-		{
-			return {};
-		}
+#ifdef ARIA_SIMD_SSE
+	// The four lanes at once, the same arithmetic as localIntersect()
+	virtual uint32_t intersectClosestPacket(const RayPacket& packet, uint32_t laneMask, Intersection* outHits) override
+	{
+		float hitT[RayPacket::Width];
+		float hitU[RayPacket::Width];
+		float hitV[RayPacket::Width];
 
-		auto originCrossE0 = cross(p0ToOrigin, e0);
-		auto v = f * dot(transformedRay.direction, originCrossE0);
+		auto hitMask = intersectTrianglePacket(p0, e0, e1, RayPacketLanes(transformRayPacket(packet, laneMask, inversedTransform), laneMask), hitT, hitU, hitV);
 
-		if (v < 0.0f || (u + v) > 1.0f)
+		for (int32_t lane = 0; lane < RayPacket::Width; lane++)
 		{
-			return {};
+			if (hitMask & (1 << lane))
+			{
+				outHits[lane] = hitAt(hitT[lane], hitU[lane], hitV[lane]);
+			}
 		}
 
-		auto t = f * dot(e1, originCrossE0);
-
-		a = u;
-		b = v;
-
-		auto c = 1.0f - a - b;
-
-		auto texcoordU = (a * t1.x + b * t2.x + c * t0.x);
-		auto texcoordV = (a * t1.y + b * t2.y + c * t0.y);
+		return hitMask;
+	}
+#endif
 
-		return { intersectionWithUV(t, shared_from_this(), a, b, texcoordU, texcoordV) };
+	// The hit at distance t with barycentrics u, v (weights of p1 and p2), also used by
+	// the BVH when it tests a whole leaf of triangles at once
+	Intersection hitAt(float t, float u, float v)
+	{
+		return intersectionWithUV(t, this, u, v);
 	}
 
 	virtual tuple localNormalAt(const tuple& localPosition, const Intersection intersection) const override
@@ -80,6 +228,11 @@ public:
 		return n1 * intersection.a + n2 * intersection.b + n0 * (1.0f - intersection.a - intersection.b);
 	}
 
+	virtual tuple localUVAt(const tuple& localPosition, const Intersection& intersection) const override
+	{
+		return t1 * intersection.a + t2 * intersection.b + t0 * (1.0f - intersection.a - intersection.b);
+	}
+
 	virtual bool boundingBox(BoundingBox& outputBox) override
 	{
 		auto minX = Math::min(p0.x, p1.x, p2.x);
@@ -93,11 +246,17 @@ public:
 		tuple min = point(minX,  minY, minZ);
 		tuple max = point(maxX,  maxY, maxZ);
 
-		outputBox = BoundingBox(min, max);
+		outputBox = transformBoundingBox(BoundingBox(min, max), transform);
 
 		return true;
 	}
 
+	virtual BoundingBox clippedBoundingBox(const BoundingBox& clip) override
+	{
+		// "clip" is in the parent's space, so are the corners once transformed
+		return clippedTriangleBounds(transform * p0, transform * p1, transform * p2, clip);
+	}
+
 	tuple p0;
 	tuple p1;
 	tuple p2;
@@ -110,8 +269,6 @@ public:
 	tuple e0;
 	tuple e1;
 	tuple normal;
-	float a = 0.0f;
-	float b = 0.0f;
 };
 
 inline static bool operator==(const std::shared_ptr<Triangle>& a, const std::shared_ptr<Triangle>& b)
@@ -0,0 +1,279 @@
+#pragma once
+
+#include "compressedbvh.h"
+
+// Up to four triangles of one BVH leaf as structure of arrays, the first vertex and the
+// two edges from it, tested with one SSE kernel call. A leaf of BVH::MaxLeafSize (4)
+// primitives fits one block, TriangleBlocks gives bigger leaves several. Lanes without
+// a triangle have zero edges, which no ray can hit.
+struct alignas(16) TriangleBlock
+{
+	static constexpr int32_t Width = 4;
+
+	float p0X[Width];
+	float p0Y[Width];
+	float p0Z[Width];
+	float e0X[Width];
+	float e0Y[Width];
+	float e0Z[Width];
+	float e1X[Width];
+	float e1Y[Width];
+	float e1Z[Width];
+
+	// Position of the triangle in the BVH's primitive list (the leaf's primitive indices)
+	uint32_t primitive[Width];
+};
+
+// Möller-Trumbore against every lane at once, the same arithmetic as
+// Triangle::localIntersect. Returns a mask of the lanes hit within [tMin, tMax]
+// and their t and barycentric u, v.
+inline static uint32_t intersectTriangleBlock(const TriangleBlock& block, const Ray& ray, float tMin, float tMax,
+											  float* outT, float* outU, float* outV)
+{
+#ifdef ARIA_SIMD_SSE
+	auto originX = _mm_set1_ps(ray.origin.x);
+	auto originY = _mm_set1_ps(ray.origin.y);
+	auto originZ = _mm_set1_ps(ray.origin.z);
+	auto directionX = _mm_set1_ps(ray.direction.x);
+	auto directionY = _mm_set1_ps(ray.direction.y);
+	auto directionZ = _mm_set1_ps(ray.direction.z);
+
+	auto e0X = _mm_load_ps(block.e0X);
+	auto e0Y = _mm_load_ps(block.e0Y);
+	auto e0Z = _mm_load_ps(block.e0Z);
+	auto e1X = _mm_load_ps(block.e1X);
+	auto e1Y = _mm_load_ps(block.e1Y);
+	auto e1Z = _mm_load_ps(block.e1Z);
+
+	// dirCrossE1 = cross(direction, e1)
+	auto dirCrossE1X = _mm_sub_ps(_mm_mul_ps(directionY, e1Z), _mm_mul_ps(directionZ, e1Y));
+	auto dirCrossE1Y = _mm_sub_ps(_mm_mul_ps(directionZ, e1X), _mm_mul_ps(directionX, e1Z));
+	auto dirCrossE1Z = _mm_sub_ps(_mm_mul_ps(directionX, e1Y), _mm_mul_ps(directionY, e1X));
+
+	auto determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0X, dirCrossE1X), _mm_mul_ps(e0Y, dirCrossE1Y)), _mm_mul_ps(e0Z, dirCrossE1Z));
+
+	// |determinant| >= EPSILON, the sign bit is masked off
+	auto mask = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), determinant), _mm_set1_ps(EPSILON));
+
+	auto f = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+	auto p0ToOriginX = _mm_sub_ps(originX, _mm_load_ps(block.p0X));
+	auto p0ToOriginY = _mm_sub_ps(originY, _mm_load_ps(block.p0Y));
+	auto p0ToOriginZ = _mm_sub_ps(originZ, _mm_load_ps(block.p0Z));
+
+	auto u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0ToOriginX, dirCrossE1X), _mm_mul_ps(p0ToOriginY, dirCrossE1Y)), _mm_mul_ps(p0ToOriginZ, dirCrossE1Z)));
+
+	mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmple_ps(u, _mm_set1_ps(1.0f))));
+
+	// originCrossE0 = cross(p0ToOrigin, e0)
+	auto originCrossE0X = _mm_sub_ps(_mm_mul_ps(p0ToOriginY, e0Z), _mm_mul_ps(p0ToOriginZ, e0Y));
+	auto originCrossE0Y = _mm_sub_ps(_mm_mul_ps(p0ToOriginZ, e0X), _mm_mul_ps(p0ToOriginX, e0Z));
+	auto originCrossE0Z = _mm_sub_ps(_mm_mul_ps(p0ToOriginX, e0Y), _mm_mul_ps(p0ToOriginY, e0X));
+
+	auto v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, originCrossE0X), _mm_mul_ps(directionY, originCrossE0Y)), _mm_mul_ps(directionZ, originCrossE0Z)));
+
+	mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f))));
+
+	auto t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1X, originCrossE0X), _mm_mul_ps(e1Y, originCrossE0Y)), _mm_mul_ps(e1Z, originCrossE0Z)));
+
+	mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(tMin)), _mm_cmple_ps(t, _mm_set1_ps(tMax))));
+
+	_mm_storeu_ps(outT, t);
+	_mm_storeu_ps(outU, u);
+	_mm_storeu_ps(outV, v);
+
+	return static_cast<uint32_t>(_mm_movemask_ps(mask));
+#else
+	uint32_t hitMask = 0;
+
+	for (int32_t lane = 0; lane < TriangleBlock::Width; lane++)
+	{
+		auto e0 = vector(block.e0X[lane], block.e0Y[lane], block.e0Z[lane]);
+		auto e1 = vector(block.e1X[lane], block.e1Y[lane], block.e1Z[lane]);
+
+		auto dirCrossE1 = cross(ray.direction, e1);
+		auto determinant = dot(e0, dirCrossE1);
+
+		if (std::fabsf(determinant) < EPSILON)
+		{
+			continue;
+		}
+
+		auto f = 1.0f / determinant;
+
+		auto p0ToOrigin = ray.origin - point(block.p0X[lane], block.p0Y[lane], block.p0Z[lane]);
+		auto u = f * dot(p0ToOrigin, dirCrossE1);
+		auto originCrossE0 = cross(p0ToOrigin, e0);
+		auto v = f * dot(ray.direction, originCrossE0);
+		auto t = f * dot(e1, originCrossE0);
+
+		outT[lane] = t;
+		outU[lane] = u;
+		outV[lane] = v;
+
+		if (u >= 0.0f && u <= 1.0f && v >= 0.0f && (u + v) <= 1.0f && t >= tMin && t <= tMax)
+		{
+			hitMask |= 1 << lane;
+		}
+	}
+
+	return hitMask;
+#endif
+}
+
+// TriangleBlocks for the leaves of a CompressedBVH, looked up by the leaf's first
+// primitive position. Leaves of more than TriangleBlock::Width primitives take several
+// blocks in a row.
+class TriangleBlocks
+{
+public:
+	// triangleAt(primitive, p0, e0, e1) fills in a triangle, or returns false when the
+	// primitive isn't a triangle that can be tested in the BVH's space. Leaves with
+	// such a primitive get no block.
+	template<typename TriangleSource>
+	void pack(const CompressedBVH& bvh, TriangleSource&& triangleAt)
+	{
+		blocks.clear();
+		blockOfLeaf.clear();
+
+		auto primitiveIndices = bvh.getPrimitiveIndices();
+
+		blockOfLeaf.assign(primitiveIndices.size(), NoBlock);
+
+		for (const auto& node : bvh.getNodes())
+		{
+			for (int32_t slot = 0; slot < CompressedBVHNode::Width; slot++)
+			{
+				if (!(node.validMask & (1 << slot)) || node.primitiveCount[slot] == 0)
+				{
+					continue;
+				}
+
+				auto leafFirst = node.child[slot];
+				auto leafBlock = static_cast<uint32_t>(blocks.size());
+				auto packable = true;
+
+				for (uint32_t i = 0; i < node.primitiveCount[slot] && packable; i++)
+				{
+					auto lane = i % TriangleBlock::Width;
+
+					if (lane == 0)
+					{
+						blocks.emplace_back();
+					}
+
+					packable = fill(blocks.back(), lane, primitiveIndices[leafFirst + i], triangleAt);
+				}
+
+				if (packable)
+				{
+					blockOfLeaf[leafFirst] = leafBlock;
+				}
+				else
+				{
+					blocks.resize(leafBlock);
+				}
+			}
+		}
+	}
+
+	void clear()
+	{
+		blocks.clear();
+		blockOfLeaf.clear();
+	}
+
+	// Tests a whole leaf and calls hitVisitor(primitive, t, u, v) for every hit within
+	// [tMin, tMax]. tMax is read again after every hit, like in the BVH traversals.
+	// Returns false when the leaf has no block, its primitives are left to the caller.
+	template<typename HitVisitor>
+	bool intersectLeaf(uint32_t leafFirst, uint32_t primitiveCount, const Ray& ray, float tMin, const float& tMax, HitVisitor&& hitVisitor) const
+	{
+		auto leafBlock = blockOfLeaf.empty() ? NoBlock : blockOfLeaf[leafFirst];
+
+		if (leafBlock == NoBlock)
+		{
+			return false;
+		}
+
+		auto blockCount = (primitiveCount + TriangleBlock::Width - 1) / TriangleBlock::Width;
+
+		for (auto blockIndex = leafBlock; blockIndex < leafBlock + blockCount; blockIndex++)
+		{
+			intersectBlock(blocks[blockIndex], ray, tMin, tMax, hitVisitor);
+		}
+
+		return true;
+	}
+
+	// Same test for triangles that aren't kept in blocks (compressed meshes), they are
+	// packed on the stack as they come, four at a time
+	template<typename TriangleSource, typename HitVisitor>
+	static void intersectPrimitives(std::span<const uint32_t> primitives, TriangleSource&& triangleAt, const Ray& ray, float tMin, const float& tMax, HitVisitor&& hitVisitor)
+	{
+		for (size_t first = 0; first < primitives.size(); first += TriangleBlock::Width)
+		{
+			TriangleBlock block = {};
+
+			for (size_t i = first; i < std::min(first + TriangleBlock::Width, primitives.size()); i++)
+			{
+				fill(block, static_cast<int32_t>(i - first), primitives[i], triangleAt);
+			}
+
+			intersectBlock(block, ray, tMin, tMax, hitVisitor);
+		}
+	}
+
+	size_t size() const { return blocks.size(); }
+
+private:
+	static constexpr uint32_t NoBlock = std::numeric_limits<uint32_t>::max();
+
+	template<typename TriangleSource>
+	static bool fill(TriangleBlock& block, int32_t lane, uint32_t primitive, TriangleSource&& triangleAt)
+	{
+		tuple p0;
+		tuple e0;
+		tuple e1;
+
+		if (!triangleAt(primitive, p0, e0, e1))
+		{
+			return false;
+		}
+
+		block.p0X[lane] = p0.x;
+		block.p0Y[lane] = p0.y;
+		block.p0Z[lane] = p0.z;
+		block.e0X[lane] = e0.x;
+		block.e0Y[lane] = e0.y;
+		block.e0Z[lane] = e0.z;
+		block.e1X[lane] = e1.x;
+		block.e1Y[lane] = e1.y;
+		block.e1Z[lane] = e1.z;
+		block.primitive[lane] = primitive;
+
+		return true;
+	}
+
+	template<typename HitVisitor>
+	static void intersectBlock(const TriangleBlock& block, const Ray& ray, float tMin, const float& tMax, HitVisitor&& hitVisitor)
+	{
+		float t[TriangleBlock::Width];
+		float u[TriangleBlock::Width];
+		float v[TriangleBlock::Width];
+
+		auto hitMask = intersectTriangleBlock(block, ray, tMin, tMax, t, u, v);
+
+		for (int32_t lane = 0; lane < TriangleBlock::Width; lane++)
+		{
+			// An earlier lane may have shrunk tMax already
+			if ((hitMask & (1 << lane)) && t[lane] <= tMax)
+			{
+				hitVisitor(block.primitive[lane], t[lane], u[lane], v[lane]);
+			}
+		}
+	}
+
+	std::vector<TriangleBlock> blocks;
+	std::vector<uint32_t> blockOfLeaf;
+};
\ No newline at end of file
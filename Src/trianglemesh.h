@@ -0,0 +1,386 @@
+#pragma once
+
+#include "meshbuffers.h"
+#include "shapebvh.h"
+#include "triangle.h"
+#include "triangleblock.h"
+
+#include <mutex>
+
+// Corners of one triangle, as indices into MeshBuffers
+struct MeshTriangle
+{
+	uint32_t positions[3] = {};
+	uint32_t normals[3] = {};
+	uint32_t texcoords[3] = {};
+};
+
+// Triangles stored as indices into shared buffers, 36 bytes each instead of a whole
+// Triangle shape. The mesh has its own BVH over the triangles and tests its leaves
+// with TriangleBlocks. Hits report the mesh as their shape, with the triangle in
+// Intersection::primitive and its barycentrics in a and b.
+//
+// Over CompressedMeshBuffers the vertices are decoded as they are read, and the
+// blocks are packed on the fly for every leaf instead of being kept around (they
+// would take more memory than the compressed vertices).
+class TriangleMesh : public Shape
+{
+public:
+	TriangleMesh(const std::shared_ptr<const MeshBuffers>& inBuffers)
+	: buffers(inBuffers)
+	{
+		// Like Triangle, the mesh looks like the group it is in
+		useParentMaterial = true;
+	}
+
+	TriangleMesh(const std::shared_ptr<const CompressedMeshBuffers>& inBuffers)
+	: compressedBuffers(inBuffers)
+	{
+		useParentMaterial = true;
+	}
+
+	// Add the triangles before the mesh goes into a group, the group takes its bounds then
+	void addTriangle(const MeshTriangle& triangle)
+	{
+		triangles.emplace_back(triangle);
+
+		for (auto index : triangle.positions)
+		{
+			bounds.addPoint(vertexPosition(index));
+		}
+
+		dirty = true;
+	}
+
+	size_t triangleCount() const { return triangles.size(); }
+
+	const MeshTriangle& getTriangle(uint32_t index) const { return triangles[index]; }
+
+	tuple position(uint32_t triangle, int32_t corner) const { return vertexPosition(triangles[triangle].positions[corner]); }
+
+	tuple normal(uint32_t triangle, int32_t corner) const
+	{
+		auto index = triangles[triangle].normals[corner];
+		return compressedBuffers ? compressedBuffers->normal(index) : buffers->normals[index];
+	}
+
+	tuple texcoord(uint32_t triangle, int32_t corner) const
+	{
+		auto index = triangles[triangle].texcoords[corner];
+		return compressedBuffers ? compressedBuffers->texcoord(index) : buffers->texcoords[index];
+	}
+
+	// One of them is set
+	const std::shared_ptr<const MeshBuffers>& getBuffers() const { return buffers; }
+
+	const std::shared_ptr<const CompressedMeshBuffers>& getCompressedBuffers() const { return compressedBuffers; }
+
+	virtual Intersections localIntersect(const Ray& transformedRay) override
+	{
+		Intersections intersections;
+
+		traverse(transformedRay, transformedRay.tMax, [&](uint32_t triangle, float t, float u, float v)
+		{
+			intersections.push_back(hitAt(triangle, t, u, v));
+		});
+
+		std::sort(intersections.begin(), intersections.end(), compare);
+
+		return intersections;
+	}
+
+	virtual bool intersectClosest(const Ray& ray, Intersection& outHit) override
+	{
+		auto localRay = transformRay(ray, inversedTransform);
+		auto found = false;
+
+		traverse(localRay, localRay.tMax, [&](uint32_t triangle, float t, float u, float v)
+		{
+			outHit = hitAt(triangle, t, u, v);
+			found = true;
+			localRay.tMax = t;
+		});
+
+		return found;
+	}
+
+	virtual uint32_t intersectClosestPacket(const RayPacket& packet, uint32_t laneMask, Intersection* outHits) override
+	{
+		auto localPacket = transformRayPacket(packet, laneMask, inversedTransform);
+		uint32_t hitMask = 0;
+
+		traversePacket(localPacket, laneMask, [&](int32_t lane, uint32_t triangle, float t, float u, float v)
+		{
+			outHits[lane] = hitAt(triangle, t, u, v);
+			localPacket.rays[lane].tMax = t;
+			hitMask |= 1 << lane;
+		});
+
+		return hitMask;
+	}
+
+	// Every triangle has the mesh's material, one hit is enough
+	virtual bool intersectAny(const Ray& ray) override
+	{
+		if (!getMaterial().castShadow)
+		{
+			return false;
+		}
+
+		auto localRay = transformRay(ray, inversedTransform);
+		auto occluded = false;
+
+		traverse(localRay, localRay.tMax, [&](uint32_t, float, float, float)
+		{
+			occluded = true;
+			localRay.tMax = -std::numeric_limits<float>::infinity();
+		});
+
+		return occluded;
+	}
+
+	// Corners without normals (all three at index 0) give the flat normal, like Triangle
+	virtual tuple localNormalAt(const tuple& localPosition, const Intersection intersection) const override
+	{
+		const auto& triangle = triangles[intersection.primitive];
+
+		if (triangle.normals[0] == 0 && triangle.normals[1] == 0 && triangle.normals[2] == 0)
+		{
+			auto e0 = position(intersection.primitive, 1) - position(intersection.primitive, 0);
+			auto e1 = position(intersection.primitive, 2) - position(intersection.primitive, 0);
+
+			// Left-Hand
+			return normalize(cross(e1, e0));
+		}
+
+		return normal(intersection.primitive, 1) * intersection.a +
+			   normal(intersection.primitive, 2) * intersection.b +
+			   normal(intersection.primitive, 0) * (1.0f - intersection.a - intersection.b);
+	}
+
+	virtual tuple localUVAt(const tuple& localPosition, const Intersection& intersection) const override
+	{
+		return texcoord(intersection.primitive, 1) * intersection.a +
+			   texcoord(intersection.primitive, 2) * intersection.b +
+			   texcoord(intersection.primitive, 0) * (1.0f - intersection.a - intersection.b);
+	}
+
+	virtual bool boundingBox(BoundingBox& outputBox) override
+	{
+		// Stays empty (inverted) without triangles, which still counts as bounded
+		outputBox = bounds.isValid() ? transformBoundingBox(bounds, transform) : bounds;
+
+		return true;
+	}
+
+	void setBVHBuildQuality(BVHBuildQuality inQuality)
+	{
+		quality = inQuality;
+		dirty = true;
+	}
+
+	BVHBuildQuality getBuildQuality() const { return quality; }
+
+	// Builds the BVH now rather than in the first intersection
+	void updateBVH()
+	{
+		if (!dirty.load(std::memory_order_acquire))
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(buildMutex);
+
+		if (!dirty.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		std::vector<BoundingBox> triangleBounds(triangles.size());
+
+		for (uint32_t i = 0; i < static_cast<uint32_t>(triangles.size()); i++)
+		{
+			for (int32_t corner = 0; corner < 3; corner++)
+			{
+				triangleBounds[i].addPoint(position(i, corner));
+			}
+		}
+
+		auto clipper = [&](uint32_t triangle, const BoundingBox& clip)
+		{
+			return clippedTriangleBounds(position(triangle, 0), position(triangle, 1), position(triangle, 2), clip);
+		};
+
+		BVH bvh;
+		bvh.build(triangleBounds, quality, clipper);
+
+		WideBVH wideBVH;
+		wideBVH.collapse(bvh);
+		compressedBVH.compress(wideBVH);
+
+		splitReferences = bvh.hasSplitReferences();
+		storage.reset();
+
+		packTriangleBlocks();
+
+		dirty.store(false, std::memory_order_release);
+	}
+
+	bool isBuilt() const { return !dirty.load(std::memory_order_acquire); }
+
+	// For bvhcache.h, in the same form as a group's child BVH. There are no shapes,
+	// the primitive indices are triangle indices.
+	ShapeBVHView view() const
+	{
+		return { compressedBVH.getNodes(), compressedBVH.getPrimitiveIndices(), {}, {}, splitReferences };
+	}
+
+	// Uses a BVH built earlier for the same triangles, see ShapeBVH::attach()
+	void attach(const ShapeBVHView& view, std::shared_ptr<const void> inStorage)
+	{
+		std::lock_guard<std::mutex> lock(buildMutex);
+
+		compressedBVH.attach(view.nodes, view.primitiveIndices);
+		splitReferences = view.splitReferences;
+		storage = std::move(inStorage);
+
+		packTriangleBlocks();
+
+		dirty.store(false, std::memory_order_release);
+	}
+
+	const CompressedBVH& getCompressedBVH() const { return compressedBVH; }
+
+	size_t triangleBlockCount() const { return triangleBlocks.size(); }
+
+private:
+	tuple vertexPosition(uint32_t index) const
+	{
+		return compressedBuffers ? compressedBuffers->position(index) : buffers->positions[index];
+	}
+
+	// The hit at distance t with barycentrics u, v (weights of the 2nd and 3rd corner)
+	Intersection hitAt(uint32_t triangle, float t, float u, float v) const
+	{
+		auto intersection = intersectionWithUV(t, const_cast<TriangleMesh*>(this), u, v);
+		intersection.primitive = triangle;
+
+		return intersection;
+	}
+
+	// Calls hitVisitor(triangle, t, u, v) for the hits within [ray.tMin, tMax], nearest
+	// leaves first, tMax may shrink while it runs. Each triangle is reported once.
+	template<typename HitVisitor>
+	void traverse(const Ray& ray, const float& tMax, HitVisitor&& hitVisitor)
+	{
+		updateBVH();
+
+		auto primitiveIndices = compressedBVH.getPrimitiveIndices();
+
+		auto triangleAt = [this](uint32_t triangle, tuple& p0, tuple& e0, tuple& e1) { return triangleEdges(triangle, p0, e0, e1); };
+
+		// Spatial splits can put a triangle in several leaves. A miss can't turn into a
+		// hit in another leaf, only hits have to be remembered
+		VisitedPrimitives visited(splitReferences);
+
+		auto visitHit = [&](uint32_t triangle, float t, float u, float v)
+		{
+			if (visited.visit(triangle) != 0)
+			{
+				hitVisitor(triangle, t, u, v);
+			}
+		};
+
+		compressedBVH.traverseLeaves(ray, ray.tMin, tMax, [&](uint32_t leafFirst, uint32_t primitiveCount)
+		{
+			if (!triangleBlocks.intersectLeaf(leafFirst, primitiveCount, ray, ray.tMin, tMax, visitHit))
+			{
+				TriangleBlocks::intersectPrimitives(primitiveIndices.subspan(leafFirst, primitiveCount), triangleAt, ray, ray.tMin, tMax, visitHit);
+			}
+		});
+	}
+
+	// traverse() for the lanes of a packet, the nodes are read once for all of them and
+	// the leaves are tested lane by lane. hitVisitor(lane, triangle, t, u, v).
+	template<typename HitVisitor>
+	void traversePacket(const RayPacket& packet, uint32_t laneMask, HitVisitor&& hitVisitor)
+	{
+		updateBVH();
+
+		auto primitiveIndices = compressedBVH.getPrimitiveIndices();
+
+		auto triangleAt = [this](uint32_t triangle, tuple& p0, tuple& e0, tuple& e1) { return triangleEdges(triangle, p0, e0, e1); };
+
+		// Same as in traverse(), with the lanes that already hit a triangle
+		VisitedPrimitives visited(splitReferences);
+
+		compressedBVH.traversePacketLeaves(packet, laneMask, [&](uint32_t leafFirst, uint32_t primitiveCount, uint32_t leafLanes)
+		{
+			for (auto lanes = leafLanes; lanes != 0; lanes &= lanes - 1)
+			{
+				auto lane = std::countr_zero(lanes);
+				const auto& ray = packet.rays[lane];
+
+				auto laneHitVisitor = [&](uint32_t triangle, float t, float u, float v)
+				{
+					if (visited.visit(triangle, 1 << lane) != 0)
+					{
+						hitVisitor(lane, triangle, t, u, v);
+					}
+				};
+
+				if (!triangleBlocks.intersectLeaf(leafFirst, primitiveCount, ray, ray.tMin, ray.tMax, laneHitVisitor))
+				{
+					TriangleBlocks::intersectPrimitives(primitiveIndices.subspan(leafFirst, primitiveCount), triangleAt, ray, ray.tMin, ray.tMax, laneHitVisitor);
+				}
+			}
+		});
+	}
+
+	// Same arithmetic as the Triangle constructor
+	bool triangleEdges(uint32_t triangle, tuple& p0, tuple& e0, tuple& e1) const
+	{
+		p0 = position(triangle, 0);
+		e0 = position(triangle, 1) - p0;
+		e1 = position(triangle, 2) - p0;
+
+		return true;
+	}
+
+	void packTriangleBlocks()
+	{
+		if (compressedBuffers)
+		{
+			triangleBlocks.clear();
+			return;
+		}
+
+		triangleBlocks.pack(compressedBVH, [this](uint32_t triangle, tuple& p0, tuple& e0, tuple& e1) { return triangleEdges(triangle, p0, e0, e1); });
+	}
+
+	std::shared_ptr<const MeshBuffers> buffers;
+	std::shared_ptr<const CompressedMeshBuffers> compressedBuffers;
+	std::vector<MeshTriangle> triangles;
+	BoundingBox bounds;
+
+	CompressedBVH compressedBVH;
+	TriangleBlocks triangleBlocks;
+	bool splitReferences = false;
+
+	// Owner of attached arrays (a mapped cache file), empty when built here
+	std::shared_ptr<const void> storage;
+
+	std::atomic<bool> dirty = true;
+	std::mutex buildMutex;
+	BVHBuildQuality quality = BVHBuildQuality::SAH;
+};
+
+inline static std::shared_ptr<TriangleMesh> createTriangleMesh(const std::shared_ptr<const MeshBuffers>& buffers)
+{
+	return std::make_shared<TriangleMesh>(buffers);
+}
+
+inline static std::shared_ptr<TriangleMesh> createTriangleMesh(const std::shared_ptr<const CompressedMeshBuffers>& buffers)
+{
+	return std::make_shared<TriangleMesh>(buffers);
+}
\ No newline at end of file
@@ -0,0 +1,314 @@
+#pragma once
+
+#include "bvh.h"
+#include "simd.h"
+
+// Four child bounds stored as structure of arrays so one ray can be tested
+// against all of them with a single SSE slab test
+struct alignas(64) WideBVHNode
+{
+	static constexpr int32_t Width = 4;
+
+	float minX[Width];
+	float minY[Width];
+	float minZ[Width];
+	float maxX[Width];
+	float maxY[Width];
+	float maxZ[Width];
+
+	// Leaf slot: first primitive in WideBVH::primitiveIndices and primitive count.
+	// Interior slot: index of the child node and a count of 0.
+	uint32_t child[Width];
+	uint32_t primitiveCount[Width];
+};
+
+// Slots of a node the ray hit, ordered far to near by entry distance. Pushed in that
+// order the nearest child ends up on top of the traversal stack.
+inline static int32_t sortHitSlots(uint32_t hitMask, const float* distances, int32_t* slots)
+{
+	int32_t count = 0;
+
+	while (hitMask != 0)
+	{
+		auto slot = std::countr_zero(hitMask);
+		hitMask &= hitMask - 1;
+
+		auto i = count++;
+
+		for (; i > 0 && distances[slots[i - 1]] < distances[slot]; i--)
+		{
+			slots[i] = slots[i - 1];
+		}
+
+		slots[i] = slot;
+	}
+
+	return count;
+}
+
+// Traversal stack entry of the wide BVHs, leaves go on the stack too so
+// every child is visited in distance order
+struct WideStackEntry
+{
+	uint32_t child;
+	uint32_t primitiveCount;
+	float distance;
+};
+
+// 4-wide BVH collapsed from a binary BVH. Each node holds up to four children,
+// which roughly halves the number of node visits and reads two full cache lines per visit.
+class WideBVH
+{
+public:
+	static constexpr int32_t Width = WideBVHNode::Width;
+
+	// Each popped node pushes at most Width - 1 more entries than it removes
+	static constexpr int32_t TraversalStackSize = (Width - 1) * BVH::TraversalStackSize + 1;
+
+	void collapse(const BVH& bvh)
+	{
+		nodes.clear();
+		primitiveIndices = bvh.primitiveIndices;
+
+		if (bvh.empty())
+		{
+			return;
+		}
+
+		collapseNode(bvh, 0);
+	}
+
+	// Calls visitor(primitiveIndex) for every primitive in a leaf whose bounds
+	// are hit by the ray within [tMin, tMax], nearest leaves first. tMax is read
+	// again before every step, a visitor that shrinks it skips what lies behind.
+	template<typename Visitor>
+	void traverse(const Ray& ray, float tMin, const float& tMax, Visitor&& visitor) const
+	{
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		RayData rayData(ray, tMin, tMax);
+
+		WideStackEntry stack[TraversalStackSize];
+		int32_t stackSize = 0;
+
+		stack[stackSize++] = { 0, 0, tMin };
+
+		while (stackSize > 0)
+		{
+			auto entry = stack[--stackSize];
+
+			if (entry.distance > tMax)
+			{
+				continue;
+			}
+
+			if (entry.primitiveCount > 0)
+			{
+				for (uint32_t i = 0; i < entry.primitiveCount; i++)
+				{
+					visitor(primitiveIndices[entry.child + i]);
+				}
+				continue;
+			}
+
+			const auto& node = nodes[entry.child];
+
+			rayData.tMax = tMax;
+
+			float distances[Width];
+			int32_t slots[Width];
+
+			auto count = sortHitSlots(intersectChildren(node, rayData, distances), distances, slots);
+
+			for (int32_t i = 0; i < count; i++)
+			{
+				auto slot = slots[i];
+				stack[stackSize++] = { node.child[slot], node.primitiveCount[slot], distances[slot] };
+			}
+		}
+	}
+
+	bool empty() const { return nodes.empty(); }
+
+	std::vector<WideBVHNode> nodes;
+	std::vector<uint32_t> primitiveIndices;
+
+private:
+	// Per ray constants of the slab test, shared by every node visit
+	struct RayData
+	{
+		RayData(const Ray& ray, float inTMin, float inTMax)
+		: tMin(inTMin), tMax(inTMax)
+		{
+			for (int32_t axis = 0; axis < 3; axis++)
+			{
+				origin[axis] = ray.origin[axis];
+				invDirection[axis] = ray.invDirection[axis];
+				negative[axis] = ray.sign[axis] != 0;
+			}
+		}
+
+		float origin[3];
+		float invDirection[3];
+		bool negative[3];
+		float tMin;
+		float tMax;
+	};
+
+	// Same slab logic as BoundingBox::hit, for all four slots at once. Picking the near
+	// and far planes from the direction sign replaces the swap, and the comparisons keep
+	// the running interval when a slab gives NaN (ray on a plane, zero direction).
+	// distances gets the entry t of every slot.
+	static uint32_t intersectChildren(const WideBVHNode& node, const RayData& ray, float* distances)
+	{
+		const float* nearPlanes[3] =
+		{
+			ray.negative[0] ? node.maxX : node.minX,
+			ray.negative[1] ? node.maxY : node.minY,
+			ray.negative[2] ? node.maxZ : node.minZ
+		};
+
+		const float* farPlanes[3] =
+		{
+			ray.negative[0] ? node.minX : node.maxX,
+			ray.negative[1] ? node.minY : node.maxY,
+			ray.negative[2] ? node.minZ : node.maxZ
+		};
+
+#ifdef ARIA_SIMD_SSE
+		auto tMin = _mm_set1_ps(ray.tMin);
+		auto tMax = _mm_set1_ps(ray.tMax);
+
+		for (int32_t axis = 0; axis < 3; axis++)
+		{
+			auto origin = _mm_set1_ps(ray.origin[axis]);
+			auto invDirection = _mm_set1_ps(ray.invDirection[axis]);
+
+			auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearPlanes[axis]), origin), invDirection);
+			auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farPlanes[axis]), origin), invDirection);
+
+			// _mm_max_ps/_mm_min_ps return the second operand when the first is NaN
+			tMin = _mm_max_ps(t0, tMin);
+			tMax = _mm_min_ps(t1, tMax);
+		}
+
+		_mm_storeu_ps(distances, tMin);
+
+		auto hitMask = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tMin, tMax)));
+#else
+		uint32_t hitMask = 0;
+
+		for (int32_t slot = 0; slot < Width; slot++)
+		{
+			auto tMin = ray.tMin;
+			auto tMax = ray.tMax;
+
+			for (int32_t axis = 0; axis < 3; axis++)
+			{
+				auto t0 = (nearPlanes[axis][slot] - ray.origin[axis]) * ray.invDirection[axis];
+				auto t1 = (farPlanes[axis][slot] - ray.origin[axis]) * ray.invDirection[axis];
+
+				tMin = t0 > tMin ? t0 : tMin;
+				tMax = t1 < tMax ? t1 : tMax;
+			}
+
+			distances[slot] = tMin;
+
+			if (tMin <= tMax)
+			{
+				hitMask |= 1 << slot;
+			}
+		}
+#endif
+		return hitMask;
+	}
+
+	// Pulls the children of the largest interior children up until the node is full,
+	// then recurses into the interior children that are left
+	uint32_t collapseNode(const BVH& bvh, uint32_t binaryIndex)
+	{
+		uint32_t children[Width];
+		int32_t childCount = 0;
+
+		const auto& binaryNode = bvh.nodes[binaryIndex];
+
+		if (binaryNode.isLeaf())
+		{
+			children[childCount++] = binaryIndex;
+		}
+		else
+		{
+			children[childCount++] = binaryNode.leftFirst;
+			children[childCount++] = binaryNode.leftFirst + 1;
+		}
+
+		while (childCount < Width)
+		{
+			int32_t largest = -1;
+			float largestArea = -1.0f;
+
+			for (int32_t i = 0; i < childCount; i++)
+			{
+				const auto& child = bvh.nodes[children[i]];
+
+				if (!child.isLeaf() && child.bounds.surfaceArea() > largestArea)
+				{
+					largest = i;
+					largestArea = child.bounds.surfaceArea();
+				}
+			}
+
+			if (largest < 0)
+			{
+				break;
+			}
+
+			auto opened = bvh.nodes[children[largest]].leftFirst;
+			children[largest] = opened;
+			children[childCount++] = opened + 1;
+		}
+
+		auto nodeIndex = static_cast<uint32_t>(nodes.size());
+		nodes.emplace_back();
+
+		WideBVHNode node;
+
+		for (int32_t slot = 0; slot < Width; slot++)
+		{
+			// Unused slots get an inverted box, which no ray can hit
+			node.minX[slot] = node.minY[slot] = node.minZ[slot] = std::numeric_limits<float>::max();
+			node.maxX[slot] = node.maxY[slot] = node.maxZ[slot] = -std::numeric_limits<float>::max();
+			node.child[slot] = 0;
+			node.primitiveCount[slot] = 0;
+		}
+
+		for (int32_t slot = 0; slot < childCount; slot++)
+		{
+			const auto& child = bvh.nodes[children[slot]];
+
+			node.minX[slot] = child.bounds.min.x;
+			node.minY[slot] = child.bounds.min.y;
+			node.minZ[slot] = child.bounds.min.z;
+			node.maxX[slot] = child.bounds.max.x;
+			node.maxY[slot] = child.bounds.max.y;
+			node.maxZ[slot] = child.bounds.max.z;
+
+			if (child.isLeaf())
+			{
+				node.child[slot] = child.leftFirst;
+				node.primitiveCount[slot] = child.primitiveCount;
+			}
+			else
+			{
+				node.child[slot] = collapseNode(bvh, children[slot]);
+			}
+		}
+
+		nodes[nodeIndex] = node;
+
+		return nodeIndex;
+	}
+};
\ No newline at end of file
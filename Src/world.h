@@ -7,6 +7,8 @@
 #include "sphere.h"
 #include "light.h"
 #include "colors.h"
+#include "shapebvh.h"
+#include "flatscene.h"
 
 class World
 {
@@ -23,9 +25,77 @@ public:
 		lights.emplace_back(light);
 	}
 
+	// A group filled after it was added grows outside the BVH's bounds, call
+	// markBVHDirty() (or commit() again) once it is complete
 	void addObject(const std::shared_ptr<Shape>& object)
 	{
 		objects.emplace_back(object);
+		objectBVH.markDirty();
+		committedScene.clear();
+	}
+
+	// Scenes without transparent materials can turn refraction off, colorAt() then
+	// skips refracted rays and the n1/n2 bookkeeping at every hit
+	void setRefractionEnabled(bool enabled)
+	{
+		refractionEnabled = enabled;
+	}
+
+	bool isRefractionEnabled() const { return refractionEnabled; }
+
+	// Build the BVH up front instead of in the first traversal
+	void updateBVH() const
+	{
+		objectBVH.update(objects);
+	}
+
+	// Linear trades some trace speed for a much faster build, for scenes rebuilt all the time.
+	// A committed scene was built with the old quality, it is dropped until the next commit()
+	void setBVHBuildQuality(BVHBuildQuality quality) 
+	{
+		objectBVH.setBuildQuality(quality);
+		committedScene.clear();
+	}
+
+	// Objects moved through getObjects() or groups filled after they were added are not
+	// tracked, mark the BVH dirty by hand
+	void markBVHDirty()
+	{
+		objectBVH.markDirty();
+		committedScene.clear();
+	}
+
+	// Freezes the objects into a FlatScene for rendering, the queries in intersection.h
+	// use it from then on. Adding objects or handing them out through getObject() drops
+	// it again. Shapes changed through pointers kept elsewhere need another commit().
+	void commit()
+	{
+		committedScene.build(objects, objectBVH.getBuildQuality());
+	}
+
+	// The scene built by commit(), nullptr when there is none
+	const FlatScene* getCommittedScene() const { return committedScene.isBuilt() ? &committedScene : nullptr; }
+
+	// Calls visitor(object) for every object the ray might hit within [ray.tMin, ray.tMax]
+	template<typename Visitor>
+	void traverse(const Ray& ray, Visitor&& visitor) const
+	{
+		objectBVH.traverse(objects, ray, visitor);
+	}
+
+	// Same, the visitor may shrink tMax to skip whatever lies behind its hits
+	template<typename Visitor>
+	void traverse(const Ray& ray, const float& tMax, Visitor&& visitor) const
+	{
+		objectBVH.traverse(objects, ray, tMax, visitor);
+	}
+
+	// Calls visitor(object, objectLanes) with the lanes of the packet that might hit the
+	// object, a visitor may shrink the lanes' tMax
+	template<typename Visitor>
+	void traversePacket(const RayPacket& packet, uint32_t laneMask, Visitor&& visitor) const
+	{
+		objectBVH.traversePacket(objects, packet, laneMask, visitor);
 	}
 
 	int32_t lightCount() const { return static_cast<int32_t>(lights.size()); }
@@ -38,13 +108,29 @@ public:
 	const auto& getObject(int32_t index) const { return objects[index]; }
 
 	auto& getLight(int32_t index) { return lights[index]; }
-	auto& getObject(int32_t index) { return objects[index]; }
+	auto& getObject(int32_t index) 
+	{
+		// The caller may move the object
+		objectBVH.markDirty();
+		committedScene.clear();
+		return objects[index]; 
+	}
+
+	const auto& getBVH() const 
+	{
+		updateBVH();
+		return objectBVH.getBVH(); 
+	}
 
 	auto getName() const { return name; }
 private:
 	std::vector<std::shared_ptr<Shape>> objects;
 	std::vector<Light> lights;
 	std::string name;
+	bool refractionEnabled = true;
+
+	mutable ShapeBVH objectBVH;
+	FlatScene committedScene;
 };
 
 inline static World defaultWorld()